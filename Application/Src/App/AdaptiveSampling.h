@@ -0,0 +1,35 @@
+#pragma once
+#include "../Utils/Vec3.h"
+#include <cmath>
+#include <cstdint>
+
+using namespace Hydro;
+
+//Error estimate of the adaptive sampler, same as relativeError in RayMarcher.hlsl
+inline float Luminance( Vec3F color )
+{
+	return color.x * 0.2126f + color.y * 0.7152f + color.z * 0.0722f;
+}
+
+//Standard error of the mean luminance relative to the mean. The floor keeps
+//black pixels converged instead of dividing by zero
+inline float RelativeError( float luminanceSum, float luminanceSquareSum, float samples )
+{
+	if( samples < 2.0f )
+		return 1e30f;
+
+	const float mean = luminanceSum / samples;
+	const float variance = std::fmax( luminanceSquareSum / samples - mean * mean, 0.0f ) * samples / (samples - 1.0f);
+	return std::sqrt( variance / samples ) / (mean + 0.01f);
+}
+
+struct AdaptiveSamplingStats
+{
+	int tileCount = 0;
+	//Tiles that got samples in the last frame
+	int activeTiles = 0;
+	//Accumulated samples averaged over all pixels
+	float samplesPerPixel = 0.0f;
+	//Samples traced in the last frame
+	int64_t frameSamples = 0;
+};
@@ -0,0 +1,91 @@
+#include "Aov.h"
+#include <fstream>
+#include <string>
+
+namespace
+{
+	const AovInfo aovInfos[(int)Aov::Count] = {
+		{ "depth", 1, true },
+		{ "normal", 3, true },
+		{ "albedo", 3, true },
+		{ "object", 1, false },
+		{ "material", 1, false },
+		{ "steps", 1, true }
+	};
+}
+
+const AovInfo& GetAovInfo( Aov aov )
+{
+	return aovInfos[(int)aov];
+}
+
+bool AovBuffers::Configure( uint32_t mask, int width, int height )
+{
+	if( mask == this->mask && width == this->width && height == this->height )
+		return false;
+
+	this->mask = mask;
+	this->width = width;
+	this->height = height;
+	for( int i = 0; i < (int)Aov::Count; i++ )
+	{
+		if( IsEnabled( (Aov)i ) )
+		{
+			planes[i].assign( (size_t)aovInfos[i].channels * width * height, 0.0f );
+		}
+		else
+		{
+			planes[i].clear();
+			planes[i].shrink_to_fit();
+		}
+	}
+	return true;
+}
+
+size_t AovBuffers::GetMemoryBytes() const
+{
+	size_t bytes = 0;
+	for( const auto& plane : planes )
+	{
+		bytes += plane.size() * sizeof( float );
+	}
+	return bytes;
+}
+
+bool AovBuffers::Export( const std::string& prefix ) const
+{
+	bool written = true;
+	for( int i = 0; i < (int)Aov::Count; i++ )
+	{
+		if( IsEnabled( (Aov)i ) )
+			written &= WritePfm( prefix + "_" + aovInfos[i].name + ".pfm", width, height, aovInfos[i].channels, planes[i].data() );
+	}
+	return written;
+}
+
+bool WritePfm( const std::string& path, int width, int height, int channels, const float* planes )
+{
+	std::ofstream f( path, std::ios::out | std::ios::binary );
+	if( !f.is_open() || (channels != 1 && channels != 3) )
+		return false;
+
+	//Negative scale marks little endian data
+	const std::string header = std::string( channels == 3 ? "PF" : "Pf" ) + "\n" + std::to_string( width ) + " " + std::to_string( height ) + "\n-1.0\n";
+	f.write( header.data(), header.size() );
+
+	const size_t pixelCount = (size_t)width * height;
+	std::vector<float> row( (size_t)width * channels );
+	for( int y = 0; y < height; y++ )
+	{
+		for( int x = 0; x < width; x++ )
+		{
+			for( int c = 0; c < channels; c++ )
+			{
+				row[(size_t)x * channels + c] = planes[c * pixelCount + (size_t)y * width + x];
+			}
+		}
+		f.write( reinterpret_cast<const char*>(row.data()), row.size() * sizeof( float ) );
+	}
+
+	return f.good();
+}
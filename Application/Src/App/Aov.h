@@ -0,0 +1,60 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+//Arbitrary output variables, what the march learns about the primary ray written
+//next to the beauty image. Same order as the AOV_ defines in RayMarcher.hlsl
+enum class Aov
+{
+	Depth,
+	Normal,
+	Albedo,
+	ObjectId,
+	MaterialId,
+	Steps,
+	Count
+};
+
+struct AovInfo
+{
+	const char* name;
+	int channels;
+	//Averaged over the samples of a pixel, ids keep the last sample instead
+	bool average;
+};
+
+//Registry of every AOV, indexed by Aov
+const AovInfo& GetAovInfo( Aov aov );
+
+constexpr uint32_t AovBit( Aov aov )
+{
+	return 1u << (uint32_t)aov;
+}
+
+//Float planes of the enabled AOVs only, channel c of an AOV starts c * width * height
+//floats after Get( aov ). Disabled AOVs take no memory and Get returns null for them
+class AovBuffers
+{
+public:
+	//Allocates the AOVs in the AovBit mask, returns true if anything was (re)allocated
+	bool Configure( uint32_t mask, int width, int height );
+	uint32_t GetMask() const { return mask; }
+	bool IsEnabled( Aov aov ) const { return (mask & AovBit( aov )) != 0; }
+	float* Get( Aov aov ) { return IsEnabled( aov ) ? planes[(int)aov].data() : nullptr; }
+	const float* Get( Aov aov ) const { return IsEnabled( aov ) ? planes[(int)aov].data() : nullptr; }
+	size_t GetPixelCount() const { return (size_t)width * height; }
+	size_t GetMemoryBytes() const;
+	//Writes every enabled AOV to <prefix>_<name>.pfm, returns false if a file could not be written
+	bool Export( const std::string& prefix ) const;
+private:
+	uint32_t mask = 0;
+	int width = 0;
+	int height = 0;
+	std::vector<float> planes[(int)Aov::Count];
+};
+
+//Portable float map with 1 or 3 channels given as planes. Row 0 is the bottom one,
+//same as in the render buffers, so rows are written in order
+bool WritePfm( const std::string& path, int width, int height, int channels, const float* planes );
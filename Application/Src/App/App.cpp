@@ -3,190 +3,11 @@
 #include "../ImGui/imgui.h"
 #include "../Utils/HydroTimer.h"
 #include "../Utils/Random.h"
-
-Scene Scene_Sphere( Renderer& renderer )
-{
-    Scene scene;
-
-    scene.objectCount = 1;
-    scene.materialCount = 1;
-
-    scene.objects[0].active = 1;
-    scene.objects[0].id = 0;
-    scene.objects[0].materialIndex = 0;
-
-    scene.objects[0].data[0] = 0.0f;
-    scene.objects[0].data[1] = 0.0f;
-    scene.objects[0].data[2] = 0.0f;
-    scene.objects[0].data[3] = 0.5f;
-
-    scene.materials[0].data[0] = 0.8f;
-    scene.materials[0].data[1] = 0.8f;
-    scene.materials[0].data[2] = 0.0f;
-
-    renderer.SetSkybox( "Src/App/Textures/Skybox.bmp" );
-
-    return scene;
-}
-
-
-Scene Scene_Cube( Renderer& renderer )
-{
-	Scene scene;
-
-	scene.objectCount = 1;
-	scene.materialCount = 1;
-
-	scene.objects[0].active = 1;
-	scene.objects[0].id = 1;
-	scene.objects[0].materialIndex = 0;
-
-	scene.objects[0].data[0] = 0.0f;
-	scene.objects[0].data[1] = 0.0f;
-	scene.objects[0].data[2] = 0.0f;
-	scene.objects[0].data[3] = 0.5f;
-    scene.objects[0].data[4] = 0.5f;
-    scene.objects[0].data[5] = 0.5f;
-
-	scene.materials[0].data[0] = 0.0f;
-	scene.materials[0].data[1] = 0.6f;
-	scene.materials[0].data[2] = 0.8f;
-
-	renderer.SetSkybox( "Src/App/Textures/Skybox.bmp" );
-
-	return scene;
-}
-
-
-
-Scene Scene_Torus( Renderer& renderer )
-{
-	Scene scene;
-
-	scene.objectCount = 1;
-	scene.materialCount = 1;
-
-	scene.objects[0].active = 1;
-	scene.objects[0].id = 2;
-	scene.objects[0].materialIndex = 0;
-
-	scene.objects[0].data[0] = 0.0f;
-	scene.objects[0].data[1] = 0.0f;
-	scene.objects[0].data[2] = 0.0f;
-	scene.objects[0].data[3] = 0.5f;
-	scene.objects[0].data[4] = 0.2f;
-
-	scene.materials[0].data[0] = 0.8f;
-	scene.materials[0].data[1] = 0.0f;
-	scene.materials[0].data[2] = 0.8f;
-
-	renderer.SetSkybox( "Src/App/Textures/Skybox.bmp" );
-
-	return scene;
-}
-
-Scene Scene_CornellBox( Renderer& renderer )
-{
-    Scene scene;
-
-    scene.objectCount = 6;
-    scene.materialCount = 4;
-
-    //Red
-    scene.materials[0].id = 0;
-    scene.materials[0].data[0] = 0.65f;
-    scene.materials[0].data[1] = 0.05f;
-    scene.materials[0].data[2] = 0.05f;
-
-    //White
-    scene.materials[1].id = 0;
-    scene.materials[1].data[0] = 0.73f;
-    scene.materials[1].data[1] = 0.73f;
-    scene.materials[1].data[2] = 0.73f;
-
-    //Green
-    scene.materials[2].id = 0;
-    scene.materials[2].data[0] = 0.12f;
-    scene.materials[2].data[1] = 0.45f;
-    scene.materials[2].data[2] = 0.15f;
-
-    //Light
-    scene.materials[3].id = 0;
-    scene.materials[3].data[0] = 1.0f;
-    scene.materials[3].data[1] = 1.0f;
-    scene.materials[3].data[2] = 1.0f;
-    scene.materials[3].emitedLight = Vec3F( 1.0f, 1.0f, 1.0f );
-    scene.materials[3].data[15] = 15.0f;
-
-    //Left Wall
-    scene.objects[0].active = 1;
-    scene.objects[0].id = 1;
-    scene.objects[0].materialIndex = 2;
-    scene.objects[0].data[0] = -3.0f;
-    scene.objects[0].data[1] = 0.0f;
-    scene.objects[0].data[2] = 0.5f;
-    scene.objects[0].data[3] = 0.1f;
-    scene.objects[0].data[4] = 2.5f;
-    scene.objects[0].data[5] = 3.0f;
-
-    //Right Wall
-    scene.objects[1].active = 1;
-    scene.objects[1].id = 1;
-    scene.objects[1].materialIndex = 0;
-    scene.objects[1].data[0] = 3.0f;
-    scene.objects[1].data[1] = 0.0f;
-    scene.objects[1].data[2] = 0.5f;
-    scene.objects[1].data[3] = 0.1f;
-    scene.objects[1].data[4] = 2.5f;
-    scene.objects[1].data[5] = 3.0f;
-
-    //Back Wall
-    scene.objects[2].active = 1;
-    scene.objects[2].id = 1;
-    scene.objects[2].materialIndex = 1;
-    scene.objects[2].data[0] = 0.0f;
-    scene.objects[2].data[1] = 0.0f;
-    scene.objects[2].data[2] = -2.6f;
-    scene.objects[2].data[3] = 2.9f;
-    scene.objects[2].data[4] = 2.5f;
-    scene.objects[2].data[5] = 0.1f;
-
-    //Floor
-    scene.objects[3].active = 1;
-    scene.objects[3].id = 1;
-    scene.objects[3].materialIndex = 1;
-    scene.objects[3].data[0] = 0.0f;
-    scene.objects[3].data[1] = -2.6f;
-    scene.objects[3].data[2] = 0.5f;
-    scene.objects[3].data[3] = 2.9f;
-    scene.objects[3].data[4] = 0.1f;
-    scene.objects[3].data[5] = 3.0f;
-
-    //Ceiling
-    scene.objects[4].active = 1;
-    scene.objects[4].id = 1;
-    scene.objects[4].materialIndex = 1;
-    scene.objects[4].data[0] = 0.0f;
-    scene.objects[4].data[1] = 2.6f;
-    scene.objects[4].data[2] = 0.5f;
-    scene.objects[4].data[3] = 2.9f;
-    scene.objects[4].data[4] = 0.1f;
-    scene.objects[4].data[5] = 3.0f;
-
-    //Ceiling Light
-    scene.objects[5].active = 1;
-    scene.objects[5].id = 1;
-    scene.objects[5].materialIndex = 3;
-    scene.objects[5].data[0] = 0.0f;
-    scene.objects[5].data[1] = 2.59f;
-    scene.objects[5].data[2] = 0.5f;
-    scene.objects[5].data[3] = 0.5f;
-    scene.objects[5].data[4] = 0.1f;
-    scene.objects[5].data[5] = 0.5f;
-
-    renderer.SetSkybox( "Src/App/Textures/NoSkybox.bmp" );
-    return scene;
-}
+#include "Scenes.h"
+#include "PacketMarcher.h"
+#include "Bvh.h"
+#include "DistanceCache.h"
+#include "GpuFrame.h"
 
 namespace Hydro
 {
@@ -200,12 +21,33 @@ namespace Hydro
         comboBoxIndexMaterial = 0;
 
         //Init Scenes
-        scenes.push_back( std::bind( Scene_Sphere, std::ref( renderer ) ) );
-        scenes.push_back( std::bind( Scene_Cube, std::ref( renderer ) ) );
-        scenes.push_back( std::bind( Scene_Torus, std::ref( renderer ) ) );
-        scenes.push_back( std::bind( Scene_CornellBox, std::ref( renderer ) ) );
+        scenes.push_back( [this]() { renderer.SetSkybox( "Src/App/Textures/Skybox.bmp" ); return Scene_Sphere(); } );
+        scenes.push_back( [this]() { renderer.SetSkybox( "Src/App/Textures/Skybox.bmp" ); return Scene_Cube(); } );
+        scenes.push_back( [this]() { renderer.SetSkybox( "Src/App/Textures/Skybox.bmp" ); return Scene_Torus(); } );
+        scenes.push_back( [this]() { renderer.SetSkybox( "Src/App/Textures/NoSkybox.bmp" ); return Scene_CornellBox(); } );
 
         scene = scenes[currentScene]();
+
+        benchmark.Add( "Packet marcher", PacketMarcher::RunBenchmark );
+        benchmark.Add( "BVH scaling", Bvh::RunBenchmark );
+        benchmark.Add( "Distance cache", DistanceCache::RunBenchmark );
+        benchmark.Add( "Sphere tracing", CpuRayMarcher::RunSphereTracingBenchmark );
+        benchmark.Add( "Next event estimation", CpuRayMarcher::RunNextEventBenchmark );
+        benchmark.Add( "Samplers", CpuRayMarcher::RunSamplerBenchmark );
+        benchmark.Add( "Russian roulette", CpuRayMarcher::RunRussianRouletteBenchmark );
+        benchmark.Add( "Wavefront", CpuRayMarcher::RunWavefrontBenchmark );
+        benchmark.Add( "Progressive preview", CpuRayMarcher::RunPreviewBenchmark );
+        benchmark.Add( "Frame time controller", FrameTimeController::RunBenchmark );
+        benchmark.Add( "Adaptive sampling", CpuRayMarcher::RunAdaptiveSamplingBenchmark );
+        benchmark.Add( "Denoiser", CpuRayMarcher::RunDenoiserBenchmark );
+        benchmark.Add( "Reprojection", CpuRayMarcher::RunReprojectionBenchmark );
+        benchmark.Add( "Cone pre-pass", CpuRayMarcher::RunConePrepassBenchmark );
+        benchmark.Add( "Normals", CpuRayMarcher::RunNormalsBenchmark );
+        benchmark.Add( "Cancellation", CpuRayMarcher::RunCancellationBenchmark );
+        benchmark.Add( "Job system", Hydro::JobSystem::RunBenchmark );
+        benchmark.Add( "GPU frame resources", GpuFrame::RunBenchmark );
+        benchmark.Add( "Path loop (GPU)", [this]() { return ComputeShader::RunPathLoopBenchmark( wnd.Gfx() ); } );
+        benchmark.Add( "Tiled dispatch (GPU)", [this]() { return ComputeShader::RunTiledDispatchBenchmark( wnd.Gfx() ); } );
 	}
 
 	App::~App()
@@ -214,7 +56,30 @@ namespace Hydro
     void App::Update()
     {
         float deltaTime = dt.Mark();
-        camera.OnUpdate( wnd, deltaTime );
+
+        //The raw deltas are drained every frame, so nothing piles up while the camera is idle
+        Camera::Input input;
+        while( const auto d = wnd.mouse.ReadRawDelta() )
+        {
+            input.mouseDelta.x += d->x;
+            input.mouseDelta.y += d->y;
+        }
+        input.active = wnd.mouse.RightIsPressed() || wnd.keyboard.KeyIsPressed( 'M' );
+        if( !input.active )
+        {
+            wnd.EnableCursor();
+            return;
+        }
+        wnd.DisableCursor();
+        input.forward = wnd.keyboard.KeyIsPressed( 'W' );
+        input.back = wnd.keyboard.KeyIsPressed( 'S' );
+        input.left = wnd.keyboard.KeyIsPressed( 'A' );
+        input.right = wnd.keyboard.KeyIsPressed( 'D' );
+        input.down = wnd.keyboard.KeyIsPressed( 'Q' );
+        input.up = wnd.keyboard.KeyIsPressed( 'E' );
+        input.turn = wnd.keyboard.KeyIsPressed( 'G' );
+        if( camera.OnUpdate( input, deltaTime ) )
+            renderer.OnCameraMoved();
     }
 
     void App::Frame()
@@ -224,6 +89,7 @@ namespace Hydro
 		RenderImGuiBaseGUI();
         
         scene.RenderGUI( comboBoxIndexObject, comboBoxIndexMaterial );
+        RenderBenchmarkGUI();
 
         ImGui::Begin( "Settings" );
         ImGui::DragInt( "Scene", &currentScene, 0.5f, 0, scenes.size() - 1 );
@@ -235,6 +101,149 @@ namespace Hydro
         ImGui::Text( "Fps: %.1f", ImGui::GetIO().Framerate );
         ImGui::NewLine();
         ImGui::InputInt("Render iterations", &renderer.GetRenderIterations(), 1, 10); 
+        FrameTimeController::Settings& controllerSettings = frameTimeController.GetSettings();
+        if( ImGui::Checkbox( "Frame time target", &controllerSettings.enabled ) && controllerSettings.enabled )
+        {
+            frameTimeController.Reset( renderer.GetRenderIterations() );
+            renderer.GetRenderIterations() = frameTimeController.GetRenderIterations();
+        }
+        if( controllerSettings.enabled )
+        {
+            const FrameTimeController::Stats& controller = frameTimeController.GetStats();
+            ImGui::SliderFloat( "Target (ms)", &controllerSettings.targetTime, 4.0f, 200.0f, "%.0f", ImGuiSliderFlags_Logarithmic );
+            ImGui::SliderFloat( "Min resolution", &controllerSettings.minScale, 0.1f, 1.0f, "%.2f" );
+            ImGui::SliderInt( "Max iterations", &controllerSettings.maxIterations, 1, 64 );
+            ImGui::Text( "%.1fms average, %.0f%% resolution, %d iterations, %d changes", controller.smoothedTime,
+                controller.scale * 100.0f, controller.renderIterations, controller.adjustments );
+        }
+        ImGui::SliderInt( "Max depth", &renderer.GetSettings().maxDepth, 1, 64 );
+        ImGui::Checkbox( "Next event estimation", &renderer.GetSettings().nextEventEstimation );
+        if( ImGui::BeginCombo( "Sampler", GetSamplerName( renderer.GetSettings().sampler ) ) )
+        {
+            for( int i = 0; i < (int)SamplerType::Count; i++ )
+            {
+                if( ImGui::Selectable( GetSamplerName( (SamplerType)i ), renderer.GetSettings().sampler == (SamplerType)i ) )
+                    renderer.GetSettings().sampler = (SamplerType)i;
+            }
+            ImGui::EndCombo();
+        }
+        ImGui::Checkbox( "Russian roulette", &renderer.GetSettings().russianRoulette );
+        if( renderer.GetSettings().russianRoulette )
+        {
+            const PathStats& paths = renderer.GetPathStats();
+            ImGui::SliderInt( "Roulette min depth", &renderer.GetSettings().rouletteMinDepth, 1, 16 );
+            ImGui::Text( "%.2f rays per path, %.0f%% ended early, %lld rays saved at most",
+                paths.averageLength, paths.terminatedFraction * 100.0f, (long long)paths.raysSaved );
+        }
+        ImGui::Checkbox( "Accumulate", &renderer.GetSettings().accumulate );
+        ImGui::SameLine();
+        ImGui::Text( "%u frames", renderer.GetFrameIndex() );
+        ImGui::Checkbox( "Reprojection", &renderer.GetSettings().reprojection );
+        if( renderer.GetSettings().reprojection )
+        {
+            ImGui::SliderInt( "Max history", &renderer.GetSettings().maxHistory, 1, 256, "%d", ImGuiSliderFlags_Logarithmic );
+            const CpuRayMarcher::ReprojectionStats& reprojection = renderer.GetReprojectionStats();
+            if( renderer.GetSettings().cpuBackend && reprojection.active )
+                ImGui::Text( "%.0f%% of pixels kept history", reprojection.historyFraction * 100.0f );
+        }
+        ImGui::Checkbox( "Adaptive sampling", &renderer.GetSettings().adaptiveSampling );
+        if( renderer.GetSettings().adaptiveSampling )
+        {
+            const AdaptiveSamplingStats& adaptive = renderer.GetAdaptiveStats();
+            ImGui::SliderFloat( "Error threshold", &renderer.GetSettings().errorThreshold, 0.005f, 0.5f, "%.3f", ImGuiSliderFlags_Logarithmic );
+            ImGui::SliderInt( "Min samples", &renderer.GetSettings().minSamples, 2, 256 );
+            ImGui::Text( "%d / %d tiles active, %.1f spp", adaptive.activeTiles, adaptive.tileCount, adaptive.samplesPerPixel );
+        }
+        ImGui::Checkbox( "CPU backend", &renderer.GetSettings().cpuBackend );
+        ImGui::SliderFloat( "GPU time budget (ms)", &renderer.GetSettings().gpuTimeBudget, 0.0f, 50.0f, "%.1f" );
+        if( renderer.GetSettings().gpuTimeBudget > 0.0f )
+        {
+            ImGui::SliderInt( "GPU tile size", &renderer.GetSettings().gpuTileSize, 8, 512 );
+            const ComputeShader::TileStats& tiles = renderer.GetTileStats();
+            if( !renderer.GetSettings().cpuBackend )
+                ImGui::Text( "%d / %d tiles, %d per call, last frame over %d UI frames, %.1fms GPU per call", tiles.tilesDone, tiles.tileCount,
+                    tiles.callTiles, tiles.callsPerFrame, tiles.callTime );
+        }
+        const GpuDevice::Stats& device = renderer.GetGpuDeviceStats();
+        ImGui::Text( "%lld GPU buffers and %lld textures created, %.1fKB in %lld uploads", (long long)device.bufferAllocations,
+            (long long)device.textureAllocations, device.uploadedBytes / 1024.0f, (long long)device.uploads );
+        ImGui::Checkbox( "Distance cache (CPU)", &renderer.GetSettings().distanceCache );
+        if( renderer.GetSettings().distanceCache )
+        {
+            const DistanceCache::Stats& cacheStats = renderer.GetDistanceCacheStats();
+            ImGui::DragInt( "Cache resolution", &renderer.GetDistanceCacheSettings().resolution, 0.5f, 4, 256 );
+            ImGui::Text( "%d bricks, %.2f MB, %s in %.1fms", cacheStats.brickCount, cacheStats.memoryBytes / (1024.0f * 1024.0f),
+                cacheStats.fullRebuild ? "built" : "updated", cacheStats.buildTime * 1000.0f );
+        }
+        ImGui::Checkbox( "Over-relaxed sphere tracing", &renderer.GetSettings().overRelaxation );
+        if( renderer.GetSettings().overRelaxation )
+        {
+            ImGui::SliderFloat( "Relaxation", &renderer.GetSettings().relaxation, 1.0f, 1.95f );
+        }
+        ImGui::Checkbox( "Cone pre-pass (CPU)", &renderer.GetSettings().conePrepass );
+        ImGui::Checkbox( "Wavefront (CPU)", &renderer.GetSettings().wavefront );
+        if( renderer.GetSettings().wavefront )
+            ImGui::Checkbox( "Packet marching (CPU)", &renderer.GetSettings().packetMarching );
+        ImGui::Checkbox( "Progressive (CPU)", &renderer.GetSettings().progressive );
+        if( renderer.GetSettings().progressive )
+        {
+            const Renderer::ProgressiveStats& progressive = renderer.GetProgressiveStats();
+            ImGui::SliderFloat( "Preview budget (ms)", &renderer.GetSettings().previewBudget, 1.0f, 100.0f, "%.0f" );
+            ImGui::Checkbox( "Edge-aware preview", &renderer.GetSettings().edgeAwarePreview );
+            ImGui::Text( "%dx%d blocks, first image after %.1fms", progressive.blockSize, progressive.blockSize, progressive.firstImageTime );
+        }
+        ImGui::Checkbox( "Denoise (CPU)", &renderer.GetSettings().denoise );
+        if( renderer.GetSettings().denoise )
+        {
+            Denoiser::Settings& denoiserSettings = renderer.GetDenoiserSettings();
+            ImGui::SliderInt( "Denoise passes", &denoiserSettings.passes, 1, 8 );
+            ImGui::SliderFloat( "Luminance sigma", &denoiserSettings.sigmaLuminance, 0.5f, 16.0f );
+            if( renderer.GetSettings().cpuBackend )
+                ImGui::Text( "Denoise: %.2fms", renderer.GetDenoiserStats().time );
+        }
+        if( renderer.GetSettings().cpuBackend )
+        {
+            const Renderer::ThreadStats& thread = renderer.GetThreadStats();
+            ImGui::Text( "Render thread: %lld frames, %lld shown, %lld snapshots skipped, %.1fms latency", (long long)thread.framesRendered,
+                (long long)thread.framesShown, (long long)thread.snapshotsSkipped, thread.latency );
+            ImGui::Text( "Cancelled: %lld frames, %lld samples skipped, %lld wasted, edit on screen after %.1fms", (long long)thread.framesCancelled,
+                (long long)thread.samplesSkipped, (long long)thread.samplesWasted, thread.editLatency );
+
+            const StepHistogram& steps = renderer.GetStepHistogram();
+            ImGui::Text( "March steps: %.1f avg, %d p99", steps.GetAverage(), steps.GetPercentile( 0.99 ) );
+
+            const CpuRayMarcher::PrepassStats& prepass = renderer.GetPrepassStats();
+            if( prepass.cameraInside )
+                ImGui::Text( "Pre-pass skipped, camera inside an object" );
+            else if( prepass.active )
+                ImGui::Text( "Pre-pass: %lld steps saved, %lld cone steps, %.2fms",
+                    (long long)prepass.stepsSaved, (long long)prepass.coneSteps, prepass.time );
+
+            const CpuRayMarcher::WavefrontStats& wavefront = renderer.GetWavefrontStats();
+            if( wavefront.active )
+            {
+                ImGui::Text( "Wavefront: %d passes, %d batches, %.0f%% occupancy", wavefront.passes, wavefront.batches, wavefront.occupancy * 100.0f );
+                ImGui::Text( "Generate %.2fms, march %.2fms, sort %.2fms", wavefront.generateTime, wavefront.marchTime, wavefront.sortTime );
+                ImGui::Text( "Marched %d paths at a time", wavefront.packetWidth );
+                ImGui::Text( "Miss %.2fms, shade %.2fms, accumulate %.2fms", wavefront.missTime, wavefront.shadeTime, wavefront.accumulateTime );
+                ImGui::Text( "Shaded: %lld diffuse, %lld metal, %lld dielectric, %lld missed", (long long)wavefront.shadedRays[0],
+                    (long long)wavefront.shadedRays[1], (long long)wavefront.shadedRays[2], (long long)wavefront.missedRays );
+            }
+        }
+        if( ImGui::TreeNode( "AOVs" ) )
+        {
+            for( int i = 0; i < (int)Aov::Count; i++ )
+            {
+                ImGui::CheckboxFlags( GetAovInfo( (Aov)i ).name, &renderer.GetSettings().aovs, AovBit( (Aov)i ) );
+            }
+            if( ImGui::Button( "Export" ) )
+                renderer.ExportAovs( "Render" );
+            ImGui::SameLine();
+            const Renderer::ExportState exportState = renderer.GetExportState();
+            ImGui::TextUnformatted( exportState == Renderer::ExportState::Pending ? "Exporting..." :
+                exportState == Renderer::ExportState::Failed ? "Export failed" : "Render_<name>.pfm" );
+            ImGui::TreePop();
+        }
         if( ImGui::Button( "Render" ) )
         {
             Render();
@@ -247,6 +256,8 @@ namespace Hydro
         }
         ImGui::End();
 
+        Present();
+
         //Render
         ImGui::PushStyleVar( ImGuiStyleVar_WindowPadding, ImVec2( 0, 0 ) );
         ImGui::Begin( "Viewport" );
@@ -257,7 +268,8 @@ namespace Hydro
         Hydro::Image image = renderer.GetFinalImage();
         if( image.Active() )
         {
-            ImGui::Image( image.GetData(), { (float)image.GetWidth(),(float)image.GetHeight() },
+            //Rendered at a lower resolution when the frame time controller asks for it
+            ImGui::Image( image.GetData(), { (float)ViewportWidth,(float)ViewportHeight },
                 ImVec2( 0, 1 ), ImVec2( 1, 0 ) );
         }
 
@@ -269,13 +281,29 @@ namespace Hydro
 
     void App::Render()
     {
-        Timer timer;
-
-        renderer.OnResize( ViewportWidth, ViewportHeight );
-        camera.OnResize( ViewportWidth, ViewportHeight );
+        const bool controlled = frameTimeController.GetSettings().enabled;
+        const int renderWidth = controlled ? frameTimeController.GetRenderSize( ViewportWidth ) : ViewportWidth;
+        const int renderHeight = controlled ? frameTimeController.GetRenderSize( ViewportHeight ) : ViewportHeight;
+        renderer.OnResize( renderWidth, renderHeight );
+        camera.OnResize( renderWidth, renderHeight );
         renderer.Render( camera, scene );
+    }
 
-        lastRenderTime = timer.Mark();
+    void App::Present()
+    {
+        //CPU frames finish on the render thread, the newest one is shown whenever it is done
+        if( !renderer.Present() )
+            return;
+
+        //Slices of a time-sliced GPU frame have no time of their own
+        if( !renderer.IsRenderTimed() )
+            return;
+        lastRenderTime = renderer.GetRenderTime();
+
+        //Previews say nothing about the time of a full frame
+        if( frameTimeController.GetSettings().enabled && renderer.GetProgressiveStats().blockSize == 1 &&
+            frameTimeController.Update( lastRenderTime * 1000.0f ) )
+            renderer.GetRenderIterations() = frameTimeController.GetRenderIterations();
     }
 
 	void App::RenderImGuiBaseGUI()
@@ -358,6 +386,28 @@ namespace Hydro
 	}
 
 
+    void App::RenderBenchmarkGUI()
+    {
+        ImGui::Begin( "Benchmarks" );
+        for( size_t i = 0; i < benchmark.GetCount(); i++ )
+        {
+            ImGui::PushID( (int)i );
+            ImGui::Text( "%s", benchmark.GetName( i ).c_str() );
+            ImGui::SameLine();
+            if( ImGui::Button( "Run" ) )
+            {
+                benchmark.Run( i );
+            }
+            for( const auto& line : benchmark.GetReport( i ) )
+            {
+                ImGui::BulletText( "%s", line.c_str() );
+            }
+            ImGui::Separator();
+            ImGui::PopID();
+        }
+        ImGui::End();
+    }
+
 	int App::Run()
 	{
 		//Application Loop
@@ -5,6 +5,8 @@
 #include "Renderer.h"
 #include "Camera.h"
 #include "Scene.h"
+#include "Benchmark.h"
+#include "FrameTimeController.h"
 #include <optional>
 #include <vector>
 #include <functional>
@@ -21,7 +23,9 @@ namespace Hydro
 		void Update();
 		void Frame();
 		void Render();
+		void Present();
 		void RenderImGuiBaseGUI();
+		void RenderBenchmarkGUI();
 	private:
 		Timer dt;
 		Window wnd;
@@ -33,6 +37,8 @@ namespace Hydro
 		std::vector<std::function<Scene()>> scenes;
 
 		Scene scene;
+		Benchmark benchmark;
+		FrameTimeController frameTimeController;
 		std::optional<int> comboBoxIndexObject;
 		std::optional<int> comboBoxIndexMaterial;
 
@@ -0,0 +1,22 @@
+#include "Benchmark.h"
+#include "../Utils/HydroTimer.h"
+#include <cstdio>
+
+void Benchmark::Add( const std::string& name, std::function<Report()> run )
+{
+	entries.push_back( { name, std::move( run ), {} } );
+}
+
+const Benchmark::Report& Benchmark::Run( size_t index )
+{
+	Entry& entry = entries[index];
+
+	Hydro::Timer timer;
+	entry.report = entry.run();
+
+	char line[64];
+	snprintf( line, sizeof( line ), "Finished in %.2fs", timer.Mark() );
+	entry.report.push_back( line );
+
+	return entry.report;
+}
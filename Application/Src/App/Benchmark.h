@@ -0,0 +1,27 @@
+#pragma once
+#include <functional>
+#include <string>
+#include <vector>
+
+//Collection of named performance measurements that can be run from the
+//Benchmarks window of the App or headless through Run
+class Benchmark
+{
+public:
+	using Report = std::vector<std::string>;
+public:
+	void Add( const std::string& name, std::function<Report()> run );
+	const Report& Run( size_t index );
+	size_t GetCount() const { return entries.size(); }
+	const std::string& GetName( size_t index ) const { return entries[index].name; }
+	//Lines of the last Run, empty before
+	const Report& GetReport( size_t index ) const { return entries[index].report; }
+private:
+	struct Entry
+	{
+		std::string name;
+		std::function<Report()> run;
+		Report report;
+	};
+	std::vector<Entry> entries;
+};
\ No newline at end of file
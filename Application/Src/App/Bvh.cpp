@@ -0,0 +1,312 @@
+#include "Bvh.h"
+#include "CompiledScene.h"
+#include "SignedDistance.h"
+#include "../Utils/Random.h"
+#include "../Utils/HydroTimer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+namespace
+{
+	float BoxDistance( const Bvh::Node& node, Vec3F p )
+	{
+		Vec3F q = Vec3F::Max( Vec3F::Max( node.boundsMin - p, p - node.boundsMax ), Vec3F( 0.0f ) );
+		return q.Magnitude();
+	}
+
+	int PrimitiveObject( const CompiledScene& scene, uint32_t primitive )
+	{
+		const int index = Bvh::GetIndex( primitive );
+		switch( Bvh::GetType( primitive ) )
+		{
+			case Bvh::Box:
+				return scene.boxObjects[index];
+			case Bvh::Torus:
+				return scene.torusObjects[index];
+			default:
+				return scene.sphereObjects[index];
+		}
+	}
+}
+
+void Bvh::Clear()
+{
+	nodes.clear();
+	primitives.clear();
+	boundingSpheres.clear();
+	depth = 0;
+}
+
+void Bvh::Build( const CompiledScene& scene )
+{
+	Clear();
+
+	std::vector<BuildPrimitive> build;
+	build.reserve( scene.GetPrimitiveCount() );
+
+	//Conservative bounds, the SDF can never be smaller than the distance to them
+	auto add = [&build, &scene]( PrimitiveType type, size_t index, float radius )
+	{
+		BuildPrimitive primitive;
+		scene.GetPrimitiveBounds( type, index, primitive.boundsMin, primitive.boundsMax );
+		primitive.centroid = (primitive.boundsMin + primitive.boundsMax) * 0.5f;
+		primitive.boundingSphere = Vec4F( primitive.centroid.x, primitive.centroid.y, primitive.centroid.z, radius );
+		primitive.primitive = (uint32_t)(index << 2) | (uint32_t)type;
+		build.push_back( primitive );
+	};
+
+	for( size_t i = 0; i < scene.spheres.size(); i++ )
+	{
+		add( Sphere, i, scene.spheres[i].w );
+	}
+
+	for( size_t i = 0; i < scene.boxSizes.size(); i++ )
+	{
+		const Vec4F& size = scene.boxSizes[i];
+		add( Box, i, Vec3F( size.x, size.y, size.z ).Magnitude() );
+	}
+
+	for( size_t i = 0; i < scene.tori.size(); i++ )
+	{
+		add( Torus, i, std::abs( scene.tori[i].w ) + std::abs( scene.torusMinorRadii[i] ) );
+	}
+
+	if( build.empty() )
+		return;
+
+	nodes.reserve( build.size() * 2 );
+	nodes.emplace_back();
+	Subdivide( build, 0, 0, (int)build.size(), 1 );
+
+	primitives.reserve( build.size() );
+	boundingSpheres.reserve( build.size() );
+	for( const BuildPrimitive& primitive : build )
+	{
+		primitives.push_back( primitive.primitive );
+		boundingSpheres.push_back( primitive.boundingSphere );
+	}
+}
+
+void Bvh::Subdivide( std::vector<BuildPrimitive>& build, int nodeIndex, int first, int count, int level )
+{
+	depth = (std::max)( depth, level );
+
+	Vec3F boundsMin = build[first].boundsMin;
+	Vec3F boundsMax = build[first].boundsMax;
+	Vec3F centroidMin = build[first].centroid;
+	Vec3F centroidMax = build[first].centroid;
+	for( int i = first + 1; i < first + count; i++ )
+	{
+		boundsMin = Vec3F::Min( boundsMin, build[i].boundsMin );
+		boundsMax = Vec3F::Max( boundsMax, build[i].boundsMax );
+		centroidMin = Vec3F::Min( centroidMin, build[i].centroid );
+		centroidMax = Vec3F::Max( centroidMax, build[i].centroid );
+	}
+
+	nodes[nodeIndex].boundsMin = boundsMin;
+	nodes[nodeIndex].boundsMax = boundsMax;
+
+	if( count <= maxLeafSize || level >= maxDepth )
+	{
+		nodes[nodeIndex].leftOrFirst = first;
+		nodes[nodeIndex].count = count;
+		return;
+	}
+
+	//Median split along the widest centroid axis
+	Vec3F extent = centroidMax - centroidMin;
+	int axis = 0;
+	if( extent.y > extent.x )
+		axis = 1;
+	if( extent.z > (axis == 0 ? extent.x : extent.y) )
+		axis = 2;
+
+	auto key = [axis]( const BuildPrimitive& primitive )
+	{
+		return axis == 0 ? primitive.centroid.x : (axis == 1 ? primitive.centroid.y : primitive.centroid.z);
+	};
+
+	const int half = count / 2;
+	std::nth_element( build.begin() + first, build.begin() + first + half, build.begin() + first + count,
+		[&key]( const BuildPrimitive& a, const BuildPrimitive& b ) { return key( a ) < key( b ); } );
+
+	const int left = (int)nodes.size();
+	nodes.emplace_back();
+	nodes.emplace_back();
+	nodes[nodeIndex].leftOrFirst = left;
+	nodes[nodeIndex].count = 0;
+
+	Subdivide( build, left, first, half, level + 1 );
+	Subdivide( build, left + 1, first + half, count - half, level + 1 );
+}
+
+ObjectDistance Bvh::SignedDistance( const CompiledScene& scene, Vec3F p, Stats* pStats ) const
+{
+	ObjectDistance result;
+	result.distance = 10000.0f;
+	result.objectIndex = -1;
+
+	if( nodes.empty() )
+		return result;
+
+	struct Entry
+	{
+		int node;
+		float distance;
+	};
+	Entry stack[maxDepth];
+	int stackSize = 0;
+
+	int64_t nodesVisited = 0;
+	int64_t primitivesTested = 0;
+	int64_t sdfEvaluations = 0;
+
+	int nodeIndex = 0;
+	while( true )
+	{
+		const Node& node = nodes[nodeIndex];
+		nodesVisited++;
+
+		if( node.count > 0 )
+		{
+			for( int i = node.leftOrFirst; i < node.leftOrFirst + node.count; i++ )
+			{
+				primitivesTested++;
+				const Vec4F& sphere = boundingSpheres[i];
+				const float sphereDistance = (p - Vec3F( sphere.x, sphere.y, sphere.z )).Magnitude() - sphere.w;
+				if( sphereDistance >= result.distance )
+					continue;
+
+				//For spheres the bounding sphere already is the exact distance
+				const uint32_t primitive = primitives[i];
+				float distance = sphereDistance;
+				if( GetType( primitive ) != Sphere )
+				{
+					distance = SignedDistancePrimitive( scene, primitive, p );
+					sdfEvaluations++;
+				}
+
+				if( distance < result.distance )
+				{
+					result.distance = distance;
+					result.objectIndex = PrimitiveObject( scene, primitive );
+				}
+			}
+		}
+		else
+		{
+			//Visit the nearer child first so the far one is more likely to be culled
+			Entry nearChild = { node.leftOrFirst, BoxDistance( nodes[node.leftOrFirst], p ) };
+			Entry farChild = { node.leftOrFirst + 1, BoxDistance( nodes[node.leftOrFirst + 1], p ) };
+			if( farChild.distance < nearChild.distance )
+				std::swap( nearChild, farChild );
+
+			if( nearChild.distance < result.distance )
+			{
+				if( farChild.distance < result.distance )
+					stack[stackSize++] = farChild;
+
+				nodeIndex = nearChild.node;
+				continue;
+			}
+		}
+
+		//Pop until a subtree that can still contain something closer
+		nodeIndex = -1;
+		while( stackSize > 0 )
+		{
+			const Entry entry = stack[--stackSize];
+			if( entry.distance < result.distance )
+			{
+				nodeIndex = entry.node;
+				break;
+			}
+		}
+
+		if( nodeIndex < 0 )
+			break;
+	}
+
+	if( pStats )
+	{
+		pStats->nodesVisited += nodesVisited;
+		pStats->primitivesTested += primitivesTested;
+		pStats->sdfEvaluations += sdfEvaluations;
+	}
+
+	return result;
+}
+
+Benchmark::Report Bvh::RunBenchmark()
+{
+	const int queryCount = 4096;
+	const float minSeconds = 0.25f;
+
+	Benchmark::Report report;
+	report.push_back( "Closest distance queries at random points, single thread" );
+
+	for( int count : { 10, 100, 1000, 10000, 100000 } )
+	{
+		float extent;
+		const CompiledScene scene = CompiledScene::RandomPrimitives( count, 1234u, extent );
+
+		Hydro::Timer timer;
+		Bvh bvh;
+		bvh.Build( scene );
+		const float buildSeconds = timer.Mark();
+
+		uint32_t seed = 5678u;
+		std::vector<Vec3F> queries( queryCount );
+		for( Vec3F& query : queries )
+		{
+			query = Random::Vec3( seed, -extent, extent );
+		}
+
+		//Both paths have to return the same closest distance
+		int mismatches = 0;
+		for( const Vec3F& query : queries )
+		{
+			const float expected = SignedDistanceSceneLinear( scene, query ).distance;
+			mismatches += std::abs( bvh.SignedDistance( scene, query ).distance - expected ) > 1e-4f;
+		}
+
+		//Runs whole passes when cheap, a partial pass is enough at 100k linear
+		auto measure = [&queries, minSeconds]( auto evaluate )
+		{
+			float checksum = 0.0f;
+			int64_t evaluated = 0;
+			Hydro::Timer timer;
+			do
+			{
+				for( int i = 0; i < 64; i++ )
+				{
+					checksum += evaluate( queries[evaluated++ % queries.size()] );
+				}
+			} while( timer.Peek() < minSeconds );
+			volatile float sink = checksum;
+			(void)sink;
+			return timer.Mark() * 1e9 / (double)evaluated;
+		};
+
+		const double linearTime = measure( [&scene]( Vec3F p ) { return SignedDistanceSceneLinear( scene, p ).distance; } );
+		const double bvhTime = measure( [&scene, &bvh]( Vec3F p ) { return bvh.SignedDistance( scene, p ).distance; } );
+
+		Stats stats;
+		for( const Vec3F& query : queries )
+		{
+			bvh.SignedDistance( scene, query, &stats );
+		}
+
+		char line[256];
+		snprintf( line, sizeof( line ), "%d objects: linear %.0f ns, BVH %.0f ns (%.1fx), %.1f nodes %.1f bounds %.1f SDFs per query",
+			count, linearTime, bvhTime, linearTime / bvhTime,
+			(double)stats.nodesVisited / queryCount, (double)stats.primitivesTested / queryCount, (double)stats.sdfEvaluations / queryCount );
+		report.push_back( line );
+		snprintf( line, sizeof( line ), "    build %.2f ms, %d nodes, depth %d%s",
+			buildSeconds * 1000.0f, (int)bvh.GetNodes().size(), bvh.GetDepth(), mismatches > 0 ? ", DISTANCE MISMATCH" : "" );
+		report.push_back( line );
+	}
+
+	return report;
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include "../Utils/Vec3.h"
+#include "../Utils/Vec4.h"
+#include "Benchmark.h"
+#include <vector>
+#include <cstdint>
+
+using namespace Hydro;
+
+class CompiledScene;
+struct ObjectDistance;
+
+//Bounding volume hierarchy over the primitives of a CompiledScene. Subtrees whose
+//bounds are already further away than the closest distance found are skipped,
+//and leaves test a bounding sphere before running the primitive SDF
+class Bvh
+{
+public:
+	enum PrimitiveType
+	{
+		Sphere,
+		Box,
+		Torus
+	};
+
+	struct Node
+	{
+		Vec3F boundsMin;
+		//Index of the left child, right child follows it. First primitive for leaves
+		int leftOrFirst;
+		Vec3F boundsMax;
+		//0 for interior nodes
+		int count;
+	};
+
+	struct Stats
+	{
+		int64_t nodesVisited = 0;
+		//Leaf bounding sphere tests
+		int64_t primitivesTested = 0;
+		//Box and torus SDFs that survived the bounding sphere test
+		int64_t sdfEvaluations = 0;
+	};
+public:
+	void Build( const CompiledScene& scene );
+	void Clear();
+	bool IsEmpty() const { return nodes.empty(); }
+	ObjectDistance SignedDistance( const CompiledScene& scene, Vec3F p, Stats* pStats = nullptr ) const;
+	const std::vector<Node>& GetNodes() const { return nodes; }
+	//Type in the low two bits, index into the per-type arrays above them
+	const std::vector<uint32_t>& GetPrimitives() const { return primitives; }
+	//Leaf bounding spheres in the same order as GetPrimitives
+	const std::vector<Vec4F>& GetBoundingSpheres() const { return boundingSpheres; }
+	int GetDepth() const { return depth; }
+	static PrimitiveType GetType( uint32_t primitive ) { return PrimitiveType( primitive & 3 ); }
+	static int GetIndex( uint32_t primitive ) { return int( primitive >> 2 ); }
+	//Linear loops against the BVH on random scenes from 10 to 100k primitives
+	static Benchmark::Report RunBenchmark();
+	//Below this many primitives the linear loops are faster than traversal
+	static constexpr size_t minPrimitives = 16;
+	static constexpr int maxLeafSize = 4;
+	static constexpr int maxDepth = 64;
+private:
+	struct BuildPrimitive
+	{
+		Vec3F boundsMin;
+		Vec3F boundsMax;
+		Vec3F centroid;
+		Vec4F boundingSphere;
+		uint32_t primitive;
+	};
+private:
+	void Subdivide( std::vector<BuildPrimitive>& build, int nodeIndex, int first, int count, int level );
+private:
+	std::vector<Node> nodes;
+	std::vector<uint32_t> primitives;
+	std::vector<Vec4F> boundingSpheres;
+	int depth = 0;
+};
@@ -15,23 +15,12 @@ Camera::Camera( float verticalFOV, float nearClip, float farClip )
 	RecalcutateView();
 }
 
-bool Camera::OnUpdate( Window& wnd, float dt )
+bool Camera::OnUpdate( const Input& input, float dt )
 {
-	Vec2F delta = Vec2F( 0.0f, 0.0f );
-
-	while( const auto d = wnd.mouse.ReadRawDelta() )
-	{
-		delta.x += d->x;
-		delta.y += d->y;
-	}
-
-	if( !wnd.mouse.RightIsPressed() && !wnd.keyboard.KeyIsPressed( 'M' ) )
-	{
-		wnd.EnableCursor();
+	if( !input.active )
 		return false;
-	}
 
-	wnd.DisableCursor();
+	Vec2F delta = input.mouseDelta;
 
 	bool moved = false;
 
@@ -40,37 +29,37 @@ bool Camera::OnUpdate( Window& wnd, float dt )
 
 	float speed = 5.0f;
 
-	if( wnd.keyboard.KeyIsPressed( 'G' ) )
+	if( input.turn )
 	{
 		delta.x += 1;
 	}
 
-	if( wnd.keyboard.KeyIsPressed( 'W' ) )
+	if( input.forward )
 	{
 		position += forwardDirection * speed * dt;
 		moved = true;
 	}
-	else if( wnd.keyboard.KeyIsPressed( 'S' ) )
+	else if( input.back )
 	{
 		position -= forwardDirection * speed * dt;
 		moved = true;
 	}
-	if( wnd.keyboard.KeyIsPressed( 'A' ) )
+	if( input.left )
 	{
 		position -= rightDirection * speed * dt;
 		moved = true;
 	}
-	else if( wnd.keyboard.KeyIsPressed( 'D' ) )
+	else if( input.right )
 	{
 		position += rightDirection * speed * dt;
 		moved = true;
 	}
-	if( wnd.keyboard.KeyIsPressed( 'Q' ) )
+	if( input.down )
 	{
 		position -= upDirection * speed * dt;
 		moved = true;
 	}
-	else if( wnd.keyboard.KeyIsPressed( 'E' ) )
+	else if( input.up )
 	{
 		position += upDirection * speed * dt;
 		moved = true;
@@ -101,6 +90,14 @@ bool Camera::OnUpdate( Window& wnd, float dt )
 	return moved;
 }
 
+void Camera::SetView( const Vec3F& position, const Vec3F& direction )
+{
+	this->position = position;
+	forwardDirection = Vec3F( direction ).Normalized();
+	forwardDirectionT = forwardDirection;
+	RecalcutateView();
+}
+
 void Camera::OnResize( uint32_t width, uint32_t height )
 {
 	if( width == m_ViewportWidth && height == m_ViewportHeight )
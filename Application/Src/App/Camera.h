@@ -1,17 +1,39 @@
 #pragma once
 
 #include "../Utils/Matrix.h"
+#include "../Utils/Vec2.h"
 #include <vector>
-#include "../Win/Window.h"
+#include <cstdint>
 
 using namespace Hydro;
 
 class Camera
 {
+public:
+	//Mouse and keys of one frame, read from the window by the App so the camera does not
+	//depend on it
+	struct Input
+	{
+		//Raw mouse movement since the last frame
+		Vec2F mouseDelta{ 0.0f, 0.0f };
+		//Right mouse button or M held, nothing moves without it
+		bool active = false;
+		bool forward = false;
+		bool back = false;
+		bool left = false;
+		bool right = false;
+		bool down = false;
+		bool up = false;
+		//Turns right at a fixed rate
+		bool turn = false;
+	};
 public:
 	Camera( float verticalFOV, float nearClip, float farClip );
 
-	bool OnUpdate( Window& wnd, float dt );
+	//True if the camera moved
+	bool OnUpdate( const Input& input, float dt );
+	//Places the camera without input, used by the benchmarks to fly a fixed path
+	void SetView( const Vec3F& position, const Vec3F& direction );
 	void OnResize( uint32_t width, uint32_t height );
 
 	const Matrix4F& GetProjection() const { return projection; }
@@ -0,0 +1,277 @@
+#include "CompiledScene.h"
+#include "../Utils/Random.h"
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+bool CompiledScene::Update( const Scene& scene )
+{
+	if( compiled && SameScene( scene, source ) )
+		return false;
+
+	Compile( scene );
+	return true;
+}
+
+bool CompiledScene::SameScene( const Scene& a, const Scene& b )
+{
+	return a.objectCount == b.objectCount &&
+		a.materialCount == b.materialCount &&
+		std::memcmp( a.objects, b.objects, sizeof( Object ) * a.objectCount ) == 0 &&
+		std::memcmp( a.materials, b.materials, sizeof( Material ) * a.materialCount ) == 0;
+}
+
+void CompiledScene::Clear()
+{
+	spheres.clear();
+	sphereObjects.clear();
+	boxCenters.clear();
+	boxSizes.clear();
+	boxObjects.clear();
+	tori.clear();
+	torusMinorRadii.clear();
+	torusObjects.clear();
+	objectMaterials.clear();
+	objectPrimitives.clear();
+	materials.clear();
+	emitterObjects.clear();
+	emitterAreaSums.clear();
+}
+
+void CompiledScene::Compile( const Scene& scene )
+{
+	Clear();
+
+	for( int i = 0; i < scene.objectCount; i++ )
+	{
+		const Object& object = scene.objects[i];
+		objectMaterials.push_back( std::clamp( object.materialIndex, 0, MAX_OBJECTS - 1 ) );
+		objectPrimitives.push_back( noPrimitive );
+
+		if( object.active <= 0 )
+			continue;
+
+		const float* data = object.data;
+		switch( object.id )
+		{
+			case 0:
+				objectPrimitives.back() = (uint32_t)(spheres.size() << 2) | Bvh::Sphere;
+				spheres.emplace_back( data[0], data[1], data[2], data[3] );
+				sphereObjects.push_back( i );
+				break;
+			case 1:
+				objectPrimitives.back() = (uint32_t)(boxCenters.size() << 2) | Bvh::Box;
+				boxCenters.emplace_back( data[0], data[1], data[2], 0.0f );
+				boxSizes.emplace_back( data[3], data[4], data[5], 0.0f );
+				boxObjects.push_back( i );
+				break;
+			case 2:
+				objectPrimitives.back() = (uint32_t)(tori.size() << 2) | Bvh::Torus;
+				tori.emplace_back( data[0], data[1], data[2], data[3] );
+				torusMinorRadii.push_back( data[4] );
+				torusObjects.push_back( i );
+				break;
+		}
+	}
+
+	//Materials are indexed without a bounds check, keep the whole array
+	materials.assign( scene.materials, scene.materials + MAX_OBJECTS );
+
+	source = scene;
+	compiled = true;
+
+	BuildEmitters();
+	BuildGpuScene();
+	BuildBvh();
+}
+
+void CompiledScene::BuildEmitters()
+{
+	emitterObjects.clear();
+	emitterAreaSums.clear();
+
+	float areaSum = 0.0f;
+	for( int i = 0; i < (int)objectPrimitives.size(); i++ )
+	{
+		if( !IsEmitter( i ) )
+			continue;
+
+		const size_t index = Bvh::GetIndex( objectPrimitives[i] );
+		float area;
+		if( Bvh::GetType( objectPrimitives[i] ) == Bvh::Box )
+		{
+			const Vec3F size = Vec3F::Abs( Vec3F( boxSizes[index].x, boxSizes[index].y, boxSizes[index].z ) );
+			area = 8.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+		}
+		else
+		{
+			area = 4.0f * 3.14159265f * spheres[index].w * spheres[index].w;
+		}
+
+		//Can not be hit either
+		if( !(area > 0.0f) )
+			continue;
+
+		areaSum += area;
+		emitterObjects.push_back( i );
+		emitterAreaSums.push_back( areaSum );
+	}
+}
+
+bool CompiledScene::IsEmitter( int objectIndex ) const
+{
+	const uint32_t primitive = objectPrimitives[objectIndex];
+	if( primitive == noPrimitive || Bvh::GetType( primitive ) == Bvh::Torus )
+		return false;
+
+	const Material& material = GetObjectMaterial( objectIndex );
+	const Vec3F emitted = material.emitedLight * material.data[15];
+	return emitted.x > 0.0f || emitted.y > 0.0f || emitted.z > 0.0f;
+}
+
+void CompiledScene::BuildBvh()
+{
+	if( GetPrimitiveCount() < Bvh::minPrimitives )
+	{
+		bvh.Clear();
+		return;
+	}
+
+	bvh.Build( *this );
+}
+
+void CompiledScene::BuildGpuScene()
+{
+	auto setPacked = []( Vec4I* packed, int index, int value )
+	{
+		int* lanes = &packed[index / 4].x;
+		lanes[index % 4] = value;
+	};
+
+	gpuScene.sphereCount = (int)(std::min)( spheres.size(), (size_t)MAX_OBJECTS );
+	for( int i = 0; i < gpuScene.sphereCount; i++ )
+	{
+		gpuScene.spheres[i] = spheres[i];
+		setPacked( gpuScene.sphereObjects, i, sphereObjects[i] );
+	}
+
+	gpuScene.boxCount = (int)(std::min)( boxCenters.size(), (size_t)MAX_OBJECTS );
+	for( int i = 0; i < gpuScene.boxCount; i++ )
+	{
+		gpuScene.boxCenters[i] = boxCenters[i];
+		gpuScene.boxSizes[i] = boxSizes[i];
+		setPacked( gpuScene.boxObjects, i, boxObjects[i] );
+	}
+
+	gpuScene.torusCount = (int)(std::min)( tori.size(), (size_t)MAX_OBJECTS );
+	for( int i = 0; i < gpuScene.torusCount; i++ )
+	{
+		gpuScene.tori[i] = tori[i];
+		(&gpuScene.torusMinorRadii[i / 4].x)[i % 4] = torusMinorRadii[i];
+		setPacked( gpuScene.torusObjects, i, torusObjects[i] );
+	}
+
+	const int objectCount = (int)(std::min)( objectMaterials.size(), (size_t)MAX_OBJECTS );
+	for( int i = 0; i < objectCount; i++ )
+	{
+		setPacked( gpuScene.objectMaterials, i, objectMaterials[i] );
+		setPacked( gpuScene.objectPrimitives, i, (int)objectPrimitives[i] );
+	}
+
+	gpuScene.materialCount = (int)(std::min)( materials.size(), (size_t)MAX_OBJECTS );
+	for( int i = 0; i < gpuScene.materialCount; i++ )
+	{
+		gpuScene.materials[i] = materials[i];
+	}
+
+	//Emitters past MAX_OBJECTS are not in the scene the shader sees either
+	gpuScene.emitterCount = 0;
+	for( size_t i = 0; i < emitterObjects.size() && emitterObjects[i] < MAX_OBJECTS; i++ )
+	{
+		setPacked( gpuScene.emitterObjects, gpuScene.emitterCount, emitterObjects[i] );
+		(&gpuScene.emitterAreaSums[i / 4].x)[i % 4] = emitterAreaSums[i];
+		gpuScene.emitterCount++;
+	}
+	gpuScene.emitterArea = gpuScene.emitterCount > 0 ? emitterAreaSums[gpuScene.emitterCount - 1] : 0.0f;
+}
+
+void CompiledScene::GetPrimitiveBounds( int type, size_t index, Vec3F& boundsMin, Vec3F& boundsMax ) const
+{
+	Vec3F center;
+	Vec3F extent;
+	switch( type )
+	{
+		case Bvh::Box:
+		{
+			const Vec4F& size = boxSizes[index];
+			center = Vec3F( boxCenters[index].x, boxCenters[index].y, boxCenters[index].z );
+			extent = Vec3F::Abs( Vec3F( size.x, size.y, size.z ) );
+			break;
+		}
+		case Bvh::Torus:
+		{
+			const float minorRadius = std::abs( torusMinorRadii[index] );
+			const float outerRadius = std::abs( tori[index].w ) + minorRadius;
+			center = Vec3F( tori[index].x, tori[index].y, tori[index].z );
+			extent = Vec3F( outerRadius, minorRadius, outerRadius );
+			break;
+		}
+		default:
+			center = Vec3F( spheres[index].x, spheres[index].y, spheres[index].z );
+			extent = Vec3F( std::abs( spheres[index].w ) );
+			break;
+	}
+
+	boundsMin = center - extent;
+	boundsMax = center + extent;
+}
+
+CompiledScene CompiledScene::RandomPrimitives( int count, uint32_t seed, float& extent )
+{
+	extent = 2.0f * std::cbrt( (float)count );
+
+	CompiledScene scene;
+	for( int i = 0; i < count; i++ )
+	{
+		Vec3F center = Random::Vec3( seed, -extent, extent );
+		switch( i % 3 )
+		{
+			case 0:
+				scene.objectPrimitives.push_back( (uint32_t)(scene.spheres.size() << 2) | Bvh::Sphere );
+				scene.spheres.emplace_back( center.x, center.y, center.z, Random::Float( seed, 0.1f, 0.5f ) );
+				scene.sphereObjects.push_back( i );
+				break;
+			case 1:
+			{
+				Vec3F size = Random::Vec3( seed, 0.1f, 0.5f );
+				scene.objectPrimitives.push_back( (uint32_t)(scene.boxCenters.size() << 2) | Bvh::Box );
+				scene.boxCenters.emplace_back( center.x, center.y, center.z, 0.0f );
+				scene.boxSizes.emplace_back( size.x, size.y, size.z, 0.0f );
+				scene.boxObjects.push_back( i );
+				break;
+			}
+			default:
+				scene.objectPrimitives.push_back( (uint32_t)(scene.tori.size() << 2) | Bvh::Torus );
+				scene.tori.emplace_back( center.x, center.y, center.z, Random::Float( seed, 0.2f, 0.5f ) );
+				scene.torusMinorRadii.push_back( Random::Float( seed, 0.05f, 0.15f ) );
+				scene.torusObjects.push_back( i );
+				break;
+		}
+		scene.objectMaterials.push_back( 0 );
+	}
+
+	Material material;
+	material.id = 0;
+	material.emitedLight = Vec3F( 0.0f );
+	for( float& value : material.data )
+	{
+		value = 0.0f;
+	}
+	material.data[0] = material.data[1] = material.data[2] = 0.7f;
+	scene.materials.assign( MAX_OBJECTS, material );
+
+	scene.BuildEmitters();
+	scene.BuildGpuScene();
+	scene.BuildBvh();
+	return scene;
+}
@@ -0,0 +1,102 @@
+#pragma once
+#include "../Utils/Vec4.h"
+#include "Scene.h"
+#include "Bvh.h"
+#include <vector>
+
+using namespace Hydro;
+
+//Layout of the scene in the compute shader constant buffer, must match
+//CompiledScene in RayMarcher.hlsl. Integer arrays are packed four per
+//element because every cbuffer array element takes 16 bytes
+struct GpuScene
+{
+	int sphereCount = 0;
+	int boxCount = 0;
+	int torusCount = 0;
+	int materialCount = 0;
+	Vec4F spheres[MAX_OBJECTS];
+	Vec4F boxCenters[MAX_OBJECTS];
+	Vec4F boxSizes[MAX_OBJECTS];
+	Vec4F tori[MAX_OBJECTS];
+	Vec4F torusMinorRadii[MAX_OBJECTS / 4];
+	Vec4I sphereObjects[MAX_OBJECTS / 4];
+	Vec4I boxObjects[MAX_OBJECTS / 4];
+	Vec4I torusObjects[MAX_OBJECTS / 4];
+	Vec4I objectMaterials[MAX_OBJECTS / 4];
+	//-1 for inactive objects
+	Vec4I objectPrimitives[MAX_OBJECTS / 4];
+	Material materials[MAX_OBJECTS];
+	int emitterCount = 0;
+	float emitterArea = 0.0f;
+	Vec2I padding;
+	Vec4I emitterObjects[MAX_OBJECTS / 4];
+	Vec4F emitterAreaSums[MAX_OBJECTS / 4];
+};
+
+//Editable Scene flattened into packed per-type arrays with inactive objects
+//compacted out, so evaluators loop over each primitive type without a switch.
+//Primitives keep the index of the Scene object they came from
+class CompiledScene
+{
+public:
+	//Recompiles only if the scene differs from the last compiled one
+	bool Update( const Scene& scene );
+	void Compile( const Scene& scene );
+	//Same active objects and materials, what is left over past the counts does not matter
+	static bool SameScene( const Scene& a, const Scene& b );
+	void Clear();
+	//Call all three after filling the primitive arrays by hand, emitters first
+	void BuildEmitters();
+	void BuildGpuScene();
+	void BuildBvh();
+	const GpuScene& GetGpuScene() const { return gpuScene; }
+	//Empty for scenes small enough that the linear loops win
+	const Bvh& GetBvh() const { return bvh; }
+	size_t GetPrimitiveCount() const { return sphereObjects.size() + boxObjects.size() + torusObjects.size(); }
+	const Material& GetObjectMaterial( int objectIndex ) const { return materials[objectMaterials[objectIndex]]; }
+	int GetObjectMaterialIndex( int objectIndex ) const { return objectMaterials[objectIndex]; }
+	//Packed like Bvh primitives, noPrimitive for inactive objects
+	uint32_t GetObjectPrimitive( int objectIndex ) const { return objectPrimitives[objectIndex]; }
+	//Conservative bounds of one primitive, type is a Bvh::PrimitiveType
+	void GetPrimitiveBounds( int type, size_t index, Vec3F& boundsMin, Vec3F& boundsMax ) const;
+	//Spheres and boxes with an emitting material, the ones next event estimation samples.
+	//Emitting tori are only found by paths that hit them
+	bool IsEmitter( int objectIndex ) const;
+	//Surface area of all emitters together, 0 without any
+	float GetEmitterArea() const { return emitterAreaSums.empty() ? 0.0f : emitterAreaSums.back(); }
+	//Random spheres, boxes and tori in [-extent, extent] at constant density, all
+	//using one diffuse material. Not limited to MAX_OBJECTS
+	static CompiledScene RandomPrimitives( int count, uint32_t seed, float& extent );
+public:
+	//Center xyz, radius w
+	std::vector<Vec4F> spheres;
+	std::vector<int> sphereObjects;
+
+	//Center xyz and half extents xyz
+	std::vector<Vec4F> boxCenters;
+	std::vector<Vec4F> boxSizes;
+	std::vector<int> boxObjects;
+
+	//Center xyz and major radius w, minor radius stored separately
+	std::vector<Vec4F> tori;
+	std::vector<float> torusMinorRadii;
+	std::vector<int> torusObjects;
+
+	std::vector<int> objectMaterials;
+	//Per Scene object, type in the low two bits and index into the per-type arrays above them
+	std::vector<uint32_t> objectPrimitives;
+	std::vector<Material> materials;
+
+	//Object index of every emitter and the running sum of the emitter areas up to and
+	//including it, an emitter is picked with the probability of its share of the area
+	std::vector<int> emitterObjects;
+	std::vector<float> emitterAreaSums;
+
+	static constexpr uint32_t noPrimitive = 0xFFFFFFFFu;
+private:
+	bool compiled = false;
+	Scene source;
+	GpuScene gpuScene;
+	Bvh bvh;
+};
@@ -1,21 +1,27 @@
 #include "ComputeShader.h"
 #include "../Win/Texture.h"
-#include "../Utils/Random.h"
+#include "../Utils/HydroTimer.h"
+#include "Scenes.h"
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
 
-ComputeShader::ComputeShader( Graphics& gfx, const std::wstring& path )
+ComputeShader::ComputeShader( Graphics& gfx, D3D11GpuDevice& device, const std::wstring& path )
 	:
 	gfx( gfx ),
+	device( device ),
+	frame( device ),
 	image( 0, 0, nullptr, gfx )
 {
 	//Load shader
 	Microsoft::WRL::ComPtr<ID3DBlob> pBlob;
 	D3DReadFileToBlob( path.c_str(), &pBlob );
-	auto hr = gfx.GetDevice()->CreateComputeShader( pBlob->GetBufferPointer(), pBlob->GetBufferSize(), nullptr, &pComputeShader );
-	assert( SUCCEEDED( hr ) );
+	SetShader( pBlob.Get() );
 
 	//Load skybox
 	SetSkybox( "Src/App/Textures/Skybox.bmp" );
 
+	CreateBlueNoiseBuffer();
 	OnResize( 0, 0 );
 }
 
@@ -26,6 +32,8 @@ void ComputeShader::OnResize( int width, int height )
 		
 	
 	image = Image( width, height, nullptr, gfx );
+	frame.OnResize( width, height );
+	image.SetView( device.GetView( frame.GetTexture() ) );
 
 	//Create output texture
 	D3D11_TEXTURE2D_DESC textureDesc = {};
@@ -47,69 +55,376 @@ void ComputeShader::OnResize( int width, int height )
 	uavDesc.Texture2D.MipSlice = 0;
 	hr = gfx.GetDevice()->CreateUnorderedAccessView( pOutputTexture.Get(), &uavDesc, &pOutputUAV );
 	assert( SUCCEEDED( hr ) );
+
+	//Per pixel accumulation and moments
+	CreateStructuredBuffer( sizeof( float ) * 4, width * height, pAccumulationBuffer, pAccumulationUAV );
+	CreateStructuredBuffer( sizeof( float ), width * height, pMomentsBuffer, pMomentsUAV );
+	CreateStructuredBuffer( sizeof( float ) * 4, width * height, pPrimaryBuffer, pPrimaryUAV );
+	pHistoryAccumulation.Reset();
+	pHistoryMoments.Reset();
+	pHistoryPrimary.Reset();
+
+	//Create counter buffer, raw so the shader can add to it
+	if( !pCounterBuffer )
+	{
+		D3D11_BUFFER_DESC counterDesc = {};
+		counterDesc.ByteWidth = 32;
+		counterDesc.Usage = D3D11_USAGE_DEFAULT;
+		counterDesc.BindFlags = D3D11_BIND_UNORDERED_ACCESS;
+		counterDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_ALLOW_RAW_VIEWS;
+		hr = gfx.GetDevice()->CreateBuffer( &counterDesc, nullptr, &pCounterBuffer );
+		assert( SUCCEEDED( hr ) );
+
+		D3D11_UNORDERED_ACCESS_VIEW_DESC counterUavDesc = {};
+		counterUavDesc.Format = DXGI_FORMAT_R32_TYPELESS;
+		counterUavDesc.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
+		counterUavDesc.Buffer.NumElements = 8;
+		counterUavDesc.Buffer.Flags = D3D11_BUFFER_UAV_FLAG_RAW;
+		hr = gfx.GetDevice()->CreateUnorderedAccessView( pCounterBuffer.Get(), &counterUavDesc, &pCounterUAV );
+		assert( SUCCEEDED( hr ) );
+
+		counterDesc.Usage = D3D11_USAGE_STAGING;
+		counterDesc.BindFlags = 0;
+		counterDesc.MiscFlags = 0;
+		counterDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+		hr = gfx.GetDevice()->CreateBuffer( &counterDesc, nullptr, &pCounterStaging );
+		assert( SUCCEEDED( hr ) );
+	}
+	counterPending = false;
+
+	ConfigureAovs( aovMask );
 }
 
-void ComputeShader::Dispatch( const Camera& camera, const Scene& scene, int renderIterations )
+void ComputeShader::CreateStructuredBuffer( UINT stride, UINT count, Microsoft::WRL::ComPtr<ID3D11Buffer>& pBuffer, Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView>& pUAV )
 {
-	//Set Constant buffer
-	struct ConstantBuffer
-	{
-		Matrix4F inverseProjection;
-		Matrix4F inverseView;
-		Vec3F cameraPosition;
-		float pad = 0.0f;
-		int renderIterations;
-		int pad1[3] = { 0 };
-		unsigned int randomSeed;
-		int pad2[3] = { 0 };
-		Scene scene;
-	};
+	D3D11_BUFFER_DESC bufferDesc = {};
+	bufferDesc.ByteWidth = stride * count;
+	bufferDesc.Usage = D3D11_USAGE_DEFAULT;
+	bufferDesc.BindFlags = D3D11_BIND_UNORDERED_ACCESS;
+	bufferDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+	bufferDesc.StructureByteStride = stride;
+	auto hr = gfx.GetDevice()->CreateBuffer( &bufferDesc, nullptr, &pBuffer );
+	assert( SUCCEEDED( hr ) );
+
+	D3D11_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
+	uavDesc.Format = DXGI_FORMAT_UNKNOWN;
+	uavDesc.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
+	uavDesc.Buffer.NumElements = count;
+	hr = gfx.GetDevice()->CreateUnorderedAccessView( pBuffer.Get(), &uavDesc, &pUAV );
+	assert( SUCCEEDED( hr ) );
+}
+
+void ComputeShader::ConfigureAovs( uint32_t mask )
+{
+	aovMask = mask;
+	pAovBuffer.Reset();
+	pAovUAV.Reset();
+
+	const int pixelCount = image.GetWidth() * image.GetHeight();
+	int floats = 0;
+	for( int i = 0; i < 8; i++ )
+	{
+		aovOffsets[i] = -1;
+		if( i < (int)Aov::Count && (mask & AovBit( (Aov)i )) != 0 && pixelCount > 0 )
+		{
+			aovOffsets[i] = floats;
+			floats += GetAovInfo( (Aov)i ).channels * pixelCount;
+		}
+	}
+
+	if( floats > 0 )
+		CreateStructuredBuffer( sizeof( float ), floats, pAovBuffer, pAovUAV );
+}
+
+void ComputeShader::CreateHistoryBuffer( ID3D11Buffer* pSource, Microsoft::WRL::ComPtr<ID3D11Buffer>& pBuffer, Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>& pSRV )
+{
+	D3D11_BUFFER_DESC bufferDesc;
+	pSource->GetDesc( &bufferDesc );
+	bufferDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+	auto hr = gfx.GetDevice()->CreateBuffer( &bufferDesc, nullptr, &pBuffer );
+	assert( SUCCEEDED( hr ) );
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.Format = DXGI_FORMAT_UNKNOWN;
+	srvDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+	srvDesc.Buffer.NumElements = bufferDesc.ByteWidth / bufferDesc.StructureByteStride;
+	hr = gfx.GetDevice()->CreateShaderResourceView( pBuffer.Get(), &srvDesc, &pSRV );
+	assert( SUCCEEDED( hr ) );
+}
+
+void ComputeShader::CreateBlueNoiseBuffer()
+{
+	const std::vector<uint32_t>& ranks = Sampler::GetBlueNoise();
 
-	ConstantBuffer cb;
-	cb.inverseProjection = camera.GetInverseProjection();
-	cb.inverseView = camera.GetInverseView();
-	cb.cameraPosition = camera.GetPosition();
-	cb.renderIterations = renderIterations;
-	cb.randomSeed = Hydro::Random::UInt();
-	cb.scene = scene;
+	D3D11_BUFFER_DESC bufferDesc = {};
+	bufferDesc.ByteWidth = (UINT)(ranks.size() * sizeof( uint32_t ));
+	bufferDesc.Usage = D3D11_USAGE_IMMUTABLE;
+	bufferDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+	bufferDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+	bufferDesc.StructureByteStride = sizeof( uint32_t );
 
-	D3D11_BUFFER_DESC cbDesc = {};
-	cbDesc.ByteWidth = sizeof( ConstantBuffer );
-	cbDesc.Usage = D3D11_USAGE_DYNAMIC;
-	cbDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
-	cbDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
-	cbDesc.MiscFlags = 0;
-	cbDesc.StructureByteStride = 0;
+	D3D11_SUBRESOURCE_DATA data = {};
+	data.pSysMem = ranks.data();
+	auto hr = gfx.GetDevice()->CreateBuffer( &bufferDesc, &data, &pBlueNoiseBuffer );
+	assert( SUCCEEDED( hr ) );
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.Format = DXGI_FORMAT_UNKNOWN;
+	srvDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+	srvDesc.Buffer.NumElements = (UINT)ranks.size();
+	hr = gfx.GetDevice()->CreateShaderResourceView( pBlueNoiseBuffer.Get(), &srvDesc, &pBlueNoiseSRV );
+	assert( SUCCEEDED( hr ) );
+}
+
+std::vector<float> ComputeShader::ReadBuffer( ID3D11Buffer* pBuffer )
+{
+	D3D11_BUFFER_DESC desc;
+	pBuffer->GetDesc( &desc );
+	desc.Usage = D3D11_USAGE_STAGING;
+	desc.BindFlags = 0;
+	desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
 
-	D3D11_SUBRESOURCE_DATA cbData = {};
-	cbData.pSysMem = &cb;
-	cbData.SysMemPitch = 0;
-	cbData.SysMemSlicePitch = 0;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> pStaging;
+	auto hr = gfx.GetDevice()->CreateBuffer( &desc, nullptr, &pStaging );
+	assert( SUCCEEDED( hr ) );
+	gfx.GetDeviceContext()->CopyResource( pStaging.Get(), pBuffer );
 
-	Microsoft::WRL::ComPtr<ID3D11Buffer> pConstantBuffer;
-	auto hr = gfx.GetDevice()->CreateBuffer( &cbDesc, &cbData, &pConstantBuffer );
+	std::vector<float> data( desc.ByteWidth / sizeof( float ) );
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	hr = gfx.GetDeviceContext()->Map( pStaging.Get(), 0, D3D11_MAP_READ, 0, &mapped );
 	assert( SUCCEEDED( hr ) );
+	std::memcpy( data.data(), mapped.pData, desc.ByteWidth );
+	gfx.GetDeviceContext()->Unmap( pStaging.Get(), 0 );
+	return data;
+}
+
+bool ComputeShader::ExportAovs( const std::string& prefix )
+{
+	const int width = image.GetWidth();
+	const int height = image.GetHeight();
+	if( !pAccumulationBuffer || width == 0 || height == 0 )
+		return false;
+
+	//Sum and sample count per pixel to linear color planes
+	const size_t count = (size_t)width * height;
+	const std::vector<float> accumulation = ReadBuffer( pAccumulationBuffer.Get() );
+	std::vector<float> beauty( count * 3 );
+	for( size_t i = 0; i < count; i++ )
+	{
+		const float samples = (std::max)( accumulation[i * 4 + 3], 1.0f );
+		for( size_t c = 0; c < 3; c++ )
+		{
+			beauty[c * count + i] = accumulation[i * 4 + c] / samples;
+		}
+	}
+	bool written = WritePfm( prefix + "_beauty.pfm", width, height, 3, beauty.data() );
+
+	if( pAovBuffer )
+	{
+		//Same packing as AovBuffers, only the allocation differs
+		const std::vector<float> data = ReadBuffer( pAovBuffer.Get() );
+		AovBuffers aovs;
+		aovs.Configure( aovMask, width, height );
+		for( int i = 0; i < (int)Aov::Count; i++ )
+		{
+			if( aovOffsets[i] >= 0 )
+				std::memcpy( aovs.Get( (Aov)i ), data.data() + aovOffsets[i], GetAovInfo( (Aov)i ).channels * count * sizeof( float ) );
+		}
+		written &= aovs.Export( prefix );
+	}
 
-	gfx.GetDeviceContext()->CSSetConstantBuffers( 0, 1, pConstantBuffer.GetAddressOf() );
+	return written;
+}
+
+void ComputeShader::ReadCallTimes()
+{
+	//In order, the first one still in flight stops the rest
+	while( pendingCallQueries > 0 )
+	{
+		CallQuery& query = callQueries[firstCallQuery];
+		D3D11_QUERY_DATA_TIMESTAMP_DISJOINT disjoint;
+		UINT64 begin = 0;
+		UINT64 end = 0;
+		if( gfx.GetDeviceContext()->GetData( query.pDisjoint.Get(), &disjoint, sizeof( disjoint ), D3D11_ASYNC_GETDATA_DONOTFLUSH ) != S_OK ||
+			gfx.GetDeviceContext()->GetData( query.pBegin.Get(), &begin, sizeof( begin ), D3D11_ASYNC_GETDATA_DONOTFLUSH ) != S_OK ||
+			gfx.GetDeviceContext()->GetData( query.pEnd.Get(), &end, sizeof( end ), D3D11_ASYNC_GETDATA_DONOTFLUSH ) != S_OK )
+			return;
+
+		//The GPU clock changed in between, the timestamps mean nothing
+		if( disjoint.Disjoint || disjoint.Frequency == 0 )
+			frame.SkipGpuTime( query.call );
+		else
+			frame.AddGpuTime( query.call, (float)((double)(end - begin) * 1000.0 / (double)disjoint.Frequency) );
+		firstCallQuery = (firstCallQuery + 1) % callQueryCount;
+		pendingCallQueries--;
+	}
+}
+
+void ComputeShader::ReadCounters()
+{
+	if( !counterPending )
+		return;
+
+	//Still in flight, try again next frame
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	if( gfx.GetDeviceContext()->Map( pCounterStaging.Get(), 0, D3D11_MAP_READ, D3D11_MAP_FLAG_DO_NOT_WAIT, &mapped ) != S_OK )
+		return;
+
+	const uint32_t* counters = (const uint32_t*)mapped.pData;
+	const uint32_t tiles = counters[0];
+	const uint32_t tileSamples = counters[1];
+	const uint32_t pathRays = counters[2];
+	const uint32_t terminatedPaths = counters[3];
+	const uint32_t raysSaved = counters[4];
+	gfx.GetDeviceContext()->Unmap( pCounterStaging.Get(), 0 );
+	counterPending = false;
+
+	//Counters only grow until the image restarts, the difference covers the frames since the last read
+	if( pendingFrames > readFrames && tiles >= readTiles )
+		adaptiveStats.activeTiles = (int)((tiles - readTiles) / (pendingFrames - readFrames));
+	else
+		adaptiveStats.activeTiles = (int)(tiles / (std::max)( pendingFrames, 1u ));
+	//The path counters can wrap within an image, a read from before a restart is the only
+	//way the samples go down
+	if( tileSamples > readTileSamples )
+	{
+		const uint32_t paths = (tileSamples - readTileSamples) * 64u;
+		pathStats.averageLength = (float)(pathRays - readPathRays) / (float)paths;
+		pathStats.terminatedFraction = (float)(terminatedPaths - readTerminatedPaths) / (float)paths;
+		pathStats.raysSaved = (int64_t)((raysSaved - readRaysSaved) / (pendingFrames > readFrames ? pendingFrames - readFrames : 1u));
+	}
+	readTileSamples = tileSamples;
+	readPathRays = pathRays;
+	readTerminatedPaths = terminatedPaths;
+	readRaysSaved = raysSaved;
+	readFrames = pendingFrames;
+	readTiles = tiles;
+
+	adaptiveStats.frameSamples = (int64_t)adaptiveStats.activeTiles * 64 * pendingIterations;
+	adaptiveStats.samplesPerPixel = (float)((double)tileSamples * 64.0 / ((double)image.GetWidth() * image.GetHeight()));
+}
+
+void ComputeShader::SetShader( ID3DBlob* pBlob )
+{
+	pComputeShader.Reset();
+	auto hr = gfx.GetDevice()->CreateComputeShader( pBlob->GetBufferPointer(), pBlob->GetBufferSize(), nullptr, &pComputeShader );
+	assert( SUCCEEDED( hr ) );
+}
+
+bool ComputeShader::Dispatch( const Camera& camera, const CompiledScene& scene, const DispatchSettings& settings )
+{
+	if( settings.aovs != aovMask )
+	{
+		ConfigureAovs( settings.aovs );
+		frame.Cancel();
+	}
+
+	const GpuFrame::Start start = frame.Begin( camera, scene, settings, aovOffsets );
+	if( start.started )
+	{
+		if( start.reproject )
+		{
+			if( !pHistoryAccumulation )
+			{
+				CreateHistoryBuffer( pAccumulationBuffer.Get(), pHistoryAccumulation, pHistoryAccumulationSRV );
+				CreateHistoryBuffer( pMomentsBuffer.Get(), pHistoryMoments, pHistoryMomentsSRV );
+				CreateHistoryBuffer( pPrimaryBuffer.Get(), pHistoryPrimary, pHistoryPrimarySRV );
+			}
+			gfx.GetDeviceContext()->CopyResource( pHistoryAccumulation.Get(), pAccumulationBuffer.Get() );
+			gfx.GetDeviceContext()->CopyResource( pHistoryMoments.Get(), pMomentsBuffer.Get() );
+			gfx.GetDeviceContext()->CopyResource( pHistoryPrimary.Get(), pPrimaryBuffer.Get() );
+		}
+
+		//Only one readback in flight, the counters are totals so nothing is lost in between.
+		//A copy still pending after a restart describes the previous image on its own
+		ReadCounters();
+		adaptiveStats.tileCount = (image.GetWidth() / 8) * (image.GetHeight() / 8);
+		if( start.restart )
+		{
+			const UINT zeros[4] = { 0, 0, 0, 0 };
+			gfx.GetDeviceContext()->ClearUnorderedAccessViewUint( pCounterUAV.Get(), zeros );
+			readFrames = 0;
+			readTiles = 0;
+			readTileSamples = 0;
+			readPathRays = 0;
+			readTerminatedPaths = 0;
+			readRaysSaved = 0;
+		}
+	}
+
+	//Before the tiles are planned, so they use the newest times
+	ReadCallTimes();
+	//A GPU that far behind loses the time of the oldest call, in order like every other
+	if( pendingCallQueries == callQueryCount )
+	{
+		frame.SkipGpuTime( callQueries[firstCallQuery].call );
+		firstCallQuery = (firstCallQuery + 1) % callQueryCount;
+		pendingCallQueries--;
+	}
+	CallQuery& query = callQueries[(firstCallQuery + pendingCallQueries) % callQueryCount];
+	if( !query.pDisjoint )
+	{
+		D3D11_QUERY_DESC queryDesc = {};
+		queryDesc.Query = D3D11_QUERY_TIMESTAMP_DISJOINT;
+		auto hr = gfx.GetDevice()->CreateQuery( &queryDesc, &query.pDisjoint );
+		assert( SUCCEEDED( hr ) );
+		queryDesc.Query = D3D11_QUERY_TIMESTAMP;
+		hr = gfx.GetDevice()->CreateQuery( &queryDesc, &query.pBegin );
+		assert( SUCCEEDED( hr ) );
+		hr = gfx.GetDevice()->CreateQuery( &queryDesc, &query.pEnd );
+		assert( SUCCEEDED( hr ) );
+	}
+
+	ID3D11Buffer* constantBuffers[] = { device.GetBuffer( frame.GetFrameBuffer() ), device.GetBuffer( frame.GetTileBuffer() ), device.GetBuffer( frame.GetSceneBuffer() ) };
+	gfx.GetDeviceContext()->CSSetConstantBuffers( 0, 3, constantBuffers );
 	//Set other resources
 	gfx.GetDeviceContext()->CSSetShader( pComputeShader.Get(), nullptr, 0 );
-	gfx.GetDeviceContext()->CSSetUnorderedAccessViews( 0, 1, pOutputUAV.GetAddressOf(), nullptr );
-	gfx.GetDeviceContext()->CSSetShaderResources( 0, 1, pSkyboxSRV.GetAddressOf() );
-
+	ID3D11UnorderedAccessView* uavs[] = { pOutputUAV.Get(), pAccumulationUAV.Get(), pMomentsUAV.Get(), pCounterUAV.Get(), pAovUAV.Get(), pPrimaryUAV.Get() };
+	gfx.GetDeviceContext()->CSSetUnorderedAccessViews( 0, 6, uavs, nullptr );
+	ID3D11ShaderResourceView* srvs[] = { pSkyboxSRV.Get(), nullptr, nullptr, nullptr, pBlueNoiseSRV.Get() };
+	if( frame.IsReprojecting() )
+	{
+		srvs[1] = pHistoryAccumulationSRV.Get();
+		srvs[2] = pHistoryMomentsSRV.Get();
+		srvs[3] = pHistoryPrimarySRV.Get();
+	}
+	gfx.GetDeviceContext()->CSSetShaderResources( 0, 5, srvs );
 
-	//Dispatch
-	gfx.GetDeviceContext()->Dispatch( image.GetWidth() / 8, image.GetHeight() / 8, 1 );
+	//As many tiles as the time of earlier calls says fit, all of them are submitted at once
+	gfx.GetDeviceContext()->Begin( query.pDisjoint.Get() );
+	gfx.GetDeviceContext()->End( query.pBegin.Get() );
+	const int callTiles = frame.GetCallTiles( settings.timeBudget );
+	GpuFrame::Tile tile;
+	for( int i = 0; i < callTiles && frame.NextTile( tile ); i++ )
+	{
+		gfx.GetDeviceContext()->Dispatch( tile.width / 8, tile.height / 8, 1 );
+	}
+	const GpuFrame::Call call = frame.EndCall();
+	const bool finished = call.finished;
+	gfx.GetDeviceContext()->End( query.pEnd.Get() );
+	gfx.GetDeviceContext()->End( query.pDisjoint.Get() );
+	query.call = call;
+	pendingCallQueries++;
 
 	//Unbind resources
 	gfx.GetDeviceContext()->CSSetShader( nullptr, nullptr, 0 );
-	ID3D11UnorderedAccessView* nullUAV = nullptr;
-	gfx.GetDeviceContext()->CSSetUnorderedAccessViews( 0, 1, &nullUAV, nullptr );
-	ID3D11ShaderResourceView* nullSRV = nullptr;
-	gfx.GetDeviceContext()->CSSetShaderResources( 0, 1, &nullSRV );
+	ID3D11UnorderedAccessView* nullUAVs[] = { nullptr, nullptr, nullptr, nullptr, nullptr, nullptr };
+	gfx.GetDeviceContext()->CSSetUnorderedAccessViews( 0, 6, nullUAVs, nullptr );
+	ID3D11ShaderResourceView* nullSRVs[] = { nullptr, nullptr, nullptr, nullptr, nullptr };
+	gfx.GetDeviceContext()->CSSetShaderResources( 0, 5, nullSRVs );
 
+	if( finished && !counterPending )
+	{
+		gfx.GetDeviceContext()->CopyResource( pCounterStaging.Get(), pCounterBuffer.Get() );
+		counterPending = true;
+		pendingFrames = frame.GetFrameIndex() + 1;
+		pendingIterations = frame.GetFrameIterations();
+	}
 
-	//Copy output texture to image
-	image.SetTexture( pOutputTexture.Get() );
+	//Copy output texture to the one the image shows
+	if( image.Active() )
+		gfx.GetDeviceContext()->CopyResource( device.GetTexture( frame.GetTexture() ), pOutputTexture.Get() );
+	return finished;
 }
 
 void ComputeShader::SetSkybox( const std::string& path )
@@ -154,3 +469,161 @@ void ComputeShader::SetSkybox( const std::string& path )
 
 	gfx.GetDeviceContext()->CSSetSamplers( 0, 1, pSkyboxSampler.GetAddressOf() );
 }
+
+Benchmark::Report ComputeShader::RunPathLoopBenchmark( Graphics& gfx )
+{
+	const int width = 640;
+	const int height = 480;
+	const int frameCount = 20;
+
+	const D3D_SHADER_MACRO loopDefines[] = { { nullptr, nullptr } };
+	const D3D_SHADER_MACRO unrolledDefines[] = { { "UNROLLED_PATH", "1" }, { nullptr, nullptr } };
+	const std::pair<const char*, const D3D_SHADER_MACRO*> kernels[] = {
+		{ "Unrolled RayColor chain", unrolledDefines },
+		{ "Path loop", loopDefines }
+	};
+
+	Camera camera( 90.0f, 0.1f, 100.0f );
+	camera.OnResize( width, height );
+	CompiledScene scene;
+	scene.Compile( Scene_CornellBox() );
+
+	D3D11GpuDevice device( gfx );
+	ComputeShader shader( gfx, device, L"RayMarcher.cso" );
+	shader.OnResize( width, height );
+
+	D3D11_QUERY_DESC queryDesc = {};
+	queryDesc.Query = D3D11_QUERY_EVENT;
+	Microsoft::WRL::ComPtr<ID3D11Query> pQuery;
+	auto hr = gfx.GetDevice()->CreateQuery( &queryDesc, &pQuery );
+	assert( SUCCEEDED( hr ) );
+
+	//Blocks until everything submitted so far has run
+	auto waitForGpu = [&gfx, &pQuery]()
+	{
+		gfx.GetDeviceContext()->End( pQuery.Get() );
+		while( gfx.GetDeviceContext()->GetData( pQuery.Get(), nullptr, 0, 0 ) == S_FALSE )
+		{
+		}
+	};
+
+	Benchmark::Report report;
+	char line[256];
+	snprintf( line, sizeof( line ), "Scene_CornellBox %dx%d, 1 sample, depth 20, %d frames", width, height, frameCount );
+	report.push_back( line );
+
+	for( const auto& [name, defines] : kernels )
+	{
+		Hydro::Timer timer;
+		Microsoft::WRL::ComPtr<ID3DBlob> pBlob;
+		Microsoft::WRL::ComPtr<ID3DBlob> pErrors;
+		hr = D3DCompileFromFile( L"Src/App/RayMarcher.hlsl", defines, D3D_COMPILE_STANDARD_FILE_INCLUDE, "main", "cs_5_0",
+			D3DCOMPILE_OPTIMIZATION_LEVEL3, 0, &pBlob, &pErrors );
+		const float compileSeconds = timer.Mark();
+		if( FAILED( hr ) )
+		{
+			report.push_back( std::string( name ) + ": compile failed" );
+			if( pErrors )
+				report.push_back( std::string( (const char*)pErrors->GetBufferPointer(), pErrors->GetBufferSize() ) );
+			continue;
+		}
+
+		shader.SetShader( pBlob.Get() );
+
+		//First frame includes driver compilation
+		const DispatchSettings settings;
+		shader.Dispatch( camera, scene, settings );
+		waitForGpu();
+
+		timer.Mark();
+		for( int i = 0; i < frameCount; i++ )
+		{
+			shader.Dispatch( camera, scene, settings );
+		}
+		waitForGpu();
+		const float frameSeconds = timer.Mark() / frameCount;
+
+		snprintf( line, sizeof( line ), "%s: %zu bytes bytecode, compiled in %.0fms, %.2fms per frame",
+			name, (size_t)pBlob->GetBufferSize(), compileSeconds * 1000.0f, frameSeconds * 1000.0f );
+		report.push_back( line );
+	}
+
+	return report;
+}
+
+Benchmark::Report ComputeShader::RunTiledDispatchBenchmark( Graphics& gfx )
+{
+	const int width = 1280;
+	const int height = 720;
+	const int frameCount = 8;
+	const float budgets[] = { 0.0f, 16.0f, 8.0f };
+
+	Camera camera( 90.0f, 0.1f, 100.0f );
+	camera.OnResize( width, height );
+	CompiledScene scene;
+	scene.Compile( Scene_CornellBox() );
+
+	D3D11_QUERY_DESC queryDesc = {};
+	queryDesc.Query = D3D11_QUERY_EVENT;
+	Microsoft::WRL::ComPtr<ID3D11Query> pQuery;
+	auto hr = gfx.GetDevice()->CreateQuery( &queryDesc, &pQuery );
+	assert( SUCCEEDED( hr ) );
+
+	//Blocks until everything submitted so far has run
+	auto waitForGpu = [&gfx, &pQuery]()
+	{
+		gfx.GetDeviceContext()->End( pQuery.Get() );
+		while( gfx.GetDeviceContext()->GetData( pQuery.Get(), nullptr, 0, 0 ) == S_FALSE )
+		{
+		}
+	};
+
+	Benchmark::Report report;
+	char line[256];
+	snprintf( line, sizeof( line ), "Scene_CornellBox %dx%d, 16 samples per frame, %d frames, every call waited for like a UI frame would", width, height, frameCount );
+	report.push_back( line );
+
+	D3D11GpuDevice device( gfx );
+	ComputeShader shader( gfx, device, L"RayMarcher.cso" );
+	shader.OnResize( width, height );
+	for( const float budget : budgets )
+	{
+		DispatchSettings settings;
+		settings.renderIterations = 16;
+		settings.timeBudget = budget;
+
+		//First frame includes driver compilation
+		while( !shader.Dispatch( camera, scene, settings ) )
+		{
+		}
+		waitForGpu();
+
+		Hydro::Timer timer;
+		float longestCall = 0.0f;
+		int calls = 0;
+		for( int frame = 1; frame <= frameCount; frame++ )
+		{
+			settings.frameIndex = (uint32_t)frame;
+			bool finished = false;
+			while( !finished )
+			{
+				Hydro::Timer callTimer;
+				finished = shader.Dispatch( camera, scene, settings );
+				waitForGpu();
+				longestCall = (std::max)( longestCall, callTimer.Mark() * 1000.0f );
+				calls++;
+			}
+		}
+		const float frameTime = timer.Mark() * 1000.0f / frameCount;
+
+		//GPU time of the last frame whose calls were all read back
+		if( budget > 0.0f )
+			snprintf( line, sizeof( line ), "%.0fms budget, %d pixel tiles: %.2fms per frame over %.1f calls, longest call %.2fms, %.2fms GPU per frame",
+				budget, settings.tileSize, frameTime, (float)calls / frameCount, longestCall, shader.GetFrameTime() );
+		else
+			snprintf( line, sizeof( line ), "Whole frame: %.2fms per frame, longest call %.2fms, %.2fms GPU per frame", frameTime, longestCall, shader.GetFrameTime() );
+		report.push_back( line );
+	}
+
+	return report;
+}
@@ -3,27 +3,142 @@
 #include <string>
 #include "../Win/Image.h"
 #include "Camera.h"
-#include "Scene.h"
+#include "CompiledScene.h"
+#include "Benchmark.h"
+#include "AdaptiveSampling.h"
+#include "Aov.h"
+#include "Sampler.h"
+#include "RussianRoulette.h"
+#include "D3D11GpuDevice.h"
+#include "GpuFrame.h"
+#include "../Utils/Vec2.h"
+#include <vector>
 
 using namespace Hydro;
 
 class ComputeShader
 {
 public:
-	ComputeShader( Graphics& gfx, const std::wstring& path );
+	using DispatchSettings = GpuFrame::DispatchSettings;
+	using TileStats = GpuFrame::TileStats;
+public:
+	//Buffers and textures kept from frame to frame are created on device
+	ComputeShader( Graphics& gfx, D3D11GpuDevice& device, const std::wstring& path );
 	Image& GetImage() { return image; }
 	void OnResize( int width, int height );
-	void Dispatch( const Camera& camera, const Scene& scene, int renderIterations );
+	//Submits as many tiles of the frame as the GPU time of earlier calls says fit in the
+	//budget and returns true once all of them are done. Never waits for the GPU. A frame in
+	//progress goes on as long as the camera stays the same, the finished tiles are in the image right away
+	bool Dispatch( const Camera& camera, const CompiledScene& scene, const DispatchSettings& settings );
+	//The next Dispatch starts a new frame, for changes it cannot see itself like the scene
+	void CancelFrame() { frame.Cancel(); }
 	void SetSkybox( const std::string& path );
+	void SetShader( ID3DBlob* pBlob );
+	//Active tiles are read back without stalling, so they lag a frame or two behind
+	const AdaptiveSamplingStats& GetAdaptiveStats() const { return adaptiveStats; }
+	//Read back with the tile counters, averaged over the frames since the last read
+	const PathStats& GetPathStats() const { return pathStats; }
+	const TileStats& GetTileStats() const { return frame.GetTileStats(); }
+	//Milliseconds of GPU time of the last finished frame over all its calls, read back a few
+	//calls late. GetFramesTimed goes up whenever it changes
+	float GetFrameTime() const { return frame.GetFrameTime(); }
+	uint32_t GetFramesTimed() const { return frame.GetFramesTimed(); }
+	//Reads the accumulation and the AOVs back and writes the linear beauty image and
+	//every enabled AOV as <prefix>_<name>.pfm. Waits for the GPU
+	bool ExportAovs( const std::string& prefix );
+	//Compiles RayMarcher.hlsl with the path loop and with the old unrolled chain and
+	//compares bytecode size and frame time on the Cornell box
+	static Benchmark::Report RunPathLoopBenchmark( Graphics& gfx );
+	//Longest call and calls per frame of time-sliced frames against whole ones
+	static Benchmark::Report RunTiledDispatchBenchmark( Graphics& gfx );
+private:
+	void CreateStructuredBuffer( UINT stride, UINT count, Microsoft::WRL::ComPtr<ID3D11Buffer>& pBuffer, Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView>& pUAV );
+	void ReadCounters();
+	//Hands the GPU time of every call read back since the last time to the frame, oldest first
+	void ReadCallTimes();
+	//Packs the enabled AOVs one after another in a single buffer, u4 only has room for one
+	void ConfigureAovs( uint32_t mask );
+	//Blocking copy of a GPU buffer to system memory
+	std::vector<float> ReadBuffer( ID3D11Buffer* pBuffer );
+	//Buffer of the same size the source can be copied to, read by the shader
+	void CreateHistoryBuffer( ID3D11Buffer* pSource, Microsoft::WRL::ComPtr<ID3D11Buffer>& pBuffer, Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>& pSRV );
+	//Copy of Sampler::GetBlueNoise for the blue-noise sampler
+	void CreateBlueNoiseBuffer();
 private:
 	Graphics& gfx;
+	D3D11GpuDevice& device;
+	//Constants, tiles and the shown texture of the frame in progress
+	GpuFrame frame;
 	Image image;
 	Microsoft::WRL::ComPtr<ID3D11ComputeShader> pComputeShader;
 
+	//Timestamps around the tiles of one call, read back without waiting some calls later
+	struct CallQuery
+	{
+		Microsoft::WRL::ComPtr<ID3D11Query> pDisjoint;
+		Microsoft::WRL::ComPtr<ID3D11Query> pBegin;
+		Microsoft::WRL::ComPtr<ID3D11Query> pEnd;
+		GpuFrame::Call call;
+	};
+	//Calls in flight at most, the oldest loses its time when another one is made
+	static constexpr int callQueryCount = 8;
+	CallQuery callQueries[callQueryCount];
+	//Oldest call in flight and how many are
+	int firstCallQuery = 0;
+	int pendingCallQueries = 0;
+
 	Microsoft::WRL::ComPtr<ID3D11Texture2D> pOutputTexture;
 	Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> pOutputUAV;
 
+	//Linear color sum in rgb and the sample count in a
+	Microsoft::WRL::ComPtr<ID3D11Buffer> pAccumulationBuffer;
+	Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> pAccumulationUAV;
+
+	//Sum of squared luminance per pixel for the error estimate
+	Microsoft::WRL::ComPtr<ID3D11Buffer> pMomentsBuffer;
+	Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> pMomentsUAV;
+
+	//Active tile counters of the current image and a copy of them the CPU can map
+	Microsoft::WRL::ComPtr<ID3D11Buffer> pCounterBuffer;
+	Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> pCounterUAV;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> pCounterStaging;
+	bool counterPending = false;
+	//Frames the pending copy covers and the ones the last read did
+	uint32_t pendingFrames = 0;
+	int pendingIterations = 0;
+	uint32_t readFrames = 0;
+	uint32_t readTiles = 0;
+	AdaptiveSamplingStats adaptiveStats;
+	//Path counters of the last read, they wrap around so only differences are used
+	uint32_t readTileSamples = 0;
+	uint32_t readPathRays = 0;
+	uint32_t readTerminatedPaths = 0;
+	uint32_t readRaysSaved = 0;
+	PathStats pathStats;
+
+	//Null while no AOV is enabled
+	Microsoft::WRL::ComPtr<ID3D11Buffer> pAovBuffer;
+	Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> pAovUAV;
+	uint32_t aovMask = 0;
+	//First float of every AOV in the buffer, -1 when disabled
+	int aovOffsets[8] = { -1, -1, -1, -1, -1, -1, -1, -1 };
+
+	//Unjittered first hit of every pixel, normal and depth
+	Microsoft::WRL::ComPtr<ID3D11Buffer> pPrimaryBuffer;
+	Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> pPrimaryUAV;
+
+	//Copies of the buffers above taken when the camera moves, created on the first move
+	Microsoft::WRL::ComPtr<ID3D11Buffer> pHistoryAccumulation;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> pHistoryAccumulationSRV;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> pHistoryMoments;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> pHistoryMomentsSRV;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> pHistoryPrimary;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> pHistoryPrimarySRV;
+
 	Microsoft::WRL::ComPtr<ID3D11Texture2D> pSkyboxTexture;
 	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> pSkyboxSRV;
 	Microsoft::WRL::ComPtr<ID3D11SamplerState> pSkyboxSampler;
+
+	Microsoft::WRL::ComPtr<ID3D11Buffer> pBlueNoiseBuffer;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> pBlueNoiseSRV;
 };
\ No newline at end of file
@@ -0,0 +1,2374 @@
+#include "CpuRayMarcher.h"
+#include "SignedDistance.h"
+#include "Scenes.h"
+#include "../Utils/Random.h"
+#include "../Utils/HydroTimer.h"
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <tuple>
+#include <thread>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+
+namespace
+{
+	constexpr float PI = 3.14159265f;
+
+	Vec3F Refract( Vec3F uv, Vec3F n, float etaiOverEtat )
+	{
+		float cosTheta = std::fmin( Vec3F::Dot( -uv, n ), 1.0f );
+		Vec3F rOutPerp = (uv + n * cosTheta) * etaiOverEtat;
+		float perpLength = rOutPerp.Magnitude();
+		Vec3F rOutParallel = n * -std::sqrt( std::abs( 1.0f - perpLength * perpLength ) );
+		return rOutPerp + rOutParallel;
+	}
+
+	Vec3F Emitted( const Material& material )
+	{
+		return material.emitedLight * material.data[15];
+	}
+
+	//u are the two numbers of the bounce, the dielectric only needs the first
+	bool Scatter( const Material& material, const Ray& rayIn, const HitPayload& hit, Vec3F& attenuation, Ray& scattered, Vec2F u )
+	{
+		switch( material.id )
+		{
+			//Diffuse
+			case 0:
+			{
+				//Unit length, the march steps by the distance times the direction length and
+				//longer ones tunnel through thin objects
+				const Vec3F scatterDirection = Sampler::CosineHemisphere( hit.WorldNormal, u );
+				scattered.Origin = hit.WorldPosition + scatterDirection * 0.001f;
+				scattered.Direction = scatterDirection;
+
+				attenuation = Vec3F( material.data[0], material.data[1], material.data[2] );
+				return true;
+			}
+			//Metal
+			case 1:
+			{
+				Vec3F reflected = Vec3F::Reflect( Vec3F( rayIn.Direction ).Normalized(), hit.WorldNormal );
+				scattered.Origin = hit.WorldPosition + reflected * 0.001f;
+				scattered.Direction = (reflected + Sampler::UniformSphere( u ) * material.data[3]).Normalized();
+
+				attenuation = Vec3F( material.data[0], material.data[1], material.data[2] );
+				return Vec3F::Dot( scattered.Direction, hit.WorldNormal ) > 0.0f;
+			}
+			//Dielectric
+			case 2:
+			{
+				attenuation = Vec3F( 1.0f, 1.0f, 1.0f );
+				float refractionRatio = hit.HitDistance > 0.0f ? (1.0f / material.data[0]) : material.data[0];
+
+				Vec3F unitDirection = Vec3F( rayIn.Direction ).Normalized();
+
+				float cosTheta = std::fmin( Vec3F::Dot( -unitDirection, hit.WorldNormal ), 1.0f );
+				float sinTheta = std::sqrt( 1.0f - cosTheta * cosTheta );
+
+				bool cannotRefract = refractionRatio * sinTheta > 1.0f;
+
+				float r0 = (1.0f - refractionRatio) / (1.0f + refractionRatio);
+				r0 = r0 * r0;
+				float r1 = r0 + (1.0f - r0) * std::pow( 1.0f - cosTheta, 5.0f );
+
+				Vec3F direction;
+				if( cannotRefract || r1 > u.x )
+					direction = Vec3F::Reflect( unitDirection, hit.WorldNormal );
+				else
+					direction = Refract( unitDirection, hit.WorldNormal, refractionRatio );
+
+				scattered.Origin = hit.WorldPosition + direction * 0.001f;
+				scattered.Direction = direction;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	//Rougher metals than this are treated as glossy and sample the emitters
+	constexpr float minLightSampleRoughness = 0.01f;
+
+	//Materials next event estimation runs at, the others reflect in a single direction
+	bool SamplesEmitters( const Material& material )
+	{
+		return material.id == 0 || (material.id == 1 && material.data[3] > minLightSampleRoughness);
+	}
+
+	//The points reflected + roughness * UnitVector are uniform on a sphere around the mirror
+	//direction, a direction crosses that sphere once or twice and every crossing adds the
+	//density of the sphere surface over the solid angle. Directions are normalized
+	float MetalPdf( Vec3F reflected, float roughness, Vec3F direction )
+	{
+		const float b = Vec3F::Dot( direction, reflected );
+		const float discriminant = b * b - (1.0f - roughness * roughness);
+		if( !(discriminant > 0.0f) )
+			return 0.0f;
+
+		const float root = std::sqrt( discriminant );
+		const float farDistance = b + root;
+		const float nearDistance = b - root;
+		if( farDistance <= 0.0f )
+			return 0.0f;
+
+		const float distances = farDistance * farDistance + (nearDistance > 0.0f ? nearDistance * nearDistance : 0.0f);
+		return distances / (4.0f * PI * roughness * root);
+	}
+
+	//Density over the solid angle of Scatter picking direction, 0 for materials that do not
+	//sample the emitters. For those that do the attenuation is the albedo, so the BSDF
+	//times the cosine is the albedo times this
+	float ScatterPdf( const Material& material, Vec3F rayDirection, Vec3F normal, Vec3F direction )
+	{
+		const float cosine = Vec3F::Dot( normal, direction );
+		if( !SamplesEmitters( material ) || cosine <= 0.0f )
+			return 0.0f;
+
+		if( material.id == 0 )
+			return cosine / PI;
+
+		return MetalPdf( Vec3F::Reflect( rayDirection.Normalized(), normal ), material.data[3], direction );
+	}
+
+	//Power heuristic weight of the technique with density pdf against the other one
+	float PowerHeuristic( float pdf, float otherPdf )
+	{
+		return pdf * pdf / (pdf * pdf + otherPdf * otherPdf);
+	}
+
+	uint32_t ToUNorm8( float value )
+	{
+		//Same conversion as a write to a R8G8B8A8_UNORM UAV
+		if( !(value > 0.0f) )
+			return 0u;
+		if( value >= 1.0f )
+			return 255u;
+		return (uint32_t)(value * 255.0f + 0.5f);
+	}
+
+	//Root mean square difference of two images in 8 bit gamma space
+	double RmsError( const std::vector<uint32_t>& pixels, const std::vector<uint32_t>& reference )
+	{
+		double sum = 0.0;
+		for( size_t i = 0; i < pixels.size(); i++ )
+		{
+			for( uint32_t shift = 0; shift < 24; shift += 8 )
+			{
+				const double d = (double)((pixels[i] >> shift) & 0xFFu) - (double)((reference[i] >> shift) & 0xFFu);
+				sum += d * d;
+			}
+		}
+		return std::sqrt( sum / (double)(pixels.size() * 3) );
+	}
+
+	//RmsError of the difference blurred by a 3x3 box, the error that is left once the eye
+	//averages neighbouring pixels. Noise at high frequencies is mostly removed by the blur
+	double BlurredRmsError( const std::vector<uint32_t>& pixels, const std::vector<uint32_t>& reference, int width, int height )
+	{
+		double sum = 0.0;
+		for( int y = 0; y < height; y++ )
+		{
+			for( int x = 0; x < width; x++ )
+			{
+				for( uint32_t shift = 0; shift < 24; shift += 8 )
+				{
+					double d = 0.0;
+					int taps = 0;
+					for( int ty = (std::max)( y - 1, 0 ); ty <= (std::min)( y + 1, height - 1 ); ty++ )
+					{
+						for( int tx = (std::max)( x - 1, 0 ); tx <= (std::min)( x + 1, width - 1 ); tx++ )
+						{
+							const size_t i = (size_t)ty * width + tx;
+							d += (double)((pixels[i] >> shift) & 0xFFu) - (double)((reference[i] >> shift) & 0xFFu);
+							taps++;
+						}
+					}
+					d /= taps;
+					sum += d * d;
+				}
+			}
+		}
+		return std::sqrt( sum / ((double)width * height * 3) );
+	}
+
+	//Samples a plain accumulation needs for error, log-log interpolated between the measured
+	//power of two counts. 0 if even the first count is better, -1 if the last one is worse
+	double EquivalentSamples( const std::vector<int>& samples, const std::vector<double>& plainErrors, double error )
+	{
+		if( plainErrors[0] < error )
+			return 0.0;
+
+		for( size_t j = 0; j + 1 < samples.size(); j++ )
+		{
+			if( plainErrors[j] >= error && plainErrors[j + 1] <= error )
+			{
+				const double t = std::log( plainErrors[j] / error ) / std::log( plainErrors[j] / plainErrors[j + 1] );
+				return samples[j] * std::pow( 2.0, std::isfinite( t ) ? t : 0.0 );
+			}
+		}
+		return -1.0;
+	}
+
+	//Linear to gamma
+	uint32_t ToPixel( Vec3F color )
+	{
+		return
+			ToUNorm8( std::sqrt( color.x ) ) |
+			(ToUNorm8( std::sqrt( color.y ) ) << 8u) |
+			(ToUNorm8( std::sqrt( color.z ) ) << 16u) |
+			(255u << 24u);
+	}
+}
+
+CpuRayMarcher::CpuRayMarcher()
+	:
+	threadCount( std::thread::hardware_concurrency() )
+{
+	if( threadCount == 0 )
+		threadCount = 1;
+	pJobs = std::make_unique<Hydro::JobSystem>( threadCount - 1 );
+}
+
+void CpuRayMarcher::OnResize( int width, int height )
+{
+	if( (width == this->width && height == this->height) || width == 0 || height == 0 )
+		return;
+
+	this->width = width;
+	this->height = height;
+	pixels.assign( (size_t)width * height, 0u );
+	accumulation.assign( (size_t)width * height, Vec3F( 0.0f ) );
+	luminanceSquares.assign( (size_t)width * height, 0.0f );
+	sampleCounts.assign( (size_t)width * height, 0.0f );
+	history = History();
+	primaryValid = false;
+	denoiser.OnResize( width, height );
+	ConfigureAovs( aovs.GetMask() );
+
+	tilesX = (width + tileSize - 1) / tileSize;
+	tilesY = (height + tileSize - 1) / tileSize;
+	tileSamples.assign( (size_t)tilesX * tilesY, 0 );
+	tileErrors.assign( (size_t)tilesX * tilesY, 0.0f );
+}
+
+void CpuRayMarcher::SetSkybox( const std::string& path )
+{
+	pSkybox = std::make_unique<Texture>( path );
+}
+
+bool CpuRayMarcher::ExportAovs( const std::string& prefix ) const
+{
+	if( width == 0 || height == 0 )
+		return false;
+
+	const size_t count = (size_t)width * height;
+	std::vector<float> beauty( count * 3 );
+	for( int y = 0; y < height; y++ )
+	{
+		for( int x = 0; x < width; x++ )
+		{
+			const size_t index = (size_t)y * width + x;
+			const Vec3F color = accumulation[index] / (std::max)( sampleCounts[index], 1.0f );
+			beauty[index] = color.x;
+			beauty[count + index] = color.y;
+			beauty[2 * count + index] = color.z;
+		}
+	}
+
+	const bool written = WritePfm( prefix + "_beauty.pfm", width, height, 3, beauty.data() );
+	return aovs.Export( prefix ) && written;
+}
+
+void CpuRayMarcher::ConfigureAovs( uint32_t mask )
+{
+	aovs.Configure( mask, width, height );
+	denoiser.GetInput().albedo = aovs.Get( Aov::Albedo );
+	denoiser.GetInput().normal = aovs.Get( Aov::Normal );
+	denoiser.GetInput().depth = aovs.Get( Aov::Depth );
+}
+
+bool CpuRayMarcher::Dispatch( const Camera& camera, const CompiledScene& scene, int renderIterations, const DistanceCache* pDistanceCache,
+	uint32_t frameIndex, const CancellationToken& cancel )
+{
+	if( width == 0 || height == 0 )
+		return true;
+
+	const Matrix4F viewProjection = camera.GetProjection() * camera.GetView();
+	const bool moved = frameIndex != 0 && !(viewProjection == history.viewProjection);
+	const bool reproject = moved && settings.reprojection && primaryValid;
+
+	if( frameIndex == 0 || (moved && settings.reprojection && !reproject) )
+	{
+		std::fill( accumulation.begin(), accumulation.end(), Vec3F( 0.0f ) );
+		std::fill( luminanceSquares.begin(), luminanceSquares.end(), 0.0f );
+		std::fill( sampleCounts.begin(), sampleCounts.end(), 0.0f );
+		std::fill( tileSamples.begin(), tileSamples.end(), 0 );
+		imageSeed = Random::UInt();
+
+		//A new mask only takes effect with a new image, so the means cover every sample
+		ConfigureAovs( settings.aovs | (settings.denoise ? Denoiser::requiredAovs : 0u) );
+	}
+
+	reprojectionStats = ReprojectionStats();
+	if( reproject )
+	{
+		//The old image becomes the history and every pixel of the new one is written from scratch
+		const size_t count = (size_t)width * height;
+		std::swap( accumulation, history.accumulation );
+		std::swap( luminanceSquares, history.luminanceSquares );
+		std::swap( sampleCounts, history.sampleCounts );
+		std::swap( primaryDepth, history.primaryDepth );
+		std::swap( primaryNormal, history.primaryNormal );
+		accumulation.resize( count );
+		luminanceSquares.resize( count );
+		sampleCounts.resize( count );
+		std::fill( tileSamples.begin(), tileSamples.end(), 0 );
+		//The sample indices start over as well
+		imageSeed = Random::UInt();
+		reprojectionStats.active = true;
+	}
+
+	DispatchData data = MakeDispatchData( camera, scene, renderIterations, pDistanceCache );
+	data.reproject = reproject;
+	data.cancel = cancel;
+	//A camera that stands still keeps the primary hits of the image start
+	data.tracePrimary = settings.reprojection && (frameIndex == 0 || moved);
+	if( data.tracePrimary )
+	{
+		primaryDepth.resize( (size_t)width * height );
+		primaryNormal.resize( (size_t)width * height );
+	}
+	primaryValid = data.tracePrimary || (primaryValid && settings.reprojection && !moved);
+
+	//Every worker counts on its own and they are merged at the end
+	std::vector<WorkerStats> workerStats( threadCount );
+
+	prepassStats = PrepassStats();
+	if( settings.conePrepass )
+	{
+		Hydro::Timer timer;
+		ConePrepass( data, workerStats );
+		prepassStats.time = timer.Mark() * 1000.0f;
+	}
+
+	//Converged tiles keep their pixels and get no more samples
+	std::vector<int> activeTiles;
+	adaptiveStats.frameSamples = 0;
+	for( int tile = 0; tile < tilesX * tilesY; tile++ )
+	{
+		if( reproject || !settings.adaptiveSampling || tileSamples[tile] < settings.minSamples || tileErrors[tile] > settings.errorThreshold )
+		{
+			activeTiles.push_back( tile );
+			const int x0 = (tile % tilesX) * tileSize;
+			const int y0 = (tile / tilesX) * tileSize;
+			adaptiveStats.frameSamples += (int64_t)((std::min)( x0 + tileSize, width ) - x0) * ((std::min)( y0 + tileSize, height ) - y0) * renderIterations;
+		}
+	}
+
+	wavefrontStats = WavefrontStats();
+	if( settings.wavefront )
+	{
+		RenderWavefront( data, activeTiles, workerStats );
+	}
+	else
+	{
+		//Hand out tiles to every core until none are left
+		ParallelFor( (int)activeTiles.size(), [&]( int index, unsigned int worker )
+		{
+			RenderTile( data, activeTiles[index], workerStats[worker] );
+		} );
+	}
+
+	if( cancel.IsCancelled() )
+	{
+		//Some tiles have the new samples and some not, nothing to reproject from either
+		primaryValid = false;
+		cancelStats = CancelStats();
+		for( const WorkerStats& stats : workerStats )
+		{
+			cancelStats.samplesTraced += stats.paths;
+		}
+		cancelStats.samplesSkipped = (std::max)( adaptiveStats.frameSamples - cancelStats.samplesTraced, (int64_t)0 );
+		return false;
+	}
+
+	adaptiveStats.tileCount = tilesX * tilesY;
+	adaptiveStats.activeTiles = (int)activeTiles.size();
+	double samples = 0.0;
+	for( const float count : sampleCounts )
+	{
+		samples += count;
+	}
+	adaptiveStats.samplesPerPixel = (float)(samples / ((double)width * height));
+
+	if( settings.denoise && (aovs.GetMask() & Denoiser::requiredAovs) == Denoiser::requiredAovs )
+	{
+		denoiser.Denoise( *pJobs );
+		ParallelFor( height, [this]( int y, unsigned int )
+		{
+			for( size_t index = (size_t)y * width; index < (size_t)(y + 1) * width; index++ )
+			{
+				pixels[index] = ToPixel( denoiser.GetColor( index ) );
+			}
+		} );
+		pixelsDenoised = true;
+	}
+	else if( pixelsDenoised )
+	{
+		//Converged tiles still show the denoised image
+		ParallelFor( height, [this]( int y, unsigned int )
+		{
+			for( int x = 0; x < width; x++ )
+			{
+				const size_t index = (size_t)y * width + x;
+				pixels[index] = ToPixel( accumulation[index] * (1.0f / (std::max)( sampleCounts[index], 1.0f )) );
+			}
+		} );
+		pixelsDenoised = false;
+	}
+
+	stepHistogram.Clear();
+	int64_t paths = 0;
+	int64_t pathRays = 0;
+	int64_t terminatedPaths = 0;
+	pathStats = PathStats();
+	for( const WorkerStats& stats : workerStats )
+	{
+		paths += stats.paths;
+		pathRays += stats.pathRays;
+		terminatedPaths += stats.terminatedPaths;
+		pathStats.raysSaved += stats.raysSaved;
+		stepHistogram.Merge( stats.steps );
+		prepassStats.primarySteps += stats.primarySteps;
+		prepassStats.coneSteps += stats.coneSteps;
+		prepassStats.stepsSaved += stats.stepsSaved;
+		reprojectionStats.historyFraction += (float)stats.reprojectedPixels;
+	}
+	reprojectionStats.historyFraction /= (float)width * height;
+	if( paths > 0 )
+	{
+		pathStats.averageLength = (float)((double)pathRays / (double)paths);
+		pathStats.terminatedFraction = (float)((double)terminatedPaths / (double)paths);
+	}
+
+	history.viewProjection = viewProjection;
+	history.cameraPosition = camera.GetPosition();
+	return true;
+}
+
+bool CpuRayMarcher::DispatchPreview( const Camera& camera, const CompiledScene& scene, int blockSize, const DistanceCache* pDistanceCache,
+	const CancellationToken& cancel )
+{
+	if( width == 0 || height == 0 )
+		return true;
+
+	const DispatchData data = MakeDispatchData( camera, scene, 1, pDistanceCache );
+	const int blocksX = (width + blockSize - 1) / blockSize;
+	const int blocksY = (height + blockSize - 1) / blockSize;
+	std::vector<Vec3F> blockColors( (size_t)blocksX * blocksY );
+	std::vector<float> blockDepths( (size_t)blocksX * blocksY );
+	std::vector<WorkerStats> workerStats( threadCount );
+
+	//One path through the pixel at the center of every block
+	ParallelFor( blocksY, [&]( int by, unsigned int worker )
+	{
+		if( cancel.IsCancelled() )
+			return;
+		for( int bx = 0; bx < blocksX; bx++ )
+		{
+			const int x = (std::min)( bx * blockSize + blockSize / 2, width - 1 );
+			const int y = (std::min)( by * blockSize + blockSize / 2, height - 1 );
+			PathState path = StartPath( data, x, y, 0u, workerStats[worker] );
+			RayColor( data, path, workerStats[worker] );
+			blockColors[(size_t)by * blocksX + bx] = path.samples.color;
+			blockDepths[(size_t)by * blocksX + bx] = path.samples.depth;
+		}
+	} );
+
+	if( cancel.IsCancelled() )
+	{
+		cancelStats = CancelStats();
+		for( const WorkerStats& stats : workerStats )
+		{
+			cancelStats.samplesTraced += stats.paths;
+		}
+		cancelStats.samplesSkipped = (int64_t)blocksX * blocksY - cancelStats.samplesTraced;
+		return false;
+	}
+
+	ParallelFor( height, [&]( int y, unsigned int )
+	{
+		const int by = y / blockSize;
+		for( int x = 0; x < width; x++ )
+		{
+			const int bx = x / blockSize;
+			const size_t block = (size_t)by * blocksX + bx;
+			if( !settings.edgeAwarePreview || blockSize == 1 )
+			{
+				pixels[(size_t)y * width + x] = ToPixel( blockColors[block] );
+				continue;
+			}
+
+			//Bilinear between the four closest block centers, leaving out the ones whose
+			//surface is at another depth than the one of the own block so edges stay sharp
+			const float fx = (std::max)( ((float)x + 0.5f) / blockSize - 0.5f, 0.0f );
+			const float fy = (std::max)( ((float)y + 0.5f) / blockSize - 0.5f, 0.0f );
+			const int cx = (std::min)( (int)fx, blocksX - 1 );
+			const int cy = (std::min)( (int)fy, blocksY - 1 );
+			const float tx = fx - (float)cx;
+			const float ty = fy - (float)cy;
+			const float depth = blockDepths[block];
+			Vec3F color( 0.0f );
+			float weightSum = 0.0f;
+			for( int j = 0; j < 2; j++ )
+			{
+				for( int i = 0; i < 2; i++ )
+				{
+					const size_t tap = (size_t)(std::min)( cy + j, blocksY - 1 ) * blocksX + (std::min)( cx + i, blocksX - 1 );
+					if( std::abs( blockDepths[tap] - depth ) > previewDepthTolerance * depth )
+						continue;
+					const float weight = (i ? tx : 1.0f - tx) * (j ? ty : 1.0f - ty);
+					color += blockColors[tap] * weight;
+					weightSum += weight;
+				}
+			}
+			pixels[(size_t)y * width + x] = ToPixel( weightSum > 0.0f ? color / weightSum : blockColors[block] );
+		}
+	} );
+	return true;
+}
+
+CpuRayMarcher::DispatchData CpuRayMarcher::MakeDispatchData( const Camera& camera, const CompiledScene& scene, int renderIterations, const DistanceCache* pDistanceCache ) const
+{
+	DispatchData data;
+	data.inverseProjection = camera.GetInverseProjection();
+	data.inverseView = camera.GetInverseView();
+	data.cameraPosition = camera.GetPosition();
+	data.renderIterations = renderIterations;
+	data.randomSeed = imageSeed;
+	data.sampler = settings.sampler;
+	data.scene = &scene;
+	data.distanceCache = pDistanceCache;
+	data.trace.relaxation = settings.relaxation;
+	data.startDistances = nullptr;
+	data.analyticNormals = settings.analyticNormals;
+	data.maxDepth = settings.maxDepth;
+	data.rouletteMinDepth = settings.russianRoulette ? (std::max)( settings.rouletteMinDepth, 1 ) : settings.maxDepth;
+	data.nextEventEstimation = settings.nextEventEstimation;
+	data.reproject = false;
+	data.tracePrimary = false;
+	return data;
+}
+
+template<typename F>
+void CpuRayMarcher::ParallelFor( int count, F&& function ) const
+{
+	//The workers stay alive between calls, starting threads for every loop cost more than
+	//the smaller loops themselves
+	pJobs->ParallelFor( count, std::forward<F>( function ) );
+}
+
+void CpuRayMarcher::ConePrepass( DispatchData& data, std::vector<WorkerStats>& workerStats )
+{
+	const int coarseX = (width + coarseBlockSize - 1) / coarseBlockSize;
+	const int coarseY = (height + coarseBlockSize - 1) / coarseBlockSize;
+	const int fineX = (width + fineBlockSize - 1) / fineBlockSize;
+	const int fineY = (height + fineBlockSize - 1) / fineBlockSize;
+	coarseDistances.assign( (size_t)coarseX * coarseY, 0.0f );
+	fineDistances.assign( (size_t)fineX * fineY, 0.0f );
+
+	//Nothing around the camera is empty, march every pixel from the start
+	if( SceneDistance( data, data.cameraPosition ) <= 0.0f )
+	{
+		prepassStats.cameraInside = true;
+		return;
+	}
+
+	ParallelFor( coarseX * coarseY, [&]( int block, unsigned int worker )
+	{
+		int steps = 0;
+		coarseDistances[block] = ConeMarch( data, (block % coarseX) * coarseBlockSize, (block / coarseX) * coarseBlockSize, coarseBlockSize, 0.0f, steps );
+		workerStats[worker].coneSteps += steps;
+	} );
+
+	//Fine blocks continue from their coarse parent, every ray of them is a ray of the parent
+	const int scale = coarseBlockSize / fineBlockSize;
+	ParallelFor( fineX * fineY, [&]( int block, unsigned int worker )
+	{
+		const int x0 = (block % fineX) * fineBlockSize;
+		const int y0 = (block / fineX) * fineBlockSize;
+		const float parent = coarseDistances[(block / fineX / scale) * coarseX + (block % fineX) / scale];
+
+		int steps = 0;
+		const float t = ConeMarch( data, x0, y0, fineBlockSize, parent, steps );
+		fineDistances[block] = t;
+
+		//Plain march of the block center up to t for the saved steps stat
+		const Vec3F direction = PrimaryDirection( data, (std::min)( x0 + fineBlockSize / 2, width - 1 ), (std::min)( y0 + fineBlockSize / 2, height - 1 ) );
+		int64_t skipped = 0;
+		for( float s = 0.0f; s < t && skipped < data.trace.maxIterations; skipped++ )
+		{
+			const float d = SceneDistance( data, data.cameraPosition + direction * s );
+			if( d < data.trace.surfaceDistance )
+				break;
+			s += d;
+		}
+
+		const int pixelCount = ((std::min)( x0 + fineBlockSize, width ) - x0) * ((std::min)( y0 + fineBlockSize, height ) - y0);
+		WorkerStats& stats = workerStats[worker];
+		stats.coneSteps += steps;
+		stats.stepsSaved += skipped * pixelCount * data.renderIterations;
+	} );
+
+	data.startDistances = fineDistances.data();
+	prepassStats.active = true;
+}
+
+float CpuRayMarcher::ConeMarch( const DispatchData& data, int x0, int y0, int size, float t, int& steps ) const
+{
+	const int x1 = (std::min)( x0 + size, width ) - 1;
+	const int y1 = (std::min)( y0 + size, height ) - 1;
+	const Vec3F corners[4] = {
+		PrimaryDirection( data, x0, y0 ),
+		PrimaryDirection( data, x1, y0 ),
+		PrimaryDirection( data, x0, y1 ),
+		PrimaryDirection( data, x1, y1 )
+	};
+
+	//Pixel rays lie between the corner rays, MarchPath then jitters them by up to one pixel
+	const Vec3F axis = (corners[0] + corners[1] + corners[2] + corners[3]).Normalized();
+	float minCos = 1.0f;
+	for( const Vec3F& corner : corners )
+	{
+		minCos = (std::min)( minCos, Vec3F::Dot( axis, corner ) );
+	}
+	const float jitter = std::sqrt( 1.0f / ((float)width * width) + 1.0f / ((float)height * height) );
+	const float angle = std::acos( (std::max)( -1.0f, (std::min)( minCos, 1.0f ) ) ) + jitter;
+	const float tanAngle = std::tan( (std::min)( angle, 1.5f ) );
+
+	//A ray at most angle away from the axis is never further than t * tanAngle from
+	//the axis point at t, so it can advance by what is left of the distance
+	for( ; steps < maxConeSteps; steps++ )
+	{
+		const float d = SceneDistance( data, data.cameraPosition + axis * t );
+		const float radius = t * tanAngle;
+		const float clearance = d - radius;
+
+		//Too close to a surface for the whole cone, the next level continues from here
+		if( clearance < (std::max)( radius, data.trace.surfaceDistance ) )
+			break;
+
+		t += clearance;
+		if( t > data.trace.maxDistance )
+			return data.trace.maxDistance;
+	}
+
+	return t;
+}
+
+Vec3F CpuRayMarcher::PrimaryDirection( const DispatchData& data, int x, int y ) const
+{
+	Vec2F coord = Vec2F( (float)x / (float)width, (float)y / (float)height ) * 2.0f - Vec2F( 1.0f );
+
+	Vec4F target = data.inverseProjection * Vec4F( coord.x, coord.y, 1.0f, 1.0f );
+	Vec3F targetDirection = (Vec3F( target.x, target.y, target.z ) / target.w).Normalized();
+	Vec4F rayDirection = data.inverseView * Vec4F( targetDirection, 0.0f );
+	return Vec3F( rayDirection.x, rayDirection.y, rayDirection.z );
+}
+
+float CpuRayMarcher::SceneDistance( const DispatchData& data, Vec3F p ) const
+{
+	//Cached distances are lower bounds, which is all the pre-pass needs
+	return data.distanceCache ?
+		data.distanceCache->SignedDistance( *data.scene, p ).distance :
+		SignedDistanceScene( *data.scene, p ).distance;
+}
+
+void CpuRayMarcher::RenderTile( const DispatchData& data, int tile, WorkerStats& stats )
+{
+	AccumulateTile( data, tile, stats, [&]( int x, int y, size_t index )
+	{
+		return PerPixel( data, x, y, data.reproject ? 0u : (uint32_t)sampleCounts[index], stats );
+	} );
+}
+
+template<typename F>
+void CpuRayMarcher::AccumulateTile( const DispatchData& data, int tile, WorkerStats& stats, F&& pixelSamples )
+{
+	const int x0 = (tile % tilesX) * tileSize;
+	const int y0 = (tile / tilesX) * tileSize;
+	const int x1 = (std::min)( x0 + tileSize, width );
+	const int y1 = (std::min)( y0 + tileSize, height );
+	if( data.cancel.IsCancelled() )
+		return;
+
+	tileSamples[tile] += data.renderIterations;
+	float error = 0.0f;
+
+	for( int y = y0; y < y1; y++ )
+	{
+		for( int x = x0; x < x1; x++ )
+		{
+			const size_t index = (size_t)y * width + x;
+			const PixelSamples pixel = pixelSamples( x, y, index );
+			if( data.tracePrimary )
+				TracePrimary( data, x, y, index, stats );
+
+			if( data.reproject )
+			{
+				accumulation[index] = pixel.color;
+				luminanceSquares[index] = pixel.luminanceSquares;
+				sampleCounts[index] = (float)data.renderIterations;
+				if( ReprojectPixel( data, x, y, index ) )
+					stats.reprojectedPixels++;
+			}
+			else
+			{
+				accumulation[index] += pixel.color;
+				luminanceSquares[index] += pixel.luminanceSquares;
+				sampleCounts[index] += (float)data.renderIterations;
+			}
+
+			const float samples = sampleCounts[index];
+			const float scale = 1.0f / samples;
+			error += RelativeError( Luminance( accumulation[index] ), luminanceSquares[index], samples );
+
+			const Vec3F color = accumulation[index] * scale;
+			pixels[index] = ToPixel( color );
+
+			//Means for the denoiser, kept up to date even when it is off so converged tiles are ready
+			Denoiser::Input& input = denoiser.GetInput();
+			input.red[index] = color.x;
+			input.green[index] = color.y;
+			input.blue[index] = color.z;
+			const float luminance = Luminance( color );
+			input.variance[index] = samples < minVarianceSamples ? -1.0f :
+				(std::max)( luminanceSquares[index] * scale - luminance * luminance, 0.0f ) / (samples - 1.0f);
+
+			//The AOVs at this pixel belong to the old view, the new samples replace them
+			UpdateAovs( pixel, index, data.renderIterations, data.reproject ? (float)data.renderIterations : samples );
+		}
+	}
+
+	tileErrors[tile] = error / (float)((x1 - x0) * (y1 - y0));
+}
+
+void CpuRayMarcher::RenderWavefront( const DispatchData& data, const std::vector<int>& activeTiles, std::vector<WorkerStats>& workerStats )
+{
+	wavefrontStats.active = true;
+	const int iterations = data.renderIterations;
+	auto tilePixels = [this]( int tile )
+	{
+		const int x0 = (tile % tilesX) * tileSize;
+		const int y0 = (tile / tilesX) * tileSize;
+		return ((std::min)( x0 + tileSize, width ) - x0) * ((std::min)( y0 + tileSize, height ) - y0);
+	};
+	//Stages hand out rays in chunks, one at a time the counter would be the bottleneck
+	constexpr int chunkSize = 64;
+	auto forEachChunk = [this]( const std::vector<int>& queue, auto&& function )
+	{
+		ParallelFor( (int)((queue.size() + chunkSize - 1) / chunkSize), [&]( int chunk, unsigned int worker )
+		{
+			const size_t end = (std::min)( (size_t)(chunk + 1) * chunkSize, queue.size() );
+			for( size_t i = (size_t)chunk * chunkSize; i < end; i++ )
+			{
+				function( i, worker );
+			}
+		} );
+	};
+
+	//The packet kernel is plain sphere tracing through signedDistanceScene
+	const bool packets = settings.packetMarching && !data.distanceCache && data.trace.relaxation == 1.0f && packetMarcher.GetWidth() > 1;
+	if( packets )
+	{
+		PacketMarcher::Settings& packetSettings = packetMarcher.GetSettings();
+		packetSettings.maxIterations = data.trace.maxIterations;
+		packetSettings.surfaceDistance = data.trace.surfaceDistance;
+		packetSettings.maxDistance = data.trace.maxDistance;
+	}
+	wavefrontStats.packetWidth = packets ? packetMarcher.GetWidth() : 1;
+
+	double occupancy = 0.0;
+	std::vector<int> batchTiles;
+	std::vector<int> tileFirstPath;
+	std::vector<int> queue;
+	std::vector<int> missQueue;
+	std::vector<int> shadeQueue;
+	std::vector<uint8_t> alive;
+	Hydro::Timer timer;
+	for( size_t first = 0; first < activeTiles.size() && !data.cancel.IsCancelled(); )
+	{
+		//Whole tiles until the batch is full, so every pixel is accumulated by one batch
+		int pathCount = 0;
+		batchTiles.clear();
+		tileFirstPath.clear();
+		for( ; first < activeTiles.size() && (pathCount == 0 || pathCount + tilePixels( activeTiles[first] ) * iterations <= wavefrontPaths); first++ )
+		{
+			batchTiles.push_back( activeTiles[first] );
+			tileFirstPath.push_back( pathCount );
+			pathCount += tilePixels( activeTiles[first] ) * iterations;
+		}
+		wavefrontStats.batches++;
+
+		//Generate: the samples of a pixel are next to each other, the pixels of a tile in rows
+		timer.Mark();
+		paths.resize( pathCount );
+		ParallelFor( (int)batchTiles.size(), [&]( int index, unsigned int worker )
+		{
+			const int tile = batchTiles[index];
+			const int x0 = (tile % tilesX) * tileSize;
+			const int y0 = (tile / tilesX) * tileSize;
+			const int x1 = (std::min)( x0 + tileSize, width );
+			const int y1 = (std::min)( y0 + tileSize, height );
+			int path = tileFirstPath[index];
+			for( int y = y0; y < y1; y++ )
+			{
+				for( int x = x0; x < x1; x++ )
+				{
+					const size_t pixel = (size_t)y * width + x;
+					const uint32_t sampleIndex = data.reproject ? 0u : (uint32_t)sampleCounts[pixel];
+					for( int i = 0; i < iterations; i++ )
+					{
+						paths[path++] = StartPath( data, x, y, sampleIndex + (uint32_t)i, workerStats[worker] );
+					}
+				}
+			}
+		} );
+		queue.resize( pathCount );
+		for( int i = 0; i < pathCount; i++ )
+		{
+			queue[i] = i;
+		}
+		wavefrontStats.generateTime += timer.Mark() * 1000.0f;
+
+		//Every pass is a sample boundary of all the paths in the batch
+		while( !queue.empty() && !data.cancel.IsCancelled() )
+		{
+			wavefrontStats.passes++;
+			occupancy += (double)queue.size() / (double)pathCount;
+
+			//March: every live path one ray further
+			if( packets )
+			{
+				packetRays.Resize( queue.size() );
+				packetResults.Resize( queue.size() );
+				//Chunks are whole packets, only the last one ends in padding
+				ParallelFor( (int)((queue.size() + chunkSize - 1) / chunkSize), [&]( int chunk, unsigned int worker )
+				{
+					const size_t end = (std::min)( (size_t)(chunk + 1) * chunkSize, queue.size() );
+					MarchPackets( data, queue, (size_t)chunk * chunkSize, end, workerStats[worker] );
+				} );
+			}
+			else
+			{
+				forEachChunk( queue, [&]( size_t i, unsigned int worker )
+				{
+					MarchPath( data, paths[queue[i]], workerStats[worker] );
+				} );
+			}
+			wavefrontStats.marchTime += timer.Mark() * 1000.0f;
+
+			//Sort: misses apart and the hits binned by Material::id, so a chunk of the shade
+			//stage mostly runs the same branch of Scatter
+			int binSizes[materialBins] = {};
+			auto bin = [&]( int path )
+			{
+				return (std::min)( data.scene->GetObjectMaterial( paths[path].hit.ObjectIndex ).id, materialBins - 1 );
+			};
+			missQueue.clear();
+			for( const int path : queue )
+			{
+				if( paths[path].hit.HitDistance > 0.0f )
+					binSizes[bin( path )]++;
+				else
+					missQueue.push_back( path );
+			}
+			int binStarts[materialBins] = {};
+			for( int b = 1; b < materialBins; b++ )
+			{
+				binStarts[b] = binStarts[b - 1] + binSizes[b - 1];
+			}
+			shadeQueue.resize( queue.size() - missQueue.size() );
+			for( const int path : queue )
+			{
+				if( paths[path].hit.HitDistance > 0.0f )
+					shadeQueue[binStarts[bin( path )]++] = path;
+			}
+			for( int b = 0; b < materialBins; b++ )
+			{
+				wavefrontStats.shadedRays[b] += binSizes[b];
+			}
+			wavefrontStats.missedRays += (int64_t)missQueue.size();
+			wavefrontStats.sortTime += timer.Mark() * 1000.0f;
+
+			//Miss: the sky ends the path
+			forEachChunk( missQueue, [&]( size_t i, unsigned int )
+			{
+				MissPath( paths[missQueue[i]] );
+			} );
+			wavefrontStats.missTime += timer.Mark() * 1000.0f;
+
+			//Shade: emission, light sampling and the next direction
+			alive.resize( shadeQueue.size() );
+			forEachChunk( shadeQueue, [&]( size_t i, unsigned int worker )
+			{
+				alive[i] = ShadePath( data, paths[shadeQueue[i]], workerStats[worker] ) ? 1 : 0;
+			} );
+			queue.clear();
+			for( size_t i = 0; i < shadeQueue.size(); i++ )
+			{
+				if( alive[i] )
+					queue.push_back( shadeQueue[i] );
+			}
+			wavefrontStats.shadeTime += timer.Mark() * 1000.0f;
+		}
+
+		//Accumulate: the finished paths of every pixel into the image
+		ParallelFor( (int)batchTiles.size(), [&]( int index, unsigned int worker )
+		{
+			const int tile = batchTiles[index];
+			const int x0 = (tile % tilesX) * tileSize;
+			const int y0 = (tile / tilesX) * tileSize;
+			const int tileWidth = (std::min)( x0 + tileSize, width ) - x0;
+			AccumulateTile( data, tile, workerStats[worker], [&]( int x, int y, size_t )
+			{
+				const int firstPath = tileFirstPath[index] + ((y - y0) * tileWidth + (x - x0)) * iterations;
+				PixelSamples samples;
+				for( int i = 0; i < iterations; i++ )
+				{
+					AddPath( samples, paths[firstPath + i].samples );
+				}
+				return samples;
+			} );
+		} );
+		wavefrontStats.accumulateTime += timer.Mark() * 1000.0f;
+	}
+
+	if( wavefrontStats.passes > 0 )
+		wavefrontStats.occupancy = (float)(occupancy / wavefrontStats.passes);
+}
+
+void CpuRayMarcher::TracePrimary( const DispatchData& data, int x, int y, size_t index, WorkerStats& stats )
+{
+	Ray ray;
+	ray.Origin = data.cameraPosition;
+	ray.Direction = PrimaryDirection( data, x, y );
+	const float startDistance = data.startDistances ?
+		data.startDistances[(y / fineBlockSize) * ((width + fineBlockSize - 1) / fineBlockSize) + x / fineBlockSize] : 0.0f;
+
+	const HitPayload hit = MarchRay( data, ray, startDistance, stats );
+	primaryDepth[index] = hit.HitDistance > 0.0f ? hit.HitDistance : data.trace.maxDistance;
+	primaryNormal[index] = hit.HitDistance > 0.0f ? hit.WorldNormal : Vec3F( 0.0f );
+}
+
+bool CpuRayMarcher::ReprojectPixel( const DispatchData& data, int x, int y, size_t index )
+{
+	const float depth = primaryDepth[index];
+	const Vec3F normal = primaryNormal[index];
+	const Vec3F direction = PrimaryDirection( data, x, y );
+	const Vec3F position = data.cameraPosition + direction * depth;
+	//The skybox only depends on the direction, it stays in place when the camera moves
+	const bool sky = depth >= data.trace.maxDistance;
+
+	//Inverse of PrimaryDirection with the old camera. The matrices are laid out for the shader,
+	//their translation is lost on a column vector so the position goes in relative to the camera
+	const Vec4F clip = history.viewProjection * Vec4F( sky ? direction : position - history.cameraPosition, 0.0f );
+	if( clip.w <= 0.0f )
+		return false;
+	const float px = (clip.x / clip.w + 1.0f) * 0.5f * (float)width;
+	const float py = (clip.y / clip.w + 1.0f) * 0.5f * (float)height;
+	const int x0 = (int)std::floor( px );
+	const int y0 = (int)std::floor( py );
+	const float fx = px - (float)x0;
+	const float fy = py - (float)y0;
+
+	const float expectedDepth = sky ? depth : Vec3F::Distance( position, history.cameraPosition );
+
+	//Taps are up to a pixel away from the position, at a grazing angle that
+	//changes the depth a lot more than the tolerance
+	const float pixelAngle = Vec3F::Distance( direction, PrimaryDirection( data, x + 1, y ) );
+	const float facing = (std::max)( std::abs( Vec3F::Dot( normal, direction ) ), 0.05f );
+	const float depthTolerance = expectedDepth * (historyDepthTolerance + pixelAngle / facing);
+
+	//Bilinear over the taps that saw the same surface, means so pixels with more samples do not dominate
+	Vec3F color;
+	float squares = 0.0f;
+	float samples = 0.0f;
+	float weightSum = 0.0f;
+	for( int tap = 0; tap < 4; tap++ )
+	{
+		const int tx = x0 + (tap & 1);
+		const int ty = y0 + (tap >> 1);
+		const float weight = ((tap & 1) ? fx : 1.0f - fx) * ((tap >> 1) ? fy : 1.0f - fy);
+		if( tx < 0 || ty < 0 || tx >= width || ty >= height || weight <= 0.0f )
+			continue;
+
+		//Normals are zero for the sky, which only has to match the sky
+		const size_t tapIndex = (size_t)ty * width + tx;
+		const float tapSamples = history.sampleCounts[tapIndex];
+		if( tapSamples <= 0.0f || std::abs( history.primaryDepth[tapIndex] - expectedDepth ) > depthTolerance ||
+			Vec3F::Dot( normal, history.primaryNormal[tapIndex] ) < historyNormalCos * Vec3F::Dot( normal, normal ) )
+			continue;
+
+		color += history.accumulation[tapIndex] * (weight / tapSamples);
+		squares += history.luminanceSquares[tapIndex] * (weight / tapSamples);
+		samples += tapSamples * weight;
+		weightSum += weight;
+	}
+
+	if( weightSum < 0.01f )
+		return false;
+
+	//The history counts as at most maxHistory samples, so the new ones always get a share
+	//of at least newSamples / (maxHistory + newSamples) and old lighting fades out
+	const float keep = (std::min)( samples / weightSum, (float)settings.maxHistory ) / weightSum;
+	accumulation[index] += color * keep;
+	luminanceSquares[index] += squares * keep;
+	sampleCounts[index] += keep * weightSum;
+	return true;
+}
+
+void CpuRayMarcher::UpdateAovs( const PixelSamples& pixel, size_t index, int newSamples, float samples )
+{
+	const size_t count = aovs.GetPixelCount();
+	const float weight = (float)newSamples / samples;
+	auto update = [&]( Aov aov, int channel, float sum )
+	{
+		float& mean = aovs.Get( aov )[channel * count + index];
+		mean += (sum / (float)newSamples - mean) * weight;
+	};
+
+	if( aovs.IsEnabled( Aov::Depth ) )
+		update( Aov::Depth, 0, pixel.depth );
+	if( aovs.IsEnabled( Aov::Normal ) )
+	{
+		update( Aov::Normal, 0, pixel.normal.x );
+		update( Aov::Normal, 1, pixel.normal.y );
+		update( Aov::Normal, 2, pixel.normal.z );
+	}
+	if( aovs.IsEnabled( Aov::Albedo ) )
+	{
+		update( Aov::Albedo, 0, pixel.albedo.x );
+		update( Aov::Albedo, 1, pixel.albedo.y );
+		update( Aov::Albedo, 2, pixel.albedo.z );
+	}
+	if( aovs.IsEnabled( Aov::ObjectId ) )
+		aovs.Get( Aov::ObjectId )[index] = pixel.objectId;
+	if( aovs.IsEnabled( Aov::MaterialId ) )
+		aovs.Get( Aov::MaterialId )[index] = pixel.materialId;
+	if( aovs.IsEnabled( Aov::Steps ) )
+		update( Aov::Steps, 0, pixel.steps );
+}
+
+CpuRayMarcher::PixelSamples CpuRayMarcher::PerPixel( const DispatchData& data, int x, int y, uint32_t sampleIndex, WorkerStats& stats ) const
+{
+	//Accumulate color
+	PixelSamples samples;
+	for( int i = 0; i < data.renderIterations && !data.cancel.IsCancelled(); i++ )
+	{
+		PathState path = StartPath( data, x, y, sampleIndex + (uint32_t)i, stats );
+		RayColor( data, path, stats );
+		AddPath( samples, path.samples );
+	}
+
+	return samples;
+}
+
+void CpuRayMarcher::AddPath( PixelSamples& samples, const PixelSamples& path )
+{
+	samples.color += path.color;
+	samples.luminanceSquares += Luminance( path.color ) * Luminance( path.color );
+	samples.albedo += path.albedo;
+	samples.normal += path.normal;
+	samples.depth += path.depth;
+	samples.steps += path.steps;
+	samples.objectId = path.objectId;
+	samples.materialId = path.materialId;
+}
+
+CpuRayMarcher::PathState CpuRayMarcher::StartPath( const DispatchData& data, int x, int y, uint32_t sampleIndex, WorkerStats& stats ) const
+{
+	PathState path;
+	path.sampler = Sampler( data.sampler, data.randomSeed, x, y, sampleIndex );
+	path.ray.Origin = data.cameraPosition;
+	path.ray.Direction = PrimaryDirection( data, x, y );
+	path.startDistance = data.startDistances ?
+		data.startDistances[(y / fineBlockSize) * ((width + fineBlockSize - 1) / fineBlockSize) + x / fineBlockSize] : 0.0f;
+	stats.paths++;
+	return path;
+}
+
+void CpuRayMarcher::RayColor( const DispatchData& data, PathState& path, WorkerStats& stats ) const
+{
+	for( ;; )
+	{
+		MarchPath( data, path, stats );
+		if( path.hit.HitDistance <= 0.0f )
+		{
+			MissPath( path );
+			return;
+		}
+		if( !ShadePath( data, path, stats ) )
+			return;
+	}
+}
+
+void CpuRayMarcher::MarchPath( const DispatchData& data, PathState& path, WorkerStats& stats ) const
+{
+	JitterPath( data, path );
+
+	//Only the camera rays are covered by the pre-pass
+	const uint64_t previousSteps = stats.steps.GetStepCount();
+	path.hit = MarchRay( data, path.ray, path.depth == 0 ? path.startDistance : 0.0f, stats );
+	EndMarch( data, path, stats.steps.GetStepCount() - previousSteps, stats );
+}
+
+void CpuRayMarcher::JitterPath( const DispatchData& data, PathState& path ) const
+{
+	const bool sampleLights = data.nextEventEstimation && data.scene->GetEmitterArea() > 0.0f;
+
+	//Generate small diffrence in ray direction between samples. Bounces keep the
+	//direction scatterPdf was computed for when it weights the emitters they hit
+	if( path.depth == 0 || !sampleLights )
+	{
+		const Vec2F jitter = path.sampler.Get2D( (uint32_t)path.depth * Sampler::DimensionsPerBounce + Sampler::JitterX );
+		path.ray.Direction += Vec3F( jitter.x / (float)width, jitter.y / (float)height, 0.0f );
+	}
+}
+
+void CpuRayMarcher::EndMarch( const DispatchData& data, PathState& path, uint64_t steps, WorkerStats& stats ) const
+{
+	const CompiledScene& scene = *data.scene;
+	path.samples.steps += (float)steps;
+	stats.pathRays++;
+	if( path.depth != 0 )
+		return;
+
+	PixelSamples& samples = path.samples;
+	const HitPayload& hit = path.hit;
+	stats.primarySteps += (int64_t)steps;
+	if( hit.HitDistance > 0.0f )
+	{
+		const Material& material = scene.GetObjectMaterial( hit.ObjectIndex );
+		samples.albedo += material.id == 2 ? Vec3F( 1.0f ) : Vec3F( material.data[0], material.data[1], material.data[2] );
+		samples.normal += hit.WorldNormal;
+		samples.depth += hit.HitDistance;
+		samples.objectId = (float)hit.ObjectIndex;
+		samples.materialId = (float)scene.GetObjectMaterialIndex( hit.ObjectIndex );
+	}
+	else
+	{
+		samples.depth += data.trace.maxDistance;
+		samples.objectId = -1.0f;
+		samples.materialId = -1.0f;
+	}
+}
+
+void CpuRayMarcher::MarchPackets( const DispatchData& data, const std::vector<int>& queue, size_t begin, size_t end, WorkerStats& stats )
+{
+	//Rays start where the pre-pass left them, like SphereTrace with a startDistance
+	for( size_t i = begin; i < end; i++ )
+	{
+		PathState& path = paths[queue[i]];
+		JitterPath( data, path );
+		const float startDistance = path.depth == 0 ? path.startDistance : 0.0f;
+		const Vec3F origin = startDistance > 0.0f ?
+			path.ray.Origin + path.ray.Direction * (startDistance / path.ray.Direction.Magnitude()) :
+			path.ray.Origin;
+		packetRays.originX[i] = origin.x;
+		packetRays.originY[i] = origin.y;
+		packetRays.originZ[i] = origin.z;
+		packetRays.directionX[i] = path.ray.Direction.x;
+		packetRays.directionY[i] = path.ray.Direction.y;
+		packetRays.directionZ[i] = path.ray.Direction.z;
+	}
+
+	packetMarcher.March( *data.scene, packetRays, begin, end, packetResults );
+
+	for( size_t i = begin; i < end; i++ )
+	{
+		PathState& path = paths[queue[i]];
+		HitPayload& hit = path.hit;
+		hit.HitDistance = -1.0f;
+		hit.ObjectIndex = -1;
+		if( packetResults.hitDistance[i] >= 0.0f )
+		{
+			//HitDistance is measured from ray.Origin again
+			const float startDistance = path.depth == 0 ? (std::max)( path.startDistance, 0.0f ) : 0.0f;
+			hit.HitDistance = startDistance + packetResults.hitDistance[i];
+			hit.WorldPosition = path.ray.Origin + path.ray.Direction.Normalized() * hit.HitDistance;
+			hit.ObjectIndex = packetResults.objectIndex[i];
+			hit.WorldNormal = HitNormal( data, hit );
+		}
+		stats.steps.Add( packetResults.steps[i] );
+		EndMarch( data, path, (uint64_t)packetResults.steps[i], stats );
+	}
+}
+
+void CpuRayMarcher::MissPath( PathState& path ) const
+{
+	path.samples.color += path.throughput * SampleSkybox( path.ray.Direction );
+}
+
+bool CpuRayMarcher::ShadePath( const DispatchData& data, PathState& path, WorkerStats& stats ) const
+{
+	const CompiledScene& scene = *data.scene;
+	const bool sampleLights = data.nextEventEstimation && scene.GetEmitterArea() > 0.0f;
+	const uint32_t dimension = (uint32_t)path.depth * Sampler::DimensionsPerBounce;
+	const HitPayload& hit = path.hit;
+	Ray ray = path.ray;
+	const uint64_t previousSteps = stats.steps.GetStepCount();
+
+	const Material& material = scene.GetObjectMaterial( hit.ObjectIndex );
+	Vec3F emitted = Emitted( material );
+	if( path.scatterPdf > 0.0f && scene.IsEmitter( hit.ObjectIndex ) )
+	{
+		//Light sampling at the last bounce could have picked this point as well
+		const float lightCos = std::abs( Vec3F::Dot( hit.WorldNormal, ray.Direction.Normalized() ) );
+		const float lightPdf = hit.HitDistance * hit.HitDistance / (lightCos * scene.GetEmitterArea());
+		emitted *= PowerHeuristic( path.scatterPdf, lightPdf );
+	}
+	path.samples.color += path.throughput * emitted;
+
+	//Not at the last vertex, the path could not find the other half of the light there
+	const bool sampleHere = sampleLights && path.depth + 1 < data.maxDepth && SamplesEmitters( material );
+	if( sampleHere )
+	{
+		path.samples.color += path.throughput * SampleEmitters( data, ray, hit, material, path.sampler, dimension, stats );
+		path.samples.steps += (float)(stats.steps.GetStepCount() - previousSteps);
+	}
+
+	Ray scattered;
+	Vec3F attenuation;
+	if( !Scatter( material, ray, hit, attenuation, scattered, path.sampler.Get2D( dimension + Sampler::ScatterU ) ) )
+		return false;
+	path.scatterPdf = sampleHere ? ScatterPdf( material, ray.Direction, hit.WorldNormal, scattered.Direction.Normalized() ) : 0.0f;
+
+	//Nothing further down the path can add to the color anymore
+	path.throughput = path.throughput * attenuation;
+	if( !(path.throughput.x > 0.0f || path.throughput.y > 0.0f || path.throughput.z > 0.0f) )
+		return false;
+	if( path.depth + 1 >= data.maxDepth )
+		return false;
+
+	//Paths that carry little light end early, the survivors make up for the ones that did not
+	if( path.depth + 1 >= data.rouletteMinDepth )
+	{
+		const float survival = SurvivalProbability( path.throughput );
+		if( path.sampler.Get( dimension + Sampler::Roulette ) >= survival )
+		{
+			stats.terminatedPaths++;
+			stats.raysSaved += data.maxDepth - path.depth - 1;
+			return false;
+		}
+		path.throughput /= survival;
+	}
+
+	path.ray = scattered;
+	path.depth++;
+	return true;
+}
+
+Vec3F CpuRayMarcher::SampleEmitters( const DispatchData& data, const Ray& ray, const HitPayload& hit, const Material& material, const Sampler& sampler, uint32_t dimension, WorkerStats& stats ) const
+{
+	const CompiledScene& scene = *data.scene;
+	const float area = scene.GetEmitterArea();
+
+	//An emitter by its share of the area and a uniform point on its surface, the density over the area is 1 / area
+	const float pick = sampler.Get( dimension + Sampler::EmitterPick ) * area;
+	const size_t emitter = (std::min)( (size_t)(std::upper_bound( scene.emitterAreaSums.begin(), scene.emitterAreaSums.end(), pick ) - scene.emitterAreaSums.begin()),
+		scene.emitterAreaSums.size() - 1 );
+	const int objectIndex = scene.emitterObjects[emitter];
+	const uint32_t primitive = scene.GetObjectPrimitive( objectIndex );
+	const size_t index = Bvh::GetIndex( primitive );
+
+	Vec3F point;
+	Vec3F normal;
+	if( Bvh::GetType( primitive ) == Bvh::Box )
+	{
+		const Vec4F& center = scene.boxCenters[index];
+		const Vec3F size = Vec3F::Abs( Vec3F( scene.boxSizes[index].x, scene.boxSizes[index].y, scene.boxSizes[index].z ) );
+
+		//The axis of the face normal by the area of its faces, then the side by which half
+		//of the axis share the number fell into
+		const float faceAreas[3] = { size.y * size.z, size.z * size.x, size.x * size.y };
+		const float face = sampler.Get( dimension + Sampler::EmitterFace ) * (faceAreas[0] + faceAreas[1] + faceAreas[2]);
+		const int axis = face < faceAreas[0] ? 0 : (face < faceAreas[0] + faceAreas[1] ? 1 : 2);
+		const float faceStart = axis == 0 ? 0.0f : (axis == 1 ? faceAreas[0] : faceAreas[0] + faceAreas[1]);
+		const float side = face - faceStart < 0.5f * faceAreas[axis] ? -1.0f : 1.0f;
+
+		const Vec2F u = sampler.Get2D( dimension + Sampler::EmitterU );
+		Vec3F local;
+		(&local.x)[axis] = side;
+		(&local.x)[(axis + 1) % 3] = u.x * 2.0f - 1.0f;
+		(&local.x)[(axis + 2) % 3] = u.y * 2.0f - 1.0f;
+		(&normal.x)[axis] = side;
+		point = Vec3F( center.x, center.y, center.z ) + Vec3F::Scale( local, size );
+	}
+	else
+	{
+		const Vec4F& sphere = scene.spheres[index];
+		normal = Sampler::UniformSphere( sampler.Get2D( dimension + Sampler::EmitterU ) );
+		point = Vec3F( sphere.x, sphere.y, sphere.z ) + normal * std::abs( sphere.w );
+	}
+
+	//Only the side of the emitter facing the point, the back is hidden by the emitter itself
+	const Vec3F origin = hit.WorldPosition + hit.WorldNormal * 0.001f;
+	Vec3F toLight = point - origin;
+	const float distance = toLight.Magnitude();
+	const Vec3F direction = toLight / distance;
+	const float lightCos = -Vec3F::Dot( normal, direction );
+	const float scatterPdf = ScatterPdf( material, ray.Direction, hit.WorldNormal, direction );
+	if( !(lightCos > 0.0f) || !(scatterPdf > 0.0f) )
+		return Vec3F( 0.0f );
+
+	Ray shadow;
+	shadow.Origin = origin;
+	shadow.Direction = direction;
+	if( Occluded( data, shadow, distance, objectIndex, stats ) )
+		return Vec3F( 0.0f );
+
+	//BSDF times cosine over the light density, weighted against scattering into the same direction
+	const float lightPdf = distance * distance / (lightCos * area);
+	const Vec3F albedo = Vec3F( material.data[0], material.data[1], material.data[2] );
+	return albedo * Emitted( scene.GetObjectMaterial( objectIndex ) ) * (scatterPdf / lightPdf * PowerHeuristic( lightPdf, scatterPdf ));
+}
+
+bool CpuRayMarcher::Occluded( const DispatchData& data, const Ray& ray, float length, int objectIndex, WorkerStats& stats ) const
+{
+	const CompiledScene& scene = *data.scene;
+
+	int iterations = 0;
+	const bool occluded = data.distanceCache ?
+		SphereTraceOccluded( [&]( Vec3F p ) { return data.distanceCache->SignedDistance( scene, p ); }, ray, length, objectIndex, data.trace, iterations ) :
+		SphereTraceOccluded( [&]( Vec3F p ) { return SignedDistanceScene( scene, p ); }, ray, length, objectIndex, data.trace, iterations );
+	stats.steps.Add( iterations );
+	return occluded;
+}
+
+HitPayload CpuRayMarcher::MarchRay( const DispatchData& data, Ray ray, float startDistance, WorkerStats& stats ) const
+{
+	const CompiledScene& scene = *data.scene;
+
+	//The cache only hands out exact distances close to a surface
+	int iterations = 0;
+	HitPayload hit = data.distanceCache ?
+		SphereTrace( [&]( Vec3F p ) { return data.distanceCache->SignedDistance( scene, p ); }, ray, data.trace, iterations, startDistance ) :
+		SphereTrace( [&]( Vec3F p ) { return SignedDistanceScene( scene, p ); }, ray, data.trace, iterations, startDistance );
+	stats.steps.Add( iterations );
+
+	if( hit.HitDistance < 0.0f )
+		return hit;
+
+	hit.WorldNormal = HitNormal( data, hit );
+	return hit;
+}
+
+Vec3F CpuRayMarcher::HitNormal( const DispatchData& data, const HitPayload& hit ) const
+{
+	return data.analyticNormals ?
+		ObjectNormal( *data.scene, hit.ObjectIndex, hit.WorldPosition ) :
+		SceneNormalForwardDifference( *data.scene, hit.WorldPosition );
+}
+
+Vec3F CpuRayMarcher::SampleSkybox( Vec3F direction ) const
+{
+	if( !pSkybox || pSkybox->GetWidth() == 0 || pSkybox->GetHeight() == 0 )
+		return Vec3F( 0.0f );
+
+	float theta = std::acos( std::fmax( -1.0f, std::fmin( direction.y, 1.0f ) ) ) / -PI;
+	float phi = std::atan2( direction.x, -direction.z ) / -PI * 0.5f;
+
+	//Bilinear sample with wrap addressing, like sampler_SkyboxTexture
+	const int w = pSkybox->GetWidth();
+	const int h = pSkybox->GetHeight();
+	const uint32_t* texels = pSkybox->GetData();
+
+	float u = phi * w - 0.5f;
+	float v = -theta * h - 0.5f;
+	float fu = std::floor( u );
+	float fv = std::floor( v );
+	float tu = u - fu;
+	float tv = v - fv;
+
+	auto wrap = []( int i, int n ) { i %= n; return i < 0 ? i + n : i; };
+	const int x0 = wrap( (int)fu, w );
+	const int x1 = wrap( (int)fu + 1, w );
+	const int y0 = wrap( (int)fv, h );
+	const int y1 = wrap( (int)fv + 1, h );
+
+	auto texel = [&]( int x, int y )
+	{
+		uint32_t c = texels[y * w + x];
+		return Vec3F( (float)(c & 0xFFu), (float)((c >> 8u) & 0xFFu), (float)((c >> 16u) & 0xFFu) ) / 255.0f;
+	};
+
+	Vec3F top = Vec3F::Lerp( texel( x0, y0 ), texel( x1, y0 ), tu );
+	Vec3F bottom = Vec3F::Lerp( texel( x0, y1 ), texel( x1, y1 ), tu );
+	return Vec3F::Lerp( top, bottom, tv );
+}
+
+Benchmark::Report CpuRayMarcher::RunSphereTracingBenchmark()
+{
+	const int width = 160;
+	const int height = 120;
+	const float relaxations[] = { 1.0f, 1.2f, 1.5f, 1.8f };
+
+	Camera camera( 90.0f, 0.1f, 100.0f );
+	camera.OnResize( width, height );
+
+	const std::pair<const char*, Scene( * )()> scenes[] = {
+		{ "Scene_Sphere", Scene_Sphere },
+		{ "Scene_Cube", Scene_Cube },
+		{ "Scene_Torus", Scene_Torus },
+		{ "Scene_CornellBox", Scene_CornellBox }
+	};
+
+	Benchmark::Report report;
+	char line[256];
+	snprintf( line, sizeof( line ), "%dx%d, 1 sample, all bounces. Steps per MarchRay call as avg / p99", width, height );
+	report.push_back( line );
+
+	for( const auto& [name, build] : scenes )
+	{
+		CompiledScene scene;
+		scene.Compile( build() );
+		report.push_back( name );
+
+		for( float relaxation : relaxations )
+		{
+			CpuRayMarcher marcher;
+			marcher.OnResize( width, height );
+			marcher.GetSettings().relaxation = relaxation;
+
+			Hydro::Timer timer;
+			marcher.Dispatch( camera, scene, 1 );
+			const float seconds = timer.Mark();
+
+			const StepHistogram& steps = marcher.GetStepHistogram();
+			snprintf( line, sizeof( line ), "    %s %.1f: %.1f / %d steps, %llu rays, %.1fms",
+				relaxation > 1.0f ? "relaxed" : "plain", relaxation, steps.GetAverage(), steps.GetPercentile( 0.99 ),
+				(unsigned long long)steps.GetRayCount(), seconds * 1000.0f );
+			report.push_back( line );
+		}
+	}
+
+	return report;
+}
+
+Benchmark::Report CpuRayMarcher::RunNextEventBenchmark()
+{
+	const int width = 96;
+	const int height = 64;
+	const int referenceSamples = 1024;
+	const int budgets[] = { 4, 16, 64 };
+
+	Camera camera( 90.0f, 0.1f, 100.0f );
+	camera.OnResize( width, height );
+
+	//The ceiling light as a sphere hanging below the ceiling, to cover both emitter shapes
+	auto cornellSphereLight = []()
+	{
+		Scene scene = Scene_CornellBox();
+		Object& light = scene.objects[5];
+		light.id = 0;
+		light.data[0] = 0.0f;
+		light.data[1] = 2.0f;
+		light.data[2] = 0.5f;
+		light.data[3] = 0.3f;
+		return scene;
+	};
+
+	const std::pair<const char*, Scene( * )()> scenes[] = {
+		{ "Scene_CornellBox", Scene_CornellBox },
+		{ "Scene_CornellBox with a sphere light", cornellSphereLight }
+	};
+
+	Benchmark::Report report;
+	char line[256];
+	snprintf( line, sizeof( line ), "%dx%d, RMS error against %d samples per pixel with next event estimation, 1 sample per frame",
+		width, height, referenceSamples );
+	report.push_back( line );
+
+	for( const auto& [name, build] : scenes )
+	{
+		CompiledScene scene;
+		scene.Compile( build() );
+		report.push_back( name );
+
+		CpuRayMarcher reference;
+		reference.OnResize( width, height );
+		reference.SetSkybox( "Src/App/Textures/NoSkybox.bmp" );
+		reference.settings.nextEventEstimation = true;
+		reference.Dispatch( camera, scene, referenceSamples );
+
+		CpuRayMarcher plain;
+		plain.OnResize( width, height );
+		plain.SetSkybox( "Src/App/Textures/NoSkybox.bmp" );
+
+		CpuRayMarcher nextEvent;
+		nextEvent.OnResize( width, height );
+		nextEvent.SetSkybox( "Src/App/Textures/NoSkybox.bmp" );
+		nextEvent.settings.nextEventEstimation = true;
+
+		//Both keep accumulating, next event estimation gets as much time as plain took for its samples
+		uint32_t plainFrames = 0;
+		uint32_t nextEventFrames = 0;
+		float plainTime = 0.0f;
+		float nextEventTime = 0.0f;
+		for( int budget : budgets )
+		{
+			Hydro::Timer timer;
+			while( plainFrames < (uint32_t)budget )
+			{
+				plain.Dispatch( camera, scene, 1, nullptr, plainFrames++ );
+			}
+			plainTime += timer.Mark();
+
+			while( nextEventTime < plainTime )
+			{
+				nextEvent.Dispatch( camera, scene, 1, nullptr, nextEventFrames++ );
+				nextEventTime += timer.Mark();
+			}
+
+			snprintf( line, sizeof( line ), "    %.0fms: plain %d spp, error %.2f. Next event estimation %u spp, error %.2f",
+				plainTime * 1000.0f, budget, RmsError( plain.pixels, reference.pixels ), nextEventFrames, RmsError( nextEvent.pixels, reference.pixels ) );
+			report.push_back( line );
+		}
+	}
+
+	return report;
+}
+
+Benchmark::Report CpuRayMarcher::RunSamplerBenchmark()
+{
+	const int width = 96;
+	const int height = 64;
+	const int referenceSamples = 1024;
+	const int counts[] = { 1, 4, 16, 64 };
+
+	Camera camera( 90.0f, 0.1f, 100.0f );
+	camera.OnResize( width, height );
+
+	const std::tuple<const char*, Scene( * )(), const char*> scenes[] = {
+		{ "Scene_Sphere", Scene_Sphere, "Src/App/Textures/Skybox.bmp" },
+		{ "Scene_CornellBox", Scene_CornellBox, "Src/App/Textures/NoSkybox.bmp" }
+	};
+
+	Benchmark::Report report;
+	char line[256];
+	snprintf( line, sizeof( line ), "%dx%d, next event estimation, RMS error / 3x3 blurred RMS error against %d samples per pixel, 1 sample per frame",
+		width, height, referenceSamples );
+	report.push_back( line );
+
+	for( const auto& [name, build, skybox] : scenes )
+	{
+		CompiledScene scene;
+		scene.Compile( build() );
+		report.push_back( name );
+
+		CpuRayMarcher reference;
+		reference.OnResize( width, height );
+		reference.SetSkybox( skybox );
+		reference.settings.nextEventEstimation = true;
+		reference.Dispatch( camera, scene, referenceSamples );
+
+		for( int type = 0; type < (int)SamplerType::Count; type++ )
+		{
+			CpuRayMarcher marcher;
+			marcher.OnResize( width, height );
+			marcher.SetSkybox( skybox );
+			marcher.settings.nextEventEstimation = true;
+			marcher.settings.sampler = (SamplerType)type;
+
+			int length = snprintf( line, sizeof( line ), "    %s:", GetSamplerName( (SamplerType)type ) );
+			uint32_t frame = 0;
+			for( int count : counts )
+			{
+				while( frame < (uint32_t)count )
+				{
+					marcher.Dispatch( camera, scene, 1, nullptr, frame++ );
+				}
+				length += snprintf( line + length, sizeof( line ) - length, " %d spp %.2f / %.2f,", count,
+					RmsError( marcher.pixels, reference.pixels ), BlurredRmsError( marcher.pixels, reference.pixels, width, height ) );
+			}
+			line[length - 1] = '\0';
+			report.push_back( line );
+		}
+	}
+
+	return report;
+}
+
+Benchmark::Report CpuRayMarcher::RunRussianRouletteBenchmark()
+{
+	const int width = 96;
+	const int height = 64;
+	const int referenceSamples = 1024;
+	const int budgets[] = { 4, 16, 64 };
+
+	Camera camera( 90.0f, 0.1f, 100.0f );
+	camera.OnResize( width, height );
+
+	//Bright rough metal keeps the throughput high, so fewer paths end early
+	auto cornellMetal = []()
+	{
+		Scene scene = Scene_CornellBox();
+		Material& white = scene.materials[1];
+		white.id = 1;
+		white.data[0] = 0.9f;
+		white.data[1] = 0.9f;
+		white.data[2] = 0.9f;
+		white.data[3] = 0.3f;
+		return scene;
+	};
+
+	const std::pair<const char*, Scene( * )()> scenes[] = {
+		{ "Scene_CornellBox", Scene_CornellBox },
+		{ "Scene_CornellBox with rough metal walls", cornellMetal }
+	};
+
+	Benchmark::Report report;
+	char line[256];
+	snprintf( line, sizeof( line ), "%dx%d, next event estimation, RMS error against %d samples per pixel without Russian roulette, 1 sample per frame",
+		width, height, referenceSamples );
+	report.push_back( line );
+
+	for( const auto& [name, build] : scenes )
+	{
+		CompiledScene scene;
+		scene.Compile( build() );
+		report.push_back( name );
+
+		CpuRayMarcher reference;
+		reference.OnResize( width, height );
+		reference.SetSkybox( "Src/App/Textures/NoSkybox.bmp" );
+		reference.settings.nextEventEstimation = true;
+		reference.Dispatch( camera, scene, referenceSamples );
+
+		CpuRayMarcher full;
+		full.OnResize( width, height );
+		full.SetSkybox( "Src/App/Textures/NoSkybox.bmp" );
+		full.settings.nextEventEstimation = true;
+
+		CpuRayMarcher roulette;
+		roulette.OnResize( width, height );
+		roulette.SetSkybox( "Src/App/Textures/NoSkybox.bmp" );
+		roulette.settings.nextEventEstimation = true;
+		roulette.settings.russianRoulette = true;
+
+		//Both keep accumulating, roulette gets as much time as the full paths took for their samples
+		uint32_t fullFrames = 0;
+		uint32_t rouletteFrames = 0;
+		float fullTime = 0.0f;
+		float rouletteTime = 0.0f;
+		double fullLength = 0.0;
+		double rouletteLength = 0.0;
+		double terminated = 0.0;
+		for( int budget : budgets )
+		{
+			Hydro::Timer timer;
+			while( fullFrames < (uint32_t)budget )
+			{
+				full.Dispatch( camera, scene, 1, nullptr, fullFrames++ );
+				fullLength += full.pathStats.averageLength;
+			}
+			fullTime += timer.Mark();
+
+			while( rouletteTime < fullTime )
+			{
+				roulette.Dispatch( camera, scene, 1, nullptr, rouletteFrames++ );
+				rouletteTime += timer.Mark();
+				rouletteLength += roulette.pathStats.averageLength;
+				terminated += roulette.pathStats.terminatedFraction;
+			}
+
+			snprintf( line, sizeof( line ), "    %.0fms: full %d spp, error %.2f. Roulette %u spp, error %.2f",
+				fullTime * 1000.0f, budget, RmsError( full.pixels, reference.pixels ), rouletteFrames, RmsError( roulette.pixels, reference.pixels ) );
+			report.push_back( line );
+		}
+
+		snprintf( line, sizeof( line ), "    Rays per path: full %.2f, roulette %.2f with %.0f%% of the paths ended by it",
+			fullLength / fullFrames, rouletteLength / rouletteFrames, terminated / rouletteFrames * 100.0 );
+		report.push_back( line );
+	}
+
+	return report;
+}
+
+Benchmark::Report CpuRayMarcher::RunWavefrontBenchmark()
+{
+	const int width = 96;
+	const int height = 64;
+	const int referenceSamples = 512;
+	const int frames = 16;
+	const int samplesPerFrame = 4;
+
+	Camera camera( 90.0f, 0.1f, 100.0f );
+	camera.OnResize( width, height );
+
+	const std::tuple<const char*, Scene( * )(), const char*> scenes[] = {
+		{ "Scene_Sphere", Scene_Sphere, "Src/App/Textures/Skybox.bmp" },
+		{ "Scene_CornellBox", Scene_CornellBox, "Src/App/Textures/NoSkybox.bmp" }
+	};
+
+	Benchmark::Report report;
+	char line[256];
+	snprintf( line, sizeof( line ), "%dx%d, next event estimation and Russian roulette, %d frames of %d samples per pixel, RMS error against %d samples per pixel",
+		width, height, frames, samplesPerFrame, referenceSamples );
+	report.push_back( line );
+
+	for( const auto& [name, build, skybox] : scenes )
+	{
+		CompiledScene scene;
+		scene.Compile( build() );
+		report.push_back( name );
+
+		auto makeMarcher = [&]( bool wavefront, bool packetMarching = true )
+		{
+			auto pMarcher = std::make_unique<CpuRayMarcher>();
+			pMarcher->OnResize( width, height );
+			pMarcher->SetSkybox( skybox );
+			pMarcher->settings.nextEventEstimation = true;
+			pMarcher->settings.russianRoulette = true;
+			pMarcher->settings.wavefront = wavefront;
+			pMarcher->settings.packetMarching = packetMarching;
+			return pMarcher;
+		};
+
+		const auto pReference = makeMarcher( false );
+		pReference->Dispatch( camera, scene, referenceSamples );
+
+		const auto pMegakernel = makeMarcher( false );
+		const auto pWavefront = makeMarcher( true );
+		const auto pScalarWavefront = makeMarcher( true, false );
+
+		Hydro::Timer timer;
+		for( uint32_t frame = 0; frame < (uint32_t)frames; frame++ )
+		{
+			pMegakernel->Dispatch( camera, scene, samplesPerFrame, nullptr, frame );
+		}
+		const float megakernelTime = timer.Mark() * 1000.0f / frames;
+
+		WavefrontStats stages;
+		double occupancy = 0.0;
+		for( uint32_t frame = 0; frame < (uint32_t)frames; frame++ )
+		{
+			pWavefront->Dispatch( camera, scene, samplesPerFrame, nullptr, frame );
+			const WavefrontStats& frameStages = pWavefront->wavefrontStats;
+			stages.generateTime += frameStages.generateTime;
+			stages.marchTime += frameStages.marchTime;
+			stages.sortTime += frameStages.sortTime;
+			stages.missTime += frameStages.missTime;
+			stages.shadeTime += frameStages.shadeTime;
+			stages.accumulateTime += frameStages.accumulateTime;
+			stages.passes += frameStages.passes;
+			stages.batches += frameStages.batches;
+			occupancy += frameStages.occupancy;
+			for( int b = 0; b < materialBins; b++ )
+			{
+				stages.shadedRays[b] += frameStages.shadedRays[b];
+			}
+			stages.missedRays += frameStages.missedRays;
+		}
+		const float wavefrontTime = timer.Mark() * 1000.0f / frames;
+
+		float scalarMarchTime = 0.0f;
+		for( uint32_t frame = 0; frame < (uint32_t)frames; frame++ )
+		{
+			pScalarWavefront->Dispatch( camera, scene, samplesPerFrame, nullptr, frame );
+			scalarMarchTime += pScalarWavefront->wavefrontStats.marchTime;
+		}
+
+		snprintf( line, sizeof( line ), "    One path per thread: %.1fms per frame, error %.2f",
+			megakernelTime, RmsError( pMegakernel->pixels, pReference->pixels ) );
+		report.push_back( line );
+		snprintf( line, sizeof( line ), "    Wavefront: %.1fms per frame, error %.2f, %.1f batches and %.1f passes per frame, %.0f%% occupancy",
+			wavefrontTime, RmsError( pWavefront->pixels, pReference->pixels ), (float)stages.batches / frames, (float)stages.passes / frames, occupancy / frames * 100.0 );
+		report.push_back( line );
+		snprintf( line, sizeof( line ), "    Stages per frame: generate %.2fms, march %.2fms, sort %.2fms, miss %.2fms, shade %.2fms, accumulate %.2fms",
+			stages.generateTime / frames, stages.marchTime / frames, stages.sortTime / frames, stages.missTime / frames, stages.shadeTime / frames, stages.accumulateTime / frames );
+		report.push_back( line );
+		snprintf( line, sizeof( line ), "    March stage: %.2fms per frame with packets of %d paths, %.2fms one path at a time, error %.2f",
+			stages.marchTime / frames, pWavefront->wavefrontStats.packetWidth, scalarMarchTime / frames, RmsError( pScalarWavefront->pixels, pReference->pixels ) );
+		report.push_back( line );
+		snprintf( line, sizeof( line ), "    Rays per frame: %lld diffuse, %lld metal, %lld dielectric, %lld other, %lld missed",
+			(long long)(stages.shadedRays[0] / frames), (long long)(stages.shadedRays[1] / frames), (long long)(stages.shadedRays[2] / frames),
+			(long long)(stages.shadedRays[3] / frames), (long long)(stages.missedRays / frames) );
+		report.push_back( line );
+	}
+
+	return report;
+}
+
+Benchmark::Report CpuRayMarcher::RunPreviewBenchmark()
+{
+	const int width = 96;
+	const int height = 64;
+	const int referenceSamples = 256;
+	const int repeats = 8;
+
+	Camera camera( 90.0f, 0.1f, 100.0f );
+	camera.OnResize( width, height );
+
+	const std::tuple<const char*, Scene( * )(), const char*> scenes[] = {
+		{ "Scene_Sphere", Scene_Sphere, "Src/App/Textures/Skybox.bmp" },
+		{ "Scene_CornellBox", Scene_CornellBox, "Src/App/Textures/NoSkybox.bmp" }
+	};
+
+	Benchmark::Report report;
+	char line[256];
+	snprintf( line, sizeof( line ), "%dx%d, next event estimation, RMS error against %d samples per pixel, mean of %d images",
+		width, height, referenceSamples, repeats );
+	report.push_back( line );
+
+	for( const auto& [name, build, skybox] : scenes )
+	{
+		CompiledScene scene;
+		scene.Compile( build() );
+		report.push_back( name );
+
+		CpuRayMarcher reference;
+		reference.OnResize( width, height );
+		reference.SetSkybox( skybox );
+		reference.settings.nextEventEstimation = true;
+		reference.Dispatch( camera, scene, referenceSamples );
+
+		CpuRayMarcher marcher;
+		marcher.OnResize( width, height );
+		marcher.SetSkybox( skybox );
+		marcher.settings.nextEventEstimation = true;
+
+		for( const int blockSize : { 4, 2, 1 } )
+		{
+			float time = 0.0f;
+			double nearestError = 0.0;
+			double edgeAwareError = 0.0;
+			for( int i = 0; i < repeats; i++ )
+			{
+				//A new image seed every time, the preview reuses the one of the last image
+				marcher.Dispatch( camera, scene, 1 );
+
+				Hydro::Timer timer;
+				if( blockSize == 1 )
+				{
+					marcher.Dispatch( camera, scene, 1 );
+					time += timer.Mark();
+					nearestError += RmsError( marcher.pixels, reference.pixels );
+					edgeAwareError += RmsError( marcher.pixels, reference.pixels );
+					continue;
+				}
+				marcher.settings.edgeAwarePreview = false;
+				marcher.DispatchPreview( camera, scene, blockSize );
+				time += timer.Mark();
+				nearestError += RmsError( marcher.pixels, reference.pixels );
+				marcher.settings.edgeAwarePreview = true;
+				marcher.DispatchPreview( camera, scene, blockSize );
+				edgeAwareError += RmsError( marcher.pixels, reference.pixels );
+			}
+
+			if( blockSize == 1 )
+				snprintf( line, sizeof( line ), "    Full frame: %.2fms, error %.2f", time * 1000.0f / repeats, nearestError / repeats );
+			else
+				snprintf( line, sizeof( line ), "    %dx%d blocks: %.2fms, error %.2f nearest, %.2f edge-aware",
+					blockSize, blockSize, time * 1000.0f / repeats, nearestError / repeats, edgeAwareError / repeats );
+			report.push_back( line );
+		}
+	}
+
+	return report;
+}
+
+Benchmark::Report CpuRayMarcher::RunCancellationBenchmark()
+{
+	const int width = 96;
+	const int height = 64;
+	const int renderIterations = 2;
+	const int repeats = 4;
+
+	Camera camera( 90.0f, 0.1f, 100.0f );
+	camera.OnResize( width, height );
+	CompiledScene scene;
+	scene.Compile( Scene_CornellBox() );
+
+	CpuRayMarcher marcher;
+	marcher.OnResize( width, height );
+	marcher.SetSkybox( "Src/App/Textures/NoSkybox.bmp" );
+
+	//Warm up and the time of a full frame
+	marcher.Dispatch( camera, scene, renderIterations );
+	Hydro::Timer timer;
+	for( int i = 0; i < repeats; i++ )
+	{
+		marcher.Dispatch( camera, scene, renderIterations );
+	}
+	const float frameTime = timer.Mark() / repeats;
+
+	Benchmark::Report report;
+	char line[256];
+	snprintf( line, sizeof( line ), "Scene_CornellBox %dx%d, %d samples per pixel, %.1fms per frame, edits part way into a frame, mean of %d",
+		width, height, renderIterations, frameTime * 1000.0f, repeats );
+	report.push_back( line );
+
+	for( const float editPoint : { 0.25f, 0.5f, 0.75f } )
+	{
+		const auto editDelay = std::chrono::duration<float>( frameTime * editPoint );
+		float stopTime = 0.0f;
+		float cancelledTime = 0.0f;
+		float finishedTime = 0.0f;
+		double skipped = 0.0;
+		for( int i = 0; i < repeats; i++ )
+		{
+			//The stale frame runs on its own thread like on the render thread, the edit comes
+			//from this one. Both ways end with the first frame of the edited image
+			CancellationSource source;
+			std::thread frame( [&]() { marcher.Dispatch( camera, scene, renderIterations, nullptr, 0u, source.GetToken() ); } );
+			std::this_thread::sleep_for( editDelay );
+			timer.Mark();
+			source.Cancel();
+			frame.join();
+			stopTime += timer.Peek();
+			marcher.Dispatch( camera, scene, renderIterations );
+			cancelledTime += timer.Mark();
+			skipped += (double)marcher.cancelStats.samplesSkipped / ((double)width * height * renderIterations);
+
+			frame = std::thread( [&]() { marcher.Dispatch( camera, scene, renderIterations ); } );
+			std::this_thread::sleep_for( editDelay );
+			timer.Mark();
+			frame.join();
+			marcher.Dispatch( camera, scene, renderIterations );
+			finishedTime += timer.Mark();
+		}
+
+		snprintf( line, sizeof( line ), "    Edit at %.0f%%: stopped after %.3fms, %.0f%% of the samples skipped, edit on screen after %.1fms against %.1fms finishing the frame",
+			editPoint * 100.0f, stopTime * 1000.0f / repeats, skipped / repeats * 100.0, cancelledTime * 1000.0f / repeats, finishedTime * 1000.0f / repeats );
+		report.push_back( line );
+	}
+
+	return report;
+}
+
+Benchmark::Report CpuRayMarcher::RunAdaptiveSamplingBenchmark()
+{
+	const int width = 96;
+	const int height = 64;
+	const int referenceSamples = 256;
+	const int budget = 32;
+
+	Camera camera( 90.0f, 0.1f, 100.0f );
+	camera.OnResize( width, height );
+
+	const std::tuple<const char*, Scene( * )(), const char*> scenes[] = {
+		{ "Scene_Sphere", Scene_Sphere, "Src/App/Textures/Skybox.bmp" },
+		{ "Scene_CornellBox", Scene_CornellBox, "Src/App/Textures/NoSkybox.bmp" }
+	};
+
+	Benchmark::Report report;
+	char line[256];
+	snprintf( line, sizeof( line ), "%dx%d, RMS error against %d samples per pixel, at most %d samples per pixel worth of work, 1 sample per frame",
+		width, height, referenceSamples, budget );
+	report.push_back( line );
+
+	for( const auto& [name, build, skybox] : scenes )
+	{
+		CompiledScene scene;
+		scene.Compile( build() );
+		report.push_back( name );
+
+		CpuRayMarcher reference;
+		reference.OnResize( width, height );
+		reference.SetSkybox( skybox );
+		reference.Dispatch( camera, scene, referenceSamples );
+
+		const int64_t budgetSamples = (int64_t)budget * width * height;
+		for( float threshold : { 0.0f, 0.2f, 0.1f, 0.05f } )
+		{
+			CpuRayMarcher marcher;
+			marcher.OnResize( width, height );
+			marcher.SetSkybox( skybox );
+			marcher.GetSettings().adaptiveSampling = threshold > 0.0f;
+			marcher.GetSettings().errorThreshold = threshold;
+
+			//Same number of traced samples for every threshold, unless everything converged
+			int64_t traced = 0;
+			uint32_t frame = 0;
+			Hydro::Timer timer;
+			while( traced < budgetSamples )
+			{
+				marcher.Dispatch( camera, scene, 1, nullptr, frame++ );
+				const AdaptiveSamplingStats& stats = marcher.GetAdaptiveStats();
+				if( stats.frameSamples == 0 )
+					break;
+				traced += stats.frameSamples;
+			}
+			const float seconds = timer.Mark();
+
+			const AdaptiveSamplingStats& stats = marcher.GetAdaptiveStats();
+			if( threshold > 0.0f )
+				snprintf( line, sizeof( line ), "    adaptive %.2f: error %.2f, %u frames, %d of %d tiles still active, %.0fms",
+					threshold, RmsError( marcher.pixels, reference.pixels ), frame, stats.activeTiles, stats.tileCount, seconds * 1000.0f );
+			else
+				snprintf( line, sizeof( line ), "    uniform: error %.2f, %u frames, %.0fms", RmsError( marcher.pixels, reference.pixels ), frame, seconds * 1000.0f );
+			report.push_back( line );
+		}
+	}
+
+	return report;
+}
+
+Benchmark::Report CpuRayMarcher::RunDenoiserBenchmark()
+{
+	const int width = 96;
+	const int height = 64;
+	const int referenceSamples = 1024;
+	const int maxSamples = 256;
+
+	Camera camera( 90.0f, 0.1f, 100.0f );
+	camera.OnResize( width, height );
+
+	const std::tuple<const char*, Scene( * )(), const char*> scenes[] = {
+		{ "Scene_Sphere", Scene_Sphere, "Src/App/Textures/Skybox.bmp" },
+		{ "Scene_CornellBox", Scene_CornellBox, "Src/App/Textures/NoSkybox.bmp" }
+	};
+
+	Benchmark::Report report;
+	char line[256];
+	snprintf( line, sizeof( line ), "%dx%d, RMS error against %d samples per pixel, 1 sample per frame", width, height, referenceSamples );
+	report.push_back( line );
+
+	for( const auto& [name, build, skybox] : scenes )
+	{
+		CompiledScene scene;
+		scene.Compile( build() );
+		report.push_back( name );
+
+		CpuRayMarcher reference;
+		reference.OnResize( width, height );
+		reference.SetSkybox( skybox );
+		reference.Dispatch( camera, scene, referenceSamples );
+
+		CpuRayMarcher marcher;
+		marcher.OnResize( width, height );
+		marcher.SetSkybox( skybox );
+		marcher.settings.aovs = Denoiser::requiredAovs;
+
+		//Both errors of the same accumulation at every power of two
+		std::vector<int> samples;
+		std::vector<double> plainErrors;
+		std::vector<double> denoisedErrors;
+		std::vector<uint32_t> denoised( marcher.pixels.size() );
+		float denoiseTime = 0.0f;
+		for( int frame = 1; frame <= maxSamples; frame++ )
+		{
+			marcher.Dispatch( camera, scene, 1, nullptr, frame - 1 );
+			if( (frame & (frame - 1)) != 0 )
+				continue;
+
+			marcher.denoiser.Denoise( *marcher.pJobs );
+			denoiseTime += marcher.denoiser.GetStats().time;
+			for( size_t i = 0; i < denoised.size(); i++ )
+			{
+				denoised[i] = ToPixel( marcher.denoiser.GetColor( i ) );
+			}
+
+			samples.push_back( frame );
+			plainErrors.push_back( RmsError( marcher.pixels, reference.pixels ) );
+			denoisedErrors.push_back( RmsError( denoised, reference.pixels ) );
+		}
+
+		for( size_t i = 0; i < samples.size(); i++ )
+		{
+			const double equivalent = EquivalentSamples( samples, plainErrors, denoisedErrors[i] );
+			int length = snprintf( line, sizeof( line ), "    %3d spp: plain %.2f, denoised %.2f, ", samples[i], plainErrors[i], denoisedErrors[i] );
+			if( equivalent < 0.0 )
+				snprintf( line + length, sizeof( line ) - length, "plain needs more than %d spp", maxSamples );
+			else if( equivalent == 0.0 )
+				snprintf( line + length, sizeof( line ) - length, "worse than plain 1 spp" );
+			else
+				snprintf( line + length, sizeof( line ) - length, "like plain %.1f spp, %.1fx fewer samples", equivalent, equivalent / samples[i] );
+			report.push_back( line );
+		}
+
+		snprintf( line, sizeof( line ), "    %.2fms per denoise on %u threads", denoiseTime / (float)samples.size(), marcher.threadCount );
+		report.push_back( line );
+	}
+
+	return report;
+}
+
+Benchmark::Report CpuRayMarcher::RunReprojectionBenchmark()
+{
+	const int width = 96;
+	const int height = 64;
+	const int referenceSamples = 256;
+	const int frameCount = 24;
+	//Only every few frames get a reference, they are the expensive part
+	const int measureInterval = 4;
+	const int maxSamples = 64;
+
+	//Strafes and turns a little every frame, about walking speed at 60 frames per second
+	auto setView = []( Camera& camera, int frame )
+	{
+		const float yaw = 0.004f * (float)frame;
+		camera.SetView( Vec3F( 0.04f * (float)frame, 0.0f, 15.0f ), Vec3F( std::sin( yaw ), 0.0f, -std::cos( yaw ) ) );
+	};
+
+	const std::tuple<const char*, Scene( * )(), const char*> scenes[] = {
+		{ "Scene_Sphere", Scene_Sphere, "Src/App/Textures/Skybox.bmp" },
+		{ "Scene_CornellBox", Scene_CornellBox, "Src/App/Textures/NoSkybox.bmp" }
+	};
+	const std::tuple<const char*, bool, int> configs[] = {
+		{ "Restart on every move", false, 0 },
+		{ "Reprojection, 16 history samples", true, 16 },
+		{ "Reprojection, 64 history samples", true, 64 }
+	};
+
+	Benchmark::Report report;
+	char line[256];
+	snprintf( line, sizeof( line ), "%dx%d, %d frames of camera motion at 1 sample per frame, RMS error against %d samples per pixel every %d frames",
+		width, height, frameCount, referenceSamples, measureInterval );
+	report.push_back( line );
+
+	for( const auto& [name, build, skybox] : scenes )
+	{
+		CompiledScene scene;
+		scene.Compile( build() );
+		report.push_back( name );
+
+		Camera camera( 90.0f, 0.1f, 100.0f );
+		camera.OnResize( width, height );
+
+		std::vector<std::vector<uint32_t>> references;
+		for( int frame = measureInterval - 1; frame < frameCount; frame += measureInterval )
+		{
+			setView( camera, frame );
+			CpuRayMarcher reference;
+			reference.OnResize( width, height );
+			reference.SetSkybox( skybox );
+			reference.Dispatch( camera, scene, referenceSamples );
+			references.push_back( reference.pixels );
+		}
+
+		//Error of a camera that stands still at the last view, to express the others in samples
+		std::vector<int> samples;
+		std::vector<double> plainErrors;
+		{
+			CpuRayMarcher marcher;
+			marcher.OnResize( width, height );
+			marcher.SetSkybox( skybox );
+			for( int frame = 1; frame <= maxSamples; frame++ )
+			{
+				marcher.Dispatch( camera, scene, 1, nullptr, frame - 1 );
+				if( (frame & (frame - 1)) != 0 )
+					continue;
+				samples.push_back( frame );
+				plainErrors.push_back( RmsError( marcher.pixels, references.back() ) );
+			}
+		}
+
+		for( const auto& [configName, reprojection, maxHistory] : configs )
+		{
+			CpuRayMarcher marcher;
+			marcher.OnResize( width, height );
+			marcher.SetSkybox( skybox );
+			marcher.settings.reprojection = reprojection;
+			marcher.settings.maxHistory = maxHistory;
+
+			double error = 0.0;
+			float historyFraction = 0.0f;
+			for( int frame = 0; frame < frameCount; frame++ )
+			{
+				setView( camera, frame );
+				marcher.Dispatch( camera, scene, 1, nullptr, reprojection ? frame : 0 );
+				historyFraction += marcher.reprojectionStats.historyFraction;
+				if( frame % measureInterval == measureInterval - 1 )
+					error += RmsError( marcher.pixels, references[frame / measureInterval] );
+			}
+			error /= (double)references.size();
+
+			const double equivalent = EquivalentSamples( samples, plainErrors, error );
+			int length = snprintf( line, sizeof( line ), "    %s: error %.2f, ", configName, error );
+			if( equivalent < 0.0 )
+				length += snprintf( line + length, sizeof( line ) - length, "like more than %d spp standing still", maxSamples );
+			else
+				length += snprintf( line + length, sizeof( line ) - length, "like %.1f spp standing still", (std::max)( equivalent, 1.0 ) );
+			if( reprojection )
+				snprintf( line + length, sizeof( line ) - length, ", %.0f%% of pixels kept history",
+					historyFraction / (float)(frameCount - 1) * 100.0f );
+			report.push_back( line );
+		}
+	}
+
+	return report;
+}
+
+Benchmark::Report CpuRayMarcher::RunConePrepassBenchmark()
+{
+	const int width = 320;
+	const int height = 240;
+
+	Camera camera( 90.0f, 0.1f, 100.0f );
+	camera.OnResize( width, height );
+
+	//Last one puts the camera inside a sphere to check the fallback
+	auto insideSphere = []()
+	{
+		Scene scene = Scene_Sphere();
+		scene.objects[0].data[3] = 50.0f;
+		return scene;
+	};
+
+	const std::pair<const char*, std::function<Scene()>> scenes[] = {
+		{ "Scene_Sphere", Scene_Sphere },
+		{ "Scene_Cube", Scene_Cube },
+		{ "Scene_Torus", Scene_Torus },
+		{ "Scene_CornellBox", Scene_CornellBox },
+		{ "Camera inside a sphere", insideSphere }
+	};
+
+	Benchmark::Report report;
+	char line[256];
+	snprintf( line, sizeof( line ), "%dx%d, 1 sample. Primary ray steps without and with the 1/8 + 1/4 cone pre-pass", width, height );
+	report.push_back( line );
+
+	for( const auto& [name, build] : scenes )
+	{
+		CompiledScene scene;
+		scene.Compile( build() );
+
+		CpuRayMarcher marcher;
+		marcher.OnResize( width, height );
+
+		Hydro::Timer timer;
+		marcher.Dispatch( camera, scene, 1 );
+		const float plainSeconds = timer.Mark();
+		const PrepassStats plain = marcher.GetPrepassStats();
+
+		marcher.GetSettings().conePrepass = true;
+		timer.Mark();
+		marcher.Dispatch( camera, scene, 1 );
+		const float prepassSeconds = timer.Mark();
+		const PrepassStats& prepass = marcher.GetPrepassStats();
+
+		const int64_t saved = plain.primarySteps - prepass.primarySteps;
+		snprintf( line, sizeof( line ), "%s: %lld -> %lld primary steps, %lld saved (%lld estimated), %lld cone steps%s",
+			name, (long long)plain.primarySteps, (long long)prepass.primarySteps, (long long)saved,
+			(long long)prepass.stepsSaved, (long long)prepass.coneSteps, prepass.cameraInside ? ", camera inside, skipped" : "" );
+		report.push_back( line );
+		snprintf( line, sizeof( line ), "    frame %.1fms -> %.1fms, pre-pass %.2fms",
+			plainSeconds * 1000.0f, prepassSeconds * 1000.0f, prepass.time );
+		report.push_back( line );
+	}
+
+	return report;
+}
+
+Benchmark::Report CpuRayMarcher::RunNormalsBenchmark()
+{
+	const int pointCount = 4096;
+	const float minSeconds = 0.25f;
+
+	Benchmark::Report report;
+	report.push_back( "Normal at surface points of random scenes, single thread" );
+	char line[256];
+
+	for( int count : { 10, 100, 1000 } )
+	{
+		float extent;
+		const CompiledScene scene = CompiledScene::RandomPrimitives( count, 1234u, extent );
+
+		//Hits of rays aimed at the center of random objects, misses through the hole of
+		//a torus and hits inside other objects are thrown away
+		uint32_t seed = 5678u;
+		std::vector<std::pair<int, Vec3F>> points;
+		while( (int)points.size() < pointCount )
+		{
+			const int object = (std::min)( (int)(Random::Float( seed ) * (float)count), count - 1 );
+			Vec3F boundsMin, boundsMax;
+			const uint32_t primitive = scene.GetObjectPrimitive( object );
+			scene.GetPrimitiveBounds( Bvh::GetType( primitive ), Bvh::GetIndex( primitive ), boundsMin, boundsMax );
+			const Vec3F center = (boundsMin + boundsMax) * 0.5f;
+			Vec3F p = center + Random::UnitVector( seed ) * 2.0f;
+			const Vec3F direction = (center - p).Normalized();
+			for( int i = 0; i < 64; i++ )
+			{
+				p += direction * SignedDistancePrimitive( scene, primitive, p );
+			}
+
+			if( std::abs( SignedDistancePrimitive( scene, primitive, p ) ) < 1e-4f && SignedDistanceScene( scene, p ).objectIndex == object )
+				points.emplace_back( object, p );
+		}
+
+		auto measure = [&points, minSeconds]( auto normal )
+		{
+			float checksum = 0.0f;
+			int64_t evaluated = 0;
+			Hydro::Timer timer;
+			do
+			{
+				for( int i = 0; i < 64; i++ )
+				{
+					const auto& [object, p] = points[evaluated++ % points.size()];
+					checksum += normal( object, p ).x;
+				}
+			} while( timer.Peek() < minSeconds );
+			volatile float sink = checksum;
+			(void)sink;
+			return timer.Mark() * 1e9 / (double)evaluated;
+		};
+
+		const double sceneTime = measure( [&scene]( int, Vec3F p ) { return SceneNormalForwardDifference( scene, p ); } );
+		const double analyticTime = measure( [&scene]( int object, Vec3F p ) { return ObjectNormal( scene, object, p ); } );
+
+		double angle = 0.0;
+		for( const auto& [object, p] : points )
+		{
+			const float cosine = Vec3F::Dot( ObjectNormal( scene, object, p ), SceneNormalForwardDifference( scene, p ) );
+			angle += std::acos( (std::max)( -1.0f, (std::min)( cosine, 1.0f ) ) ) * 180.0f / PI;
+		}
+
+		snprintf( line, sizeof( line ), "%d objects: scene differences %.0f ns, analytic %.0f ns (%.1fx), %.2f degrees mean difference",
+			count, sceneTime, analyticTime, sceneTime / analyticTime, angle / pointCount );
+		report.push_back( line );
+	}
+
+	const int width = 160;
+	const int height = 120;
+	Camera camera( 90.0f, 0.1f, 100.0f );
+	camera.OnResize( width, height );
+
+	const std::pair<const char*, Scene( * )()> scenes[] = {
+		{ "Scene_Sphere", Scene_Sphere },
+		{ "Scene_Torus", Scene_Torus },
+		{ "Scene_CornellBox", Scene_CornellBox }
+	};
+
+	snprintf( line, sizeof( line ), "%dx%d frames, 1 sample, all bounces", width, height );
+	report.push_back( line );
+
+	for( const auto& [name, build] : scenes )
+	{
+		CompiledScene scene;
+		scene.Compile( build() );
+
+		CpuRayMarcher marcher;
+		marcher.OnResize( width, height );
+
+		float seconds[2];
+		for( int analytic = 0; analytic < 2; analytic++ )
+		{
+			marcher.GetSettings().analyticNormals = analytic == 1;
+			Hydro::Timer timer;
+			marcher.Dispatch( camera, scene, 1 );
+			seconds[analytic] = timer.Mark();
+		}
+
+		snprintf( line, sizeof( line ), "    %s: %.1fms -> %.1fms", name, seconds[0] * 1000.0f, seconds[1] * 1000.0f );
+		report.push_back( line );
+	}
+
+	return report;
+}
@@ -0,0 +1,390 @@
+#pragma once
+#include "../Utils/Matrix.h"
+#include "../Utils/JobSystem.h"
+#include "../Utils/CancellationToken.h"
+#include "../Win/Texture.h"
+#include "Camera.h"
+#include "CompiledScene.h"
+#include "DistanceCache.h"
+#include "Ray.h"
+#include "SphereTracing.h"
+#include "AdaptiveSampling.h"
+#include "Denoiser.h"
+#include "Aov.h"
+#include "Benchmark.h"
+#include "Sampler.h"
+#include "PacketMarcher.h"
+#include "RussianRoulette.h"
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstdint>
+
+using namespace Hydro;
+
+//Portable C++ port of RayMarcher.hlsl, renders a compiled Scene into an
+//in-memory RGBA buffer using every core without touching Graphics/Image
+class CpuRayMarcher
+{
+public:
+	struct Settings
+	{
+		//Over-relaxed sphere tracing when above 1
+		float relaxation = 1.0f;
+		//Start primary rays from a distance found by cone marching pixel blocks
+		bool conePrepass = false;
+		//Gradient of the hit object instead of four scene distances, off only for comparisons
+		bool analyticNormals = true;
+		//Bounces per path
+		int maxDepth = 20;
+		//Only tiles whose mean relative error is above errorThreshold get more samples
+		bool adaptiveSampling = false;
+		float errorThreshold = 0.05f;
+		//Samples a tile gets before its error is trusted
+		int minSamples = 16;
+		//Edge-avoiding a-trous filter over the accumulated image
+		bool denoise = false;
+		//AovBit mask of the outputs written next to the image, the denoiser adds the ones it needs
+		uint32_t aovs = 0;
+		//A camera move keeps the samples of pixels whose first hit was visible before
+		bool reprojection = false;
+		//Samples of the old view a pixel keeps at most, fewer follow lighting changes faster but are noisier
+		int maxHistory = 16;
+		//Diffuse and rough metal bounces also sample a point on the emitting spheres and
+		//boxes, combined with the bounce direction by multiple importance sampling
+		bool nextEventEstimation = false;
+		//From rouletteMinDepth bounces on paths end at random by their throughput, the ones
+		//that go on count for more so the image stays the same
+		bool russianRoulette = false;
+		int rouletteMinDepth = 3;
+		//Where the random numbers of the paths come from, only change it with a new image
+		SamplerType sampler = SamplerType::Sobol;
+		//Paths of many tiles advance a bounce at a time through separate stages instead of
+		//one path after the other, same image
+		bool wavefront = false;
+		//The march stage of the wavefront advances 8 or 16 paths at once with the PacketMarcher,
+		//it has no distance cache or relaxation so those still march one path at a time
+		bool packetMarching = true;
+		//Previews interpolate between the block samples on the same surface instead of
+		//filling every block with its own
+		bool edgeAwarePreview = true;
+	};
+
+	struct PrepassStats
+	{
+		bool active = false;
+		//Camera inside an object, every primary ray started at the camera
+		bool cameraInside = false;
+		int64_t coneSteps = 0;
+		//MarchRay steps of the first bounce over all render iterations
+		int64_t primarySteps = 0;
+		//Steps the primary rays skipped, estimated from the center ray of every fine block
+		int64_t stepsSaved = 0;
+		float time = 0.0f;
+	};
+
+	struct ReprojectionStats
+	{
+		//Last Dispatch followed a camera move
+		bool active = false;
+		//Share of the pixels that kept samples of the old view, the others started over
+		float historyFraction = 0.0f;
+	};
+
+	//Shade queue bins, materials with a higher id share the last one
+	static constexpr int materialBins = 4;
+
+	struct WavefrontStats
+	{
+		//Last Dispatch ran the wavefront stages
+		bool active = false;
+		//Milliseconds every stage took over all passes
+		float generateTime = 0.0f;
+		float marchTime = 0.0f;
+		float sortTime = 0.0f;
+		float missTime = 0.0f;
+		float shadeTime = 0.0f;
+		float accumulateTime = 0.0f;
+		//Bounces of all batches, every pass marches the live paths of its batch once
+		int passes = 0;
+		int batches = 0;
+		//Live paths of a pass over the paths of its batch, averaged over the passes
+		float occupancy = 0.0f;
+		//Paths the march stage advanced at once, 1 when it marched them one at a time
+		int packetWidth = 1;
+		//Hits shaded per Material::id bin and rays that went to the sky
+		int64_t shadedRays[materialBins] = {};
+		int64_t missedRays = 0;
+	};
+
+	//Left by the last dispatch that was cancelled
+	struct CancelStats
+	{
+		//Paths traced before it stopped, thrown away with the frame
+		int64_t samplesTraced = 0;
+		//Paths of the frame it never started
+		int64_t samplesSkipped = 0;
+	};
+public:
+	CpuRayMarcher();
+	void OnResize( int width, int height );
+	//The distance cache is optional and has to be built from the same scene. Samples are
+	//added to the ones of earlier dispatches and the average is written to the pixels,
+	//frameIndex 0 starts over. With reprojection a camera different from the last one
+	//moves the samples to where the new camera sees them. Once cancel is cancelled the
+	//workers stop at their next tile or sample and false is returned, the image is then
+	//unfinished and the next dispatch has to start over
+	bool Dispatch( const Camera& camera, const CompiledScene& scene, int renderIterations, const DistanceCache* pDistanceCache = nullptr,
+		uint32_t frameIndex = 0, const CancellationToken& cancel = CancellationToken() );
+	//One path per blockSize squared pixels written straight to the pixels, upsampled to the
+	//full image. Leaves the accumulated samples alone, the next Dispatch overwrites it.
+	//Stops at the next row of blocks once cancel is cancelled and returns false
+	bool DispatchPreview( const Camera& camera, const CompiledScene& scene, int blockSize, const DistanceCache* pDistanceCache = nullptr,
+		const CancellationToken& cancel = CancellationToken() );
+	void SetSkybox( const std::string& path );
+	//Workers of the render, the distance cache of the scene is built on them too
+	Hydro::JobSystem& GetJobs() { return *pJobs; }
+	std::vector<uint32_t>& GetPixels() { return pixels; }
+	int GetWidth() const { return width; }
+	int GetHeight() const { return height; }
+	Settings& GetSettings() { return settings; }
+	//Iterations of every MarchRay call in the last Dispatch
+	const StepHistogram& GetStepHistogram() const { return stepHistogram; }
+	//Primary steps are counted even with the pre-pass disabled
+	const PrepassStats& GetPrepassStats() const { return prepassStats; }
+	const AdaptiveSamplingStats& GetAdaptiveStats() const { return adaptiveStats; }
+	const ReprojectionStats& GetReprojectionStats() const { return reprojectionStats; }
+	const PathStats& GetPathStats() const { return pathStats; }
+	const WavefrontStats& GetWavefrontStats() const { return wavefrontStats; }
+	const CancelStats& GetCancelStats() const { return cancelStats; }
+	Denoiser& GetDenoiser() { return denoiser; }
+	//Allocated on the next Dispatch after the mask changed
+	const AovBuffers& GetAovs() const { return aovs; }
+	//Linear beauty image and every enabled AOV as <prefix>_<name>.pfm
+	bool ExportAovs( const std::string& prefix ) const;
+	//Plain against over-relaxed sphere tracing on the built in scenes
+	static Benchmark::Report RunSphereTracingBenchmark();
+	//Error of next event estimation against plain path tracing in the same time
+	static Benchmark::Report RunNextEventBenchmark();
+	//Error of every sampler after the same number of samples
+	static Benchmark::Report RunSamplerBenchmark();
+	//Error of Russian roulette against full length paths in the same time
+	static Benchmark::Report RunRussianRouletteBenchmark();
+	//Frame time and stages of the wavefront path tracer against one path per thread
+	static Benchmark::Report RunWavefrontBenchmark();
+	//Time and error of the coarse previews against the first full frame
+	static Benchmark::Report RunPreviewBenchmark();
+	//Samples adaptive sampling needs to reach the error of uniform sampling
+	static Benchmark::Report RunAdaptiveSamplingBenchmark();
+	//Samples per pixel the denoised image saves for the same error
+	static Benchmark::Report RunDenoiserBenchmark();
+	//Error along a camera path with and without reprojection
+	static Benchmark::Report RunReprojectionBenchmark();
+	//Primary ray steps with and without the cone pre-pass on the built in scenes
+	static Benchmark::Report RunConePrepassBenchmark();
+	//Analytic object normals against the four scene distance estimate
+	static Benchmark::Report RunNormalsBenchmark();
+	//Time from cancelling a frame until it stops and until the next image is done, against
+	//letting the stale frame finish
+	static Benchmark::Report RunCancellationBenchmark();
+private:
+	//Same content as the constant buffer of the compute shader
+	struct DispatchData
+	{
+		Matrix4F inverseProjection;
+		Matrix4F inverseView;
+		Vec3F cameraPosition;
+		int renderIterations;
+		//Seed of the image, the samples of a pixel are told apart by their index
+		uint32_t randomSeed;
+		SamplerType sampler;
+		const CompiledScene* scene;
+		const DistanceCache* distanceCache;
+		SphereTraceSettings trace;
+		//Safe start distance per fine pre-pass block, null without the pre-pass
+		const float* startDistances;
+		bool analyticNormals;
+		int maxDepth;
+		//Bounces before Russian roulette, maxDepth when it is off
+		int rouletteMinDepth;
+		//Pixels start from the reprojected history instead of their own samples
+		bool reproject;
+		//March the unjittered ray of every pixel for the next reprojection
+		bool tracePrimary;
+		bool nextEventEstimation;
+		//Polled before every tile and sample
+		CancellationToken cancel;
+	};
+
+	//Counted by every worker on its own and merged after the dispatch
+	struct WorkerStats
+	{
+		StepHistogram steps;
+		int64_t primarySteps = 0;
+		int64_t coneSteps = 0;
+		int64_t stepsSaved = 0;
+		int64_t reprojectedPixels = 0;
+		int64_t paths = 0;
+		int64_t pathRays = 0;
+		int64_t terminatedPaths = 0;
+		int64_t raysSaved = 0;
+	};
+
+	//Sums over the samples of one pixel
+	struct PixelSamples
+	{
+		Vec3F color;
+		float luminanceSquares = 0.0f;
+		//AOVs of the first surface the primary rays hit
+		Vec3F albedo;
+		Vec3F normal;
+		float depth = 0.0f;
+		//March iterations of the whole path
+		float steps = 0.0f;
+		//Of the last sample, -1 for the sky
+		float objectId = -1.0f;
+		float materialId = -1.0f;
+	};
+
+	//Everything a path carries from one bounce to the next
+	struct PathState
+	{
+		Sampler sampler;
+		Ray ray;
+		//Where the march of the camera ray starts
+		float startDistance = 0.0f;
+		int depth = 0;
+		Vec3F throughput = Vec3F( 1.0f );
+		//Density the bounce direction was picked with, 0 for the camera ray and mirrors
+		float scatterPdf = 0.0f;
+		HitPayload hit;
+		//Color and AOVs of this path only
+		PixelSamples samples;
+	};
+
+	//Camera of the last Dispatch, and the image of the camera before the last move
+	//swapped in from the accumulation
+	struct History
+	{
+		Matrix4F viewProjection;
+		Vec3F cameraPosition;
+		std::vector<Vec3F> accumulation;
+		std::vector<float> luminanceSquares;
+		std::vector<float> sampleCounts;
+		std::vector<float> primaryDepth;
+		std::vector<Vec3F> primaryNormal;
+	};
+private:
+	template<typename F>
+	void ParallelFor( int count, F&& function ) const;
+	//Everything but the reprojection flags, which start off
+	DispatchData MakeDispatchData( const Camera& camera, const CompiledScene& scene, int renderIterations, const DistanceCache* pDistanceCache ) const;
+	void ConePrepass( DispatchData& data, std::vector<WorkerStats>& workerStats );
+	//Marches the cone around every primary ray of a block from t, returns how far all of them are empty
+	float ConeMarch( const DispatchData& data, int x0, int y0, int size, float t, int& steps ) const;
+	Vec3F PrimaryDirection( const DispatchData& data, int x, int y ) const;
+	float SceneDistance( const DispatchData& data, Vec3F p ) const;
+	//Reallocates the AOVs and points the denoiser at its features
+	void ConfigureAovs( uint32_t mask );
+	//Adds samples to every pixel of the tile and updates its error
+	void RenderTile( const DispatchData& data, int tile, WorkerStats& stats );
+	//RenderTile with the samples of a pixel from pixelSamples( x, y, index )
+	template<typename F>
+	void AccumulateTile( const DispatchData& data, int tile, WorkerStats& stats, F&& pixelSamples );
+	//Same samples as RenderTile on every active tile, stage by stage over queues of paths
+	void RenderWavefront( const DispatchData& data, const std::vector<int>& activeTiles, std::vector<WorkerStats>& workerStats );
+	//First hit of the unjittered ray through the pixel, the sky is at the max distance
+	void TracePrimary( const DispatchData& data, int x, int y, size_t index, WorkerStats& stats );
+	//Adds the history of the pixel to its accumulation if the old camera saw the same
+	//surface, returns false if no tap passed the depth and normal checks
+	bool ReprojectPixel( const DispatchData& data, int x, int y, size_t index );
+	//Moves the means of the enabled AOVs towards the newSamples of pixel, samples counts all of them
+	void UpdateAovs( const PixelSamples& pixel, size_t index, int newSamples, float samples );
+	//The samples of the pixel get the indices from sampleIndex on
+	PixelSamples PerPixel( const DispatchData& data, int x, int y, uint32_t sampleIndex, WorkerStats& stats ) const;
+	static void AddPath( PixelSamples& samples, const PixelSamples& path );
+	//Camera ray of sample sampleIndex through the pixel
+	PathState StartPath( const DispatchData& data, int x, int y, uint32_t sampleIndex, WorkerStats& stats ) const;
+	//Runs the stages below on one path until it ends
+	void RayColor( const DispatchData& data, PathState& path, WorkerStats& stats ) const;
+	//Marches the ray of the path, the camera ray also adds the first hit to the AOVs
+	void MarchPath( const DispatchData& data, PathState& path, WorkerStats& stats ) const;
+	//Parts of MarchPath before and after the march, steps are the ones the march took
+	void JitterPath( const DispatchData& data, PathState& path ) const;
+	void EndMarch( const DispatchData& data, PathState& path, uint64_t steps, WorkerStats& stats ) const;
+	//MarchPath over the queued paths from begin to end as packets of the PacketMarcher
+	void MarchPackets( const DispatchData& data, const std::vector<int>& queue, size_t begin, size_t end, WorkerStats& stats );
+	void MissPath( PathState& path ) const;
+	//Light of the hit and the next bounce, returns false when the path ended
+	bool ShadePath( const DispatchData& data, PathState& path, WorkerStats& stats ) const;
+	//Emitted light from a point picked on the emitters, weighted against the bounce finding it.
+	//dimension is the first of the bounce
+	Vec3F SampleEmitters( const DispatchData& data, const Ray& ray, const HitPayload& hit, const Material& material, const Sampler& sampler, uint32_t dimension, WorkerStats& stats ) const;
+	//Shadow ray that ignores the emitter at its end
+	bool Occluded( const DispatchData& data, const Ray& ray, float length, int objectIndex, WorkerStats& stats ) const;
+	HitPayload MarchRay( const DispatchData& data, Ray ray, float startDistance, WorkerStats& stats ) const;
+	Vec3F HitNormal( const DispatchData& data, const HitPayload& hit ) const;
+	Vec3F SampleSkybox( Vec3F direction ) const;
+private:
+	static constexpr int tileSize = 16;
+	//Pixels per side of the coarse and fine pre-pass blocks, 1/8 and 1/4 resolution
+	static constexpr int coarseBlockSize = 8;
+	static constexpr int fineBlockSize = 4;
+	static constexpr int maxConeSteps = 128;
+	//Below this the denoiser estimates the variance from the neighbours, like SVGF
+	static constexpr int minVarianceSamples = 4;
+	//Relative depth difference and normal cosine a history tap has to stay within
+	static constexpr float historyDepthTolerance = 0.05f;
+	static constexpr float historyNormalCos = 0.9f;
+	//Relative depth difference of the block samples an edge-aware preview blends
+	static constexpr float previewDepthTolerance = 0.1f;
+	//Paths a wavefront batch holds at most, whole tiles are added until the next would not fit
+	static constexpr int wavefrontPaths = 1 << 16;
+	int width = 0;
+	int height = 0;
+	unsigned int threadCount;
+	//Workers besides the calling thread, so ParallelFor slots match threadCount
+	std::unique_ptr<Hydro::JobSystem> pJobs;
+	Settings settings;
+	StepHistogram stepHistogram;
+	PrepassStats prepassStats;
+	std::vector<float> coarseDistances;
+	std::vector<float> fineDistances;
+	std::vector<uint32_t> pixels;
+	//Linear color and squared luminance summed over the samples of the pixel
+	std::vector<Vec3F> accumulation;
+	std::vector<float> luminanceSquares;
+	//Not whole numbers after a reprojection blended the history of several pixels
+	std::vector<float> sampleCounts;
+	//Jittered samples disagree at every edge, so the history is validated with these instead of the AOVs
+	std::vector<float> primaryDepth;
+	std::vector<Vec3F> primaryNormal;
+	//Primary hits belong to the camera of the last Dispatch
+	bool primaryValid = false;
+	History history;
+	ReprojectionStats reprojectionStats;
+	PathStats pathStats;
+	WavefrontStats wavefrontStats;
+	CancelStats cancelStats;
+	//Path states of the wavefront batch, kept between dispatches
+	std::vector<PathState> paths;
+	//Rays and hits of the queued paths when the march stage runs packets
+	PacketMarcher packetMarcher;
+	RayBatch packetRays;
+	MarchResult packetResults;
+	//Renewed whenever the samples of the pixels start over
+	uint32_t imageSeed = 0;
+	int tilesX = 0;
+	int tilesY = 0;
+	//Samples since the image started or the camera moved, adaptive sampling waits for minSamples of them
+	std::vector<int> tileSamples;
+	//Mean relative error of the pixels in a tile
+	std::vector<float> tileErrors;
+	AdaptiveSamplingStats adaptiveStats;
+	Denoiser denoiser;
+	//Means over the samples of every pixel, like accumulation they are only updated for active tiles
+	AovBuffers aovs;
+	//Pixels hold the denoised image, converged tiles have to be written again once the denoiser is off
+	bool pixelsDenoised = false;
+	std::unique_ptr<Texture> pSkybox;
+};
@@ -0,0 +1,123 @@
+#include "D3D11GpuDevice.h"
+#include <cassert>
+#include <cstring>
+
+D3D11GpuDevice::D3D11GpuDevice( Graphics& gfx )
+	:
+	gfx( gfx )
+{
+}
+
+GpuDevice::Id D3D11GpuDevice::CreateConstantBuffer( size_t size )
+{
+	assert( size % 16 == 0 );
+	D3D11_BUFFER_DESC desc = {};
+	desc.ByteWidth = (UINT)size;
+	desc.Usage = D3D11_USAGE_DYNAMIC;
+	desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+	desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+
+	Resource resource;
+	auto hr = gfx.GetDevice()->CreateBuffer( &desc, nullptr, &resource.pBuffer );
+	assert( SUCCEEDED( hr ) );
+	stats.bufferAllocations++;
+
+	return Add( std::move( resource ) );
+}
+
+void D3D11GpuDevice::Upload( Id buffer, const void* pData, size_t size )
+{
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	auto hr = gfx.GetDeviceContext()->Map( GetBuffer( buffer ), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped );
+	assert( SUCCEEDED( hr ) );
+	std::memcpy( mapped.pData, pData, size );
+	gfx.GetDeviceContext()->Unmap( GetBuffer( buffer ), 0 );
+	stats.uploads++;
+	stats.uploadedBytes += (int64_t)size;
+}
+
+GpuDevice::Id D3D11GpuDevice::CreateTexture( int width, int height )
+{
+	D3D11_TEXTURE2D_DESC textureDesc = {};
+	textureDesc.Width = width;
+	textureDesc.Height = height;
+	textureDesc.MipLevels = 1;
+	textureDesc.ArraySize = 1;
+	textureDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+	textureDesc.SampleDesc.Count = 1;
+	textureDesc.Usage = D3D11_USAGE_DEFAULT;
+	textureDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+
+	Resource resource;
+	auto hr = gfx.GetDevice()->CreateTexture2D( &textureDesc, nullptr, &resource.pTexture );
+	assert( SUCCEEDED( hr ) );
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.Format = textureDesc.Format;
+	srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
+	srvDesc.Texture2D.MipLevels = 1;
+	hr = gfx.GetDevice()->CreateShaderResourceView( resource.pTexture.Get(), &srvDesc, &resource.pView );
+	assert( SUCCEEDED( hr ) );
+	stats.textureAllocations++;
+
+	return Add( std::move( resource ) );
+}
+
+void D3D11GpuDevice::UploadTexture( Id texture, const void* pPixels )
+{
+	D3D11_TEXTURE2D_DESC desc;
+	GetTexture( texture )->GetDesc( &desc );
+	gfx.GetDeviceContext()->UpdateSubresource( GetTexture( texture ), 0, nullptr, pPixels, desc.Width * 4, 0 );
+	stats.uploads++;
+	stats.uploadedBytes += (int64_t)desc.Width * desc.Height * 4;
+}
+
+void D3D11GpuDevice::Release( Id resource )
+{
+	Get( resource ) = Resource();
+	freeIds.push_back( resource );
+}
+
+ID3D11Buffer* D3D11GpuDevice::GetBuffer( Id buffer ) const
+{
+	return Get( buffer ).pBuffer.Get();
+}
+
+ID3D11Texture2D* D3D11GpuDevice::GetTexture( Id texture ) const
+{
+	return Get( texture ).pTexture.Get();
+}
+
+ID3D11ShaderResourceView* D3D11GpuDevice::GetView( Id texture ) const
+{
+	return Get( texture ).pView.Get();
+}
+
+GpuDevice::Id D3D11GpuDevice::Add( Resource resource )
+{
+	Id id;
+	if( freeIds.empty() )
+	{
+		resources.push_back( std::move( resource ) );
+		id = (Id)resources.size();
+	}
+	else
+	{
+		id = freeIds.back();
+		freeIds.pop_back();
+		Get( id ) = std::move( resource );
+	}
+	return id;
+}
+
+D3D11GpuDevice::Resource& D3D11GpuDevice::Get( Id resource )
+{
+	assert( resource != 0 && resource <= resources.size() );
+	return resources[resource - 1];
+}
+
+const D3D11GpuDevice::Resource& D3D11GpuDevice::Get( Id resource ) const
+{
+	assert( resource != 0 && resource <= resources.size() );
+	return resources[resource - 1];
+}
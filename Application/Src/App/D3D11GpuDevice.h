@@ -0,0 +1,38 @@
+#pragma once
+#include "../Win/Graphics.h"
+#include "GpuDevice.h"
+#include <vector>
+
+using namespace Hydro;
+
+//GpuDevice of the Direct3D 11 backend. Constant buffers are dynamic and written by mapping
+//them with discard, so an upload never waits for the dispatches still reading the old contents
+class D3D11GpuDevice : public GpuDevice
+{
+public:
+	D3D11GpuDevice( Graphics& gfx );
+	Id CreateConstantBuffer( size_t size ) override;
+	void Upload( Id buffer, const void* pData, size_t size ) override;
+	Id CreateTexture( int width, int height ) override;
+	void UploadTexture( Id texture, const void* pPixels ) override;
+	void Release( Id resource ) override;
+	ID3D11Buffer* GetBuffer( Id buffer ) const;
+	ID3D11Texture2D* GetTexture( Id texture ) const;
+	ID3D11ShaderResourceView* GetView( Id texture ) const;
+private:
+	struct Resource
+	{
+		Microsoft::WRL::ComPtr<ID3D11Buffer> pBuffer;
+		Microsoft::WRL::ComPtr<ID3D11Texture2D> pTexture;
+		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> pView;
+	};
+private:
+	//Id of the resource, the ids of released ones are reused
+	Id Add( Resource resource );
+	Resource& Get( Id resource );
+	const Resource& Get( Id resource ) const;
+private:
+	Graphics& gfx;
+	std::vector<Resource> resources;
+	std::vector<Id> freeIds;
+};
@@ -0,0 +1,348 @@
+#include "Denoiser.h"
+#include "../Utils/HydroTimer.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined( _M_X64 ) || defined( _M_IX86 ) || defined( __x86_64__ ) || defined( __i386__ )
+#define HYDRO_X86 1
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+	//B3 spline, the taps of one axis
+	constexpr float kernel[5] = { 1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+
+	//Single lane version for the columns where the wide taps leave the image
+	struct Float1
+	{
+		static constexpr int width = 1;
+
+		Float1() = default;
+		Float1( float v ) : v( v ) {}
+
+		static Float1 Load( const float* p ) { return Float1( *p ); }
+		void Store( float* p ) const { *p = v; }
+
+		friend Float1 operator+( Float1 a, Float1 b ) { return a.v + b.v; }
+		friend Float1 operator-( Float1 a, Float1 b ) { return a.v - b.v; }
+		friend Float1 operator*( Float1 a, Float1 b ) { return a.v * b.v; }
+		friend Float1 operator/( Float1 a, Float1 b ) { return a.v / b.v; }
+
+		static Float1 Abs( Float1 a ) { return std::abs( a.v ); }
+		//e^-a for a >= 0
+		static Float1 ExpNegative( Float1 a ) { return std::exp( -(std::min)( a.v, 80.0f ) ); }
+
+		float v;
+	};
+
+#if HYDRO_X86
+	//SSE2 is part of every x64 CPU, no dispatch needed like for the packet marcher
+	struct Float4
+	{
+		static constexpr int width = 4;
+
+		Float4() = default;
+		Float4( float v ) : v( _mm_set1_ps( v ) ) {}
+		Float4( __m128 v ) : v( v ) {}
+
+		static Float4 Load( const float* p ) { return _mm_loadu_ps( p ); }
+		void Store( float* p ) const { _mm_storeu_ps( p, v ); }
+
+		friend Float4 operator+( Float4 a, Float4 b ) { return _mm_add_ps( a.v, b.v ); }
+		friend Float4 operator-( Float4 a, Float4 b ) { return _mm_sub_ps( a.v, b.v ); }
+		friend Float4 operator*( Float4 a, Float4 b ) { return _mm_mul_ps( a.v, b.v ); }
+		friend Float4 operator/( Float4 a, Float4 b ) { return _mm_div_ps( a.v, b.v ); }
+
+		static Float4 Abs( Float4 a ) { return _mm_andnot_ps( _mm_set1_ps( -0.0f ), a.v ); }
+		//e^-a for a >= 0 as 2^i * 2^f, the fraction from a polynomial and the integer
+		//part written straight into the exponent bits. Relative error below 1e-5
+		static Float4 ExpNegative( Float4 a )
+		{
+			const __m128 t = _mm_mul_ps( _mm_min_ps( a.v, _mm_set1_ps( 80.0f ) ), _mm_set1_ps( -1.44269504f ) );
+			const __m128i i = _mm_cvtps_epi32( t );
+			const __m128 f = _mm_sub_ps( t, _mm_cvtepi32_ps( i ) );
+
+			__m128 p = _mm_set1_ps( 1.33335581e-3f );
+			p = _mm_add_ps( _mm_mul_ps( p, f ), _mm_set1_ps( 9.61812911e-3f ) );
+			p = _mm_add_ps( _mm_mul_ps( p, f ), _mm_set1_ps( 5.55041087e-2f ) );
+			p = _mm_add_ps( _mm_mul_ps( p, f ), _mm_set1_ps( 2.40226507e-1f ) );
+			p = _mm_add_ps( _mm_mul_ps( p, f ), _mm_set1_ps( 6.93147181e-1f ) );
+			p = _mm_add_ps( _mm_mul_ps( p, f ), _mm_set1_ps( 1.0f ) );
+
+			const __m128 scale = _mm_castsi128_ps( _mm_slli_epi32( _mm_add_epi32( i, _mm_set1_epi32( 127 ) ), 23 ) );
+			return _mm_mul_ps( p, scale );
+		}
+
+		__m128 v;
+	};
+#else
+	using Float4 = Float1;
+#endif
+
+	//Everything one pass reads and writes
+	struct PassData
+	{
+		int width;
+		int height;
+		int step;
+		const float* red;
+		const float* green;
+		const float* blue;
+		const float* variance;
+		const float* luminanceScale;
+		const float* albedoR;
+		const float* albedoG;
+		const float* albedoB;
+		const float* normalX;
+		const float* normalY;
+		const float* normalZ;
+		const float* depth;
+		const float* depthGradient;
+		float* outRed;
+		float* outGreen;
+		float* outBlue;
+		float* outVariance;
+		float normalScale;
+		float albedoScale;
+		float sigmaDepth;
+	};
+
+	template<typename F>
+	F Luminance( F r, F g, F b )
+	{
+		return r * F( 0.2126f ) + g * F( 0.7152f ) + b * F( 0.0722f );
+	}
+
+	template<typename F>
+	F Square( F x, F y, F z )
+	{
+		return x * x + y * y + z * z;
+	}
+
+	//Filters F::width pixels starting at x, taps outside the image are left out
+	template<typename F>
+	void FilterPixels( const PassData& p, int x, int y )
+	{
+		const size_t center = (size_t)y * p.width + x;
+		const F luminance = Luminance( F::Load( p.red + center ), F::Load( p.green + center ), F::Load( p.blue + center ) );
+		const F luminanceScale = F::Load( p.luminanceScale + center );
+		const F albedoR = F::Load( p.albedoR + center );
+		const F albedoG = F::Load( p.albedoG + center );
+		const F albedoB = F::Load( p.albedoB + center );
+		const F normalX = F::Load( p.normalX + center );
+		const F normalY = F::Load( p.normalY + center );
+		const F normalZ = F::Load( p.normalZ + center );
+		const F depth = F::Load( p.depth + center );
+		//Depth change expected per pixel of tap distance on the surface of the center pixel
+		const F depthSlope = F::Load( p.depthGradient + center ) * F( p.sigmaDepth * (float)p.step );
+
+		F red( 0.0f ), green( 0.0f ), blue( 0.0f ), variance( 0.0f ), weightSum( 0.0f );
+		for( int j = -2; j <= 2; j++ )
+		{
+			const int ty = y + j * p.step;
+			if( ty < 0 || ty >= p.height )
+				continue;
+
+			for( int i = -2; i <= 2; i++ )
+			{
+				const int tx = x + i * p.step;
+				if( tx < 0 || tx + F::width > p.width )
+					continue;
+
+				const size_t tap = (size_t)ty * p.width + tx;
+				const F tapRed = F::Load( p.red + tap );
+				const F tapGreen = F::Load( p.green + tap );
+				const F tapBlue = F::Load( p.blue + tap );
+
+				const F luminanceTerm = F::Abs( luminance - Luminance( tapRed, tapGreen, tapBlue ) ) * luminanceScale;
+				const F normalTerm = Square( normalX - F::Load( p.normalX + tap ), normalY - F::Load( p.normalY + tap ), normalZ - F::Load( p.normalZ + tap ) ) * F( p.normalScale );
+				const F albedoTerm = Square( albedoR - F::Load( p.albedoR + tap ), albedoG - F::Load( p.albedoG + tap ), albedoB - F::Load( p.albedoB + tap ) ) * F( p.albedoScale );
+				const F depthTerm = F::Abs( depth - F::Load( p.depth + tap ) ) / (depthSlope * F( (float)(std::abs( i ) + std::abs( j )) ) + F( 1e-2f ));
+
+				//One exponential for all four edge-stopping functions
+				const F weight = F( kernel[i + 2] * kernel[j + 2] ) * F::ExpNegative( luminanceTerm + normalTerm + albedoTerm + depthTerm );
+				red = red + tapRed * weight;
+				green = green + tapGreen * weight;
+				blue = blue + tapBlue * weight;
+				variance = variance + F::Load( p.variance + tap ) * weight * weight;
+				weightSum = weightSum + weight;
+			}
+		}
+
+		//The center tap always has weight, so the sum is never 0
+		const F scale = F( 1.0f ) / weightSum;
+		(red * scale).Store( p.outRed + center );
+		(green * scale).Store( p.outGreen + center );
+		(blue * scale).Store( p.outBlue + center );
+		(variance * scale * scale).Store( p.outVariance + center );
+	}
+}
+
+void Denoiser::OnResize( int width, int height )
+{
+	if( width == this->width && height == this->height )
+		return;
+
+	this->width = width;
+	this->height = height;
+	const size_t count = (size_t)width * height;
+	for( auto* v : { &input.red, &input.green, &input.blue, &input.variance, &luminanceScale, &depthGradient } )
+	{
+		v->assign( count, 0.0f );
+	}
+	for( Planes& p : planes )
+	{
+		for( auto* v : { &p.red, &p.green, &p.blue, &p.variance } )
+		{
+			v->assign( count, 0.0f );
+		}
+	}
+	output[0] = planes[0].red.data();
+	output[1] = planes[0].green.data();
+	output[2] = planes[0].blue.data();
+}
+
+void Denoiser::Denoise( Hydro::JobSystem& jobs )
+{
+	if( width == 0 || height == 0 || !input.albedo || !input.normal || !input.depth )
+		return;
+
+	Hydro::Timer timer;
+
+	jobs.ParallelFor( height, [this]( int y, unsigned int ) { PrepareRow( y ); } );
+
+	int source = 0;
+	for( int pass = 0; pass < settings.passes; pass++ )
+	{
+		const int step = 1 << pass;
+		Planes& from = planes[source];
+		Planes& to = planes[1 - source];
+
+		jobs.ParallelFor( height, [&]( int y, unsigned int ) { LuminanceScaleRow( from, y ); } );
+		jobs.ParallelFor( height, [&]( int y, unsigned int ) { FilterRow( from, to, step, y ); } );
+		source = 1 - source;
+	}
+
+	output[0] = planes[source].red.data();
+	output[1] = planes[source].green.data();
+	output[2] = planes[source].blue.data();
+
+	stats.time = timer.Mark() * 1000.0f;
+}
+
+void Denoiser::PrepareRow( int y )
+{
+	Planes& p = planes[0];
+	auto luminance = [this]( int x, int y )
+	{
+		const size_t i = (size_t)y * width + x;
+		return input.red[i] * 0.2126f + input.green[i] * 0.7152f + input.blue[i] * 0.0722f;
+	};
+
+	for( int x = 0; x < width; x++ )
+	{
+		const size_t index = (size_t)y * width + x;
+		p.red[index] = input.red[index];
+		p.green[index] = input.green[index];
+		p.blue[index] = input.blue[index];
+
+		if( input.variance[index] >= 0.0f )
+		{
+			p.variance[index] = input.variance[index];
+		}
+		else
+		{
+			//Too few samples for a variance of its own, use the one of the 7x7 neighbourhood
+			float sum = 0.0f;
+			float squares = 0.0f;
+			int count = 0;
+			for( int ny = (std::max)( y - 3, 0 ); ny <= (std::min)( y + 3, height - 1 ); ny++ )
+			{
+				for( int nx = (std::max)( x - 3, 0 ); nx <= (std::min)( x + 3, width - 1 ); nx++ )
+				{
+					const float l = luminance( nx, ny );
+					sum += l;
+					squares += l * l;
+					count++;
+				}
+			}
+			const float mean = sum / (float)count;
+			p.variance[index] = (std::max)( squares / (float)count - mean * mean, 0.0f );
+		}
+
+		//One sided differences, so silhouettes do not loosen the depth test of the surface next to them
+		auto difference = [&]( int nx, int ny ) { return std::abs( input.depth[(size_t)ny * width + nx] - input.depth[index] ); };
+		float gradientX = 1e30f;
+		float gradientY = 1e30f;
+		if( x > 0 ) gradientX = (std::min)( gradientX, difference( x - 1, y ) );
+		if( x < width - 1 ) gradientX = (std::min)( gradientX, difference( x + 1, y ) );
+		if( y > 0 ) gradientY = (std::min)( gradientY, difference( x, y - 1 ) );
+		if( y < height - 1 ) gradientY = (std::min)( gradientY, difference( x, y + 1 ) );
+		depthGradient[index] = (std::max)( gradientX < 1e30f ? gradientX : 0.0f, gradientY < 1e30f ? gradientY : 0.0f );
+	}
+}
+
+void Denoiser::LuminanceScaleRow( const Planes& source, int y )
+{
+	constexpr float blur[3] = { 0.25f, 0.5f, 0.25f };
+	for( int x = 0; x < width; x++ )
+	{
+		float variance = 0.0f;
+		for( int j = -1; j <= 1; j++ )
+		{
+			const int ny = (std::min)( (std::max)( y + j, 0 ), height - 1 );
+			for( int i = -1; i <= 1; i++ )
+			{
+				const int nx = (std::min)( (std::max)( x + i, 0 ), width - 1 );
+				variance += source.variance[(size_t)ny * width + nx] * blur[i + 1] * blur[j + 1];
+			}
+		}
+		luminanceScale[(size_t)y * width + x] = 1.0f / (settings.sigmaLuminance * std::sqrt( (std::max)( variance, 0.0f ) ) + 1e-3f);
+	}
+}
+
+void Denoiser::FilterRow( const Planes& source, Planes& destination, int step, int y ) const
+{
+	PassData data;
+	data.width = width;
+	data.height = height;
+	data.step = step;
+	data.red = source.red.data();
+	data.green = source.green.data();
+	data.blue = source.blue.data();
+	data.variance = source.variance.data();
+	data.luminanceScale = luminanceScale.data();
+	const size_t count = (size_t)width * height;
+	data.albedoR = input.albedo;
+	data.albedoG = input.albedo + count;
+	data.albedoB = input.albedo + 2 * count;
+	data.normalX = input.normal;
+	data.normalY = input.normal + count;
+	data.normalZ = input.normal + 2 * count;
+	data.depth = input.depth;
+	data.depthGradient = depthGradient.data();
+	data.outRed = destination.red.data();
+	data.outGreen = destination.green.data();
+	data.outBlue = destination.blue.data();
+	data.outVariance = destination.variance.data();
+	data.normalScale = 1.0f / (settings.sigmaNormal * settings.sigmaNormal);
+	data.albedoScale = 1.0f / (settings.sigmaAlbedo * settings.sigmaAlbedo);
+	data.sigmaDepth = settings.sigmaDepth;
+
+	//Wide loads only where every tap of all lanes is inside the row
+	const int reach = 2 * step;
+	int x = 0;
+	for( ; x < (std::min)( reach, width ); x++ )
+	{
+		FilterPixels<Float1>( data, x, y );
+	}
+	for( ; x + Float4::width + reach <= width; x += Float4::width )
+	{
+		FilterPixels<Float4>( data, x, y );
+	}
+	for( ; x < width; x++ )
+	{
+		FilterPixels<Float1>( data, x, y );
+	}
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include "../Utils/Vec3.h"
+#include "../Utils/JobSystem.h"
+#include "Aov.h"
+#include <vector>
+#include <cstddef>
+
+using namespace Hydro;
+
+//Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010). Every pass is a 5x5
+//B3 spline kernel with twice the tap spacing of the pass before, the weight of a tap
+//drops with the difference in albedo, normal and depth of the first hit and with the
+//luminance difference measured in standard deviations of the noise (SVGF, Schied et
+//al. 2017). Planes are stored as structure of arrays so four pixels filter at once
+class Denoiser
+{
+public:
+	struct Settings
+	{
+		//Tap spacing doubles every pass, 5 passes reach 62 pixels to every side
+		int passes = 5;
+		//Luminance difference in standard deviations where a tap keeps 1/e of its weight
+		float sigmaLuminance = 4.0f;
+		//Length of the normal difference
+		float sigmaNormal = 0.2f;
+		//Multiple of the expected depth difference along the surface
+		float sigmaDepth = 1.0f;
+		float sigmaAlbedo = 0.1f;
+	};
+
+	//Means over the samples of every pixel, filled by the renderer
+	struct Input
+	{
+		std::vector<float> red, green, blue;
+		//Variance of the mean luminance, negative for pixels with too few samples
+		//where it is estimated from the neighbours instead
+		std::vector<float> variance;
+		//Depth, Normal and Albedo AOVs of the renderer, laid out like in AovBuffers
+		const float* albedo = nullptr;
+		const float* normal = nullptr;
+		const float* depth = nullptr;
+	};
+
+	struct Stats
+	{
+		float time = 0.0f;
+	};
+
+	//Feature AOVs the renderer has to write for Input
+	static constexpr uint32_t requiredAovs = AovBit( Aov::Depth ) | AovBit( Aov::Normal ) | AovBit( Aov::Albedo );
+public:
+	void OnResize( int width, int height );
+	Input& GetInput() { return input; }
+	//Filters the input color a row per job, the result stays until the next call
+	void Denoise( Hydro::JobSystem& jobs );
+	Vec3F GetColor( size_t index ) const { return Vec3F( output[0][index], output[1][index], output[2][index] ); }
+	Settings& GetSettings() { return settings; }
+	const Stats& GetStats() const { return stats; }
+private:
+	//Color and luminance variance of a pass
+	struct Planes
+	{
+		std::vector<float> red, green, blue, variance;
+	};
+private:
+	void PrepareRow( int y );
+	//Edge-stopping scale of the luminance term from the 3x3 blurred variance
+	void LuminanceScaleRow( const Planes& source, int y );
+	void FilterRow( const Planes& source, Planes& destination, int step, int y ) const;
+private:
+	int width = 0;
+	int height = 0;
+	Settings settings;
+	Stats stats;
+	Input input;
+	Planes planes[2];
+	std::vector<float> luminanceScale;
+	//Smallest depth change to a horizontal or vertical neighbour
+	std::vector<float> depthGradient;
+	const float* output[3] = {};
+};
@@ -0,0 +1,579 @@
+#include "DistanceCache.h"
+#include "SignedDistance.h"
+#include "Camera.h"
+#include "Scenes.h"
+#include "../Utils/HydroTimer.h"
+#include "../Utils/Random.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+namespace
+{
+	//Trilinear interpolation of a 1-Lipschitz function is off by at most half the
+	//cell diagonal, subtracting it keeps the lookup a lower bound
+	constexpr float halfSqrt3 = 0.8660254f;
+
+	float Trilinear( const float c[8], float tx, float ty, float tz )
+	{
+		float x00 = c[0] + (c[1] - c[0]) * tx;
+		float x10 = c[2] + (c[3] - c[2]) * tx;
+		float x01 = c[4] + (c[5] - c[4]) * tx;
+		float x11 = c[6] + (c[7] - c[6]) * tx;
+		float y0 = x00 + (x10 - x00) * ty;
+		float y1 = x01 + (x11 - x01) * ty;
+		return y0 + (y1 - y0) * tz;
+	}
+
+	float BoxDistance( Vec3F p, Vec3F boundsMin, Vec3F boundsMax )
+	{
+		return Vec3F::Max( Vec3F::Max( boundsMin - p, p - boundsMax ), Vec3F( 0.0f ) ).Magnitude();
+	}
+
+	//Plain sphere tracing loop with the settings of MarchRay
+	template<typename F>
+	int MarchSteps( F&& distance, Vec3F origin, Vec3F direction, int& objectIndex )
+	{
+		objectIndex = -1;
+		for( int i = 0; i < 1000; i++ )
+		{
+			ObjectDistance d = distance( origin );
+			if( d.distance < 0.0001f )
+			{
+				objectIndex = d.objectIndex;
+				return i + 1;
+			}
+			if( d.distance > 100.0f )
+				return i + 1;
+			origin += direction * d.distance;
+		}
+		return 1000;
+	}
+}
+
+bool DistanceCache::Shape::operator==( const Shape& rhs ) const
+{
+	return type == rhs.type &&
+		a.x == rhs.a.x && a.y == rhs.a.y && a.z == rhs.a.z && a.w == rhs.a.w &&
+		b.x == rhs.b.x && b.y == rhs.b.y && b.z == rhs.b.z && b.w == rhs.b.w;
+}
+
+std::vector<DistanceCache::Shape> DistanceCache::GetShapes( const CompiledScene& scene )
+{
+	std::vector<Shape> result( scene.objectMaterials.size() );
+	auto add = [&]( int type, size_t index, int object, Vec4F a, Vec4F b )
+	{
+		if( object >= (int)result.size() )
+			result.resize( object + 1 );
+
+		Shape& shape = result[object];
+		shape.type = type;
+		shape.a = a;
+		shape.b = b;
+		scene.GetPrimitiveBounds( type, index, shape.boundsMin, shape.boundsMax );
+	};
+
+	for( size_t i = 0; i < scene.spheres.size(); i++ )
+	{
+		add( Bvh::Sphere, i, scene.sphereObjects[i], scene.spheres[i], Vec4F( 0.0f, 0.0f, 0.0f, 0.0f ) );
+	}
+	for( size_t i = 0; i < scene.boxCenters.size(); i++ )
+	{
+		add( Bvh::Box, i, scene.boxObjects[i], scene.boxCenters[i], scene.boxSizes[i] );
+	}
+	for( size_t i = 0; i < scene.tori.size(); i++ )
+	{
+		add( Bvh::Torus, i, scene.torusObjects[i], scene.tori[i], Vec4F( scene.torusMinorRadii[i], 0.0f, 0.0f, 0.0f ) );
+	}
+
+	return result;
+}
+
+void DistanceCache::Clear()
+{
+	shapes.clear();
+	corners.clear();
+	cellDistances.clear();
+	cellBricks.clear();
+	bricks.clear();
+	freeBricks.clear();
+	dimensions[0] = dimensions[1] = dimensions[2] = 0;
+	builtResolution = 0;
+	UpdateStats();
+}
+
+void DistanceCache::Build( const CompiledScene& scene, Hydro::JobSystem& jobs )
+{
+	Hydro::Timer timer;
+
+	Clear();
+	shapes = GetShapes( scene );
+	builtResolution = settings.resolution;
+
+	bool any = false;
+	for( const Shape& shape : shapes )
+	{
+		if( shape.type < 0 )
+			continue;
+
+		sceneMin = any ? Vec3F::Min( sceneMin, shape.boundsMin ) : shape.boundsMin;
+		sceneMax = any ? Vec3F::Max( sceneMax, shape.boundsMax ) : shape.boundsMax;
+		any = true;
+	}
+
+	if( !any )
+		return;
+
+	//One empty cell of margin on every side
+	Vec3F size = sceneMax - sceneMin;
+	const float longest = (std::max)( (std::max)( size.x, size.y ), (std::max)( size.z, 1e-3f ) );
+	const int resolution = (std::max)( settings.resolution, 4 );
+	cellSize = longest / (float)(resolution - 2);
+	voxelSize = cellSize / (float)(brickSize - 1);
+	//Bricked cell centers are within halfDiagonal + cellSize of a surface
+	brickRange = 2.0f * halfSqrt3 * cellSize + cellSize;
+	origin = sceneMin - Vec3F( cellSize );
+	dimensions[0] = (int)std::ceil( size.x / cellSize ) + 2;
+	dimensions[1] = (int)std::ceil( size.y / cellSize ) + 2;
+	dimensions[2] = (int)std::ceil( size.z / cellSize ) + 2;
+
+	const int cellCount = dimensions[0] * dimensions[1] * dimensions[2];
+	corners.resize( (size_t)(dimensions[0] + 1) * (dimensions[1] + 1) * (dimensions[2] + 1) );
+	cellDistances.resize( cellCount );
+	cellBricks.assign( cellCount, -1 );
+
+	//Far field, one z slice of corners per task
+	jobs.ParallelFor( dimensions[2] + 1, [&]( int z, unsigned int )
+	{
+		for( int y = 0; y <= dimensions[1]; y++ )
+		{
+			for( int x = 0; x <= dimensions[0]; x++ )
+			{
+				corners[CornerIndex( x, y, z )] = SignedDistanceScene( scene, CornerPosition( x, y, z ) ).distance;
+			}
+		}
+	} );
+
+	//Narrow band, allocated serially so brick indices are deterministic
+	const float halfDiagonal = halfSqrt3 * cellSize;
+	jobs.ParallelFor( cellCount, [&]( int cell, unsigned int )
+	{
+		cellDistances[cell] = SignedDistanceScene( scene, CellMin( cell ) + Vec3F( cellSize * 0.5f ) ).distance;
+	} );
+
+	std::vector<int> bricked;
+	for( int cell = 0; cell < cellCount; cell++ )
+	{
+		if( std::abs( cellDistances[cell] ) < halfDiagonal + cellSize )
+		{
+			cellBricks[cell] = (int)bricked.size();
+			bricked.push_back( cell );
+		}
+	}
+
+	bricks.resize( bricked.size() * brickSamples );
+	jobs.ParallelFor( (int)bricked.size(), [&]( int i, unsigned int )
+	{
+		FillBrick( scene, bricked[i], i );
+	} );
+
+	UpdateStats();
+	stats.fullRebuild = true;
+	stats.rebuiltCorners = (int)corners.size();
+	stats.rebuiltBricks = (int)bricked.size();
+	stats.buildTime = timer.Mark();
+}
+
+bool DistanceCache::Update( const CompiledScene& scene, Hydro::JobSystem& jobs )
+{
+	std::vector<Shape> newShapes = GetShapes( scene );
+	if( newShapes.size() != shapes.size() || builtResolution != settings.resolution )
+	{
+		Build( scene, jobs );
+		return true;
+	}
+
+	bool any = false;
+	int changed = 0;
+	Vec3F dirtyMin;
+	Vec3F dirtyMax;
+	for( size_t i = 0; i < shapes.size(); i++ )
+	{
+		if( shapes[i] == newShapes[i] )
+			continue;
+
+		//Both where the object was and where it is now
+		for( const Shape* shape : { &shapes[i], &newShapes[i] } )
+		{
+			if( shape->type < 0 )
+				continue;
+
+			dirtyMin = any ? Vec3F::Min( dirtyMin, shape->boundsMin ) : shape->boundsMin;
+			dirtyMax = any ? Vec3F::Max( dirtyMax, shape->boundsMax ) : shape->boundsMax;
+			any = true;
+		}
+		changed++;
+	}
+
+	if( changed == 0 )
+		return false;
+
+	if( IsEmpty() )
+	{
+		Build( scene, jobs );
+		return true;
+	}
+
+	//The grid only has to be laid out again if something left the scene bounds
+	const bool inside = !any ||
+		(dirtyMin.x >= sceneMin.x && dirtyMin.y >= sceneMin.y && dirtyMin.z >= sceneMin.z &&
+		dirtyMax.x <= sceneMax.x && dirtyMax.y <= sceneMax.y && dirtyMax.z <= sceneMax.z);
+	if( !inside || changed * 4 > (int)shapes.size() )
+	{
+		Build( scene, jobs );
+		return true;
+	}
+
+	Hydro::Timer timer;
+	shapes = std::move( newShapes );
+	if( any )
+		Rebuild( scene, jobs, dirtyMin, dirtyMax );
+	stats.buildTime = timer.Mark();
+	return true;
+}
+
+void DistanceCache::Rebuild( const CompiledScene& scene, Hydro::JobSystem& jobs, Vec3F dirtyMin, Vec3F dirtyMax )
+{
+	//A sample can only change if the edited object is within its old distance,
+	//the object was either the closest one or could now be closer. Cells also
+	//cover every brick sample, which is at most half a diagonal from the center
+	std::vector<int> dirtyCorners;
+	for( int z = 0; z <= dimensions[2]; z++ )
+	{
+		for( int y = 0; y <= dimensions[1]; y++ )
+		{
+			for( int x = 0; x <= dimensions[0]; x++ )
+			{
+				const int index = CornerIndex( x, y, z );
+				if( BoxDistance( CornerPosition( x, y, z ), dirtyMin, dirtyMax ) <= std::abs( corners[index] ) + voxelSize )
+					dirtyCorners.push_back( index );
+			}
+		}
+	}
+
+	const float halfDiagonal = halfSqrt3 * cellSize;
+	std::vector<int> dirtyCells;
+	for( int cell = 0; cell < (int)cellDistances.size(); cell++ )
+	{
+		Vec3F center = CellMin( cell ) + Vec3F( cellSize * 0.5f );
+		if( BoxDistance( center, dirtyMin, dirtyMax ) <= std::abs( cellDistances[cell] ) + 2.0f * halfDiagonal + voxelSize )
+			dirtyCells.push_back( cell );
+	}
+
+	jobs.ParallelFor( (int)dirtyCorners.size(), [&]( int i, unsigned int )
+	{
+		const int index = dirtyCorners[i];
+		const int rowLength = dimensions[0] + 1;
+		const int sliceLength = rowLength * (dimensions[1] + 1);
+		corners[index] = SignedDistanceScene( scene, CornerPosition( index % rowLength, (index % sliceLength) / rowLength, index / sliceLength ) ).distance;
+	} );
+
+	//Brick allocation changes serially, filling them is parallel again
+	jobs.ParallelFor( (int)dirtyCells.size(), [&]( int i, unsigned int )
+	{
+		const int cell = dirtyCells[i];
+		cellDistances[cell] = SignedDistanceScene( scene, CellMin( cell ) + Vec3F( cellSize * 0.5f ) ).distance;
+	} );
+
+	std::vector<int> filled;
+	for( int cell : dirtyCells )
+	{
+		const bool needsBrick = std::abs( cellDistances[cell] ) < halfDiagonal + cellSize;
+		int& brick = cellBricks[cell];
+		if( !needsBrick )
+		{
+			if( brick >= 0 )
+				freeBricks.push_back( brick );
+			brick = -1;
+			continue;
+		}
+
+		if( brick < 0 )
+		{
+			if( !freeBricks.empty() )
+			{
+				brick = freeBricks.back();
+				freeBricks.pop_back();
+			}
+			else
+			{
+				brick = (int)(bricks.size() / brickSamples);
+				bricks.resize( bricks.size() + brickSamples );
+			}
+		}
+		filled.push_back( cell );
+	}
+
+	jobs.ParallelFor( (int)filled.size(), [&]( int i, unsigned int )
+	{
+		FillBrick( scene, filled[i], cellBricks[filled[i]] );
+	} );
+
+	UpdateStats();
+	stats.fullRebuild = false;
+	stats.rebuiltCorners = (int)dirtyCorners.size();
+	stats.rebuiltBricks = (int)filled.size();
+}
+
+void DistanceCache::FillBrick( const CompiledScene& scene, int cell, int brick )
+{
+	//Samples include both faces of the cell so a lookup never needs a neighbour
+	const Vec3F cellMin = CellMin( cell );
+	uint8_t* samples = &bricks[(size_t)brick * brickSamples];
+	const float scale = 255.0f / (2.0f * brickRange);
+	for( int z = 0; z < brickSize; z++ )
+	{
+		for( int y = 0; y < brickSize; y++ )
+		{
+			for( int x = 0; x < brickSize; x++ )
+			{
+				Vec3F p = cellMin + Vec3F( (float)x, (float)y, (float)z ) * voxelSize;
+				const float distance = std::fmin( std::fmax( SignedDistanceScene( scene, p ).distance, -brickRange ), brickRange );
+				*samples++ = (uint8_t)std::lround( (distance + brickRange) * scale );
+			}
+		}
+	}
+}
+
+void DistanceCache::UpdateStats()
+{
+	stats.cellCount = (int)cellBricks.size();
+	stats.brickCount = (int)(bricks.size() / brickSamples - freeBricks.size());
+	stats.memoryBytes =
+		corners.capacity() * sizeof( float ) +
+		cellDistances.capacity() * sizeof( float ) +
+		cellBricks.capacity() * sizeof( int ) +
+		bricks.capacity() * sizeof( uint8_t ) +
+		freeBricks.capacity() * sizeof( int ) +
+		shapes.capacity() * sizeof( Shape );
+}
+
+float DistanceCache::MaxSampleError( const CompiledScene& scene ) const
+{
+	float maxError = 0.0f;
+	for( int z = 0; z <= dimensions[2]; z++ )
+	{
+		for( int y = 0; y <= dimensions[1]; y++ )
+		{
+			for( int x = 0; x <= dimensions[0]; x++ )
+			{
+				const float exact = SignedDistanceScene( scene, CornerPosition( x, y, z ) ).distance;
+				maxError = (std::max)( maxError, std::abs( corners[CornerIndex( x, y, z )] - exact ) );
+			}
+		}
+	}
+
+	for( int cell = 0; cell < (int)cellBricks.size(); cell++ )
+	{
+		if( cellBricks[cell] < 0 )
+			continue;
+
+		const uint8_t* samples = &bricks[(size_t)cellBricks[cell] * brickSamples];
+		for( int i = 0; i < brickSamples; i++ )
+		{
+			Vec3F p = CellMin( cell ) + Vec3F( (float)(i % brickSize), (float)((i / brickSize) % brickSize), (float)(i / (brickSize * brickSize)) ) * voxelSize;
+			const float exact = std::fmin( std::fmax( SignedDistanceScene( scene, p ).distance, -brickRange ), brickRange );
+			maxError = (std::max)( maxError, std::abs( DecodeSample( samples[i] ) - exact ) );
+		}
+	}
+
+	return maxError;
+}
+
+Vec3F DistanceCache::CornerPosition( int x, int y, int z ) const
+{
+	return origin + Vec3F( (float)x, (float)y, (float)z ) * cellSize;
+}
+
+Vec3F DistanceCache::CellMin( int cell ) const
+{
+	const int x = cell % dimensions[0];
+	const int y = (cell / dimensions[0]) % dimensions[1];
+	const int z = cell / (dimensions[0] * dimensions[1]);
+	return CornerPosition( x, y, z );
+}
+
+float DistanceCache::CachedDistance( Vec3F p ) const
+{
+	//Everything is inside the scene bounds, which are at least a cell away from the grid edge
+	Vec3F local = (p - origin) / cellSize;
+	if( local.x < 0.0f || local.y < 0.0f || local.z < 0.0f ||
+		local.x >= (float)dimensions[0] || local.y >= (float)dimensions[1] || local.z >= (float)dimensions[2] )
+	{
+		return BoxDistance( p, sceneMin, sceneMax );
+	}
+
+	const int x = (int)local.x;
+	const int y = (int)local.y;
+	const int z = (int)local.z;
+	const int brick = cellBricks[(z * dimensions[1] + y) * dimensions[0] + x];
+
+	float c[8];
+	if( brick < 0 )
+	{
+		c[0] = corners[CornerIndex( x, y, z )];
+		c[1] = corners[CornerIndex( x + 1, y, z )];
+		c[2] = corners[CornerIndex( x, y + 1, z )];
+		c[3] = corners[CornerIndex( x + 1, y + 1, z )];
+		c[4] = corners[CornerIndex( x, y, z + 1 )];
+		c[5] = corners[CornerIndex( x + 1, y, z + 1 )];
+		c[6] = corners[CornerIndex( x, y + 1, z + 1 )];
+		c[7] = corners[CornerIndex( x + 1, y + 1, z + 1 )];
+		return Trilinear( c, local.x - x, local.y - y, local.z - z ) - halfSqrt3 * cellSize;
+	}
+
+	//Position inside the brick in voxels
+	const float scale = (float)(brickSize - 1);
+	const float bx = (std::min)( (local.x - x) * scale, scale );
+	const float by = (std::min)( (local.y - y) * scale, scale );
+	const float bz = (std::min)( (local.z - z) * scale, scale );
+	const int vx = (std::min)( (int)bx, brickSize - 2 );
+	const int vy = (std::min)( (int)by, brickSize - 2 );
+	const int vz = (std::min)( (int)bz, brickSize - 2 );
+
+	const uint8_t* samples = &bricks[(size_t)brick * brickSamples + (vz * brickSize + vy) * brickSize + vx];
+	const int dy = brickSize;
+	const int dz = brickSize * brickSize;
+	c[0] = samples[0];
+	c[1] = samples[1];
+	c[2] = samples[dy];
+	c[3] = samples[dy + 1];
+	c[4] = samples[dz];
+	c[5] = samples[dz + 1];
+	c[6] = samples[dz + dy];
+	c[7] = samples[dz + dy + 1];
+
+	//Interpolating the codes is the same as interpolating the decoded values,
+	//rounding can make a sample up to half a step too large
+	const float step = 2.0f * brickRange / 255.0f;
+	return Trilinear( c, bx - vx, by - vy, bz - vz ) * step - brickRange - halfSqrt3 * voxelSize - 0.5f * step;
+}
+
+ObjectDistance DistanceCache::SignedDistance( const CompiledScene& scene, Vec3F p ) const
+{
+	if( IsEmpty() )
+		return SignedDistanceScene( scene, p );
+
+	const float distance = CachedDistance( p );
+	if( distance < settings.exactVoxels * voxelSize )
+		return SignedDistanceScene( scene, p );
+
+	ObjectDistance result;
+	result.distance = distance;
+	result.objectIndex = -1;
+	return result;
+}
+
+Benchmark::Report DistanceCache::RunBenchmark()
+{
+	const int width = 160;
+	const int height = 120;
+
+	Camera camera( 90.0f, 0.1f, 100.0f );
+	camera.OnResize( width, height );
+
+	std::vector<Vec3F> directions;
+	for( int y = 0; y < height; y++ )
+	{
+		for( int x = 0; x < width; x++ )
+		{
+			Vec2F coord = Vec2F( (float)x / (float)width, (float)y / (float)height ) * 2.0f - Vec2F( 1.0f );
+			Vec4F target = camera.GetInverseProjection() * Vec4F( coord.x, coord.y, 1.0f, 1.0f );
+			Vec3F direction = (Vec3F( target.x, target.y, target.z ) / target.w).Normalized();
+			Vec4F rayDirection = camera.GetInverseView() * Vec4F( direction, 0.0f );
+			directions.emplace_back( rayDirection.x, rayDirection.y, rayDirection.z );
+		}
+	}
+
+	float extent;
+	CompiledScene cornell;
+	cornell.Compile( Scene_CornellBox() );
+	struct Entry
+	{
+		const char* name;
+		CompiledScene scene;
+		//Random scenes are moved in front of the camera
+		Vec3F origin;
+	};
+	Entry scenes[3] = { { "Scene_CornellBox", cornell, camera.GetPosition() } };
+	scenes[1] = { "1000 random", CompiledScene::RandomPrimitives( 1000, 42u, extent ), camera.GetPosition() };
+	scenes[1].origin.z += extent;
+	scenes[2] = { "20000 random", CompiledScene::RandomPrimitives( 20000, 42u, extent ), camera.GetPosition() };
+	scenes[2].origin.z += extent;
+
+	//Builds and updates fill the cache on every core, only the march is single threaded
+	Hydro::JobSystem jobs;
+	Benchmark::Report report;
+	report.push_back( "Primary rays " + std::to_string( width ) + "x" + std::to_string( height ) + ", single thread march" );
+
+	for( Entry& entry : scenes )
+	{
+		const char* name = entry.name;
+		CompiledScene& scene = entry.scene;
+		DistanceCache cache;
+		cache.Build( scene, jobs );
+		const Stats built = cache.GetStats();
+
+		auto measure = [&]( auto distance, double& stepsPerRay, std::vector<int>& objects )
+		{
+			objects.assign( directions.size(), -1 );
+			int64_t steps = 0;
+			int64_t rays = 0;
+			Hydro::Timer timer;
+			do
+			{
+				for( size_t i = 0; i < directions.size(); i++ )
+				{
+					steps += MarchSteps( distance, entry.origin, directions[i], objects[i] );
+				}
+				rays += directions.size();
+			} while( timer.Peek() < 0.25f );
+			stepsPerRay = (double)steps / rays;
+			return rays / timer.Mark() / 1e6;
+		};
+
+		double exactSteps, cachedSteps;
+		std::vector<int> exactObjects, cachedObjects;
+		const double exactRate = measure( [&scene]( Vec3F p ) { return SignedDistanceScene( scene, p ); }, exactSteps, exactObjects );
+		const double cachedRate = measure( [&scene, &cache]( Vec3F p ) { return cache.SignedDistance( scene, p ); }, cachedSteps, cachedObjects );
+
+		int mismatches = 0;
+		for( size_t i = 0; i < directions.size(); i++ )
+		{
+			mismatches += exactObjects[i] != cachedObjects[i];
+		}
+
+		//Move a single object, every stored sample has to match the exact distance afterwards
+		if( !scene.boxCenters.empty() )
+			scene.boxCenters[0].x += 0.25f;
+		else
+			scene.spheres[0].x += 0.25f;
+		scene.BuildBvh();
+		cache.Update( scene, jobs );
+		const Stats updated = cache.GetStats();
+		const float maxError = cache.MaxSampleError( scene );
+
+		char line[256];
+		snprintf( line, sizeof( line ), "%s: exact %.2f Mrays/s %.1f steps, cached %.2f Mrays/s %.1f steps (%.2fx)%s",
+			name, exactRate, exactSteps, cachedRate, cachedSteps, cachedRate / exactRate, mismatches > 0 ? ", HITS DIFFER" : "" );
+		report.push_back( line );
+		snprintf( line, sizeof( line ), "    build %.1fms, %d bricks / %d cells, %.2f MB",
+			built.buildTime * 1000.0f, built.brickCount, built.cellCount, built.memoryBytes / (1024.0 * 1024.0) );
+		report.push_back( line );
+		snprintf( line, sizeof( line ), "    one object moved: %s in %.1fms, %d corners %d bricks rebuilt, max sample error %.4f (quantization step %.4f)",
+			updated.fullRebuild ? "full rebuild" : "partial update", updated.buildTime * 1000.0f, updated.rebuiltCorners, updated.rebuiltBricks, maxError, 2.0f * cache.brickRange / 255.0f );
+		report.push_back( line );
+	}
+
+	return report;
+}
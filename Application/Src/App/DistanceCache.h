@@ -0,0 +1,102 @@
+#pragma once
+#include "../Utils/Vec3.h"
+#include "../Utils/JobSystem.h"
+#include "CompiledScene.h"
+#include "Benchmark.h"
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+using namespace Hydro;
+
+struct ObjectDistance;
+
+//Sparse brick map of the scene distance field for static scenes. A coarse grid stores
+//the distance at every cell corner and cells close to a surface also get a brick of
+//8x8x8 finer 8 bit samples. Cached lookups are conservative (never above the exact distance)
+//and the exact SDF is only evaluated once a ray gets close to a surface
+class DistanceCache
+{
+public:
+	struct Settings
+	{
+		//Cells along the longest axis of the scene bounds
+		int resolution = 32;
+		//Below this many brick voxels the exact SDF is used
+		float exactVoxels = 2.0f;
+	};
+
+	struct Stats
+	{
+		int cellCount = 0;
+		int brickCount = 0;
+		size_t memoryBytes = 0;
+		float buildTime = 0.0f;
+		//Work done by the last Update
+		bool fullRebuild = false;
+		int rebuiltCorners = 0;
+		int rebuiltBricks = 0;
+	};
+
+	static constexpr int brickSize = 8;
+	static constexpr int brickSamples = brickSize * brickSize * brickSize;
+public:
+	//Rebuilds only the corners and bricks near objects that changed since the last
+	//call, returns false if nothing had to be done. Corners and bricks are filled on jobs
+	bool Update( const CompiledScene& scene, Hydro::JobSystem& jobs );
+	void Build( const CompiledScene& scene, Hydro::JobSystem& jobs );
+	void Clear();
+	bool IsEmpty() const { return corners.empty(); }
+	ObjectDistance SignedDistance( const CompiledScene& scene, Vec3F p ) const;
+	//Lower bound of the scene distance, objectIndex is not known
+	float CachedDistance( Vec3F p ) const;
+	Settings& GetSettings() { return settings; }
+	const Stats& GetStats() const { return stats; }
+	static Benchmark::Report RunBenchmark();
+private:
+	//Distance relevant part of one object, used to find what changed
+	struct Shape
+	{
+		int type = -1;
+		Vec4F a;
+		Vec4F b;
+		Vec3F boundsMin;
+		Vec3F boundsMax;
+
+		bool operator==( const Shape& rhs ) const;
+	};
+private:
+	static std::vector<Shape> GetShapes( const CompiledScene& scene );
+	void Rebuild( const CompiledScene& scene, Hydro::JobSystem& jobs, Vec3F dirtyMin, Vec3F dirtyMax );
+	void FillBrick( const CompiledScene& scene, int cell, int brick );
+	void UpdateStats();
+	//Largest difference between any stored sample and the exact distance
+	float MaxSampleError( const CompiledScene& scene ) const;
+	float DecodeSample( uint8_t sample ) const { return (float)sample * (2.0f * brickRange / 255.0f) - brickRange; }
+	Vec3F CornerPosition( int x, int y, int z ) const;
+	Vec3F CellMin( int cell ) const;
+	int CornerIndex( int x, int y, int z ) const { return (z * (dimensions[1] + 1) + y) * (dimensions[0] + 1) + x; }
+private:
+	Settings settings;
+	Stats stats;
+	int builtResolution = 0;
+
+	std::vector<Shape> shapes;
+	Vec3F sceneMin;
+	Vec3F sceneMax;
+
+	Vec3F origin;
+	float cellSize = 0.0f;
+	float voxelSize = 0.0f;
+	int dimensions[3] = { 0, 0, 0 };
+
+	std::vector<float> corners;
+	//Exact distance at the cell center, decides if a cell needs a brick
+	std::vector<float> cellDistances;
+	//-1 for cells without a brick
+	std::vector<int> cellBricks;
+	//8 bit samples in [-brickRange, brickRange]
+	std::vector<uint8_t> bricks;
+	float brickRange = 0.0f;
+	std::vector<int> freeBricks;
+};
@@ -0,0 +1,120 @@
+#include "FrameTimeController.h"
+#include "../Utils/Random.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+using namespace Hydro;
+
+void FrameTimeController::Reset( int renderIterations )
+{
+	stats = Stats();
+	stats.renderIterations = (std::min)( (std::max)( renderIterations, 1 ), settings.maxIterations );
+}
+
+bool FrameTimeController::Update( float frameTime )
+{
+	stats.smoothedTime = stats.smoothedTime > 0.0f ? stats.smoothedTime + (frameTime - stats.smoothedTime) * settings.smoothing : frameTime;
+	if( stats.settling > 0 )
+	{
+		stats.settling--;
+		return false;
+	}
+
+	const float target = settings.targetTime;
+	if( std::abs( stats.smoothedTime - target ) <= settings.tolerance * target || stats.smoothedTime <= 0.0f )
+		return false;
+
+	//Paths per viewport pixel that fit in the target, iterations first and resolution only
+	//below one sample per frame. Rounded down, so the new time is at most the target
+	const float work = stats.scale * stats.scale * (float)stats.renderIterations;
+	const float targetWork = work * target / stats.smoothedTime;
+	int renderIterations = 1;
+	float scale = 1.0f;
+	if( targetWork >= 1.0f )
+	{
+		renderIterations = (std::min)( (int)targetWork, (std::max)( settings.maxIterations, 1 ) );
+	}
+	else
+	{
+		scale = std::floor( std::sqrt( targetWork ) / scaleStep ) * scaleStep;
+		scale = (std::min)( (std::max)( scale, settings.minScale ), 1.0f );
+	}
+	if( renderIterations == stats.renderIterations && scale == stats.scale )
+		return false;
+
+	//The average continues from the time the new settings should take, so the frames of
+	//the old ones do not cause a second change
+	stats.smoothedTime *= scale * scale * (float)renderIterations / work;
+	stats.scale = scale;
+	stats.renderIterations = renderIterations;
+	stats.adjustments++;
+	stats.settling = settings.settleFrames;
+	return true;
+}
+
+int FrameTimeController::GetRenderSize( int viewportSize ) const
+{
+	return viewportSize > 0 ? (std::max)( (int)((float)viewportSize * stats.scale), 1 ) : 0;
+}
+
+Benchmark::Report FrameTimeController::RunBenchmark()
+{
+	//Milliseconds of one path per pixel at full resolution in the three phases
+	const float phaseCosts[] = { 4.0f, 80.0f, 12.0f };
+	const int phaseFrames = 120;
+	const float noise = 0.15f;
+
+	Settings plain;
+	plain.tolerance = 0.0f;
+	plain.smoothing = 1.0f;
+	plain.settleFrames = 0;
+	const std::pair<const char*, Settings> controllers[] = {
+		{ "Smoothing and hysteresis", Settings() },
+		{ "Last frame only", plain }
+	};
+
+	Benchmark::Report report;
+	char line[256];
+	snprintf( line, sizeof( line ), "Simulated frames of cost times scale squared times iterations, +-%.0f%% noise, %.0fms target, %d frames per phase",
+		noise * 100.0f, Settings().targetTime, phaseFrames );
+	report.push_back( line );
+
+	for( const auto& [name, controllerSettings] : controllers )
+	{
+		FrameTimeController controller;
+		controller.settings = controllerSettings;
+		controller.Reset( 1 );
+		report.push_back( name );
+
+		uint32_t seed = 1u;
+		for( const float cost : phaseCosts )
+		{
+			const int adjustments = controller.stats.adjustments;
+			int lastChange = -1;
+			double error = 0.0;
+			int errorFrames = 0;
+			for( int frame = 0; frame < phaseFrames; frame++ )
+			{
+				const float work = controller.stats.scale * controller.stats.scale * (float)controller.stats.renderIterations;
+				const float time = cost * work * (1.0f + noise * (2.0f * Random::Float( seed ) - 1.0f));
+				if( controller.Update( time ) )
+					lastChange = frame;
+
+				//Error over the second half, once every controller had time to settle
+				if( frame >= phaseFrames / 2 )
+				{
+					error += std::abs( cost * work - controller.settings.targetTime ) / controller.settings.targetTime;
+					errorFrames++;
+				}
+			}
+
+			snprintf( line, sizeof( line ), "    Cost %.0fms: %d changes, last at frame %d, %.0f%% scale, %d iterations, %.0f%% mean error",
+				cost, controller.stats.adjustments - adjustments, lastChange, controller.stats.scale * 100.0f,
+				controller.stats.renderIterations, error / errorFrames * 100.0 );
+			report.push_back( line );
+		}
+	}
+
+	return report;
+}
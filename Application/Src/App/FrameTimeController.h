@@ -0,0 +1,58 @@
+#pragma once
+#include "Benchmark.h"
+
+//Keeps the frame time near a target by trading render resolution and samples per frame.
+//The frame time is taken as proportional to the paths traced, so one measurement says how
+//much work fits. Changes are only made once the smoothed time leaves a band around the
+//target and not again until the new time had a few frames to show
+class FrameTimeController
+{
+public:
+	struct Settings
+	{
+		bool enabled = false;
+		//Milliseconds a frame should take
+		float targetTime = 33.0f;
+		//Share of the target the smoothed time may be off before anything changes
+		float tolerance = 0.2f;
+		//Weight of the newest frame in the smoothed time
+		float smoothing = 0.2f;
+		//Frames after a change before the next one
+		int settleFrames = 8;
+		//Render resolution relative to the viewport along each axis at least
+		float minScale = 0.25f;
+		int maxIterations = 16;
+	};
+
+	struct Stats
+	{
+		//Milliseconds, the average the decisions are made on
+		float smoothedTime = 0.0f;
+		//Render resolution over viewport resolution along each axis
+		float scale = 1.0f;
+		int renderIterations = 1;
+		//Changes since the last Reset
+		int adjustments = 0;
+		//Frames until the next change is allowed
+		int settling = 0;
+	};
+public:
+	//Starts over at full resolution with the given samples per frame
+	void Reset( int renderIterations );
+	//Time of the last frame, rendered with the current scale and iterations. Returns true
+	//if either changed
+	bool Update( float frameTime );
+	float GetScale() const { return stats.scale; }
+	int GetRenderIterations() const { return stats.renderIterations; }
+	//Render size for one side of the viewport, at least one pixel unless the viewport is empty
+	int GetRenderSize( int viewportSize ) const;
+	Settings& GetSettings() { return settings; }
+	const Stats& GetStats() const { return stats; }
+	//Settling time and oscillation on a simulated renderer whose cost jumps
+	static Benchmark::Report RunBenchmark();
+private:
+	//Scales are multiples of this, small changes are not worth a new image
+	static constexpr float scaleStep = 1.0f / 16.0f;
+	Settings settings;
+	Stats stats;
+};
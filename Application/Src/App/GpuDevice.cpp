@@ -0,0 +1,105 @@
+#include "GpuDevice.h"
+#include <algorithm>
+#include <cstring>
+
+GpuDevice::Id NullGpuDevice::CreateConstantBuffer( size_t size )
+{
+	if( size == 0 || size % 16 != 0 )
+		invalidCalls++;
+	stats.bufferAllocations++;
+	calls.push_back( { CallType::CreateConstantBuffer, nextId, size } );
+	resources.push_back( { size, false } );
+	return nextId++;
+}
+
+void NullGpuDevice::Upload( Id buffer, const void* pData, size_t size )
+{
+	const Resource* pResource = Find( buffer, false );
+	if( pResource == nullptr || pData == nullptr || size > pResource->size )
+		invalidCalls++;
+	stats.uploads++;
+	stats.uploadedBytes += (int64_t)size;
+	calls.push_back( { CallType::Upload, buffer, size } );
+}
+
+GpuDevice::Id NullGpuDevice::CreateTexture( int width, int height )
+{
+	if( width <= 0 || height <= 0 )
+		invalidCalls++;
+	const size_t size = (size_t)(std::max)( width, 0 ) * (std::max)( height, 0 ) * 4;
+	stats.textureAllocations++;
+	calls.push_back( { CallType::CreateTexture, nextId, size } );
+	resources.push_back( { size, true } );
+	return nextId++;
+}
+
+void NullGpuDevice::UploadTexture( Id texture, const void* pPixels )
+{
+	const Resource* pResource = Find( texture, true );
+	if( pResource == nullptr || pPixels == nullptr )
+		invalidCalls++;
+	const size_t size = pResource != nullptr ? pResource->size : 0;
+	stats.uploads++;
+	stats.uploadedBytes += (int64_t)size;
+	calls.push_back( { CallType::UploadTexture, texture, size } );
+}
+
+void NullGpuDevice::Release( Id resource )
+{
+	if( resource == 0 || resource >= nextId || resources[resource - 1].released )
+		invalidCalls++;
+	else
+		resources[resource - 1].released = true;
+	calls.push_back( { CallType::Release, resource, 0 } );
+}
+
+NullGpuDevice::Resource* NullGpuDevice::Find( Id resource, bool texture )
+{
+	if( resource == 0 || resource >= nextId )
+		return nullptr;
+	Resource& found = resources[resource - 1];
+	return found.texture == texture && !found.released ? &found : nullptr;
+}
+
+GpuFrameResources::GpuFrameResources( GpuDevice& device, size_t frameSize, size_t sceneSize )
+	:
+	device( device ),
+	frameSize( frameSize ),
+	scene( sceneSize )
+{
+	frameBuffer = device.CreateConstantBuffer( frameSize );
+	sceneBuffer = device.CreateConstantBuffer( sceneSize );
+}
+
+GpuFrameResources::~GpuFrameResources()
+{
+	device.Release( frameBuffer );
+	device.Release( sceneBuffer );
+	if( texture != 0 )
+		device.Release( texture );
+}
+
+void GpuFrameResources::OnResize( int width, int height )
+{
+	if( texture != 0 && width == this->width && height == this->height )
+		return;
+
+	if( texture != 0 )
+		device.Release( texture );
+	texture = device.CreateTexture( width, height );
+	this->width = width;
+	this->height = height;
+}
+
+bool GpuFrameResources::Update( const void* pFrame, const void* pScene )
+{
+	device.Upload( frameBuffer, pFrame, frameSize );
+	//Comparing is a few microseconds, uploading the scene is the biggest part of a frame's constants
+	if( sceneValid && std::memcmp( scene.data(), pScene, scene.size() ) == 0 )
+		return false;
+
+	std::memcpy( scene.data(), pScene, scene.size() );
+	sceneValid = true;
+	device.Upload( sceneBuffer, pScene, scene.size() );
+	return true;
+}
@@ -0,0 +1,117 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+//The resources ComputeShader keeps from frame to frame, created and written through this so
+//a NullGpuDevice can count what a frame allocates and uploads without a GPU
+class GpuDevice
+{
+public:
+	//Index of a buffer or texture of the device, 0 is none
+	using Id = uint32_t;
+
+	//Totals since the device was created
+	struct Stats
+	{
+		int64_t bufferAllocations = 0;
+		int64_t textureAllocations = 0;
+		int64_t uploads = 0;
+		int64_t uploadedBytes = 0;
+	};
+public:
+	virtual ~GpuDevice() = default;
+	//Constant buffer of size bytes, a multiple of 16, the CPU writes with Upload
+	virtual Id CreateConstantBuffer( size_t size ) = 0;
+	//Replaces the whole buffer. Dispatches queued before still read the old contents
+	virtual void Upload( Id buffer, const void* pData, size_t size ) = 0;
+	//RGBA8 texture the shader output is copied to and the UI shows
+	virtual Id CreateTexture( int width, int height ) = 0;
+	//Replaces every pixel of a texture, pPixels holds width * height of them
+	virtual void UploadTexture( Id texture, const void* pPixels ) = 0;
+	virtual void Release( Id resource ) = 0;
+	const Stats& GetStats() const { return stats; }
+protected:
+	Stats stats;
+};
+
+//Records the calls and creates nothing, for checking what a frame costs on any platform.
+//Calls a real device would fail on are counted instead of asserted, so release builds see them
+class NullGpuDevice : public GpuDevice
+{
+public:
+	enum class CallType
+	{
+		CreateConstantBuffer,
+		Upload,
+		CreateTexture,
+		UploadTexture,
+		Release
+	};
+
+	struct Call
+	{
+		CallType type;
+		Id resource = 0;
+		//Bytes allocated or uploaded
+		size_t size = 0;
+	};
+public:
+	Id CreateConstantBuffer( size_t size ) override;
+	void Upload( Id buffer, const void* pData, size_t size ) override;
+	Id CreateTexture( int width, int height ) override;
+	void UploadTexture( Id texture, const void* pPixels ) override;
+	void Release( Id resource ) override;
+	const std::vector<Call>& GetCalls() const { return calls; }
+	void ClearCalls() { calls.clear(); }
+	//Calls with a null pointer, a size the resource does not have or a resource that is not
+	//alive or of the wrong kind, since the device was created
+	int64_t GetInvalidCalls() const { return invalidCalls; }
+private:
+	struct Resource
+	{
+		//Bytes
+		size_t size = 0;
+		bool texture = false;
+		bool released = false;
+	};
+private:
+	//Resource alive with the id and of the kind, null otherwise
+	Resource* Find( Id resource, bool texture );
+private:
+	std::vector<Call> calls;
+	//Every resource created, by Id - 1
+	std::vector<Resource> resources;
+	int64_t invalidCalls = 0;
+	Id nextId = 1;
+};
+
+//Constant buffers and the shown copy of the output texture of ComputeShader. The frame
+//constants are uploaded with every new frame, the scene constants only when they differ from
+//the last upload, which is most frames while only the camera moves
+class GpuFrameResources
+{
+public:
+	GpuFrameResources( GpuDevice& device, size_t frameSize, size_t sceneSize );
+	~GpuFrameResources();
+	GpuFrameResources( const GpuFrameResources& ) = delete;
+	GpuFrameResources& operator=( const GpuFrameResources& ) = delete;
+	//Creates the shown texture for a new size, nothing if the size stays the same
+	void OnResize( int width, int height );
+	//Uploads the constants of a new frame, and the scene if it changed. True if it did
+	bool Update( const void* pFrame, const void* pScene );
+	GpuDevice::Id GetFrameBuffer() const { return frameBuffer; }
+	GpuDevice::Id GetSceneBuffer() const { return sceneBuffer; }
+	GpuDevice::Id GetTexture() const { return texture; }
+private:
+	GpuDevice& device;
+	size_t frameSize;
+	GpuDevice::Id frameBuffer = 0;
+	GpuDevice::Id sceneBuffer = 0;
+	GpuDevice::Id texture = 0;
+	int width = 0;
+	int height = 0;
+	//Copy of the scene constants last uploaded
+	std::vector<uint8_t> scene;
+	bool sceneValid = false;
+};
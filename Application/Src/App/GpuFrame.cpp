@@ -0,0 +1,294 @@
+#include "GpuFrame.h"
+#include "Scenes.h"
+#include "../Utils/Random.h"
+#include "../Utils/HydroTimer.h"
+#include <algorithm>
+#include <cstdio>
+#include <iterator>
+
+GpuFrame::GpuFrame( GpuDevice& device )
+	:
+	device( device ),
+	resources( device, sizeof( FrameConstants ), sizeof( GpuScene ) )
+{
+	static_assert( sizeof( FrameConstants ) % 16 == 0 && sizeof( GpuScene ) % 16 == 0, "Constant buffers are whole registers" );
+	static_assert( sizeof( FrameConstants ) == 320, "FrameConstants has to match the Constants cbuffer of RayMarcher.hlsl" );
+	tileBuffer = device.CreateConstantBuffer( sizeof( TileConstants ) );
+}
+
+GpuFrame::~GpuFrame()
+{
+	device.Release( tileBuffer );
+}
+
+void GpuFrame::OnResize( int width, int height )
+{
+	if( width == this->width && height == this->height )
+		return;
+
+	resources.OnResize( width, height );
+	this->width = width;
+	this->height = height;
+	inProgress = false;
+	primaryValid = false;
+}
+
+GpuFrame::Start GpuFrame::Begin( const Camera& camera, const CompiledScene& scene, const DispatchSettings& settings, const int ( &aovOffsets )[8] )
+{
+	const Matrix4F viewProjection = camera.GetProjection() * camera.GetView();
+	//A frame in progress was started with lastViewProjection, a move starts the next one
+	Start start;
+	if( inProgress && viewProjection == lastViewProjection )
+		return start;
+
+	//A frame dropped part way left its tiles next to the ones of the frame before, the history
+	//matches neither camera. Like a cancelled frame on the CPU backend
+	if( inProgress )
+		InvalidatePrimary();
+
+	//Same decisions as CpuRayMarcher::Dispatch
+	const bool moved = settings.frameIndex != 0 && !(viewProjection == lastViewProjection);
+	start.started = true;
+	start.reproject = moved && settings.reprojection && primaryValid;
+	//Without primary hits to check the history against a move starts over
+	start.restart = settings.frameIndex == 0 || (moved && settings.reprojection && !start.reproject);
+	const bool tracePrimary = settings.reprojection && (settings.frameIndex == 0 || moved);
+	primaryValid = tracePrimary || (primaryValid && settings.reprojection && !moved);
+	//Sample indices start over with every new image and every reprojected one
+	if( start.restart || start.reproject )
+		imageSeed = Hydro::Random::UInt();
+
+	FrameConstants cb;
+	cb.inverseProjection = camera.GetInverseProjection();
+	cb.inverseView = camera.GetInverseView();
+	cb.cameraPosition = camera.GetPosition();
+	cb.renderIterations = settings.renderIterations;
+	cb.relaxation = settings.relaxation;
+	cb.maxDepth = settings.maxDepth;
+	cb.frameIndex = start.restart ? 0 : settings.frameIndex;
+	cb.errorThreshold = settings.errorThreshold;
+	cb.minSamples = settings.minSamples;
+	cb.randomSeed = imageSeed;
+	std::copy( std::begin( aovOffsets ), std::end( aovOffsets ), std::begin( cb.aovOffsets ) );
+	cb.previousViewProjection = lastViewProjection;
+	cb.previousCameraPosition = lastCameraPosition;
+	cb.reproject = start.reproject ? 1u : 0u;
+	cb.tracePrimary = tracePrimary ? 1u : 0u;
+	cb.maxHistory = (float)settings.maxHistory;
+	cb.nextEventEstimation = settings.nextEventEstimation ? 1u : 0u;
+	cb.samplerType = (unsigned int)settings.sampler;
+	cb.rouletteMinDepth = settings.rouletteMinDepth > 0 ? settings.rouletteMinDepth : settings.maxDepth;
+	resources.Update( &cb, &scene.GetGpuScene() );
+
+	//Without a budget the whole image is one tile. Tiles closest to the center come first,
+	//that is where a time-sliced frame is looked at
+	const int groupsWidth = width / 8 * 8;
+	const int groupsHeight = height / 8 * 8;
+	tileSize = settings.timeBudget > 0.0f ? (std::max)( settings.tileSize / 8 * 8, 8 ) : (std::max)( groupsWidth, groupsHeight );
+	tileOffsets.clear();
+	for( int y = 0; y < groupsHeight; y += tileSize )
+	{
+		for( int x = 0; x < groupsWidth; x += tileSize )
+		{
+			tileOffsets.emplace_back( x, y );
+		}
+	}
+	auto centerDistance = [&]( const Vec2I& offset )
+	{
+		const int dx = 2 * offset.x + tileSize - groupsWidth;
+		const int dy = 2 * offset.y + tileSize - groupsHeight;
+		return dx * dx + dy * dy;
+	};
+	std::stable_sort( tileOffsets.begin(), tileOffsets.end(), [&]( const Vec2I& a, const Vec2I& b )
+	{
+		return centerDistance( a ) < centerDistance( b );
+	} );
+
+	inProgress = true;
+	frameSerial++;
+	reproject = start.reproject;
+	frameIndex = settings.frameIndex;
+	frameIterations = settings.renderIterations;
+	nextTile = 0;
+	frameCalls = 0;
+	lastViewProjection = viewProjection;
+	lastCameraPosition = camera.GetPosition();
+	return start;
+}
+
+void GpuFrame::Cancel()
+{
+	if( inProgress )
+		InvalidatePrimary();
+	inProgress = false;
+}
+
+int GpuFrame::GetCallTiles( float timeBudget ) const
+{
+	const int tilesLeft = (int)(tileOffsets.size() - nextTile);
+	if( timeBudget <= 0.0f )
+		return tilesLeft;
+	if( sampleTime <= 0.0f )
+		return (std::min)( tilesLeft, 1 );
+
+	//Edge tiles are smaller, every tile is estimated on its own
+	int tiles = 0;
+	float time = 0.0f;
+	for( ; tiles < tilesLeft; tiles++ )
+	{
+		const Vec2I offset = tileOffsets[nextTile + tiles];
+		const int tileWidth = (std::min)( tileSize, width / 8 * 8 - offset.x );
+		const int tileHeight = (std::min)( tileSize, height / 8 * 8 - offset.y );
+		time += (float)tileWidth * (float)tileHeight * (float)frameIterations * sampleTime;
+		if( tiles > 0 && time > timeBudget )
+			break;
+	}
+	return tiles;
+}
+
+bool GpuFrame::NextTile( Tile& tile )
+{
+	if( nextTile == tileOffsets.size() )
+		return false;
+
+	const Vec2I offset = tileOffsets[nextTile++];
+	TileConstants constants;
+	constants.tileOffset[0] = (unsigned int)offset.x;
+	constants.tileOffset[1] = (unsigned int)offset.y;
+	device.Upload( tileBuffer, &constants, sizeof( constants ) );
+
+	tile.x = offset.x;
+	tile.y = offset.y;
+	tile.width = (std::min)( tileSize, width / 8 * 8 - offset.x );
+	tile.height = (std::min)( tileSize, height / 8 * 8 - offset.y );
+	callTiles++;
+	callSamples += (int64_t)tile.width * tile.height * frameIterations;
+	return true;
+}
+
+GpuFrame::Call GpuFrame::EndCall()
+{
+	Call call;
+	call.frame = frameSerial;
+	call.samples = callSamples;
+	call.finished = nextTile == tileOffsets.size();
+
+	frameCalls++;
+	tileStats.tileCount = (int)tileOffsets.size();
+	tileStats.tilesDone = (int)nextTile;
+	tileStats.callTiles = callTiles;
+	callTiles = 0;
+	callSamples = 0;
+	if( call.finished )
+	{
+		inProgress = false;
+		tileStats.callsPerFrame = frameCalls;
+	}
+	return call;
+}
+
+void GpuFrame::AddGpuTime( const Call& call, float time )
+{
+	tileStats.callTime = time;
+	//Averaged, a single call is as much the timer's noise as the scene's cost
+	if( call.samples > 0 )
+	{
+		const float callSampleTime = time / (float)call.samples;
+		sampleTime = sampleTime > 0.0f ? sampleTime + (callSampleTime - sampleTime) * 0.25f : callSampleTime;
+	}
+
+	if( call.frame != timedFrame )
+	{
+		timedFrame = call.frame;
+		timedFrameTime = 0.0f;
+		timedFrameValid = true;
+	}
+	timedFrameTime += time;
+	if( call.finished && timedFrameValid )
+	{
+		frameTime = timedFrameTime;
+		framesTimed++;
+	}
+}
+
+void GpuFrame::SkipGpuTime( const Call& call )
+{
+	timedFrame = call.frame;
+	timedFrameValid = false;
+}
+
+Benchmark::Report GpuFrame::RunBenchmark()
+{
+	const int frameCount = 120;
+	//A material is edited at these frames, the camera moves every frame
+	const int editFrames[] = { 40, 41, 90 };
+	const int width = 1280;
+	const int height = 720;
+
+	Camera camera( 90.0f, 0.1f, 100.0f );
+	camera.OnResize( width, height );
+	CompiledScene compiled;
+	Scene scene = Scene_CornellBox();
+	compiled.Compile( scene );
+
+	DispatchSettings settings;
+	settings.timeBudget = 8.0f;
+	const int aovOffsets[8] = { -1, -1, -1, -1, -1, -1, -1, -1 };
+
+	NullGpuDevice device;
+	Hydro::Timer timer;
+	float updateTime = 0.0f;
+	int sceneUploads = 0;
+	int tiles = 0;
+	{
+		GpuFrame frame( device );
+		frame.OnResize( width, height );
+		for( int i = 0; i < frameCount; i++ )
+		{
+			for( const int editFrame : editFrames )
+			{
+				if( i == editFrame )
+				{
+					scene.materials[0].data[0] += 0.01f;
+					compiled.Compile( scene );
+				}
+			}
+			camera.SetView( Vec3F( 0.01f * (float)i, 0.0f, 3.0f ), Vec3F( 0.0f, 0.0f, -1.0f ) );
+			settings.frameIndex = (uint32_t)i;
+
+			const int64_t uploads = device.GetStats().uploads;
+			timer.Mark();
+			frame.Begin( camera, compiled, settings, aovOffsets );
+			updateTime += timer.Peek();
+			//Frame constants and the scene if it changed, the tiles come after
+			sceneUploads += (int)(device.GetStats().uploads - uploads) - 1;
+
+			Tile tile;
+			while( frame.NextTile( tile ) )
+			{
+				tiles++;
+			}
+			frame.EndCall();
+			//Same size, keeps the texture
+			frame.OnResize( width, height );
+		}
+	}
+	const GpuDevice::Stats& stats = device.GetStats();
+
+	Benchmark::Report report;
+	char line[256];
+	snprintf( line, sizeof( line ), "%d frames of a moving camera over the Cornell box, %d material edits, %zu bytes of scene constants, %d tiles per frame",
+		frameCount, (int)std::size( editFrames ), sizeof( GpuScene ), tiles / frameCount );
+	report.push_back( line );
+	snprintf( line, sizeof( line ), "    New buffer per frame: %d buffers, %d textures, %.1fKB uploaded per frame",
+		frameCount, frameCount, (sizeof( FrameConstants ) + sizeof( GpuScene )) / 1024.0f );
+	report.push_back( line );
+	snprintf( line, sizeof( line ), "    Persistent: %lld buffers, %lld textures, %lld uploads with %d of the scene, %.2fKB uploaded per frame",
+		(long long)stats.bufferAllocations, (long long)stats.textureAllocations, (long long)stats.uploads, sceneUploads,
+		stats.uploadedBytes / 1024.0f / frameCount );
+	report.push_back( line );
+	snprintf( line, sizeof( line ), "    Frame constants and scene comparison: %.2fus per frame", updateTime * 1e6f / frameCount );
+	report.push_back( line );
+
+	return report;
+}
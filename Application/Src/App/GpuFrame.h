@@ -0,0 +1,207 @@
+#pragma once
+#include "GpuDevice.h"
+#include "Camera.h"
+#include "CompiledScene.h"
+#include "Benchmark.h"
+#include "Sampler.h"
+#include "../Utils/Matrix.h"
+#include "../Utils/Vec2.h"
+#include <vector>
+#include <cstdint>
+
+using namespace Hydro;
+
+//The part of ComputeShader::Dispatch that needs no Direct3D: when a frame starts, its
+//constants, the order of its tiles and the upload of every tile offset. Everything goes
+//through the GpuDevice, so a NullGpuDevice counts what the frames of the GPU backend cost
+class GpuFrame
+{
+public:
+	//Per dispatch values of the constant buffer
+	struct DispatchSettings
+	{
+		int renderIterations = 1;
+		//Over-relaxed sphere tracing when above 1
+		float relaxation = 1.0f;
+		//Bounces per path
+		int maxDepth = 20;
+		//Samples are added to the accumulation buffer, 0 starts over
+		uint32_t frameIndex = 0;
+		//Mean relative error below which an 8x8 tile stops getting samples, 0 disables it
+		float errorThreshold = 0.0f;
+		int minSamples = 16;
+		//AovBit mask, the AOV buffer is reallocated when it changes and should start a new image
+		uint32_t aovs = 0;
+		//A camera different from the last dispatch moves the samples to where it sees them
+		bool reprojection = false;
+		//Samples the history counts as at most after a move
+		int maxHistory = 16;
+		//Diffuse and rough metal bounces also sample a point on the emitters
+		bool nextEventEstimation = false;
+		//Where the random numbers of the paths come from, only change it with a new image
+		SamplerType sampler = SamplerType::Sobol;
+		//Bounces before paths end at random by their throughput, 0 disables it
+		int rouletteMinDepth = 0;
+		//Milliseconds of GPU work one Dispatch call submits, estimated from the time earlier
+		//tiles took. The tiles left over continue in the next call, 0 renders the whole frame at once
+		float timeBudget = 0.0f;
+		//Pixels per side of a time-sliced tile, rounded down to the 8x8 thread groups
+		int tileSize = 128;
+	};
+
+	struct TileStats
+	{
+		//Tiles of the frame in progress and how many of them are done
+		int tileCount = 0;
+		int tilesDone = 0;
+		//Dispatch calls the last finished frame was spread over
+		int callsPerFrame = 0;
+		//Tiles the last call submitted
+		int callTiles = 0;
+		//Milliseconds of GPU time of the last call that was read back, a few calls late
+		float callTime = 0.0f;
+	};
+
+	//What one Dispatch call submitted, handed back with its GPU time once that is read back
+	struct Call
+	{
+		//Frames started before the call, the calls of one frame have the same
+		uint32_t frame = 0;
+		//Pixels times samples per pixel of the call's tiles
+		int64_t samples = 0;
+		//The call did the last tiles of its frame
+		bool finished = false;
+	};
+
+	//Constants cbuffer of RayMarcher.hlsl, register b0. The scene is in b2 on its own
+	struct FrameConstants
+	{
+		Matrix4F inverseProjection;
+		Matrix4F inverseView;
+		Vec3F cameraPosition;
+		float pad = 0.0f;
+		int renderIterations;
+		float relaxation;
+		int maxDepth;
+		unsigned int frameIndex;
+		unsigned int randomSeed;
+		float errorThreshold;
+		int minSamples;
+		int pad2 = 0;
+		int aovOffsets[8];
+		Matrix4F previousViewProjection;
+		Vec3F previousCameraPosition;
+		unsigned int reproject;
+		unsigned int tracePrimary;
+		float maxHistory;
+		unsigned int nextEventEstimation;
+		unsigned int samplerType;
+		int rouletteMinDepth;
+		int pad4[3] = {};
+	};
+
+	//What Begin decided for a new frame
+	struct Start
+	{
+		bool started = false;
+		//The accumulation starts over
+		bool restart = false;
+		//The history is copied and reprojected to the new camera
+		bool reproject = false;
+	};
+
+	//Thread groups of one tile, in pixels
+	struct Tile
+	{
+		int x = 0;
+		int y = 0;
+		int width = 0;
+		int height = 0;
+	};
+public:
+	GpuFrame( GpuDevice& device );
+	~GpuFrame();
+	GpuFrame( const GpuFrame& ) = delete;
+	GpuFrame& operator=( const GpuFrame& ) = delete;
+	//Creates the shown texture for a new size, the next Begin starts a new frame
+	void OnResize( int width, int height );
+	//Starts a new frame unless one is in progress for the same camera. aovOffsets are the
+	//first floats of the AOVs in their buffer, -1 when disabled
+	Start Begin( const Camera& camera, const CompiledScene& scene, const DispatchSettings& settings, const int ( &aovOffsets )[8] );
+	//Tiles the next call submits. Without a budget all of them, otherwise as many as fit by
+	//the time samples took so far, at least one. One at a time until a call was read back
+	int GetCallTiles( float timeBudget ) const;
+	//Uploads the offset of the next tile, false once every tile of the frame is done
+	bool NextTile( Tile& tile );
+	//Ends a Dispatch call, its finished is true if the frame is done
+	Call EndCall();
+	//GPU time of a call in milliseconds. Calls are handed back in the order they were made
+	void AddGpuTime( const Call& call, float time );
+	//A call whose time is lost, its frame gets no frame time
+	void SkipGpuTime( const Call& call );
+	//Milliseconds of GPU time the last finished frame took over all of its calls, and how many
+	//frames were timed so far, it only counts frames whose every call was read back
+	float GetFrameTime() const { return frameTime; }
+	uint32_t GetFramesTimed() const { return framesTimed; }
+	//The next Begin starts a new frame. The tiles done so far leave the history to no camera
+	void Cancel();
+	//Primary hits of the last frame are gone, like after a resize
+	void InvalidatePrimary() { primaryValid = false; }
+	bool IsReprojecting() const { return reproject; }
+	uint32_t GetFrameIndex() const { return frameIndex; }
+	int GetFrameIterations() const { return frameIterations; }
+	const TileStats& GetTileStats() const { return tileStats; }
+	GpuDevice::Id GetFrameBuffer() const { return resources.GetFrameBuffer(); }
+	GpuDevice::Id GetTileBuffer() const { return tileBuffer; }
+	GpuDevice::Id GetSceneBuffer() const { return resources.GetSceneBuffer(); }
+	GpuDevice::Id GetTexture() const { return resources.GetTexture(); }
+	//Buffers, textures and uploads of frames with a moving camera, against a new buffer per frame
+	static Benchmark::Report RunBenchmark();
+private:
+	//Pixel offset of one tile, register b1
+	struct TileConstants
+	{
+		unsigned int tileOffset[2];
+		unsigned int pad[2] = {};
+	};
+private:
+	GpuDevice& device;
+	//Constants of the frame in progress and the texture the image shows, kept from frame to
+	//frame. The tiles only change the offset in tileBuffer
+	GpuFrameResources resources;
+	GpuDevice::Id tileBuffer = 0;
+	int width = 0;
+	int height = 0;
+
+	bool inProgress = false;
+	bool reproject = false;
+	uint32_t frameIndex = 0;
+	int frameIterations = 0;
+	//Pixel offsets of the tiles in the order they are rendered, the ones in the center first
+	std::vector<Vec2I> tileOffsets;
+	int tileSize = 0;
+	size_t nextTile = 0;
+	int frameCalls = 0;
+	TileStats tileStats;
+	//Frames started so far, tells the calls of different frames apart
+	uint32_t frameSerial = 0;
+	//Tiles and samples of the call in progress
+	int callTiles = 0;
+	int64_t callSamples = 0;
+
+	//Milliseconds per sample of the calls read back, 0 until the first one
+	float sampleTime = 0.0f;
+	//Frame the timed calls belong to and their time so far, invalid once one of its calls was lost
+	uint32_t timedFrame = 0;
+	float timedFrameTime = 0.0f;
+	bool timedFrameValid = false;
+	float frameTime = 0.0f;
+	uint32_t framesTimed = 0;
+
+	//Primary hits belong to the camera of the last frame
+	bool primaryValid = false;
+	Matrix4F lastViewProjection;
+	Vec3F lastCameraPosition;
+	//Renewed whenever the samples of the pixels start over, like in CpuRayMarcher
+	uint32_t imageSeed = 0;
+};
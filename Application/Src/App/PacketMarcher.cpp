@@ -0,0 +1,261 @@
+#include "PacketMarcher.h"
+#include "PacketMarcherKernel.h"
+#include "Camera.h"
+#include "Scenes.h"
+#include "../Utils/HydroTimer.h"
+#include <cmath>
+#include <cstdio>
+
+#if defined( _M_X64 ) || defined( _M_IX86 ) || defined( __x86_64__ ) || defined( __i386__ )
+#define HYDRO_X86 1
+#if defined( _MSC_VER )
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+#endif
+
+namespace
+{
+	//Single lane fallback, runs the same kernel one ray at a time
+	struct Float1
+	{
+		static constexpr int width = 1;
+		using Mask = bool;
+
+		Float1() = default;
+		Float1( float v ) : v( v ) {}
+
+		static Float1 Load( const float* p ) { return Float1( *p ); }
+		void Store( float* p ) const { *p = v; }
+		static Float1 LaneIndex() { return Float1( 0.0f ); }
+
+		friend Float1 operator+( Float1 a, Float1 b ) { return a.v + b.v; }
+		friend Float1 operator-( Float1 a, Float1 b ) { return a.v - b.v; }
+		friend Float1 operator*( Float1 a, Float1 b ) { return a.v * b.v; }
+
+		static Float1 Min( Float1 a, Float1 b ) { return a.v < b.v ? a : b; }
+		static Float1 Max( Float1 a, Float1 b ) { return a.v > b.v ? a : b; }
+		static Float1 Sqrt( Float1 a ) { return std::sqrt( a.v ); }
+		static Float1 Abs( Float1 a ) { return std::abs( a.v ); }
+
+		static Mask Less( Float1 a, Float1 b ) { return a.v < b.v; }
+		static Mask Greater( Float1 a, Float1 b ) { return a.v > b.v; }
+		static Mask And( Mask a, Mask b ) { return a && b; }
+		static Mask Or( Mask a, Mask b ) { return a || b; }
+		static Mask AndNot( Mask a, Mask b ) { return a && !b; }
+		static bool Any( Mask m ) { return m; }
+		static Float1 Select( Mask m, Float1 a, Float1 b ) { return m ? a : b; }
+
+		float v;
+	};
+}
+
+void RayBatch::Resize( size_t newCount )
+{
+	count = newCount;
+	const size_t padded = (count + padding - 1) / padding * padding;
+	for( auto* v : { &originX, &originY, &originZ, &directionX, &directionY, &directionZ } )
+	{
+		v->assign( padded, 0.0f );
+	}
+}
+
+void MarchResult::Resize( size_t count )
+{
+	hitDistance.assign( count, -1.0f );
+	objectIndex.assign( count, -1 );
+	steps.assign( count, 0 );
+}
+
+void MarchPacketsScalar( const CompiledScene& scene, const RayBatch& rays, size_t begin, size_t end, MarchResult& result, const PacketMarcher::Settings& settings )
+{
+	PacketKernel::MarchPackets<Float1>( scene, rays, begin, end, result, settings );
+}
+
+PacketMarcher::PacketMarcher()
+	:
+	isa( DetectIsa() )
+{
+}
+
+PacketMarcher::Isa PacketMarcher::DetectIsa()
+{
+#if defined( HYDRO_X86 ) && defined( _MSC_VER )
+	int info[4];
+	__cpuid( info, 0 );
+	const int maxLeaf = info[0];
+
+	__cpuid( info, 1 );
+	const bool osxsave = (info[2] & (1 << 27)) != 0;
+	const bool fma = (info[2] & (1 << 12)) != 0;
+	if( maxLeaf < 7 || !osxsave )
+		return Isa::Scalar;
+
+	//The OS has to save the ymm/zmm registers on context switches
+	const unsigned long long xcr0 = _xgetbv( 0 );
+	__cpuidex( info, 7, 0 );
+	const bool avx2 = (info[1] & (1 << 5)) != 0 && fma && (xcr0 & 0x6) == 0x6;
+	const bool avx512 = (info[1] & (1 << 16)) != 0 && (xcr0 & 0xE6) == 0xE6;
+
+	if( avx512 )
+		return Isa::AVX512;
+	if( avx2 )
+		return Isa::AVX2;
+	return Isa::Scalar;
+#elif defined( HYDRO_X86 ) && defined( __GNUC__ )
+	__builtin_cpu_init();
+	if( __builtin_cpu_supports( "avx512f" ) )
+		return Isa::AVX512;
+	if( __builtin_cpu_supports( "avx2" ) && __builtin_cpu_supports( "fma" ) )
+		return Isa::AVX2;
+	return Isa::Scalar;
+#else
+	return Isa::Scalar;
+#endif
+}
+
+const char* PacketMarcher::GetIsaName( Isa isa )
+{
+	switch( isa )
+	{
+		case Isa::AVX2:
+			return "AVX2";
+		case Isa::AVX512:
+			return "AVX-512";
+		default:
+			return "Scalar";
+	}
+}
+
+bool PacketMarcher::SetIsa( Isa newIsa )
+{
+	if( (int)newIsa > (int)DetectIsa() )
+		return false;
+
+	isa = newIsa;
+	return true;
+}
+
+int PacketMarcher::GetWidth() const
+{
+	switch( isa )
+	{
+		case Isa::AVX2:
+			return 8;
+		case Isa::AVX512:
+			return 16;
+		default:
+			return 1;
+	}
+}
+
+void PacketMarcher::March( const CompiledScene& scene, const RayBatch& rays, MarchResult& result ) const
+{
+	result.Resize( rays.GetCount() );
+	March( scene, rays, 0, rays.GetCount(), result );
+}
+
+void PacketMarcher::March( const CompiledScene& scene, const RayBatch& rays, size_t begin, size_t end, MarchResult& result ) const
+{
+	MarchPacketsFunction function = MarchPacketsScalar;
+#if defined( HYDRO_X86 )
+	if( isa == Isa::AVX2 )
+		function = MarchPacketsAVX2;
+	else if( isa == Isa::AVX512 )
+		function = MarchPacketsAVX512;
+#endif
+	function( scene, rays, begin, end, result, settings );
+}
+
+Benchmark::Report PacketMarcher::RunBenchmark()
+{
+	const int width = 320;
+	const int height = 240;
+
+	Camera camera( 90.0f, 0.1f, 100.0f );
+	camera.OnResize( width, height );
+
+	//Primary rays exactly like main in RayMarcher.hlsl
+	RayBatch rays;
+	rays.Resize( (size_t)width * height );
+	for( int y = 0; y < height; y++ )
+	{
+		for( int x = 0; x < width; x++ )
+		{
+			Vec2F coord = Vec2F( (float)x / (float)width, (float)y / (float)height ) * 2.0f - Vec2F( 1.0f );
+			Vec4F target = camera.GetInverseProjection() * Vec4F( coord.x, coord.y, 1.0f, 1.0f );
+			Vec3F direction = (Vec3F( target.x, target.y, target.z ) / target.w).Normalized();
+			Vec4F rayDirection = camera.GetInverseView() * Vec4F( direction, 0.0f );
+
+			const size_t i = (size_t)y * width + x;
+			rays.originX[i] = camera.GetPosition().x;
+			rays.originY[i] = camera.GetPosition().y;
+			rays.originZ[i] = camera.GetPosition().z;
+			rays.directionX[i] = rayDirection.x;
+			rays.directionY[i] = rayDirection.y;
+			rays.directionZ[i] = rayDirection.z;
+		}
+	}
+
+	const std::pair<const char*, Scene( * )()> scenes[] = {
+		{ "Scene_Sphere", Scene_Sphere },
+		{ "Scene_Cube", Scene_Cube },
+		{ "Scene_Torus", Scene_Torus },
+		{ "Scene_CornellBox", Scene_CornellBox }
+	};
+
+	Benchmark::Report report;
+	char line[256];
+	snprintf( line, sizeof( line ), "%dx%d primary rays, single thread, detected %s", width, height, GetIsaName( DetectIsa() ) );
+	report.push_back( line );
+
+	for( const auto& [name, build] : scenes )
+	{
+		CompiledScene scene;
+		scene.Compile( build() );
+		int length = snprintf( line, sizeof( line ), "%s:", name );
+
+		MarchResult reference;
+		for( Isa isa : { Isa::Scalar, Isa::AVX2, Isa::AVX512 } )
+		{
+			PacketMarcher marcher;
+			if( !marcher.SetIsa( isa ) )
+			{
+				length += snprintf( line + length, sizeof( line ) - length, " %s n/a", GetIsaName( isa ) );
+				continue;
+			}
+
+			MarchResult result;
+			Hydro::Timer timer;
+			int repeats = 0;
+			do
+			{
+				marcher.March( scene, rays, result );
+				repeats++;
+			} while( timer.Peek() < 0.25f );
+			const float seconds = timer.Mark();
+
+			//Every ISA has to agree with the scalar path on what was hit
+			int mismatches = 0;
+			if( isa == Isa::Scalar )
+			{
+				reference = result;
+			}
+			else
+			{
+				for( size_t i = 0; i < rays.GetCount(); i++ )
+				{
+					mismatches += reference.objectIndex[i] != result.objectIndex[i];
+				}
+			}
+
+			const double mrays = (double)rays.GetCount() * repeats / seconds / 1e6;
+			length += snprintf( line + length, sizeof( line ) - length, " %s %.2f Mrays/s", GetIsaName( isa ), mrays );
+			if( mismatches > 0 )
+				length += snprintf( line + length, sizeof( line ) - length, " (%d mismatches)", mismatches );
+		}
+		report.push_back( line );
+	}
+
+	return report;
+}
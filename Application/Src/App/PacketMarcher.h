@@ -0,0 +1,69 @@
+#pragma once
+#include "CompiledScene.h"
+#include "Benchmark.h"
+#include <vector>
+#include <cstddef>
+
+//Rays stored as structure of arrays, padded so every packet can be loaded whole
+struct RayBatch
+{
+	static constexpr size_t padding = 16;
+
+	void Resize( size_t count );
+	size_t GetCount() const { return count; }
+
+	std::vector<float> originX, originY, originZ;
+	std::vector<float> directionX, directionY, directionZ;
+private:
+	size_t count = 0;
+};
+
+struct MarchResult
+{
+	void Resize( size_t count );
+
+	//-1 when the ray missed
+	std::vector<float> hitDistance;
+	std::vector<int> objectIndex;
+	std::vector<int> steps;
+};
+
+//Marches 8 (AVX2) or 16 (AVX-512) rays at once through signedDistanceScene,
+//rays that hit or escape are masked out until the whole packet is done
+class PacketMarcher
+{
+public:
+	enum class Isa
+	{
+		Scalar,
+		AVX2,
+		AVX512
+	};
+
+	struct Settings
+	{
+		int maxIterations = 1000;
+		float surfaceDistance = 0.0001f;
+		float maxDistance = 100.0f;
+	};
+public:
+	PacketMarcher();
+	void March( const CompiledScene& scene, const RayBatch& rays, MarchResult& result ) const;
+	void March( const CompiledScene& scene, const RayBatch& rays, size_t begin, size_t end, MarchResult& result ) const;
+	bool SetIsa( Isa isa );
+	Isa GetIsa() const { return isa; }
+	int GetWidth() const;
+	Settings& GetSettings() { return settings; }
+	static Isa DetectIsa();
+	static const char* GetIsaName( Isa isa );
+	static Benchmark::Report RunBenchmark();
+private:
+	Isa isa;
+	Settings settings;
+};
+
+//One instantiation of PacketMarcherKernel.h per instruction set
+using MarchPacketsFunction = void( * )(const CompiledScene& scene, const RayBatch& rays, size_t begin, size_t end, MarchResult& result, const PacketMarcher::Settings& settings);
+void MarchPacketsScalar( const CompiledScene& scene, const RayBatch& rays, size_t begin, size_t end, MarchResult& result, const PacketMarcher::Settings& settings );
+void MarchPacketsAVX2( const CompiledScene& scene, const RayBatch& rays, size_t begin, size_t end, MarchResult& result, const PacketMarcher::Settings& settings );
+void MarchPacketsAVX512( const CompiledScene& scene, const RayBatch& rays, size_t begin, size_t end, MarchResult& result, const PacketMarcher::Settings& settings );
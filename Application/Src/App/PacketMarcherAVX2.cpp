@@ -0,0 +1,48 @@
+//Built with /arch:AVX2 (-mavx2 -mfma), only called after PacketMarcher::DetectIsa found AVX2 and FMA
+#include "PacketMarcher.h"
+
+#if defined( _M_X64 ) || defined( _M_IX86 ) || defined( __x86_64__ ) || defined( __i386__ )
+#include <immintrin.h>
+#include "PacketMarcherKernel.h"
+
+namespace
+{
+	struct Float8
+	{
+		static constexpr int width = 8;
+		using Mask = __m256;
+
+		Float8() = default;
+		Float8( float v ) : v( _mm256_set1_ps( v ) ) {}
+		Float8( __m256 v ) : v( v ) {}
+
+		static Float8 Load( const float* p ) { return _mm256_loadu_ps( p ); }
+		void Store( float* p ) const { _mm256_storeu_ps( p, v ); }
+		static Float8 LaneIndex() { return _mm256_setr_ps( 0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f ); }
+
+		friend Float8 operator+( Float8 a, Float8 b ) { return _mm256_add_ps( a.v, b.v ); }
+		friend Float8 operator-( Float8 a, Float8 b ) { return _mm256_sub_ps( a.v, b.v ); }
+		friend Float8 operator*( Float8 a, Float8 b ) { return _mm256_mul_ps( a.v, b.v ); }
+
+		static Float8 Min( Float8 a, Float8 b ) { return _mm256_min_ps( a.v, b.v ); }
+		static Float8 Max( Float8 a, Float8 b ) { return _mm256_max_ps( a.v, b.v ); }
+		static Float8 Sqrt( Float8 a ) { return _mm256_sqrt_ps( a.v ); }
+		static Float8 Abs( Float8 a ) { return _mm256_andnot_ps( _mm256_set1_ps( -0.0f ), a.v ); }
+
+		static Mask Less( Float8 a, Float8 b ) { return _mm256_cmp_ps( a.v, b.v, _CMP_LT_OQ ); }
+		static Mask Greater( Float8 a, Float8 b ) { return _mm256_cmp_ps( a.v, b.v, _CMP_GT_OQ ); }
+		static Mask And( Mask a, Mask b ) { return _mm256_and_ps( a, b ); }
+		static Mask Or( Mask a, Mask b ) { return _mm256_or_ps( a, b ); }
+		static Mask AndNot( Mask a, Mask b ) { return _mm256_andnot_ps( b, a ); }
+		static bool Any( Mask m ) { return _mm256_movemask_ps( m ) != 0; }
+		static Float8 Select( Mask m, Float8 a, Float8 b ) { return _mm256_blendv_ps( b.v, a.v, m ); }
+
+		__m256 v;
+	};
+}
+
+void MarchPacketsAVX2( const CompiledScene& scene, const RayBatch& rays, size_t begin, size_t end, MarchResult& result, const PacketMarcher::Settings& settings )
+{
+	PacketKernel::MarchPackets<Float8>( scene, rays, begin, end, result, settings );
+}
+#endif
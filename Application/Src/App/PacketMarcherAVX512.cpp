@@ -0,0 +1,52 @@
+//Built with /arch:AVX512 (-mavx512f), only called after PacketMarcher::DetectIsa found AVX-512F
+#include "PacketMarcher.h"
+
+#if defined( _M_X64 ) || defined( _M_IX86 ) || defined( __x86_64__ ) || defined( __i386__ )
+#include <immintrin.h>
+#include "PacketMarcherKernel.h"
+
+namespace
+{
+	struct Float16
+	{
+		static constexpr int width = 16;
+		using Mask = __mmask16;
+
+		Float16() = default;
+		Float16( float v ) : v( _mm512_set1_ps( v ) ) {}
+		Float16( __m512 v ) : v( v ) {}
+
+		static Float16 Load( const float* p ) { return _mm512_loadu_ps( p ); }
+		void Store( float* p ) const { _mm512_storeu_ps( p, v ); }
+		static Float16 LaneIndex()
+		{
+			return _mm512_setr_ps( 0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f,
+				8.0f, 9.0f, 10.0f, 11.0f, 12.0f, 13.0f, 14.0f, 15.0f );
+		}
+
+		friend Float16 operator+( Float16 a, Float16 b ) { return _mm512_add_ps( a.v, b.v ); }
+		friend Float16 operator-( Float16 a, Float16 b ) { return _mm512_sub_ps( a.v, b.v ); }
+		friend Float16 operator*( Float16 a, Float16 b ) { return _mm512_mul_ps( a.v, b.v ); }
+
+		static Float16 Min( Float16 a, Float16 b ) { return _mm512_min_ps( a.v, b.v ); }
+		static Float16 Max( Float16 a, Float16 b ) { return _mm512_max_ps( a.v, b.v ); }
+		static Float16 Sqrt( Float16 a ) { return _mm512_sqrt_ps( a.v ); }
+		static Float16 Abs( Float16 a ) { return _mm512_abs_ps( a.v ); }
+
+		static Mask Less( Float16 a, Float16 b ) { return _mm512_cmp_ps_mask( a.v, b.v, _CMP_LT_OQ ); }
+		static Mask Greater( Float16 a, Float16 b ) { return _mm512_cmp_ps_mask( a.v, b.v, _CMP_GT_OQ ); }
+		static Mask And( Mask a, Mask b ) { return (Mask)(a & b); }
+		static Mask Or( Mask a, Mask b ) { return (Mask)(a | b); }
+		static Mask AndNot( Mask a, Mask b ) { return (Mask)(a & ~b); }
+		static bool Any( Mask m ) { return m != 0; }
+		static Float16 Select( Mask m, Float16 a, Float16 b ) { return _mm512_mask_blend_ps( m, b.v, a.v ); }
+
+		__m512 v;
+	};
+}
+
+void MarchPacketsAVX512( const CompiledScene& scene, const RayBatch& rays, size_t begin, size_t end, MarchResult& result, const PacketMarcher::Settings& settings )
+{
+	PacketKernel::MarchPackets<Float16>( scene, rays, begin, end, result, settings );
+}
+#endif
@@ -0,0 +1,238 @@
+#pragma once
+#include "PacketMarcher.h"
+#include <algorithm>
+
+//Packet version of MarchRay, F is a float vector type with static helpers for
+//masks (Less, Greater, And, Or, AndNot, Any, Select) and math (Min, Max, Sqrt, Abs)
+namespace PacketKernel
+{
+	template<typename F>
+	F Length( F x, F y, F z )
+	{
+		return F::Sqrt( x * x + y * y + z * z );
+	}
+
+	template<typename F>
+	F SignedDistanceSphere( F px, F py, F pz, const Vec4F& sphere )
+	{
+		return Length( px - F( sphere.x ), py - F( sphere.y ), pz - F( sphere.z ) ) - F( sphere.w );
+	}
+
+	template<typename F>
+	F SignedDistanceBox( F px, F py, F pz, const Vec4F& center, const Vec4F& size )
+	{
+		const F zero( 0.0f );
+		F qx = F::Abs( px - F( center.x ) ) - F( size.x );
+		F qy = F::Abs( py - F( center.y ) ) - F( size.y );
+		F qz = F::Abs( pz - F( center.z ) ) - F( size.z );
+		F outside = Length( F::Max( qx, zero ), F::Max( qy, zero ), F::Max( qz, zero ) );
+		F inside = F::Min( F::Max( qx, F::Max( qy, qz ) ), zero );
+		return outside + inside;
+	}
+
+	template<typename F>
+	F SignedDistanceTorus( F px, F py, F pz, const Vec4F& torus, float minorRadius )
+	{
+		px = px - F( torus.x );
+		py = py - F( torus.y );
+		pz = pz - F( torus.z );
+		F qx = F::Sqrt( px * px + pz * pz ) - F( torus.w );
+		return F::Sqrt( qx * qx + py * py ) - F( minorRadius );
+	}
+
+	template<typename F>
+	void Closest( F d, int objectIndex, F& distance, F& object )
+	{
+		auto closer = F::Less( d, distance );
+		distance = F::Select( closer, d, distance );
+		object = F::Select( closer, F( (float)objectIndex ), object );
+	}
+
+	template<typename F>
+	void SceneDistanceLinear( const CompiledScene& scene, F px, F py, F pz, F& distance, F& object )
+	{
+		for( size_t o = 0; o < scene.spheres.size(); o++ )
+		{
+			Closest( SignedDistanceSphere( px, py, pz, scene.spheres[o] ), scene.sphereObjects[o], distance, object );
+		}
+		for( size_t o = 0; o < scene.boxCenters.size(); o++ )
+		{
+			Closest( SignedDistanceBox( px, py, pz, scene.boxCenters[o], scene.boxSizes[o] ), scene.boxObjects[o], distance, object );
+		}
+		for( size_t o = 0; o < scene.tori.size(); o++ )
+		{
+			Closest( SignedDistanceTorus( px, py, pz, scene.tori[o], scene.torusMinorRadii[o] ), scene.torusObjects[o], distance, object );
+		}
+	}
+
+	template<typename F>
+	F BoxDistance( F px, F py, F pz, const Bvh::Node& node )
+	{
+		const F zero( 0.0f );
+		F qx = F::Max( F::Max( F( node.boundsMin.x ) - px, px - F( node.boundsMax.x ) ), zero );
+		F qy = F::Max( F::Max( F( node.boundsMin.y ) - py, py - F( node.boundsMax.y ) ), zero );
+		F qz = F::Max( F::Max( F( node.boundsMin.z ) - pz, pz - F( node.boundsMax.z ) ), zero );
+		return Length( qx, qy, qz );
+	}
+
+	//Same traversal as Bvh::SignedDistance, a subtree is only skipped when no active
+	//lane can find anything closer in it
+	template<typename F>
+	void SceneDistanceBvh( const CompiledScene& scene, F px, F py, F pz, typename F::Mask active, F& distance, F& object )
+	{
+		auto closer = [&distance, active]( F d ) { return F::Any( F::And( active, F::Less( d, distance ) ) ); };
+
+		const Bvh& bvh = scene.GetBvh();
+		const auto& nodes = bvh.GetNodes();
+		const auto& primitives = bvh.GetPrimitives();
+		const auto& boundingSpheres = bvh.GetBoundingSpheres();
+
+		struct Entry
+		{
+			int node;
+			F distance;
+		};
+		Entry stack[Bvh::maxDepth];
+		int stackSize = 0;
+
+		int nodeIndex = 0;
+		while( true )
+		{
+			const Bvh::Node& node = nodes[nodeIndex];
+
+			if( node.count > 0 )
+			{
+				for( int i = node.leftOrFirst; i < node.leftOrFirst + node.count; i++ )
+				{
+					const F sphereDistance = SignedDistanceSphere( px, py, pz, boundingSpheres[i] );
+					if( !closer( sphereDistance ) )
+						continue;
+
+					const uint32_t primitive = primitives[i];
+					const int index = Bvh::GetIndex( primitive );
+					switch( Bvh::GetType( primitive ) )
+					{
+						case Bvh::Box:
+							Closest( SignedDistanceBox( px, py, pz, scene.boxCenters[index], scene.boxSizes[index] ), scene.boxObjects[index], distance, object );
+							break;
+						case Bvh::Torus:
+							Closest( SignedDistanceTorus( px, py, pz, scene.tori[index], scene.torusMinorRadii[index] ), scene.torusObjects[index], distance, object );
+							break;
+						default:
+							Closest( sphereDistance, scene.sphereObjects[index], distance, object );
+							break;
+					}
+				}
+			}
+			else
+			{
+				Entry nearChild = { node.leftOrFirst, BoxDistance( px, py, pz, nodes[node.leftOrFirst] ) };
+				Entry farChild = { node.leftOrFirst + 1, BoxDistance( px, py, pz, nodes[node.leftOrFirst + 1] ) };
+				if( !F::Any( F::And( active, F::Less( nearChild.distance, farChild.distance ) ) ) )
+					std::swap( nearChild, farChild );
+
+				const bool visitNear = closer( nearChild.distance );
+				if( closer( farChild.distance ) )
+				{
+					if( visitNear )
+						stack[stackSize++] = farChild;
+					else
+						nearChild = farChild;
+				}
+				else if( !visitNear )
+				{
+					nearChild.node = -1;
+				}
+
+				if( nearChild.node >= 0 )
+				{
+					nodeIndex = nearChild.node;
+					continue;
+				}
+			}
+
+			nodeIndex = -1;
+			while( stackSize > 0 )
+			{
+				const Entry& entry = stack[--stackSize];
+				if( closer( entry.distance ) )
+				{
+					nodeIndex = entry.node;
+					break;
+				}
+			}
+
+			if( nodeIndex < 0 )
+				break;
+		}
+	}
+
+	template<typename F>
+	void MarchPackets( const CompiledScene& scene, const RayBatch& rays, size_t begin, size_t end, MarchResult& result, const PacketMarcher::Settings& settings )
+	{
+		const F zero( 0.0f );
+		const F one( 1.0f );
+		const F surfaceDistance( settings.surfaceDistance );
+		const F maxDistance( settings.maxDistance );
+
+		for( size_t base = begin; base < end; base += F::width )
+		{
+			const size_t lanes = (std::min)( (size_t)F::width, end - base );
+
+			const F ox = F::Load( &rays.originX[base] );
+			const F oy = F::Load( &rays.originY[base] );
+			const F oz = F::Load( &rays.originZ[base] );
+			const F dx = F::Load( &rays.directionX[base] );
+			const F dy = F::Load( &rays.directionY[base] );
+			const F dz = F::Load( &rays.directionZ[base] );
+
+			F px = ox, py = oy, pz = oz;
+			F hitDistance( -1.0f );
+			F hitObject( -1.0f );
+			F steps = zero;
+
+			//Padding lanes start out finished
+			auto active = F::Less( F::LaneIndex(), F( (float)lanes ) );
+
+			for( int i = 0; i < settings.maxIterations && F::Any( active ); i++ )
+			{
+				F distance( 10000.0f );
+				F object( -1.0f );
+
+				if( scene.GetBvh().IsEmpty() )
+					SceneDistanceLinear( scene, px, py, pz, distance, object );
+				else
+					SceneDistanceBvh( scene, px, py, pz, active, distance, object );
+
+				steps = steps + F::Select( active, one, zero );
+
+				auto hit = F::And( active, F::Less( distance, surfaceDistance ) );
+				auto miss = F::And( active, F::Greater( distance, maxDistance ) );
+
+				hitDistance = F::Select( hit, Length( px - ox, py - oy, pz - oz ), hitDistance );
+				hitObject = F::Select( hit, object, hitObject );
+
+				active = F::AndNot( active, F::Or( hit, miss ) );
+
+				F step = F::Select( active, distance, zero );
+				px = px + dx * step;
+				py = py + dy * step;
+				pz = pz + dz * step;
+			}
+
+			float distances[F::width];
+			float objects[F::width];
+			float counts[F::width];
+			hitDistance.Store( distances );
+			hitObject.Store( objects );
+			steps.Store( counts );
+
+			for( size_t lane = 0; lane < lanes; lane++ )
+			{
+				result.hitDistance[base + lane] = distances[lane];
+				result.objectIndex[base + lane] = (int)objects[lane];
+				result.steps[base + lane] = (int)counts[lane];
+			}
+		}
+	}
+}
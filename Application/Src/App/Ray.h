@@ -5,4 +5,12 @@ struct Ray
 {
 	Hydro::Vec3F Origin;
 	Hydro::Vec3F Direction;
+};
+
+struct HitPayload
+{
+	float HitDistance;
+	Hydro::Vec3F WorldPosition;
+	Hydro::Vec3F WorldNormal;
+	int ObjectIndex;
 };
\ No newline at end of file
@@ -16,56 +16,161 @@ namespace Random
         return ( float ) seed / ( float ) 0xffffffffu;
     }
 
-    float RandomFloat( inout uint seed, float min, float max )
+}
+
+//Sampler, same as Sampler.cpp. The integer part is identical so both backends draw the
+//same numbers for the same pixel, sample index and dimension
+#define SAMPLER_RANDOM 0
+#define SAMPLER_SOBOL 1
+#define SAMPLER_BLUE_NOISE 2
+#define BLUE_NOISE_SIZE 64
+
+//Dimensions every bounce owns, same order as Sampler::BounceDimension. Whole groups of four
+//per bounce, the pairs would lose their 2D stratification across two Sobol shuffles
+#define DIMENSION_JITTER 0
+#define DIMENSION_SCATTER 2
+#define DIMENSION_EMITTER_PICK 4
+#define DIMENSION_EMITTER_FACE 5
+#define DIMENSION_EMITTER_UV 6
+#define DIMENSION_ROULETTE 8
+#define DIMENSIONS_PER_BOUNCE 12
+
+//Ranks of the void-and-cluster mask from Sampler::GetBlueNoise, BLUE_NOISE_SIZE squared in rows
+StructuredBuffer<uint> BlueNoise : register( t4 );
+
+//Generator matrices of the first four Sobol dimensions, 32 columns each
+static const uint SobolDirections[128] =
+{
+    0x80000000u, 0x40000000u, 0x20000000u, 0x10000000u, 0x08000000u, 0x04000000u, 0x02000000u, 0x01000000u,
+    0x00800000u, 0x00400000u, 0x00200000u, 0x00100000u, 0x00080000u, 0x00040000u, 0x00020000u, 0x00010000u,
+    0x00008000u, 0x00004000u, 0x00002000u, 0x00001000u, 0x00000800u, 0x00000400u, 0x00000200u, 0x00000100u,
+    0x00000080u, 0x00000040u, 0x00000020u, 0x00000010u, 0x00000008u, 0x00000004u, 0x00000002u, 0x00000001u,
+    0x80000000u, 0xC0000000u, 0xA0000000u, 0xF0000000u, 0x88000000u, 0xCC000000u, 0xAA000000u, 0xFF000000u,
+    0x80800000u, 0xC0C00000u, 0xA0A00000u, 0xF0F00000u, 0x88880000u, 0xCCCC0000u, 0xAAAA0000u, 0xFFFF0000u,
+    0x80008000u, 0xC000C000u, 0xA000A000u, 0xF000F000u, 0x88008800u, 0xCC00CC00u, 0xAA00AA00u, 0xFF00FF00u,
+    0x80808080u, 0xC0C0C0C0u, 0xA0A0A0A0u, 0xF0F0F0F0u, 0x88888888u, 0xCCCCCCCCu, 0xAAAAAAAAu, 0xFFFFFFFFu,
+    0x80000000u, 0xC0000000u, 0x60000000u, 0x90000000u, 0xE8000000u, 0x5C000000u, 0x8E000000u, 0xC5000000u,
+    0x68800000u, 0x9CC00000u, 0xEE600000u, 0x55900000u, 0x80680000u, 0xC09C0000u, 0x60EE0000u, 0x90550000u,
+    0xE8808000u, 0x5CC0C000u, 0x8E606000u, 0xC5909000u, 0x6868E800u, 0x9C9C5C00u, 0xEEEE8E00u, 0x5555C500u,
+    0x8000E880u, 0xC0005CC0u, 0x60008E60u, 0x9000C590u, 0xE8006868u, 0x5C009C9Cu, 0x8E00EEEEu, 0xC5005555u,
+    0x80000000u, 0xC0000000u, 0x20000000u, 0x50000000u, 0xF8000000u, 0x74000000u, 0xA2000000u, 0x93000000u,
+    0xD8800000u, 0x25400000u, 0x59E00000u, 0xE6D00000u, 0x78080000u, 0xB40C0000u, 0x82020000u, 0xC3050000u,
+    0x208F8000u, 0x51474000u, 0xFBEA2000u, 0x75D93000u, 0xA0858800u, 0x914E5400u, 0xDBE79E00u, 0x25DB6D00u,
+    0x58800080u, 0xE54000C0u, 0x79E00020u, 0xB6D00050u, 0x800800F8u, 0xC00C0074u, 0x200200A2u, 0x50050093u
+};
+
+namespace Sampler
+{
+    uint hash( uint seed, uint value )
     {
-        return RandomFloat( seed ) * (max - min) + min;
+        return Random::PCG_Hash( seed ^ Random::PCG_Hash( value ) );
     }
 
-    float3 randomVector3( inout uint seed )
+    uint laineKarrasPermutation( uint x, uint seed )
     {
-        return float3( RandomFloat( seed ), RandomFloat( seed ), RandomFloat( seed ) );
+        x += seed;
+        x ^= x * 0x6c50b47cu;
+        x ^= x * 0xb82f1e52u;
+        x ^= x * 0xc7afe638u;
+        x ^= x * 0x8d22f6e6u;
+        return x;
     }
 
-    float3 randomVector3( inout uint seed, float min, float max )
+    uint nestedUniformScramble( uint x, uint seed )
     {
-        return float3( RandomFloat( seed, min, max ), RandomFloat( seed, min, max ), RandomFloat( seed, min, max ) );
+        return reversebits( laineKarrasPermutation( reversebits( x ), seed ) );
     }
 
-    float3 random_in_unit_sphere( inout uint seed )
+    uint sobol( uint index, uint dimension )
     {
-        while ( true )
+        uint x = 0u;
+        for ( uint bit = 0u; index != 0u; bit++, index >>= 1u )
         {
-            float3 p = randomVector3( seed, -1.0f, 1.0f );
-            if ( length( p ) < 1.0f ) 
-                return p;
+            if ( (index & 1u) != 0u )
+                x ^= SobolDirections[dimension * 32u + bit];
         }
-        
-        return float3( 0.0f, 0.0f, 0.0f );
+        return x;
     }
 
-    float3 random_unit_vector( inout uint seed )
+    uint owenScrambledSobol( uint index, uint dimension, uint seed )
     {
-        return normalize( random_in_unit_sphere( seed ) );
+        uint groupSeed = hash( seed, dimension / 4u );
+        uint shuffled = nestedUniformScramble( index, groupSeed );
+        return nestedUniformScramble( sobol( shuffled, dimension % 4u ), hash( groupSeed, dimension % 4u ) );
     }
 
-    float3 random_on_hemisphere( inout uint seed, float3 normal )
+    float toFloat( uint bits )
     {
-        float3 on_unit_sphere = random_unit_vector( seed );
-        if ( dot( on_unit_sphere, normal ) > 0.0f )
-            return on_unit_sphere;
-        else
-            return -on_unit_sphere;
+        return (float) (bits >> 8u) * (1.0f / 16777216.0f);
+    }
+
+    float3 uniformSphere( float2 u )
+    {
+        float z = 1.0f - 2.0f * u.x;
+        float r = sqrt( max( 1.0f - z * z, 0.0f ) );
+        float phi = 2.0f * 3.14159265f * u.y;
+        return float3( r * cos( phi ), r * sin( phi ), z );
     }
 
+    //Density cosine over pi around normal
+    float3 cosineHemisphere( float3 normal, float2 u )
+    {
+        float zSign = normal.z >= 0.0f ? 1.0f : -1.0f;
+        float a = -1.0f / (zSign + normal.z);
+        float b = normal.x * normal.y * a;
+        float3 tangent = float3( 1.0f + zSign * normal.x * normal.x * a, zSign * b, -zSign * normal.x );
+        float3 bitangent = float3( b, zSign + normal.y * normal.y * a, -normal.y );
+        
+        float r = sqrt( u.x );
+        float phi = 2.0f * 3.14159265f * u.y;
+        return tangent * (r * cos( phi )) + bitangent * (r * sin( phi )) + normal * sqrt( max( 1.0f - u.x, 0.0f ) );
+    }
 }
 
-//Utility
-bool near_zero( float3 v )
+//The numbers of one sample of a pixel, created by createPathSampler
+struct PathSampler
+{
+    uint type;
+    uint seed;
+    uint sampleIndex;
+    uint2 pixel;
+    
+    float get( uint dimension )
+    {
+        if ( type == SAMPLER_SOBOL )
+            return Sampler::toFloat( Sampler::owenScrambledSobol( sampleIndex, dimension, seed ) );
+        
+        if ( type == SAMPLER_BLUE_NOISE )
+        {
+            uint offset = Sampler::hash( seed, dimension );
+            uint mx = (pixel.x + (offset & (BLUE_NOISE_SIZE - 1))) & (BLUE_NOISE_SIZE - 1);
+            uint my = (pixel.y + ((offset >> 8u) & (BLUE_NOISE_SIZE - 1))) & (BLUE_NOISE_SIZE - 1);
+            uint shift = BlueNoise[my * BLUE_NOISE_SIZE + mx] << 20u;
+            return Sampler::toFloat( Sampler::owenScrambledSobol( sampleIndex, dimension, seed ) + shift );
+        }
+        
+        return Sampler::toFloat( Sampler::hash( Sampler::hash( seed, sampleIndex ), dimension ) );
+    }
+    
+    float2 get2D( uint dimension )
+    {
+        return float2( get( dimension ), get( dimension + 1u ) );
+    }
+};
+
+PathSampler createPathSampler( uint type, uint seed, uint2 pixel, uint sampleIndex )
 {
-    const float s = 1e-8;
-    return ( abs( v.x ) < s ) && ( abs( v.y ) < s ) && ( abs( v.z ) < s );
+    PathSampler pathSampler;
+    pathSampler.type = type;
+    //Blue noise shares one sequence between all pixels, the others get one each
+    pathSampler.seed = type == SAMPLER_BLUE_NOISE ? seed : Sampler::hash( Sampler::hash( seed, pixel.x ), pixel.y );
+    pathSampler.sampleIndex = sampleIndex;
+    pathSampler.pixel = pixel;
+    return pathSampler;
 }
 
+//Utility
+
 float3 reflect( float3 v, float3 n )
 {
     return v - 2.0f * dot( v, n ) * n;
@@ -92,72 +197,34 @@ struct HitPayload
     float3 WorldPosition;
     float3 WorldNormal;
     int ObjectIndex;
+    //March iterations it took
+    int Steps;
 };
 
-struct Object
-{
-    int id;
-    int materialIndex;
-    int active;
-    int pading;
-    
-    float4 data[4];
-};
-
-struct Sphere
-{
-    float3 center;
-    float radius;
-    int materialIndex;
-};
-
-Sphere SphereFromObject( Object obj )
-{
-    Sphere sphere;
-        
-    sphere.materialIndex = obj.materialIndex;
-    sphere.center = obj.data[0].xyz;
-    sphere.radius = obj.data[0].w;
-        
-    return sphere;
-}
-
-struct Cube
-{
-    float3 center;
-    float3 size;
-    int materialIndex;
-};
-
-Cube CubeFromObject( Object obj )
-{
-    Cube cube;
-        
-    cube.materialIndex = obj.materialIndex;
-    cube.center = obj.data[0].xyz;
-    cube.size = float3(obj.data[0].w, obj.data[1].xy);
-        
-    return cube;
-}
+//Arbitrary output variables, same order as Aov in Aov.h
+#define AOV_DEPTH 0
+#define AOV_NORMAL 1
+#define AOV_ALBEDO 2
+#define AOV_OBJECT_ID 3
+#define AOV_MATERIAL_ID 4
+#define AOV_STEPS 5
 
-struct Torus
+//What the primary ray hit, summed over the samples of a pixel like the color
+struct PrimaryHit
 {
-    float3 posision;
-    float2 size;
-    int materialIndex;
+    float depth;
+    float3 normal;
+    float3 albedo;
+    float steps;
+    //Of the last sample, -1 for the sky
+    float objectId;
+    float materialId;
+    //Rays marched, paths Russian roulette ended and the bounces they had left
+    uint pathRays;
+    uint terminatedPaths;
+    uint raysSaved;
 };
 
-Torus TorusFromObject( Object obj )
-{
-    Torus torus;
-        
-    torus.materialIndex = obj.materialIndex;
-    torus.posision = obj.data[0].xyz;
-    torus.size = float2(obj.data[0].w, obj.data[1].x);
-        
-    return torus;
-}
-
 struct Material
 {
     int id;
@@ -166,15 +233,14 @@ struct Material
     //Options
     float4 data[4];
     
-    bool scatter( inout Ray ray_in, inout HitPayload hit, inout float3 attenuation, inout Ray scattered, inout uint seed )
+    //u are the two numbers of the bounce, the dielectric only needs the first
+    bool scatter( inout Ray ray_in, inout HitPayload hit, inout float3 attenuation, inout Ray scattered, float2 u )
     {
         if( id == 0)
         {
-            float3 scatter_direction = hit.WorldNormal + Random::random_unit_vector( seed );
-            
-            if ( near_zero( scatter_direction ) )
-                scatter_direction = hit.WorldNormal;
-            
+            //Unit length, MarchRay steps by the distance times the direction length and
+            //longer ones tunnel through thin objects
+            float3 scatter_direction = Sampler::cosineHemisphere( hit.WorldNormal, u );
             scattered.origin = hit.WorldPosition + scatter_direction * 0.001f;
             scattered.dir = scatter_direction;
             
@@ -187,7 +253,7 @@ struct Material
         {
             float3 reflected = reflect( normalize( ray_in.dir ), hit.WorldNormal );
             scattered.origin = hit.WorldPosition + reflected * 0.001f;
-            scattered.dir = reflected + data[0].w * Random::random_unit_vector( seed );
+            scattered.dir = normalize( reflected + data[0].w * Sampler::uniformSphere( u ) );
             
             attenuation = data[0].xyz;
             
@@ -211,7 +277,7 @@ struct Material
             r0 = r0 * r0;
             float r1 = r0 + (1 - r0) * pow( (1 - cos_theta), 5 );
             
-            if ( cannot_refract || r1 > Random::RandomFloat( seed ) )
+            if ( cannot_refract || r1 > u.x )
                 direction = reflect( unit_direction, hit.WorldNormal );
             else
                 direction = refract( unit_direction, hit.WorldNormal, refraction_ratio );
@@ -236,23 +302,102 @@ struct Material
 
 static const int MAX_OBJECTS = 128;
 
-struct Scene
+//Packed per-type primitive arrays built by CompiledScene on the CPU,
+//int arrays hold four indices per element
+struct CompiledScene
 {
-    int objectCount;
+    int sphereCount;
+    int boxCount;
+    int torusCount;
     int materialCount;
-    Object objects[MAX_OBJECTS];
+    float4 spheres[MAX_OBJECTS];
+    float4 boxCenters[MAX_OBJECTS];
+    float4 boxSizes[MAX_OBJECTS];
+    float4 tori[MAX_OBJECTS];
+    float4 torusMinorRadii[MAX_OBJECTS / 4];
+    int4 sphereObjects[MAX_OBJECTS / 4];
+    int4 boxObjects[MAX_OBJECTS / 4];
+    int4 torusObjects[MAX_OBJECTS / 4];
+    int4 objectMaterials[MAX_OBJECTS / 4];
+    //Type in the low two bits, index into the per-type arrays above them. -1 for inactive objects
+    int4 objectPrimitives[MAX_OBJECTS / 4];
     Material materials[MAX_OBJECTS];
+    int emitterCount;
+    //Sum of the emitter areas
+    float emitterArea;
+    //Object index of every emitter and the running sum of the areas up to and including it
+    int4 emitterObjects[MAX_OBJECTS / 4];
+    float4 emitterAreaSums[MAX_OBJECTS / 4];
 };
 
 RWTexture2D<float4> Result : register( u0 );
+//Linear color sum in xyz and the sample count in w, one per pixel in rows. A buffer
+//since cs_5_0 can not load from a float4 UAV texture
+RWStructuredBuffer<float4> Accumulation : register( u1 );
+//Sum of the squared luminance of every sample, laid out like Accumulation
+RWStructuredBuffer<float> Moments : register( u2 );
+//Since frame 0: 8x8 tiles that traced samples, those tiles times the samples they traced,
+//rays marched by the paths, paths ended by Russian roulette and the bounces they had left
+RWByteAddressBuffer Counters : register( u3 );
+//Enabled AOVs one after another, every channel a plane laid out like Moments. Only
+//bound when at least one AOV is enabled
+RWStructuredBuffer<float> Aovs : register( u4 );
+//First hit of the unjittered ray through every pixel, normal in xyz and depth in w. The
+//history is validated with it since jittered samples disagree at every edge
+RWStructuredBuffer<float4> Primary : register( u5 );
 Texture2D<float4> SkyboxTexture : register( t0 );
+//Copies of Accumulation, Moments and Primary from before the camera moved, only bound
+//when reproject is set
+StructuredBuffer<float4> HistoryAccumulation : register( t1 );
+StructuredBuffer<float> HistoryMoments : register( t2 );
+StructuredBuffer<float4> HistoryPrimary : register( t3 );
 SamplerState sampler_SkyboxTexture : register( s0 );
-float4x4 InverseProjectionMatrix : register( c0 );
-float4x4 InverseViewProjectionMatrix : register( c4 );
-float3 cameraPosition : register( c8 );
-int renderInterations : register( c9 );
-uint seedStart : register( c10 );
-Scene scene : register( c11 );
+cbuffer Constants : register( b0 )
+{
+    float4x4 InverseProjectionMatrix : packoffset( c0 );
+    float4x4 InverseViewProjectionMatrix : packoffset( c4 );
+    float3 cameraPosition : packoffset( c8 );
+    int renderInterations : packoffset( c9 );
+    //Over-relaxed sphere tracing when above 1
+    float relaxation : packoffset( c9.y );
+    //Bounces per path
+    int maxDepth : packoffset( c9.z );
+    //Samples are added to Accumulation, 0 starts over
+    uint frameIndex : packoffset( c9.w );
+    //Seed of the image, the samples of a pixel are told apart by their index
+    uint seedStart : packoffset( c10 );
+    //Tiles with a mean relative error below this stop getting samples, 0 samples every tile
+    float errorThreshold : packoffset( c10.y );
+    //Samples a tile gets before its error is trusted
+    int minSamples : packoffset( c10.z );
+    //First float of every AOV in Aovs indexed by the AOV_ defines, -1 when disabled
+    int4 aovOffsets[2] : packoffset( c11 );
+    //Camera the history was rendered with
+    float4x4 PreviousViewProjectionMatrix : packoffset( c13 );
+    float3 previousCameraPosition : packoffset( c17 );
+    //Pixels start from the reprojected history instead of Accumulation
+    uint reproject : packoffset( c17.w );
+    //March the unjittered ray of every pixel into Primary for the next reprojection
+    uint tracePrimary : packoffset( c18 );
+    //Samples the history counts as at most
+    float maxHistory : packoffset( c18.y );
+    //Diffuse and rough metal bounces also sample a point on the emitters
+    uint nextEventEstimation : packoffset( c18.z );
+    //Where the random numbers come from, one of the SAMPLER_ defines
+    uint samplerType : packoffset( c18.w );
+    //Bounces before Russian roulette, maxDepth when it is off
+    int rouletteMinDepth : packoffset( c19 );
+};
+//Pixel offset of the tile a dispatch covers when a frame is split over several
+cbuffer Tile : register( b1 )
+{
+    uint2 tileOffset;
+};
+//Uploaded again only when the scene changes, the camera changes far more often
+cbuffer SceneConstants : register( b2 )
+{
+    CompiledScene scene : packoffset( c0 );
+};
 
 static const float PI = 3.14159265f;
 
@@ -292,94 +437,169 @@ float signedDistanceTorus( float3 p, float3 center, float2 t)
     return length(q) - t.y;
 }
 
-ObjectDistance signedDistanceScene( float3 p, int objectIndex = -1 )
+void closest( inout ObjectDistance result, float distance, int objectIndex )
+{
+    bool closer = distance < result.distance;
+    result.distance = closer ? distance : result.distance;
+    result.objectIndex = closer ? objectIndex : result.objectIndex;
+}
+
+ObjectDistance signedDistanceScene( float3 p )
 {
     ObjectDistance result;
     result.distance = 10000.0f;
     result.objectIndex = -1;
     
-    for ( int i = 0; i < scene.objectCount; i++ )
+    for ( int i = 0; i < scene.sphereCount; i++ )
     {
-        if ( scene.objects[i].active > 0.0f && objectIndex != i)
-        {
-            float tempDistance = 10000.0f;
-            
-            switch ( scene.objects[i].id )
-            {
-                case 0:
-                {
-                    Sphere sphere = SphereFromObject( scene.objects[i] );
-                    tempDistance = signedDistanceSphere( p, sphere.center, sphere.radius );
-                    break;
-                }
-                case 1:
-                {
-                    Cube cube = CubeFromObject( scene.objects[i] );
-                    tempDistance = signedDistanceBox( p, cube.center, cube.size );
-                    break;
-                }
-                case 2:
-                {
-                    Torus torus = TorusFromObject(scene.objects[i]);
-                    tempDistance = signedDistanceTorus(p, torus.posision, torus.size);
-                    break;
-                }
-                default:
-                {
-                    break;
-                }
-            }
-            
-            if( tempDistance < result.distance )
-            {
-                result.distance = tempDistance;
-                result.objectIndex = i;
-            }
-        }
+        closest( result, signedDistanceSphere( p, scene.spheres[i].xyz, scene.spheres[i].w ), scene.sphereObjects[i >> 2][i & 3] );
+    }
+    
+    for ( int j = 0; j < scene.boxCount; j++ )
+    {
+        closest( result, signedDistanceBox( p, scene.boxCenters[j].xyz, scene.boxSizes[j].xyz ), scene.boxObjects[j >> 2][j & 3] );
+    }
+    
+    for ( int k = 0; k < scene.torusCount; k++ )
+    {
+        float2 t = float2( scene.tori[k].w, scene.torusMinorRadii[k >> 2][k & 3] );
+        closest( result, signedDistanceTorus( p, scene.tori[k].xyz, t ), scene.torusObjects[k >> 2][k & 3] );
     }
     
     return result;
 }
 
-HitPayload MarchRay( Ray ray, int maxIterations, float surfaceDistance, float maxDistance, int currentObject = -1)
+static const int PRIMITIVE_SPHERE = 0;
+static const int PRIMITIVE_BOX = 1;
+static const int PRIMITIVE_TORUS = 2;
+
+float signedDistancePrimitive( int type, int index, float3 p )
+{
+    if ( type == PRIMITIVE_BOX )
+        return signedDistanceBox( p, scene.boxCenters[index].xyz, scene.boxSizes[index].xyz );
+    if ( type == PRIMITIVE_TORUS )
+        return signedDistanceTorus( p, scene.tori[index].xyz, float2( scene.tori[index].w, scene.torusMinorRadii[index >> 2][index & 3] ) );
+    return signedDistanceSphere( p, scene.spheres[index].xyz, scene.spheres[index].w );
+}
+
+float3 gradientBox( float3 p, float3 c, float3 b )
+{
+    p -= c;
+    float3 w = abs( p ) - b;
+    float3 s = float3( p.x < 0.0f ? -1.0f : 1.0f, p.y < 0.0f ? -1.0f : 1.0f, p.z < 0.0f ? -1.0f : 1.0f );
+    
+    //Outside the closest point is on a face, edge or corner, inside it is on the nearest face
+    if ( max( w.x, max( w.y, w.z ) ) > 0.0f )
+        return s * max( w, 0.0f );
+    
+    if ( w.x > w.y && w.x > w.z )
+        return float3( s.x, 0.0f, 0.0f );
+    if ( w.y > w.z )
+        return float3( 0.0f, s.y, 0.0f );
+    return float3( 0.0f, 0.0f, s.z );
+}
+
+float3 gradientTorus( float3 p, float3 center, float2 t )
+{
+    p -= center;
+    float ringDistance = length( p.xz );
+    float k = (ringDistance - t.x) / ringDistance;
+    return float3( p.x * k, p.y, p.z * k );
+}
+
+//Tetrahedral estimate on one primitive, used where the analytic gradient is undefined
+float3 primitiveNormalTetrahedral( int type, int index, float3 p )
+{
+    const float h = 0.0005f;
+    const float2 k = float2( 1.0f, -1.0f );
+    return normalize( k.xyy * signedDistancePrimitive( type, index, p + k.xyy * h ) +
+                      k.yyx * signedDistancePrimitive( type, index, p + k.yyx * h ) +
+                      k.yxy * signedDistancePrimitive( type, index, p + k.yxy * h ) +
+                      k.xxx * signedDistancePrimitive( type, index, p + k.xxx * h ) );
+}
+
+//Normal of the object that was hit, only that object is evaluated
+float3 objectNormal( int objectIndex, float3 p )
+{
+    int primitive = scene.objectPrimitives[objectIndex >> 2][objectIndex & 3];
+    int type = primitive & 3;
+    int index = primitive >> 2;
+    
+    float3 gradient;
+    if ( type == PRIMITIVE_BOX )
+        gradient = gradientBox( p, scene.boxCenters[index].xyz, scene.boxSizes[index].xyz );
+    else if ( type == PRIMITIVE_TORUS )
+        gradient = gradientTorus( p, scene.tori[index].xyz, float2( scene.tori[index].w, scene.torusMinorRadii[index >> 2][index & 3] ) );
+    else
+        gradient = p - scene.spheres[index].xyz;
+    
+    //Degenerate at the center of a sphere or on the axis of a torus
+    float gradientLength = length( gradient );
+    if ( !(gradientLength > 1e-12f) || isinf( gradientLength ) )
+        return primitiveNormalTetrahedral( type, index, p );
+    
+    return gradient / gradientLength;
+}
+
+Material ObjectMaterial( int objectIndex )
+{
+    return scene.materials[scene.objectMaterials[objectIndex >> 2][objectIndex & 3]];
+}
+
+HitPayload MarchRay( Ray ray, int maxIterations, float surfaceDistance, float maxDistance )
 {
     float3 origin = ray.origin;
+    float directionLength = length( ray.dir );
+    
+    //Enhanced sphere tracing, steps are scaled by omega until the unbounding spheres
+    //of two points stop overlapping, then the step is undone and omega drops to 1
+    float omega = relaxation;
+    float previousRadius = 0.0f;
+    float stepLength = 0.0f;
     
     for ( int i = 0; i < maxIterations; i++ )
     {
-        ObjectDistance d = signedDistanceScene( ray.origin, currentObject );
-        if ( d.distance < surfaceDistance )
+        ObjectDistance d = signedDistanceScene( ray.origin );
+        float radius = abs( d.distance );
+        
+        bool overshoot = omega > 1.0f && radius + previousRadius < abs( stepLength ) * directionLength;
+        if ( overshoot )
+        {
+            stepLength -= omega * stepLength;
+            omega = 1.0f;
+        }
+        else
         {
-            HitPayload hit;
+            if ( d.distance < surfaceDistance )
+            {
+                HitPayload hit;
 
-            hit.HitDistance = distance( origin, ray.origin );
-            hit.WorldPosition = ray.origin;
-            hit.ObjectIndex = d.objectIndex;
-            
-            //Calculate normal
-            float epsilon = 0.001;
-            float centerDistance = signedDistanceScene( ray.origin ).distance;
-            float xDistance = signedDistanceScene( ray.origin + float3( epsilon, 0, 0 ) ).distance;
-            float yDistance = signedDistanceScene( ray.origin + float3( 0, epsilon, 0 ) ).distance;
-            float zDistance = signedDistanceScene( ray.origin + float3( 0, 0, epsilon ) ).distance;
-            hit.WorldNormal = (float3( xDistance, yDistance, zDistance ) - centerDistance) / epsilon;
-            hit.WorldNormal = normalize( hit.WorldNormal );
+                hit.HitDistance = distance( origin, ray.origin );
+                hit.WorldPosition = ray.origin;
+                hit.ObjectIndex = d.objectIndex;
             
+                hit.WorldNormal = objectNormal( d.objectIndex, ray.origin );
+                hit.Steps = i + 1;
             
-            return hit;
-        }
+                return hit;
+            }
 
-        if ( d.distance > maxDistance )
-        {
-            HitPayload hit;
-            hit.HitDistance = -1.0f;
-            hit.WorldNormal = float3( 0, 0, 0 );
-            hit.WorldPosition = float3( 0, 0, 0 );
-            hit.ObjectIndex = -1;
-            return hit;
+            if ( d.distance > maxDistance )
+            {
+                HitPayload hit;
+                hit.HitDistance = -1.0f;
+                hit.WorldNormal = float3( 0, 0, 0 );
+                hit.WorldPosition = float3( 0, 0, 0 );
+                hit.ObjectIndex = -1;
+                hit.Steps = i + 1;
+                return hit;
+            }
+            
+            stepLength = d.distance * omega;
         }
 
-        ray.origin += ray.dir * d.distance;
+        previousRadius = radius;
+        ray.origin += ray.dir * stepLength;
     }
     
     HitPayload hit;
@@ -387,703 +607,439 @@ HitPayload MarchRay( Ray ray, int maxIterations, float surfaceDistance, float ma
     hit.WorldNormal = float3( 0, 0, 0 );
     hit.WorldPosition = float3( 0, 0, 0 );
     hit.ObjectIndex = -1;
+    hit.Steps = maxIterations;
     return hit;
 }
 
-namespace RayColor
+float3 SampleSkybox( float3 direction )
 {
+    float theta = acos( direction.y ) / -PI;
+    float phi = atan2( direction.x, -direction.z ) / -PI * 0.5f;
+    return SkyboxTexture.SampleLevel( sampler_SkyboxTexture, float2( phi, -theta ), 0 ).xyz;
+}
 
-    float3 RayColor1( inout uint seed, Ray ray, uint maxIterations, float minDistance, float maxDistance )
-    {
-        return float3( 0, 0, 0 );
-    }
+//Next event estimation, same as CpuRayMarcher::SampleEmitters. Rougher metals than this sample the emitters
+static const float minLightSampleRoughness = 0.01f;
 
-    float3 RayColor2( inout uint seed, Ray ray, uint maxIterations, float minDistance, float maxDistance, int lastHitIndex )
-    {
-        uint width, height;
-        Result.GetDimensions( width, height );
-    
-        //Generate small diffrence in ray direction between samples
-        float2 delta = float2( Random::RandomFloat( seed ), Random::RandomFloat( seed ) ) / float2( width, height );
-        ray.dir += float3( delta, 0.0f );
-        
-        HitPayload hit = MarchRay( ray, maxIterations, minDistance, maxDistance );
+bool samplesEmitters( Material material )
+{
+    return material.id == 0 || (material.id == 1 && material.data[0].w > minLightSampleRoughness);
+}
+
+//Spheres and boxes with an emitting material, same as CompiledScene::IsEmitter
+bool isEmitter( int objectIndex )
+{
+    int primitive = scene.objectPrimitives[objectIndex >> 2][objectIndex & 3];
+    if ( primitive < 0 || (primitive & 3) == PRIMITIVE_TORUS )
+        return false;
+    Material material = ObjectMaterial( objectIndex );
+    return any( material.emitted() > 0.0f );
+}
+
+//A direction crosses the sphere of points reflected + roughness * unit vector once or
+//twice, every crossing adds the density of the sphere surface over the solid angle
+float metalPdf( float3 reflected, float roughness, float3 direction )
+{
+    float b = dot( direction, reflected );
+    float discriminant = b * b - (1.0f - roughness * roughness);
+    if ( !(discriminant > 0.0f) )
+        return 0.0f;
+    
+    float root = sqrt( discriminant );
+    float farDistance = b + root;
+    float nearDistance = b - root;
+    if ( farDistance <= 0.0f )
+        return 0.0f;
+    
+    return (farDistance * farDistance + (nearDistance > 0.0f ? nearDistance * nearDistance : 0.0f)) / (4.0f * PI * roughness * root);
+}
+
+//Density over the solid angle of scatter picking direction, 0 for materials that do not sample the emitters
+float scatterPdf( Material material, float3 rayDirection, float3 normal, float3 direction )
+{
+    float cosine = dot( normal, direction );
+    if ( !samplesEmitters( material ) || cosine <= 0.0f )
+        return 0.0f;
     
-        if ( hit.HitDistance > 0.0f )
-        {
-            Ray scattered;
-            float3 attenuation;
-            float3 color_from_emission = scene.materials[scene.objects[hit.ObjectIndex].materialIndex].emitted();
-            if ( scene.materials[scene.objects[hit.ObjectIndex].materialIndex].scatter( ray, hit, attenuation, scattered, seed ) )
-            {
-                float3 color_from_scatter = attenuation * RayColor1( seed, scattered, maxIterations, minDistance, maxDistance );
-                return color_from_emission + color_from_scatter;
-            }
-            else
-            {
-                return color_from_emission;
-            }
-        }
+    if ( material.id == 0 )
+        return cosine / PI;
     
-        //Skybox
-        float theta = acos( ray.dir.y ) / -PI;
-        float phi = atan2( ray.dir.x, -ray.dir.z ) / -PI * 0.5f;
-        float4 color = SkyboxTexture.SampleLevel( sampler_SkyboxTexture, float2( phi, -theta ), 0 );
-        return color.xyz;
-    }
+    return metalPdf( reflect( normalize( rayDirection ), normal ), material.data[0].w, direction );
+}
 
-    float3 RayColor3( inout uint seed, Ray ray, uint maxIterations, float minDistance, float maxDistance, int lastHitIndex )
+float powerHeuristic( float pdf, float otherPdf )
+{
+    return pdf * pdf / (pdf * pdf + otherPdf * otherPdf);
+}
+
+//Any-hit shadow ray towards a point length along the normalized direction, the emitter
+//at its end is skipped. Same as SphereTraceOccluded
+bool occluded( float3 origin, float3 direction, float length, int targetObject, uint maxIterations, float minDistance )
+{
+    float t = 0.0f;
+    for ( uint i = 0; i < maxIterations; i++ )
     {
-        uint width, height;
-        Result.GetDimensions( width, height );
-    
-        //Generate small diffrence in ray direction between samples
-        float2 delta = float2( Random::RandomFloat( seed ), Random::RandomFloat( seed ) ) / float2( width, height );
-        ray.dir += float3( delta, 0.0f );
+        ObjectDistance d = signedDistanceScene( origin );
+        if ( d.distance < minDistance )
+            return d.objectIndex != targetObject;
         
-        HitPayload hit = MarchRay( ray, maxIterations, minDistance, maxDistance );
-    
-        if ( hit.HitDistance > 0.0f )
-        {
-            Ray scattered;
-            float3 attenuation;
-            float3 color_from_emission = scene.materials[scene.objects[hit.ObjectIndex].materialIndex].emitted();
-            if ( scene.materials[scene.objects[hit.ObjectIndex].materialIndex].scatter( ray, hit, attenuation, scattered, seed ) )
-            {
-                float3 color_from_scatter = attenuation * RayColor2( seed, scattered, maxIterations, minDistance, maxDistance, hit.ObjectIndex );
-                return color_from_emission + color_from_scatter;
-            }
-            else
-            {
-                return color_from_emission;
-            }
-        }
-    
-        //Skybox
-        float theta = acos( ray.dir.y ) / -PI;
-        float phi = atan2( ray.dir.x, -ray.dir.z ) / -PI * 0.5f;
-        float4 color = SkyboxTexture.SampleLevel( sampler_SkyboxTexture, float2( phi, -theta ), 0 );
-        return color.xyz;
-    }
-    
-    float3 RayColor4( inout uint seed, Ray ray, uint maxIterations, float minDistance, float maxDistance, int lastHitIndex )
-    {
-        uint width, height;
-        Result.GetDimensions( width, height );
-    
-        //Generate small diffrence in ray direction between samples
-        float2 delta = float2( Random::RandomFloat( seed ), Random::RandomFloat( seed ) ) / float2( width, height );
-        ray.dir += float3( delta, 0.0f );
+        t += d.distance;
+        if ( t >= length )
+            return false;
         
-        HitPayload hit = MarchRay( ray, maxIterations, minDistance, maxDistance );
-    
-        if ( hit.HitDistance > 0.0f )
-        {
-            Ray scattered;
-            float3 attenuation;
-            float3 color_from_emission = scene.materials[scene.objects[hit.ObjectIndex].materialIndex].emitted();
-            if ( scene.materials[scene.objects[hit.ObjectIndex].materialIndex].scatter( ray, hit, attenuation, scattered, seed ) )
-            {
-                float3 color_from_scatter = attenuation * RayColor3( seed, scattered, maxIterations, minDistance, maxDistance, hit.ObjectIndex );
-                return color_from_emission + color_from_scatter;
-            }
-            else
-            {
-                return color_from_emission;
-            }
-        }
-    
-        //Skybox
-        float theta = acos( ray.dir.y ) / -PI;
-        float phi = atan2( ray.dir.x, -ray.dir.z ) / -PI * 0.5f;
-        float4 color = SkyboxTexture.SampleLevel( sampler_SkyboxTexture, float2( phi, -theta ), 0 );
-        return color.xyz;
+        origin += direction * d.distance;
     }
     
-    float3 RayColor5( inout uint seed, Ray ray, uint maxIterations, float minDistance, float maxDistance, int lastHitIndex )
+    return true;
+}
+
+//Emitted light from a point picked on the emitters by area, weighted against the bounce finding it
+//dimension is the first of the bounce
+float3 sampleEmitters( PathSampler pathSampler, uint dimension, Ray ray, HitPayload hit, Material material, uint maxIterations, float minDistance )
+{
+    float pick = pathSampler.get( dimension + DIMENSION_EMITTER_PICK ) * scene.emitterArea;
+    int emitter = 0;
+    while ( emitter + 1 < scene.emitterCount && scene.emitterAreaSums[emitter >> 2][emitter & 3] <= pick )
     {
-        uint width, height;
-        Result.GetDimensions( width, height );
-    
-        //Generate small diffrence in ray direction between samples
-        float2 delta = float2( Random::RandomFloat( seed ), Random::RandomFloat( seed ) ) / float2( width, height );
-        ray.dir += float3( delta, 0.0f );
-        
-        HitPayload hit = MarchRay( ray, maxIterations, minDistance, maxDistance );
-    
-        if ( hit.HitDistance > 0.0f )
-        {
-            Ray scattered;
-            float3 attenuation;
-            float3 color_from_emission = scene.materials[scene.objects[hit.ObjectIndex].materialIndex].emitted();
-            if ( scene.materials[scene.objects[hit.ObjectIndex].materialIndex].scatter( ray, hit, attenuation, scattered, seed ) )
-            {
-                float3 color_from_scatter = attenuation * RayColor4( seed, scattered, maxIterations, minDistance, maxDistance, hit.ObjectIndex );
-                return color_from_emission + color_from_scatter;
-            }
-            else
-            {
-                return color_from_emission;
-            }
-        }
-    
-        //Skybox
-        float theta = acos( ray.dir.y ) / -PI;
-        float phi = atan2( ray.dir.x, -ray.dir.z ) / -PI * 0.5f;
-        float4 color = SkyboxTexture.SampleLevel( sampler_SkyboxTexture, float2( phi, -theta ), 0 );
-        return color.xyz;
+        emitter++;
     }
     
-    float3 RayColor6( inout uint seed, Ray ray, uint maxIterations, float minDistance, float maxDistance, int lastHitIndex )
-    {
-        uint width, height;
-        Result.GetDimensions( width, height );
+    int objectIndex = scene.emitterObjects[emitter >> 2][emitter & 3];
+    int primitive = scene.objectPrimitives[objectIndex >> 2][objectIndex & 3];
+    int index = primitive >> 2;
     
-        //Generate small diffrence in ray direction between samples
-        float2 delta = float2( Random::RandomFloat( seed ), Random::RandomFloat( seed ) ) / float2( width, height );
-        ray.dir += float3( delta, 0.0f );
-        
-        HitPayload hit = MarchRay( ray, maxIterations, minDistance, maxDistance );
-    
-        if ( hit.HitDistance > 0.0f )
-        {
-            Ray scattered;
-            float3 attenuation;
-            float3 color_from_emission = scene.materials[scene.objects[hit.ObjectIndex].materialIndex].emitted();
-            if ( scene.materials[scene.objects[hit.ObjectIndex].materialIndex].scatter( ray, hit, attenuation, scattered, seed ) )
-            {
-                float3 color_from_scatter = attenuation * RayColor5( seed, scattered, maxIterations, minDistance, maxDistance, hit.ObjectIndex );
-                return color_from_emission + color_from_scatter;
-            }
-            else
-            {
-                return color_from_emission;
-            }
-        }
-    
-        //Skybox
-        float theta = acos( ray.dir.y ) / -PI;
-        float phi = atan2( ray.dir.x, -ray.dir.z ) / -PI * 0.5f;
-        float4 color = SkyboxTexture.SampleLevel( sampler_SkyboxTexture, float2( phi, -theta ), 0 );
-        return color.xyz;
-    }
-    
-    float3 RayColor7( inout uint seed, Ray ray, uint maxIterations, float minDistance, float maxDistance, int lastHitIndex )
+    float3 position;
+    float3 normal = float3( 0, 0, 0 );
+    if ( (primitive & 3) == PRIMITIVE_BOX )
     {
-        uint width, height;
-        Result.GetDimensions( width, height );
-    
-        //Generate small diffrence in ray direction between samples
-        float2 delta = float2( Random::RandomFloat( seed ), Random::RandomFloat( seed ) ) / float2( width, height );
-        ray.dir += float3( delta, 0.0f );
+        float3 size = abs( scene.boxSizes[index].xyz );
+        float3 faceAreas = size.yzx * size.zxy;
+        float face = pathSampler.get( dimension + DIMENSION_EMITTER_FACE ) * (faceAreas.x + faceAreas.y + faceAreas.z);
+        int axis = face < faceAreas.x ? 0 : (face < faceAreas.x + faceAreas.y ? 1 : 2);
+        float faceStart = axis == 0 ? 0.0f : (axis == 1 ? faceAreas.x : faceAreas.x + faceAreas.y);
+        float side = face - faceStart < 0.5f * faceAreas[axis] ? -1.0f : 1.0f;
         
-        HitPayload hit = MarchRay( ray, maxIterations, minDistance, maxDistance );
-    
-        if ( hit.HitDistance > 0.0f )
-        {
-            Ray scattered;
-            float3 attenuation;
-            float3 color_from_emission = scene.materials[scene.objects[hit.ObjectIndex].materialIndex].emitted();
-            if ( scene.materials[scene.objects[hit.ObjectIndex].materialIndex].scatter( ray, hit, attenuation, scattered, seed ) )
-            {
-                float3 color_from_scatter = attenuation * RayColor6( seed, scattered, maxIterations, minDistance, maxDistance, hit.ObjectIndex );
-                return color_from_emission + color_from_scatter;
-            }
-            else
-            {
-                return color_from_emission;
-            }
-        }
-    
-        //Skybox
-        float theta = acos( ray.dir.y ) / -PI;
-        float phi = atan2( ray.dir.x, -ray.dir.z ) / -PI * 0.5f;
-        float4 color = SkyboxTexture.SampleLevel( sampler_SkyboxTexture, float2( phi, -theta ), 0 );
-        return color.xyz;
+        float2 u = pathSampler.get2D( dimension + DIMENSION_EMITTER_UV );
+        float3 local = float3( 0, 0, 0 );
+        local[axis] = side;
+        local[(axis + 1) % 3] = u.x * 2.0f - 1.0f;
+        local[(axis + 2) % 3] = u.y * 2.0f - 1.0f;
+        normal[axis] = side;
+        position = scene.boxCenters[index].xyz + local * size;
     }
-    
-    float3 RayColor8( inout uint seed, Ray ray, uint maxIterations, float minDistance, float maxDistance, int lastHitIndex )
+    else
     {
-        uint width, height;
-        Result.GetDimensions( width, height );
-    
-        //Generate small diffrence in ray direction between samples
-        float2 delta = float2( Random::RandomFloat( seed ), Random::RandomFloat( seed ) ) / float2( width, height );
-        ray.dir += float3( delta, 0.0f );
-        
-        HitPayload hit = MarchRay( ray, maxIterations, minDistance, maxDistance );
-    
-        if ( hit.HitDistance > 0.0f )
-        {
-            Ray scattered;
-            float3 attenuation;
-            float3 color_from_emission = scene.materials[scene.objects[hit.ObjectIndex].materialIndex].emitted();
-            if ( scene.materials[scene.objects[hit.ObjectIndex].materialIndex].scatter( ray, hit, attenuation, scattered, seed ) )
-            {
-                float3 color_from_scatter = attenuation * RayColor7( seed, scattered, maxIterations, minDistance, maxDistance, hit.ObjectIndex );
-                return color_from_emission + color_from_scatter;
-            }
-            else
-            {
-                return color_from_emission;
-            }
-        }
-    
-        //Skybox
-        float theta = acos( ray.dir.y ) / -PI;
-        float phi = atan2( ray.dir.x, -ray.dir.z ) / -PI * 0.5f;
-        float4 color = SkyboxTexture.SampleLevel( sampler_SkyboxTexture, float2( phi, -theta ), 0 );
-        return color.xyz;
+        normal = Sampler::uniformSphere( pathSampler.get2D( dimension + DIMENSION_EMITTER_UV ) );
+        position = scene.spheres[index].xyz + normal * abs( scene.spheres[index].w );
     }
     
-    float3 RayColor9( inout uint seed, Ray ray, uint maxIterations, float minDistance, float maxDistance, int lastHitIndex )
-    {
-        uint width, height;
-        Result.GetDimensions( width, height );
-    
-        //Generate small diffrence in ray direction between samples
-        float2 delta = float2( Random::RandomFloat( seed ), Random::RandomFloat( seed ) ) / float2( width, height );
-        ray.dir += float3( delta, 0.0f );
-        
-        HitPayload hit = MarchRay( ray, maxIterations, minDistance, maxDistance );
+    //Only the side of the emitter facing the point, the back is hidden by the emitter itself
+    float3 origin = hit.WorldPosition + hit.WorldNormal * 0.001f;
+    float lightDistance = length( position - origin );
+    float3 direction = (position - origin) / lightDistance;
+    float lightCos = -dot( normal, direction );
+    float bsdfPdf = scatterPdf( material, ray.dir, hit.WorldNormal, direction );
+    if ( !(lightCos > 0.0f) || !(bsdfPdf > 0.0f) )
+        return float3( 0, 0, 0 );
     
-        if ( hit.HitDistance > 0.0f )
-        {
-            Ray scattered;
-            float3 attenuation;
-            float3 color_from_emission = scene.materials[scene.objects[hit.ObjectIndex].materialIndex].emitted();
-            if ( scene.materials[scene.objects[hit.ObjectIndex].materialIndex].scatter( ray, hit, attenuation, scattered, seed ) )
-            {
-                float3 color_from_scatter = attenuation * RayColor8( seed, scattered, maxIterations, minDistance, maxDistance, hit.ObjectIndex );
-                return color_from_emission + color_from_scatter;
-            }
-            else
-            {
-                return color_from_emission;
-            }
-        }
+    if ( occluded( origin, direction, lightDistance, objectIndex, maxIterations, minDistance ) )
+        return float3( 0, 0, 0 );
     
-        //Skybox
-        float theta = acos( ray.dir.y ) / -PI;
-        float phi = atan2( ray.dir.x, -ray.dir.z ) / -PI * 0.5f;
-        float4 color = SkyboxTexture.SampleLevel( sampler_SkyboxTexture, float2( phi, -theta ), 0 );
-        return color.xyz;
-    }
+    Material emitterMaterial = ObjectMaterial( objectIndex );
+    float lightPdf = lightDistance * lightDistance / (lightCos * scene.emitterArea);
+    return material.data[0].xyz * emitterMaterial.emitted() * (bsdfPdf / lightPdf * powerHeuristic( lightPdf, bsdfPdf ));
+}
+
+//Chance a path keeps going, same as SurvivalProbability in RussianRoulette.h
+float survivalProbability( float3 throughput )
+{
+    return min( max( max( throughput.x, throughput.y ), throughput.z ), 1.0f );
+}
+
+//Iterative path with the product of all attenuations so far carried as throughput.
+//pixelSize is one over the output dimensions, used to jitter every bounce. The first
+//hit, the march iterations and the path counts are added to primary
+float3 RayColor( PathSampler pathSampler, Ray ray, float2 pixelSize, uint maxIterations, float minDistance, float maxDistance, inout PrimaryHit primary )
+{
+    float3 color = float3( 0, 0, 0 );
+    float3 throughput = float3( 1, 1, 1 );
+    bool sampleLights = nextEventEstimation != 0 && scene.emitterCount > 0;
+    //Of the direction the last bounce picked, 0 if light sampling could not have found the hit
+    float lastScatterPdf = 0.0f;
     
-    float3 RayColor10( inout uint seed, Ray ray, uint maxIterations, float minDistance, float maxDistance, int lastHitIndex )
+    for ( int depth = 0; depth < maxDepth; depth++ )
     {
-        uint width, height;
-        Result.GetDimensions( width, height );
-    
-        //Generate small diffrence in ray direction between samples
-        float2 delta = float2( Random::RandomFloat( seed ), Random::RandomFloat( seed ) ) / float2( width, height );
-        ray.dir += float3( delta, 0.0f );
+        uint dimension = (uint) depth * DIMENSIONS_PER_BOUNCE;
+        primary.pathRays++;
         
-        HitPayload hit = MarchRay( ray, maxIterations, minDistance, maxDistance );
-    
-        if ( hit.HitDistance > 0.0f )
+        //Generate small diffrence in ray direction between samples. Bounces keep the
+        //direction lastScatterPdf was computed for when it weights the emitters they hit
+        if ( depth == 0 || !sampleLights )
         {
-            Ray scattered;
-            float3 attenuation;
-            float3 color_from_emission = scene.materials[scene.objects[hit.ObjectIndex].materialIndex].emitted();
-            if ( scene.materials[scene.objects[hit.ObjectIndex].materialIndex].scatter( ray, hit, attenuation, scattered, seed ) )
-            {
-                float3 color_from_scatter = attenuation * RayColor9( seed, scattered, maxIterations, minDistance, maxDistance, hit.ObjectIndex );
-                return color_from_emission + color_from_scatter;
-            }
-            else
-            {
-                return color_from_emission;
-            }
+            float2 delta = pathSampler.get2D( dimension + DIMENSION_JITTER ) * pixelSize;
+            ray.dir += float3( delta, 0.0f );
         }
-    
-        //Skybox
-        float theta = acos( ray.dir.y ) / -PI;
-        float phi = atan2( ray.dir.x, -ray.dir.z ) / -PI * 0.5f;
-        float4 color = SkyboxTexture.SampleLevel( sampler_SkyboxTexture, float2( phi, -theta ), 0 );
-        return color.xyz;
-    }
-    
-    float3 RayColor11( inout uint seed, Ray ray, uint maxIterations, float minDistance, float maxDistance, int lastHitIndex )
-    {
-        uint width, height;
-        Result.GetDimensions( width, height );
-    
-        //Generate small diffrence in ray direction between samples
-        float2 delta = float2( Random::RandomFloat( seed ), Random::RandomFloat( seed ) ) / float2( width, height );
-        ray.dir += float3( delta, 0.0f );
         
         HitPayload hit = MarchRay( ray, maxIterations, minDistance, maxDistance );
-    
-        if ( hit.HitDistance > 0.0f )
-        {
-            Ray scattered;
-            float3 attenuation;
-            float3 color_from_emission = scene.materials[scene.objects[hit.ObjectIndex].materialIndex].emitted();
-            if ( scene.materials[scene.objects[hit.ObjectIndex].materialIndex].scatter( ray, hit, attenuation, scattered, seed ) )
-            {
-                float3 color_from_scatter = attenuation * RayColor10( seed, scattered, maxIterations, minDistance, maxDistance, hit.ObjectIndex );
-                return color_from_emission + color_from_scatter;
-            }
-            else
-            {
-                return color_from_emission;
-            }
-        }
-    
-        //Skybox
-        float theta = acos( ray.dir.y ) / -PI;
-        float phi = atan2( ray.dir.x, -ray.dir.z ) / -PI * 0.5f;
-        float4 color = SkyboxTexture.SampleLevel( sampler_SkyboxTexture, float2( phi, -theta ), 0 );
-        return color.xyz;
-    }
-    
-    float3 RayColor12( inout uint seed, Ray ray, uint maxIterations, float minDistance, float maxDistance, int lastHitIndex )
-    {
-        uint width, height;
-        Result.GetDimensions( width, height );
-    
-        //Generate small diffrence in ray direction between samples
-        float2 delta = float2( Random::RandomFloat( seed ), Random::RandomFloat( seed ) ) / float2( width, height );
-        ray.dir += float3( delta, 0.0f );
+        primary.steps += hit.Steps;
         
-        HitPayload hit = MarchRay( ray, maxIterations, minDistance, maxDistance );
-    
-        if ( hit.HitDistance > 0.0f )
+        if ( depth == 0 )
         {
-            Ray scattered;
-            float3 attenuation;
-            float3 color_from_emission = scene.materials[scene.objects[hit.ObjectIndex].materialIndex].emitted();
-            if ( scene.materials[scene.objects[hit.ObjectIndex].materialIndex].scatter( ray, hit, attenuation, scattered, seed ) )
+            if ( hit.HitDistance > 0.0f )
             {
-                float3 color_from_scatter = attenuation * RayColor11( seed, scattered, maxIterations, minDistance, maxDistance, hit.ObjectIndex );
-                return color_from_emission + color_from_scatter;
+                Material firstMaterial = ObjectMaterial( hit.ObjectIndex );
+                primary.depth += hit.HitDistance;
+                primary.normal += hit.WorldNormal;
+                primary.albedo += firstMaterial.id == 2 ? float3( 1, 1, 1 ) : firstMaterial.data[0].xyz;
+                primary.objectId = hit.ObjectIndex;
+                primary.materialId = scene.objectMaterials[hit.ObjectIndex >> 2][hit.ObjectIndex & 3];
             }
             else
             {
-                return color_from_emission;
+                primary.depth += maxDistance;
+                primary.objectId = -1.0f;
+                primary.materialId = -1.0f;
             }
         }
-    
-        //Skybox
-        float theta = acos( ray.dir.y ) / -PI;
-        float phi = atan2( ray.dir.x, -ray.dir.z ) / -PI * 0.5f;
-        float4 color = SkyboxTexture.SampleLevel( sampler_SkyboxTexture, float2( phi, -theta ), 0 );
-        return color.xyz;
-    }
-    
-    float3 RayColor13( inout uint seed, Ray ray, uint maxIterations, float minDistance, float maxDistance, int lastHitIndex )
-    {
-        uint width, height;
-        Result.GetDimensions( width, height );
-    
-        //Generate small diffrence in ray direction between samples
-        float2 delta = float2( Random::RandomFloat( seed ), Random::RandomFloat( seed ) ) / float2( width, height );
-        ray.dir += float3( delta, 0.0f );
         
-        HitPayload hit = MarchRay( ray, maxIterations, minDistance, maxDistance );
-    
-        if ( hit.HitDistance > 0.0f )
-        {
-            Ray scattered;
-            float3 attenuation;
-            float3 color_from_emission = scene.materials[scene.objects[hit.ObjectIndex].materialIndex].emitted();
-            if ( scene.materials[scene.objects[hit.ObjectIndex].materialIndex].scatter( ray, hit, attenuation, scattered, seed ) )
-            {
-                float3 color_from_scatter = attenuation * RayColor12( seed, scattered, maxIterations, minDistance, maxDistance, hit.ObjectIndex );
-                return color_from_emission + color_from_scatter;
-            }
-            else
-            {
-                return color_from_emission;
-            }
-        }
-    
-        //Skybox
-        float theta = acos( ray.dir.y ) / -PI;
-        float phi = atan2( ray.dir.x, -ray.dir.z ) / -PI * 0.5f;
-        float4 color = SkyboxTexture.SampleLevel( sampler_SkyboxTexture, float2( phi, -theta ), 0 );
-        return color.xyz;
-    }
-    
-    float3 RayColor14( inout uint seed, Ray ray, uint maxIterations, float minDistance, float maxDistance, int lastHitIndex )
-    {
-        uint width, height;
-        Result.GetDimensions( width, height );
-    
-        //Generate small diffrence in ray direction between samples
-        float2 delta = float2( Random::RandomFloat( seed ), Random::RandomFloat( seed ) ) / float2( width, height );
-        ray.dir += float3( delta, 0.0f );
+        if ( hit.HitDistance <= 0.0f )
+            return color + throughput * SampleSkybox( ray.dir );
         
-        HitPayload hit = MarchRay( ray, maxIterations, minDistance, maxDistance );
-    
-        if ( hit.HitDistance > 0.0f )
+        Ray scattered;
+        float3 attenuation;
+        Material material = ObjectMaterial( hit.ObjectIndex );
+        float3 emitted = material.emitted();
+        if ( lastScatterPdf > 0.0f && isEmitter( hit.ObjectIndex ) )
         {
-            Ray scattered;
-            float3 attenuation;
-            float3 color_from_emission = scene.materials[scene.objects[hit.ObjectIndex].materialIndex].emitted();
-            if ( scene.materials[scene.objects[hit.ObjectIndex].materialIndex].scatter( ray, hit, attenuation, scattered, seed ) )
-            {
-                float3 color_from_scatter = attenuation * RayColor13( seed, scattered, maxIterations, minDistance, maxDistance, hit.ObjectIndex );
-                return color_from_emission + color_from_scatter;
-            }
-            else
-            {
-                return color_from_emission;
-            }
+            //Light sampling at the last bounce could have picked this point as well
+            float lightPdf = hit.HitDistance * hit.HitDistance / (abs( dot( hit.WorldNormal, normalize( ray.dir ) ) ) * scene.emitterArea);
+            emitted *= powerHeuristic( lastScatterPdf, lightPdf );
         }
-    
-        //Skybox
-        float theta = acos( ray.dir.y ) / -PI;
-        float phi = atan2( ray.dir.x, -ray.dir.z ) / -PI * 0.5f;
-        float4 color = SkyboxTexture.SampleLevel( sampler_SkyboxTexture, float2( phi, -theta ), 0 );
-        return color.xyz;
-    }
-    
-    float3 RayColor15( inout uint seed, Ray ray, uint maxIterations, float minDistance, float maxDistance, int lastHitIndex )
-    {
-        uint width, height;
-        Result.GetDimensions( width, height );
-    
-        //Generate small diffrence in ray direction between samples
-        float2 delta = float2( Random::RandomFloat( seed ), Random::RandomFloat( seed ) ) / float2( width, height );
-        ray.dir += float3( delta, 0.0f );
+        color += throughput * emitted;
         
-        HitPayload hit = MarchRay( ray, maxIterations, minDistance, maxDistance );
-    
-        if ( hit.HitDistance > 0.0f )
-        {
-            Ray scattered;
-            float3 attenuation;
-            float3 color_from_emission = scene.materials[scene.objects[hit.ObjectIndex].materialIndex].emitted();
-            if ( scene.materials[scene.objects[hit.ObjectIndex].materialIndex].scatter( ray, hit, attenuation, scattered, seed ) )
-            {
-                float3 color_from_scatter = attenuation * RayColor14( seed, scattered, maxIterations, minDistance, maxDistance, hit.ObjectIndex );
-                return color_from_emission + color_from_scatter;
-            }
-            else
-            {
-                return color_from_emission;
-            }
-        }
-    
-        //Skybox
-        float theta = acos( ray.dir.y ) / -PI;
-        float phi = atan2( ray.dir.x, -ray.dir.z ) / -PI * 0.5f;
-        float4 color = SkyboxTexture.SampleLevel( sampler_SkyboxTexture, float2( phi, -theta ), 0 );
-        return color.xyz;
-    }
-    
-    float3 RayColor16( inout uint seed, Ray ray, uint maxIterations, float minDistance, float maxDistance, int lastHitIndex )
-    {
-        uint width, height;
-        Result.GetDimensions( width, height );
-    
-        //Generate small diffrence in ray direction between samples
-        float2 delta = float2( Random::RandomFloat( seed ), Random::RandomFloat( seed ) ) / float2( width, height );
-        ray.dir += float3( delta, 0.0f );
+        //Not at the last vertex, the path could not find the other half of the light there
+        bool sampleHere = sampleLights && depth + 1 < maxDepth && samplesEmitters( material );
+        if ( sampleHere )
+            color += throughput * sampleEmitters( pathSampler, dimension, ray, hit, material, maxIterations, minDistance );
         
-        HitPayload hit = MarchRay( ray, maxIterations, minDistance, maxDistance );
-    
-        if ( hit.HitDistance > 0.0f )
+        if ( !material.scatter( ray, hit, attenuation, scattered, pathSampler.get2D( dimension + DIMENSION_SCATTER ) ) )
+            return color;
+        lastScatterPdf = sampleHere ? scatterPdf( material, ray.dir, hit.WorldNormal, normalize( scattered.dir ) ) : 0.0f;
+        
+        //Nothing further down the path can add to the color anymore
+        throughput *= attenuation;
+        if ( !any( throughput > 0.0f ) )
+            return color;
+        
+        //Paths that carry little light end early, the survivors make up for the ones that did not
+        if ( depth + 1 >= rouletteMinDepth && depth + 1 < maxDepth )
         {
-            Ray scattered;
-            float3 attenuation;
-            float3 color_from_emission = scene.materials[scene.objects[hit.ObjectIndex].materialIndex].emitted();
-            if ( scene.materials[scene.objects[hit.ObjectIndex].materialIndex].scatter( ray, hit, attenuation, scattered, seed ) )
+            float survival = survivalProbability( throughput );
+            if ( pathSampler.get( dimension + DIMENSION_ROULETTE ) >= survival )
             {
-                float3 color_from_scatter = attenuation * RayColor15( seed, scattered, maxIterations, minDistance, maxDistance, hit.ObjectIndex );
-                return color_from_emission + color_from_scatter;
-            }
-            else
-            {
-                return color_from_emission;
+                primary.terminatedPaths++;
+                primary.raysSaved += maxDepth - depth - 1;
+                return color;
             }
+            throughput /= survival;
         }
-    
-        //Skybox
-        float theta = acos( ray.dir.y ) / -PI;
-        float phi = atan2( ray.dir.x, -ray.dir.z ) / -PI * 0.5f;
-        float4 color = SkyboxTexture.SampleLevel( sampler_SkyboxTexture, float2( phi, -theta ), 0 );
-        return color.xyz;
-    }
-    
-    float3 RayColor17( inout uint seed, Ray ray, uint maxIterations, float minDistance, float maxDistance, int lastHitIndex )
-    {
-        uint width, height;
-        Result.GetDimensions( width, height );
-    
-        //Generate small diffrence in ray direction between samples
-        float2 delta = float2( Random::RandomFloat( seed ), Random::RandomFloat( seed ) ) / float2( width, height );
-        ray.dir += float3( delta, 0.0f );
         
-        HitPayload hit = MarchRay( ray, maxIterations, minDistance, maxDistance );
+        ray = scattered;
+    }
     
-        if ( hit.HitDistance > 0.0f )
-        {
-            Ray scattered;
-            float3 attenuation;
-            float3 color_from_emission = scene.materials[scene.objects[hit.ObjectIndex].materialIndex].emitted();
-            if ( scene.materials[scene.objects[hit.ObjectIndex].materialIndex].scatter( ray, hit, attenuation, scattered, seed ) )
-            {
-                float3 color_from_scatter = attenuation * RayColor16( seed, scattered, maxIterations, minDistance, maxDistance, hit.ObjectIndex );
-                return color_from_emission + color_from_scatter;
-            }
-            else
-            {
-                return color_from_emission;
-            }
-        }
+    return color;
+}
+
+#ifdef UNROLLED_PATH
+//The fixed depth chain RayColor used to be, one function per bounce. Only compiled
+//by the path loop benchmark to compare against the loop
+float3 RayColorUnrolled0( inout uint seed, Ray ray, uint maxIterations, float minDistance, float maxDistance )
+{
+    return float3( 0, 0, 0 );
+}
+
+#define RAY_COLOR_UNROLLED( level, next ) \
+float3 RayColorUnrolled##level( inout uint seed, Ray ray, uint maxIterations, float minDistance, float maxDistance ) \
+{ \
+    uint width, height; \
+    Result.GetDimensions( width, height ); \
+    float2 delta = float2( Random::RandomFloat( seed ), Random::RandomFloat( seed ) ) / float2( width, height ); \
+    ray.dir += float3( delta, 0.0f ); \
+    HitPayload hit = MarchRay( ray, maxIterations, minDistance, maxDistance ); \
+    if ( hit.HitDistance > 0.0f ) \
+    { \
+        Ray scattered; \
+        float3 attenuation; \
+        Material material = ObjectMaterial( hit.ObjectIndex ); \
+        float3 color_from_emission = material.emitted(); \
+        float2 u = float2( Random::RandomFloat( seed ), Random::RandomFloat( seed ) ); \
+        if ( material.scatter( ray, hit, attenuation, scattered, u ) ) \
+            return color_from_emission + attenuation * RayColorUnrolled##next( seed, scattered, maxIterations, minDistance, maxDistance ); \
+        return color_from_emission; \
+    } \
+    float theta = acos( ray.dir.y ) / -PI; \
+    float phi = atan2( ray.dir.x, -ray.dir.z ) / -PI * 0.5f; \
+    return SkyboxTexture.SampleLevel( sampler_SkyboxTexture, float2( phi, -theta ), 0 ).xyz; \
+}
+
+RAY_COLOR_UNROLLED( 1, 0 )
+RAY_COLOR_UNROLLED( 2, 1 )
+RAY_COLOR_UNROLLED( 3, 2 )
+RAY_COLOR_UNROLLED( 4, 3 )
+RAY_COLOR_UNROLLED( 5, 4 )
+RAY_COLOR_UNROLLED( 6, 5 )
+RAY_COLOR_UNROLLED( 7, 6 )
+RAY_COLOR_UNROLLED( 8, 7 )
+RAY_COLOR_UNROLLED( 9, 8 )
+RAY_COLOR_UNROLLED( 10, 9 )
+RAY_COLOR_UNROLLED( 11, 10 )
+RAY_COLOR_UNROLLED( 12, 11 )
+RAY_COLOR_UNROLLED( 13, 12 )
+RAY_COLOR_UNROLLED( 14, 13 )
+RAY_COLOR_UNROLLED( 15, 14 )
+RAY_COLOR_UNROLLED( 16, 15 )
+RAY_COLOR_UNROLLED( 17, 16 )
+RAY_COLOR_UNROLLED( 18, 17 )
+RAY_COLOR_UNROLLED( 19, 18 )
+RAY_COLOR_UNROLLED( 20, 19 )
+#endif
+
+float luminance( float3 color )
+{
+    return dot( color, float3( 0.2126f, 0.7152f, 0.0722f ) );
+}
+
+//Standard error of the mean luminance relative to the mean, same as RelativeError on the CPU
+float relativeError( float luminanceSum, float luminanceSquareSum, float samples )
+{
+    if ( samples < 2.0f )
+        return 1e30f;
     
-        //Skybox
-        float theta = acos( ray.dir.y ) / -PI;
-        float phi = atan2( ray.dir.x, -ray.dir.z ) / -PI * 0.5f;
-        float4 color = SkyboxTexture.SampleLevel( sampler_SkyboxTexture, float2( phi, -theta ), 0 );
-        return color.xyz;
-    }
+    float mean = luminanceSum / samples;
+    float variance = max( luminanceSquareSum / samples - mean * mean, 0.0f ) * samples / (samples - 1.0f);
+    return sqrt( variance / samples ) / (mean + 0.01f);
+}
+
+//Moves the mean of one AOV channel towards the new samples, weight is their share of all
+//samples. Disabled AOVs cost one branch on a constant
+void UpdateAov( int aov, uint channel, uint pixelIndex, uint pixelCount, float sum, float weight )
+{
+    int offset = aovOffsets[aov >> 2][aov & 3];
+    if ( offset < 0 )
+        return;
     
-    float3 RayColor18( inout uint seed, Ray ray, uint maxIterations, float minDistance, float maxDistance, int lastHitIndex )
+    uint index = offset + channel * pixelCount + pixelIndex;
+    float value = sum / renderInterations;
+    Aovs[index] = weight >= 1.0f ? value : lerp( Aovs[index], value, weight );
+}
+
+void SetAov( int aov, uint pixelIndex, float value )
+{
+    int offset = aovOffsets[aov >> 2][aov & 3];
+    if ( offset >= 0 )
+        Aovs[offset + pixelIndex] = value;
+}
+
+static const float historyDepthTolerance = 0.05f;
+static const float historyNormalCos = 0.9f;
+
+//Bilinear sum of the history taps that saw the same surface as primary, same as
+//CpuRayMarcher::ReprojectPixel. Means are blended so pixels with more samples do not
+//dominate, the result holds at most maxHistory samples. Zero when no tap matched
+float4 ReprojectHistory( float3 direction, float4 primary, float pixelAngle, float maxDistance, uint width, uint height, out float squares )
+{
+    squares = 0.0f;
+    
+    //The skybox only depends on the direction, it stays in place when the camera moves
+    float3 position = cameraPosition + direction * primary.w;
+    bool sky = primary.w >= maxDistance;
+    float4 clip = mul( transpose( PreviousViewProjectionMatrix ), float4( sky ? direction : position - previousCameraPosition, 0.0f ) );
+    if ( clip.w <= 0.0f )
+        return float4( 0, 0, 0, 0 );
+    
+    float2 p = (clip.xy / clip.w + 1.0f) * 0.5f * float2( width, height );
+    int2 p0 = int2( floor( p ) );
+    float2 f = p - p0;
+    
+    //Taps are up to a pixel away from the position, at a grazing angle that changes the depth a lot
+    float expectedDepth = sky ? primary.w : distance( position, previousCameraPosition );
+    float facing = max( abs( dot( primary.xyz, direction ) ), 0.05f );
+    float depthTolerance = expectedDepth * (historyDepthTolerance + pixelAngle / facing);
+    
+    float3 color = float3( 0, 0, 0 );
+    float samples = 0.0f;
+    float weightSum = 0.0f;
+    for ( int tap = 0; tap < 4; tap++ )
     {
-        uint width, height;
-        Result.GetDimensions( width, height );
-    
-        //Generate small diffrence in ray direction between samples
-        float2 delta = float2( Random::RandomFloat( seed ), Random::RandomFloat( seed ) ) / float2( width, height );
-        ray.dir += float3( delta, 0.0f );
+        int2 t = p0 + int2( tap & 1, tap >> 1 );
+        float weight = ((tap & 1) ? f.x : 1.0f - f.x) * ((tap >> 1) ? f.y : 1.0f - f.y);
+        if ( any( t < 0 ) || t.x >= (int) width || t.y >= (int) height || weight <= 0.0f )
+            continue;
         
-        HitPayload hit = MarchRay( ray, maxIterations, minDistance, maxDistance );
-    
-        if ( hit.HitDistance > 0.0f )
-        {
-            Ray scattered;
-            float3 attenuation;
-            float3 color_from_emission = scene.materials[scene.objects[hit.ObjectIndex].materialIndex].emitted();
-            if ( scene.materials[scene.objects[hit.ObjectIndex].materialIndex].scatter( ray, hit, attenuation, scattered, seed ) )
-            {
-                float3 color_from_scatter = attenuation * RayColor17( seed, scattered, maxIterations, minDistance, maxDistance, hit.ObjectIndex );
-                return color_from_emission + color_from_scatter;
-            }
-            else
-            {
-                return color_from_emission;
-            }
-        }
-    
-        //Skybox
-        float theta = acos( ray.dir.y ) / -PI;
-        float phi = atan2( ray.dir.x, -ray.dir.z ) / -PI * 0.5f;
-        float4 color = SkyboxTexture.SampleLevel( sampler_SkyboxTexture, float2( phi, -theta ), 0 );
-        return color.xyz;
+        //Normals are zero for the sky, which only has to match the sky
+        uint index = t.y * width + t.x;
+        float4 history = HistoryAccumulation[index];
+        float4 historyPrimary = HistoryPrimary[index];
+        if ( history.w <= 0.0f || abs( historyPrimary.w - expectedDepth ) > depthTolerance ||
+            dot( primary.xyz, historyPrimary.xyz ) < historyNormalCos * dot( primary.xyz, primary.xyz ) )
+            continue;
+        
+        color += history.xyz * (weight / history.w);
+        squares += HistoryMoments[index] * (weight / history.w);
+        samples += history.w * weight;
+        weightSum += weight;
     }
     
-    float3 RayColor19( inout uint seed, Ray ray, uint maxIterations, float minDistance, float maxDistance, int lastHitIndex )
+    if ( weightSum < 0.01f )
     {
-        uint width, height;
-        Result.GetDimensions( width, height );
+        squares = 0.0f;
+        return float4( 0, 0, 0, 0 );
+    }
     
-        //Generate small diffrence in ray direction between samples
-        float2 delta = float2( Random::RandomFloat( seed ), Random::RandomFloat( seed ) ) / float2( width, height );
-        ray.dir += float3( delta, 0.0f );
-        
-        HitPayload hit = MarchRay( ray, maxIterations, minDistance, maxDistance );
+    float count = min( samples / weightSum, maxHistory );
+    squares *= count / weightSum;
+    return float4( color * (count / weightSum), count );
+}
+
+groupshared float groupErrors[64];
+groupshared bool groupActive;
+
+[numthreads(8, 8, 1)]
+void main( uint3 threadId : SV_DispatchThreadID, uint groupIndex : SV_GroupIndex )
+{
+    uint width, height;
+    Result.GetDimensions( width, height );
     
-        if ( hit.HitDistance > 0.0f )
-        {
-            Ray scattered;
-            float3 attenuation;
-            float3 color_from_emission = scene.materials[scene.objects[hit.ObjectIndex].materialIndex].emitted();
-            if ( scene.materials[scene.objects[hit.ObjectIndex].materialIndex].scatter( ray, hit, attenuation, scattered, seed ) )
-            {
-                float3 color_from_scatter = attenuation * RayColor18( seed, scattered, maxIterations, minDistance, maxDistance, hit.ObjectIndex );
-                return color_from_emission + color_from_scatter;
-            }
-            else
-            {
-                return color_from_emission;
-            }
-        }
+    uint2 id = threadId.xy + tileOffset;
+    uint pixelIndex = id.y * width + id.x;
+    float4 previous = frameIndex > 0 ? Accumulation[pixelIndex] : float4( 0, 0, 0, 0 );
+    float previousSquares = frameIndex > 0 ? Moments[pixelIndex] : 0.0f;
     
-        //Skybox
-        float theta = acos( ray.dir.y ) / -PI;
-        float phi = atan2( ray.dir.x, -ray.dir.z ) / -PI * 0.5f;
-        float4 color = SkyboxTexture.SampleLevel( sampler_SkyboxTexture, float2( phi, -theta ), 0 );
-        return color.xyz;
-    }
+    //Every thread group is a tile, converged tiles keep their image and skip tracing
+    groupErrors[groupIndex] = relativeError( luminance( previous.xyz ), previousSquares, previous.w );
+    GroupMemoryBarrierWithGroupSync();
     
-    float3 RayColor20( inout uint seed, Ray ray, uint maxIterations, float minDistance, float maxDistance, int lastHitIndex )
+    if ( groupIndex == 0 )
     {
-        uint width, height;
-        Result.GetDimensions( width, height );
-    
-        //Generate small diffrence in ray direction between samples
-        float2 delta = float2( Random::RandomFloat( seed ), Random::RandomFloat( seed ) ) / float2( width, height );
-        ray.dir += float3( delta, 0.0f );
-        
-        HitPayload hit = MarchRay( ray, maxIterations, minDistance, maxDistance );
-    
-        if ( hit.HitDistance > 0.0f )
+        float error = 0.0f;
+        for ( int e = 0; e < 64; e++ )
         {
-            Ray scattered;
-            float3 attenuation;
-            float3 color_from_emission = scene.materials[scene.objects[hit.ObjectIndex].materialIndex].emitted();
-            if ( scene.materials[scene.objects[hit.ObjectIndex].materialIndex].scatter( ray, hit, attenuation, scattered, seed ) )
-            {
-                float3 color_from_scatter = attenuation * RayColor19( seed, scattered, maxIterations, minDistance, maxDistance, hit.ObjectIndex );
-                return color_from_emission + color_from_scatter;
-            }
-            else
-            {
-                return color_from_emission;
-            }
+            error += groupErrors[e];
         }
-    
-        //Skybox
-        float theta = acos( ray.dir.y ) / -PI;
-        float phi = atan2( ray.dir.x, -ray.dir.z ) / -PI * 0.5f;
-        float4 color = SkyboxTexture.SampleLevel( sampler_SkyboxTexture, float2( phi, -theta ), 0 );
-        return color.xyz;
-    }
-    
-    float3 RayColor( inout uint seed, Ray ray, uint maxIterations, float minDistance, float maxDistance )
-    {
-        uint width, height;
-        Result.GetDimensions( width, height );
-    
-        //Generate small diffrence in ray direction between samples
-        float2 delta = float2( Random::RandomFloat( seed ), Random::RandomFloat( seed ) ) / float2( width, height );
-        ray.dir += float3( delta, 0.0f );
+        //After a camera move every pixel has to be written again
+        groupActive = reproject != 0 || errorThreshold <= 0.0f || previous.w < minSamples || error / 64.0f > errorThreshold;
         
-        HitPayload hit = MarchRay( ray, maxIterations, minDistance, maxDistance );
-    
-        if ( hit.HitDistance > 0.0f )
+        if ( groupActive )
         {
-            Ray scattered;
-            float3 attenuation;
-            float3 color_from_emission = scene.materials[scene.objects[hit.ObjectIndex].materialIndex].emitted();
-            if( scene.materials[scene.objects[hit.ObjectIndex].materialIndex].scatter( ray, hit, attenuation, scattered, seed ) )
-            {
-                float3 color_from_scatter = attenuation * RayColor20( seed, scattered, maxIterations, minDistance, maxDistance, hit.ObjectIndex );
-                return color_from_emission + color_from_scatter;
-            }
-            else
-            {
-                return color_from_emission;
-            }
+            uint ignored;
+            Counters.InterlockedAdd( 0, 1, ignored );
+            Counters.InterlockedAdd( 4, renderInterations, ignored );
         }
-    
-        //Skybox
-        float theta = acos( ray.dir.y ) / -PI;
-        float phi = atan2( ray.dir.x, -ray.dir.z ) / -PI * 0.5f;
-        float4 color = SkyboxTexture.SampleLevel( sampler_SkyboxTexture, float2( phi, -theta ), 0 );
-        return color.xyz;
     }
-}
-
-[numthreads(8, 8, 1)]
-void main( uint3 id : SV_DispatchThreadID )
-{
-    uint width, height;
-    Result.GetDimensions( width, height );
+    GroupMemoryBarrierWithGroupSync();
+    
+    if ( !groupActive )
+        return;
     
     float4x4 inverseProjectionMatrix = transpose( InverseProjectionMatrix );
     float4x4 inverseViewProjectionMatrix = transpose( InverseViewProjectionMatrix );
@@ -1103,20 +1059,68 @@ void main( uint3 id : SV_DispatchThreadID )
     float4 rayDir4D = mul( inverseViewProjectionMatrix, float4( normalize( float3( target.x, target.y, target.z ) / target.w ), 0.0f ) );
     originalRay.dir = float3( rayDir4D.xyz );
     
+    uint pixelCount = width * height;
+    if ( tracePrimary != 0 )
+    {
+        HitPayload hit = MarchRay( originalRay, maxIterations, minDistance, maxDistance );
+        Primary[pixelIndex] = hit.HitDistance > 0.0f ? float4( hit.WorldNormal, hit.HitDistance ) : float4( 0, 0, 0, maxDistance );
+    }
+    
+    if ( reproject != 0 )
+    {
+        //Distance to the ray of the next pixel, the angle one pixel covers
+        float4 nextTarget = mul( inverseProjectionMatrix, float4( coord.x + 2.0f / width, coord.y, 1.0f, 1.0f ) );
+        float4 nextDir4D = mul( inverseViewProjectionMatrix, float4( normalize( float3( nextTarget.x, nextTarget.y, nextTarget.z ) / nextTarget.w ), 0.0f ) );
+        previous = ReprojectHistory( originalRay.dir, Primary[pixelIndex], distance( originalRay.dir, nextDir4D.xyz ), maxDistance, width, height, previousSquares );
+    }
+    
+#ifdef UNROLLED_PATH
     uint seed = id.x + id.y * width + seedStart;
+#endif
+    //Samples after a move start over with a new seed
+    uint sampleIndex = reproject != 0 ? 0u : (uint) previous.w;
     
     //Accumalate color
     float3 accumelatedColor = float3( 0, 0, 0 );
+    float luminanceSquares = 0.0f;
+    PrimaryHit primary = (PrimaryHit) 0;
+    primary.objectId = -1.0f;
+    primary.materialId = -1.0f;
     
     for ( int i = 0; i < renderInterations; i++ )
     {
-        accumelatedColor += RayColor::RayColor( seed, originalRay, maxIterations, minDistance, maxDistance );
+#ifdef UNROLLED_PATH
+        float3 color = RayColorUnrolled20( seed, originalRay, maxIterations, minDistance, maxDistance );
+#else
+        PathSampler pathSampler = createPathSampler( samplerType, seedStart, id.xy, sampleIndex + (uint) i );
+        float3 color = RayColor( pathSampler, originalRay, 1.0f / float2( width, height ), maxIterations, minDistance, maxDistance, primary );
+#endif
+        accumelatedColor += color;
+        luminanceSquares += luminance( color ) * luminance( color );
     }
     
-    accumelatedColor /= renderInterations;
-    
-    //Maybe use this?
-    accumelatedColor = linear_to_gamma( accumelatedColor );
-    
-    Result[id.xy] = float4( accumelatedColor, 1.0f );
+    //Add to the samples of earlier frames and show the average
+    float4 accumulation = previous + float4( accumelatedColor, renderInterations );
+    Accumulation[pixelIndex] = accumulation;
+    Moments[pixelIndex] = previousSquares + luminanceSquares;
+    
+    //The AOVs at this pixel belong to the old view after a camera move, the new samples replace them
+    float weight = reproject != 0 ? 1.0f : renderInterations / accumulation.w;
+    UpdateAov( AOV_DEPTH, 0, pixelIndex, pixelCount, primary.depth, weight );
+    UpdateAov( AOV_NORMAL, 0, pixelIndex, pixelCount, primary.normal.x, weight );
+    UpdateAov( AOV_NORMAL, 1, pixelIndex, pixelCount, primary.normal.y, weight );
+    UpdateAov( AOV_NORMAL, 2, pixelIndex, pixelCount, primary.normal.z, weight );
+    UpdateAov( AOV_ALBEDO, 0, pixelIndex, pixelCount, primary.albedo.x, weight );
+    UpdateAov( AOV_ALBEDO, 1, pixelIndex, pixelCount, primary.albedo.y, weight );
+    UpdateAov( AOV_ALBEDO, 2, pixelIndex, pixelCount, primary.albedo.z, weight );
+    SetAov( AOV_OBJECT_ID, pixelIndex, primary.objectId );
+    SetAov( AOV_MATERIAL_ID, pixelIndex, primary.materialId );
+    UpdateAov( AOV_STEPS, 0, pixelIndex, pixelCount, primary.steps, weight );
+    
+    uint ignoredCount;
+    Counters.InterlockedAdd( 8, primary.pathRays, ignoredCount );
+    Counters.InterlockedAdd( 12, primary.terminatedPaths, ignoredCount );
+    Counters.InterlockedAdd( 16, primary.raysSaved, ignoredCount );
+    
+    Result[id.xy] = float4( linear_to_gamma( accumulation.xyz / accumulation.w ), 1.0f );
 }
\ No newline at end of file
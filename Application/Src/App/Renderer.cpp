@@ -2,16 +2,373 @@
 
 Renderer::Renderer( Graphics& gfx )
     :
-    rayMarcherShader( gfx, L"RayMarcher.cso" )
+    gfx( gfx ),
+    gpuDevice( gfx ),
+    rayMarcherShader( gfx, gpuDevice, L"RayMarcher.cso" ),
+    cpuImage( 0, 0, nullptr, gfx )
 {
+    renderThread = std::thread( &Renderer::RenderLoop, this );
+}
+
+Renderer::~Renderer()
+{
+    //The frame in flight stops at its next tile or sample instead of finishing first
+    cancelSource.Cancel();
+    running = false;
+    publishedVersion++;
+    publishedVersion.notify_one();
+    renderThread.join();
 }
 
 void Renderer::Render( const Camera& camera, const Scene& scene )
 {
-    rayMarcherShader.Dispatch( camera, scene, renderIterations );
+    if( settings.cpuBackend )
+    {
+        const uint64_t version = publishedVersion.load() + 1;
+        Snapshot& snapshot = snapshots.GetBack();
+        snapshot.version = version;
+        snapshot.time = std::chrono::steady_clock::now();
+        snapshot.camera = camera;
+        snapshot.scene = scene;
+        snapshot.settings = settings;
+        snapshot.renderIterations = renderIterations;
+        snapshot.width = renderWidth;
+        snapshot.height = renderHeight;
+        snapshot.resets = resets;
+        snapshot.cameraMoves = cameraMoves;
+        snapshot.exports = exports;
+        snapshot.exportPrefix = exportPrefix;
+        snapshot.skybox = skybox;
+        snapshot.distanceCache = distanceCacheSettings;
+        snapshot.denoiser = denoiserSettings;
+
+        //The frame in flight renders an image that is about to be thrown away, it stops at
+        //its next tile or sample
+        if( StartsNewImage( snapshot, lastSnapshot ) )
+        {
+            cancelSource.Cancel();
+            editVersion = version;
+            editTime = snapshot.time;
+        }
+        snapshot.cancel = cancelSource.GetToken();
+        lastSnapshot = snapshot;
+
+        snapshots.Publish();
+        publishedVersion = version;
+        publishedVersion.notify_one();
+        return;
+    }
+
+    //Only recompiles when the editable scene changed
+    if( compiledScene.Update( scene ) || StartsNewImage( settings, lastSettings, false ) )
+        ResetGpuAccumulation();
+    //Every frame is a new image, a GPU frame spread over several calls still gets to finish
+    if( !settings.accumulate )
+        frameIndex = 0;
+    lastSettings = settings;
+
+    ComputeShader::DispatchSettings dispatchSettings;
+    dispatchSettings.renderIterations = renderIterations;
+    dispatchSettings.relaxation = settings.overRelaxation ? settings.relaxation : 1.0f;
+    dispatchSettings.maxDepth = settings.maxDepth;
+    dispatchSettings.nextEventEstimation = settings.nextEventEstimation;
+    dispatchSettings.sampler = settings.sampler;
+    dispatchSettings.rouletteMinDepth = settings.russianRoulette ? (std::max)( settings.rouletteMinDepth, 1 ) : 0;
+    dispatchSettings.frameIndex = frameIndex;
+    //A threshold of 0 keeps every tile active
+    dispatchSettings.errorThreshold = settings.adaptiveSampling ? settings.errorThreshold : 0.0f;
+    dispatchSettings.minSamples = settings.minSamples;
+    dispatchSettings.aovs = settings.aovs;
+    dispatchSettings.reprojection = settings.reprojection;
+    dispatchSettings.maxHistory = settings.maxHistory;
+    dispatchSettings.timeBudget = settings.gpuTimeBudget;
+    dispatchSettings.tileSize = settings.gpuTileSize;
+    //A time-sliced frame only counts once its last tile is done
+    if( rayMarcherShader.Dispatch( camera, compiledScene, dispatchSettings ) )
+        frameIndex++;
+    //The time of a call alone is a slice of a frame, only whole frames are handed on
+    if( rayMarcherShader.GetFramesTimed() != gpuFramesTimed )
+    {
+        gpuFramesTimed = rayMarcherShader.GetFramesTimed();
+        gpuRenderTime = rayMarcherShader.GetFrameTime() / 1000.0f;
+        gpuRenderTimed = true;
+    }
+    gpuRendered = true;
+}
+
+bool Renderer::Present()
+{
+    if( !settings.cpuBackend )
+    {
+        const bool rendered = gpuRendered;
+        gpuRendered = false;
+        renderTimed = rendered && gpuRenderTimed;
+        gpuRenderTimed = false;
+        return rendered;
+    }
+
+    renderTimed = false;
+    if( !cpuFrames.Acquire() )
+        return false;
+    renderTimed = true;
+
+    CpuFrame& frame = cpuFrames.GetFront();
+    if( frame.width != cpuImage.GetWidth() || frame.height != cpuImage.GetHeight() )
+    {
+        if( cpuTexture != 0 )
+            gpuDevice.Release( cpuTexture );
+        cpuTexture = gpuDevice.CreateTexture( frame.width, frame.height );
+        cpuImage = Image( frame.width, frame.height, nullptr, gfx );
+        cpuImage.SetView( gpuDevice.GetView( cpuTexture ) );
+    }
+    gpuDevice.UploadTexture( cpuTexture, frame.pixels.data() );
+
+    threadStats.framesRendered = frame.framesRendered;
+    threadStats.framesShown++;
+    threadStats.snapshotsSkipped = frame.snapshotsSkipped;
+    threadStats.framesCancelled = frame.framesCancelled;
+    threadStats.samplesSkipped = frame.samplesSkipped;
+    threadStats.samplesWasted = frame.samplesWasted;
+    const auto now = std::chrono::steady_clock::now();
+    threadStats.latency = std::chrono::duration<float, std::milli>( now - frame.snapshotTime ).count();
+    if( editVersion != 0 && frame.snapshotVersion >= editVersion )
+    {
+        threadStats.editLatency = std::chrono::duration<float, std::milli>( now - editTime ).count();
+        editVersion = 0;
+    }
+    return true;
+}
+
+void Renderer::OnCameraMoved()
+{
+    if( !settings.reprojection || !settings.accumulate )
+        ResetGpuAccumulation();
+    //The render thread decides with the settings of its next frame
+    cameraMoves++;
+}
+
+bool Renderer::StartsNewImage( const Settings& settings, const Settings& last, bool cpu )
+{
+    //Only settings that change the converged image
+    if( settings.maxDepth != last.maxDepth )
+        return true;
+    //New AOV buffers start empty, the denoiser adds its own AOVs on the CPU backend
+    if( settings.aovs != last.aovs || (cpu && settings.denoise != last.denoise) )
+        return true;
+    //Primary hits to check the history against are only kept while reprojection is on
+    if( settings.reprojection != last.reprojection )
+        return true;
+    //Samples of two samplers share indices and would not be independent
+    return settings.sampler != last.sampler;
+}
+
+bool Renderer::StartsNewImage( const Snapshot& next, const Snapshot& last )
+{
+    //Restarts and camera moves are counted, so ones in skipped snapshots still show
+    if( next.resets != last.resets || next.skybox != last.skybox )
+        return true;
+    if( next.cameraMoves != last.cameraMoves && (!next.settings.reprojection || !next.settings.accumulate) )
+        return true;
+    if( next.width != last.width || next.height != last.height )
+        return true;
+    return !CompiledScene::SameScene( next.scene, last.scene ) || StartsNewImage( next.settings, last.settings, true );
+}
+
+void Renderer::RenderLoop()
+{
+    uint64_t version = 0;
+    while( running.load() )
+    {
+        //Sleeps until the UI thread publishes a snapshot this thread has not seen
+        if( !snapshots.Acquire() )
+        {
+            publishedVersion.wait( version );
+            continue;
+        }
+
+        const Snapshot& snapshot = snapshots.GetFront();
+        snapshotsSkipped += (int64_t)(snapshot.version - version - 1);
+        version = snapshot.version;
+
+        //The files hold the image of the last frame, before this one adds to it
+        if( snapshot.exports != cpuExports )
+        {
+            cpuExports = snapshot.exports;
+            exportFailed = !cpuRayMarcher.ExportAovs( snapshot.exportPrefix );
+            exportsDone = cpuExports;
+        }
+
+        CpuFrame& frame = cpuFrames.GetBack();
+        if( !RenderCpu( snapshot, frame ) )
+            continue;
+
+        frame.snapshotVersion = snapshot.version;
+        frame.snapshotTime = snapshot.time;
+        frame.framesRendered = ++framesRendered;
+        frame.snapshotsSkipped = snapshotsSkipped;
+        frame.framesCancelled = framesCancelled;
+        frame.samplesSkipped = samplesSkipped;
+        frame.samplesWasted = samplesWasted;
+        cpuFrames.Publish();
+    }
+}
+
+bool Renderer::RenderCpu( const Snapshot& snapshot, CpuFrame& frame )
+{
+    const Settings& settings = snapshot.settings;
+    if( snapshot.width == 0 || snapshot.height == 0 )
+        return false;
+
+    if( snapshot.skybox != cpuLastSnapshot.skybox && !snapshot.skybox.empty() )
+        cpuRayMarcher.SetSkybox( snapshot.skybox );
+    if( snapshot.width != cpuRayMarcher.GetWidth() || snapshot.height != cpuRayMarcher.GetHeight() )
+        cpuRayMarcher.OnResize( snapshot.width, snapshot.height );
+    //Only recompiles when the editable scene changed, StartsNewImage sees the same change
+    cpuCompiledScene.Update( snapshot.scene );
+    //Every frame is a new image without accumulation
+    if( StartsNewImage( snapshot, cpuLastSnapshot ) || !settings.accumulate )
+        ResetCpuAccumulation();
+    cpuLastSnapshot = snapshot;
+
+    const DistanceCache* pDistanceCache = nullptr;
+    if( settings.distanceCache )
+    {
+        distanceCache.GetSettings() = snapshot.distanceCache;
+        distanceCache.Update( cpuCompiledScene, cpuRayMarcher.GetJobs() );
+        pDistanceCache = &distanceCache;
+    }
+
+    cpuRayMarcher.GetSettings().relaxation = settings.overRelaxation ? settings.relaxation : 1.0f;
+    cpuRayMarcher.GetSettings().conePrepass = settings.conePrepass;
+    cpuRayMarcher.GetSettings().wavefront = settings.wavefront;
+    cpuRayMarcher.GetSettings().packetMarching = settings.packetMarching;
+    cpuRayMarcher.GetSettings().maxDepth = settings.maxDepth;
+    cpuRayMarcher.GetSettings().nextEventEstimation = settings.nextEventEstimation;
+    cpuRayMarcher.GetSettings().sampler = settings.sampler;
+    cpuRayMarcher.GetSettings().russianRoulette = settings.russianRoulette;
+    cpuRayMarcher.GetSettings().rouletteMinDepth = settings.rouletteMinDepth;
+    cpuRayMarcher.GetSettings().adaptiveSampling = settings.adaptiveSampling;
+    cpuRayMarcher.GetSettings().errorThreshold = settings.errorThreshold;
+    cpuRayMarcher.GetSettings().minSamples = settings.minSamples;
+    cpuRayMarcher.GetSettings().denoise = settings.denoise;
+    cpuRayMarcher.GetSettings().aovs = settings.aovs;
+    cpuRayMarcher.GetSettings().reprojection = settings.reprojection;
+    cpuRayMarcher.GetSettings().maxHistory = settings.maxHistory;
+    cpuRayMarcher.GetSettings().edgeAwarePreview = settings.edgeAwarePreview;
+    cpuRayMarcher.GetDenoiser().GetSettings() = snapshot.denoiser;
+
+    const bool firstImage = cpuFrameIndex == 0 && previewBlockSize == 0;
+    Hydro::Timer timer;
+    bool preview = false;
+
+    //A new image starts with coarse previews, one level finer every frame until the
+    //samples are per pixel or something starts the image over
+    if( settings.progressive && settings.accumulate && cpuFrameIndex == 0 )
+    {
+        if( previewBlockSize == 0 )
+            previewBlockSize = FirstPreviewBlockSize( snapshot );
+        if( previewBlockSize > 1 )
+        {
+            if( !cpuRayMarcher.DispatchPreview( snapshot.camera, cpuCompiledScene, previewBlockSize, pDistanceCache, snapshot.cancel ) )
+                return Cancelled();
+            progressiveStats.blockSize = previewBlockSize;
+            previewBlockSize /= 2;
+            preview = true;
+        }
+    }
+
+    if( !preview )
+    {
+        if( !cpuRayMarcher.Dispatch( snapshot.camera, cpuCompiledScene, snapshot.renderIterations, pDistanceCache, cpuFrameIndex++, snapshot.cancel ) )
+            return Cancelled();
+        if( cpuRayMarcher.GetAdaptiveStats().frameSamples > 0 )
+            pathTime = timer.Peek() / (float)cpuRayMarcher.GetAdaptiveStats().frameSamples;
+        progressiveStats.blockSize = 1;
+    }
+    const float time = timer.Mark();
+    if( firstImage )
+        progressiveStats.firstImageTime = time * 1000.0f;
+
+    frame.pixels = cpuRayMarcher.GetPixels();
+    frame.width = cpuRayMarcher.GetWidth();
+    frame.height = cpuRayMarcher.GetHeight();
+    frame.frameIndex = cpuFrameIndex;
+    frame.renderTime = time;
+    frame.progressive = progressiveStats;
+    frame.steps = cpuRayMarcher.GetStepHistogram();
+    frame.prepass = cpuRayMarcher.GetPrepassStats();
+    frame.wavefront = cpuRayMarcher.GetWavefrontStats();
+    frame.reprojection = cpuRayMarcher.GetReprojectionStats();
+    frame.adaptive = cpuRayMarcher.GetAdaptiveStats();
+    frame.paths = cpuRayMarcher.GetPathStats();
+    frame.denoiser = cpuRayMarcher.GetDenoiser().GetStats();
+    frame.distanceCache = distanceCache.GetStats();
+    return true;
+}
+
+bool Renderer::Cancelled()
+{
+    //The image is unfinished, whatever comes next starts a new one
+    const CpuRayMarcher::CancelStats& cancel = cpuRayMarcher.GetCancelStats();
+    framesCancelled++;
+    samplesSkipped += cancel.samplesSkipped;
+    samplesWasted += cancel.samplesTraced;
+    ResetCpuAccumulation();
+    return false;
+}
+
+int Renderer::FirstPreviewBlockSize( const Snapshot& snapshot ) const
+{
+    //Nothing is known before the first full frame
+    if( pathTime <= 0.0f )
+        return maxPreviewBlockSize;
+
+    const float budget = snapshot.settings.previewBudget * 0.001f;
+    const float pixels = (float)cpuRayMarcher.GetWidth() * (float)cpuRayMarcher.GetHeight();
+    if( pixels * snapshot.renderIterations * pathTime <= budget )
+        return 1;
+    int blockSize = 2;
+    while( blockSize < maxPreviewBlockSize && pixels / (float)(blockSize * blockSize) * pathTime > budget )
+    {
+        blockSize *= 2;
+    }
+    return blockSize;
 }
 
 void Renderer::OnResize( int width, int height )
 {
     rayMarcherShader.OnResize( width, height );
+    //The render thread resizes with the next snapshot
+    renderWidth = width;
+    renderHeight = height;
+}
+
+void Renderer::ExportAovs( const std::string& prefix )
+{
+    if( !settings.cpuBackend )
+    {
+        gpuExportFailed = !rayMarcherShader.ExportAovs( prefix );
+        return;
+    }
+
+    //Goes to the render thread with the next snapshot
+    exports++;
+    exportPrefix = prefix;
+}
+
+Renderer::ExportState Renderer::GetExportState() const
+{
+    if( !settings.cpuBackend )
+        return gpuExportFailed ? ExportState::Failed : ExportState::Done;
+    if( exportsDone.load() != exports )
+        return ExportState::Pending;
+    return exportFailed.load() ? ExportState::Failed : ExportState::Done;
+}
+
+void Renderer::SetSkybox( const std::string& path )
+{
+    rayMarcherShader.SetSkybox( path );
+    ResetGpuAccumulation();
+    //Loaded by the render thread, which starts a new image with it
+    skybox = path;
 }
@@ -1,23 +1,293 @@
 #pragma once
 #include "../Win/Image.h"
 #include "../Utils/Vec4.h"
+#include "../Utils/HydroTimer.h"
+#include "../Utils/TripleBuffer.h"
+#include "../Utils/CancellationToken.h"
 #include "ComputeShader.h"
+#include "CpuRayMarcher.h"
+#include "CompiledScene.h"
+#include "DistanceCache.h"
 #include "Ray.h"
 #include "Camera.h"
 #include "Scene.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
 
 using namespace Hydro;
 
 class Renderer
 {
+public:
+	struct Settings
+	{
+		bool cpuBackend = false;
+		//Brick map of the distance field, CPU backend only
+		bool distanceCache = false;
+		//Enhanced sphere tracing with steps scaled by relaxation
+		bool overRelaxation = false;
+		float relaxation = 1.5f;
+		//Cone marched start distances for primary rays, CPU backend only
+		bool conePrepass = false;
+		//Stages over queues of paths binned by material instead of one path per thread,
+		//CPU backend only
+		bool wavefront = false;
+		//Packets of 8 or 16 paths in the march stage of the wavefront, CPU backend only
+		bool packetMarching = true;
+		//A new image first shows one path per 4x4 and then per 2x2 pixels, a level per
+		//frame, so something is on screen quickly however slow the scene is. CPU backend only
+		bool progressive = false;
+		//Milliseconds the first image may take, the previews start at the finest level the
+		//cost of the last full frame says fits
+		float previewBudget = 16.0f;
+		//Blend the preview blocks that see the same surface instead of showing them as squares
+		bool edgeAwarePreview = true;
+		//Bounces per path on both backends
+		int maxDepth = 20;
+		//Sample the emitting spheres and boxes at every diffuse and rough metal bounce,
+		//same converged image with far less noise from small lights
+		bool nextEventEstimation = true;
+		//End paths at random by their throughput after rouletteMinDepth bounces, the
+		//survivors are weighted up so the converged image is the same
+		bool russianRoulette = true;
+		int rouletteMinDepth = 3;
+		//Low-discrepancy samples converge faster, blue noise also spreads the error evenly over the screen
+		SamplerType sampler = SamplerType::Sobol;
+		//Add every frame to the ones before until something changes
+		bool accumulate = true;
+		//Stop sampling tiles whose relative error is below errorThreshold
+		bool adaptiveSampling = false;
+		float errorThreshold = 0.05f;
+		int minSamples = 16;
+		//Edge-avoiding a-trous filter guided by first hit features, CPU backend only
+		bool denoise = false;
+		//AovBit mask of the outputs written next to the image
+		uint32_t aovs = 0;
+		//Camera moves keep the samples of surfaces that stay visible instead of starting over
+		bool reprojection = false;
+		//Samples the history counts as at most, fewer follow lighting changes faster
+		int maxHistory = 16;
+		//Milliseconds of GPU work a UI frame waits for at most, longer renders go on tile by
+		//tile in the next frames. 0 renders every frame at once, GPU backend only
+		float gpuTimeBudget = 0.0f;
+		int gpuTileSize = 128;
+	};
+
+	struct ProgressiveStats
+	{
+		//Pixels per side sharing one path in the image on screen, 1 once it is a full frame
+		int blockSize = 1;
+		//Milliseconds from the last restart of the image until something was on screen
+		float firstImageTime = 0.0f;
+	};
+
+	struct ThreadStats
+	{
+		//Frames the render thread finished, the ones the UI never showed were replaced by a
+		//newer frame first
+		int64_t framesRendered = 0;
+		int64_t framesShown = 0;
+		//Snapshots replaced by a newer one before the render thread got to them
+		int64_t snapshotsSkipped = 0;
+		//Milliseconds from publishing the snapshot of the image on screen until it was shown
+		float latency = 0.0f;
+		//Frames stopped part way because a newer snapshot starts a new image
+		int64_t framesCancelled = 0;
+		//Paths the cancelled frames never traced and the ones they traced for nothing
+		int64_t samplesSkipped = 0;
+		int64_t samplesWasted = 0;
+		//Milliseconds from the last edit that started a new image until its first pixels were shown
+		float editLatency = 0.0f;
+	};
+	enum class ExportState
+	{
+		Done,
+		//Queued for the render thread, CPU backend only
+		Pending,
+		Failed
+	};
 public:
 	Renderer( Graphics& gfx );
+	~Renderer();
+	//Renders a GPU frame right away. On the CPU backend the frame is handed to the render
+	//thread with a copy of camera, scene and settings, Present shows it once it is done
 	void Render( const Camera& camera, const Scene& scene );
+	//Shows the newest finished frame, true if the image changed since the last call
+	bool Present();
 	void OnResize( int width, int height );
-	Image& GetFinalImage() { return rayMarcherShader.GetImage(); }
+	Image& GetFinalImage() { return settings.cpuBackend ? cpuImage : rayMarcherShader.GetImage(); }
 	int& GetRenderIterations() { return renderIterations; }
-	void SetSkybox( const std::string& path ) { rayMarcherShader.SetSkybox( path ); }
+	Settings& GetSettings() { return settings; }
+	//Copied to the render thread with the next frame, CPU backend only
+	DistanceCache::Settings& GetDistanceCacheSettings() { return distanceCacheSettings; }
+	Denoiser::Settings& GetDenoiserSettings() { return denoiserSettings; }
+	//CPU numbers are those of the frame on screen
+	const DistanceCache::Stats& GetDistanceCacheStats() const { return cpuFrames.GetFront().distanceCache; }
+	const Denoiser::Stats& GetDenoiserStats() const { return cpuFrames.GetFront().denoiser; }
+	const StepHistogram& GetStepHistogram() const { return cpuFrames.GetFront().steps; }
+	const CpuRayMarcher::PrepassStats& GetPrepassStats() const { return cpuFrames.GetFront().prepass; }
+	const CpuRayMarcher::WavefrontStats& GetWavefrontStats() const { return cpuFrames.GetFront().wavefront; }
+	const ProgressiveStats& GetProgressiveStats() const { return cpuFrames.GetFront().progressive; }
+	//Beauty and AOVs of the active backend as <prefix>_<name>.pfm. The render thread writes
+	//the ones of the CPU backend between two frames, the UI never waits for a frame in flight
+	void ExportAovs( const std::string& prefix );
+	//Of the last ExportAovs
+	ExportState GetExportState() const;
+	//Tiles of the active backend, the GPU numbers are a few frames old
+	const AdaptiveSamplingStats& GetAdaptiveStats() const { return settings.cpuBackend ? cpuFrames.GetFront().adaptive : rayMarcherShader.GetAdaptiveStats(); }
+	void SetSkybox( const std::string& path );
+	//CPU backend only, the GPU does not read its numbers back
+	const PathStats& GetPathStats() const { return settings.cpuBackend ? cpuFrames.GetFront().paths : rayMarcherShader.GetPathStats(); }
+	const CpuRayMarcher::ReprojectionStats& GetReprojectionStats() const { return cpuFrames.GetFront().reprojection; }
+	const ComputeShader::TileStats& GetTileStats() const { return rayMarcherShader.GetTileStats(); }
+	//Buffers and textures of both backends created and bytes uploaded so far
+	const GpuDevice::Stats& GetGpuDeviceStats() const { return gpuDevice.GetStats(); }
+	const ThreadStats& GetThreadStats() const { return threadStats; }
+	//Seconds the last finished frame took. On the GPU that is the GPU time of all the calls the
+	//frame was spread over, read back a few frames late
+	float GetRenderTime() const { return settings.cpuBackend ? cpuFrames.GetFront().renderTime : gpuRenderTime; }
+	//True if GetRenderTime got the time of another finished frame with the last Present
+	bool IsRenderTimed() const { return renderTimed; }
+	//Next Render starts a new image
+	void ResetAccumulation() { ResetGpuAccumulation(); resets++; }
+	//Starts a new image unless the backends can reproject the old one to the new camera
+	void OnCameraMoved();
+	//Frames in the current image
+	uint32_t GetFrameIndex() const { return settings.cpuBackend ? cpuFrames.GetFront().frameIndex : frameIndex; }
+private:
+	//Everything a CPU frame is rendered from, copied on the UI thread so the render thread
+	//never reads what the UI is editing
+	struct Snapshot
+	{
+		uint64_t version = 0;
+		std::chrono::steady_clock::time_point time;
+		Camera camera{ 90.0f, 0.1f, 100.0f };
+		Scene scene;
+		Settings settings;
+		int renderIterations = 1;
+		int width = 0;
+		int height = 0;
+		//Restarts and camera moves so far, the render thread acts when they changed
+		uint32_t resets = 0;
+		uint32_t cameraMoves = 0;
+		//Exports requested so far, the render thread writes the files when it changed
+		uint32_t exports = 0;
+		std::string exportPrefix;
+		std::string skybox;
+		DistanceCache::Settings distanceCache;
+		Denoiser::Settings denoiser;
+		//Cancelled by the first newer snapshot that starts a new image
+		CancellationToken cancel;
+	};
+
+	//A finished CPU frame and the numbers of its render
+	struct CpuFrame
+	{
+		std::vector<uint32_t> pixels;
+		int width = 0;
+		int height = 0;
+		uint32_t frameIndex = 0;
+		float renderTime = 0.0f;
+		//Snapshot it was rendered from
+		uint64_t snapshotVersion = 0;
+		std::chrono::steady_clock::time_point snapshotTime;
+		int64_t framesRendered = 0;
+		int64_t snapshotsSkipped = 0;
+		int64_t framesCancelled = 0;
+		int64_t samplesSkipped = 0;
+		int64_t samplesWasted = 0;
+		ProgressiveStats progressive;
+		StepHistogram steps;
+		CpuRayMarcher::PrepassStats prepass;
+		CpuRayMarcher::WavefrontStats wavefront;
+		CpuRayMarcher::ReprojectionStats reprojection;
+		AdaptiveSamplingStats adaptive;
+		PathStats paths;
+		Denoiser::Stats denoiser;
+		DistanceCache::Stats distanceCache;
+	};
+private:
+	void ResetGpuAccumulation() { frameIndex = 0; rayMarcherShader.CancelFrame(); }
+	//Settings whose change starts a new image on the CPU or GPU backend
+	static bool StartsNewImage( const Settings& settings, const Settings& last, bool cpu );
+	//Whether the CPU image of next starts over from the one of last
+	static bool StartsNewImage( const Snapshot& next, const Snapshot& last );
+	void RenderLoop();
+	//Renders the CPU frame of snapshot on the render thread, false if there is nothing to
+	//render or it was cancelled
+	bool RenderCpu( const Snapshot& snapshot, CpuFrame& frame );
+	void ResetCpuAccumulation() { cpuFrameIndex = 0; previewBlockSize = 0; }
+	//Counts the frame the render thread just stopped, always false
+	bool Cancelled();
+	//Block size of the first preview of a new image, 1 when a full frame fits in the budget
+	int FirstPreviewBlockSize( const Snapshot& snapshot ) const;
 private:
+	//Coarsest preview, a sixteenth of the paths of a full frame
+	static constexpr int maxPreviewBlockSize = 4;
+	Graphics& gfx;
 	int renderIterations = 1;
+	Settings settings;
+	DistanceCache::Settings distanceCacheSettings;
+	Denoiser::Settings denoiserSettings;
+	std::string skybox;
+	int renderWidth = 0;
+	int renderHeight = 0;
+	uint32_t resets = 0;
+	uint32_t cameraMoves = 0;
+	uint32_t exports = 0;
+	std::string exportPrefix;
+	//Last snapshot published, the next one cancels the frames of the older ones if it
+	//starts a new image
+	Snapshot lastSnapshot;
+	CancellationSource cancelSource;
+	//Version and time of the last snapshot that started a new image, until it is on screen
+	uint64_t editVersion = 0;
+	std::chrono::steady_clock::time_point editTime;
+	//GPU backend, rendered on the UI thread. Settings the last image was rendered with, a
+	//change starts a new one
+	Settings lastSettings;
+	uint32_t frameIndex = 0;
+	float gpuRenderTime = 0.0f;
+	uint32_t gpuFramesTimed = 0;
+	bool gpuRenderTimed = false;
+	bool gpuRendered = false;
+	bool renderTimed = false;
+	bool gpuExportFailed = false;
+	CompiledScene compiledScene;
+	//Resources kept from frame to frame, the GPU backend's and the texture of the CPU image
+	D3D11GpuDevice gpuDevice;
 	ComputeShader rayMarcherShader;
+	//CPU backend, only the render thread touches these
+	Snapshot cpuLastSnapshot;
+	uint32_t cpuFrameIndex = 0;
+	//Next preview of the current image, 0 before the first and 1 once they are done
+	int previewBlockSize = 0;
+	//Seconds per path of the last full CPU frame, what the preview levels are planned with
+	float pathTime = 0.0f;
+	ProgressiveStats progressiveStats;
+	int64_t framesRendered = 0;
+	int64_t snapshotsSkipped = 0;
+	int64_t framesCancelled = 0;
+	int64_t samplesSkipped = 0;
+	int64_t samplesWasted = 0;
+	CompiledScene cpuCompiledScene;
+	DistanceCache distanceCache;
+	CpuRayMarcher cpuRayMarcher;
+	//Exports the render thread wrote, it sets exportFailed before it counts one
+	uint32_t cpuExports = 0;
+	std::atomic<uint32_t> exportsDone = 0;
+	std::atomic<bool> exportFailed = false;
+	//Handoff between the threads, snapshots to the render thread and frames back. The
+	//render thread sleeps on publishedVersion until a snapshot newer than its last one
+	TripleBuffer<Snapshot> snapshots;
+	TripleBuffer<CpuFrame> cpuFrames;
+	std::atomic<uint64_t> publishedVersion = 0;
+	std::atomic<bool> running = true;
+	std::thread renderThread;
+	//UI thread side of the CPU backend
+	ThreadStats threadStats;
+	//Created once per size, Present uploads the pixels of every new frame into it
+	GpuDevice::Id cpuTexture = 0;
+	Image cpuImage;
 };
\ No newline at end of file
@@ -0,0 +1,26 @@
+#pragma once
+#include "../Utils/Vec3.h"
+#include <algorithm>
+#include <cstdint>
+
+using namespace Hydro;
+
+//Chance a path with this throughput keeps going, same as survivalProbability in RayMarcher.hlsl.
+//Paths that survive divide their throughput by it, so the expected color stays the same and a
+//path is only ever ended once its throughput fell below 1
+inline float SurvivalProbability( Vec3F throughput )
+{
+	return (std::min)( (std::max)( (std::max)( throughput.x, throughput.y ), throughput.z ), 1.0f );
+}
+
+//Path lengths of the last frame
+struct PathStats
+{
+	//Rays marched per path, the camera ray included
+	float averageLength = 0.0f;
+	//Share of the paths Russian roulette ended
+	float terminatedFraction = 0.0f;
+	//Bounces the ended paths had left before the max depth. An upper bound on the rays
+	//saved, most of the paths would have escaped to the sky before that
+	int64_t raysSaved = 0;
+};
@@ -0,0 +1,253 @@
+#include "Sampler.h"
+#include "../Utils/Random.h"
+#include <algorithm>
+#include <cmath>
+
+//Every Get2D pair in one group of four, the next bounce starts a new group
+static_assert( Sampler::DimensionsPerBounce % 4 == 0, "Bounces take whole groups of Sobol dimensions" );
+static_assert( Sampler::JitterX / 4 == Sampler::JitterY / 4 && Sampler::ScatterU / 4 == Sampler::ScatterV / 4 &&
+	Sampler::EmitterU / 4 == Sampler::EmitterV / 4, "2D pairs share the shuffle of one group" );
+
+namespace
+{
+	constexpr float PI = 3.14159265f;
+
+	//Generator matrices of the first four Sobol dimensions (Joe and Kuo 2008), column per bit
+	//of the index. Same table as sobolDirections in RayMarcher.hlsl
+	constexpr uint32_t sobolDirections[4][32] = {
+		{ 0x80000000u, 0x40000000u, 0x20000000u, 0x10000000u, 0x08000000u, 0x04000000u, 0x02000000u, 0x01000000u,
+		  0x00800000u, 0x00400000u, 0x00200000u, 0x00100000u, 0x00080000u, 0x00040000u, 0x00020000u, 0x00010000u,
+		  0x00008000u, 0x00004000u, 0x00002000u, 0x00001000u, 0x00000800u, 0x00000400u, 0x00000200u, 0x00000100u,
+		  0x00000080u, 0x00000040u, 0x00000020u, 0x00000010u, 0x00000008u, 0x00000004u, 0x00000002u, 0x00000001u },
+		{ 0x80000000u, 0xC0000000u, 0xA0000000u, 0xF0000000u, 0x88000000u, 0xCC000000u, 0xAA000000u, 0xFF000000u,
+		  0x80800000u, 0xC0C00000u, 0xA0A00000u, 0xF0F00000u, 0x88880000u, 0xCCCC0000u, 0xAAAA0000u, 0xFFFF0000u,
+		  0x80008000u, 0xC000C000u, 0xA000A000u, 0xF000F000u, 0x88008800u, 0xCC00CC00u, 0xAA00AA00u, 0xFF00FF00u,
+		  0x80808080u, 0xC0C0C0C0u, 0xA0A0A0A0u, 0xF0F0F0F0u, 0x88888888u, 0xCCCCCCCCu, 0xAAAAAAAAu, 0xFFFFFFFFu },
+		{ 0x80000000u, 0xC0000000u, 0x60000000u, 0x90000000u, 0xE8000000u, 0x5C000000u, 0x8E000000u, 0xC5000000u,
+		  0x68800000u, 0x9CC00000u, 0xEE600000u, 0x55900000u, 0x80680000u, 0xC09C0000u, 0x60EE0000u, 0x90550000u,
+		  0xE8808000u, 0x5CC0C000u, 0x8E606000u, 0xC5909000u, 0x6868E800u, 0x9C9C5C00u, 0xEEEE8E00u, 0x5555C500u,
+		  0x8000E880u, 0xC0005CC0u, 0x60008E60u, 0x9000C590u, 0xE8006868u, 0x5C009C9Cu, 0x8E00EEEEu, 0xC5005555u },
+		{ 0x80000000u, 0xC0000000u, 0x20000000u, 0x50000000u, 0xF8000000u, 0x74000000u, 0xA2000000u, 0x93000000u,
+		  0xD8800000u, 0x25400000u, 0x59E00000u, 0xE6D00000u, 0x78080000u, 0xB40C0000u, 0x82020000u, 0xC3050000u,
+		  0x208F8000u, 0x51474000u, 0xFBEA2000u, 0x75D93000u, 0xA0858800u, 0x914E5400u, 0xDBE79E00u, 0x25DB6D00u,
+		  0x58800080u, 0xE54000C0u, 0x79E00020u, 0xB6D00050u, 0x800800F8u, 0xC00C0074u, 0x200200A2u, 0x50050093u }
+	};
+
+	uint32_t Hash( uint32_t seed, uint32_t value )
+	{
+		return Random::PCG_Hash( seed ^ Random::PCG_Hash( value ) );
+	}
+
+	uint32_t ReverseBits( uint32_t x )
+	{
+		x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+		x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+		x = ((x >> 4) & 0x0F0F0F0Fu) | ((x & 0x0F0F0F0Fu) << 4);
+		x = ((x >> 8) & 0x00FF00FFu) | ((x & 0x00FF00FFu) << 8);
+		return (x >> 16) | (x << 16);
+	}
+
+	//Hash where every bit only depends on the bits below it, the improved constants of Burley 2020
+	uint32_t LaineKarrasPermutation( uint32_t x, uint32_t seed )
+	{
+		x += seed;
+		x ^= x * 0x6c50b47cu;
+		x ^= x * 0xb82f1e52u;
+		x ^= x * 0xc7afe638u;
+		x ^= x * 0x8d22f6e6u;
+		return x;
+	}
+
+	//Owen scrambling, a random flip of every subtree of the binary digits
+	uint32_t NestedUniformScramble( uint32_t x, uint32_t seed )
+	{
+		return ReverseBits( LaineKarrasPermutation( ReverseBits( x ), seed ) );
+	}
+
+	uint32_t Sobol( uint32_t index, uint32_t dimension )
+	{
+		uint32_t x = 0u;
+		for( int bit = 0; index != 0u; bit++, index >>= 1 )
+		{
+			if( index & 1u )
+				x ^= sobolDirections[dimension][bit];
+		}
+		return x;
+	}
+
+	//Void and cluster: the tightest cluster of a random pattern moves to the largest void until
+	//both are the same pixel, then pixels are ranked by removing clusters and filling voids
+	std::vector<uint32_t> BuildBlueNoise( int size, float sigma )
+	{
+		const int count = size * size;
+
+		//Gaussian energy a pixel adds at every toroidal offset
+		std::vector<float> kernel( count );
+		for( int y = 0; y < size; y++ )
+		{
+			for( int x = 0; x < size; x++ )
+			{
+				const float dx = (float)(std::min)( x, size - x );
+				const float dy = (float)(std::min)( y, size - y );
+				kernel[y * size + x] = std::exp( -(dx * dx + dy * dy) / (2.0f * sigma * sigma) );
+			}
+		}
+
+		std::vector<uint8_t> pattern( count, 0 );
+		std::vector<float> energy( count, 0.0f );
+		auto toggle = [&]( std::vector<uint8_t>& bits, std::vector<float>& field, int pixel, bool set )
+		{
+			bits[pixel] = set ? 1 : 0;
+			const int px = pixel % size;
+			const int py = pixel / size;
+			const float sign = set ? 1.0f : -1.0f;
+			for( int y = 0; y < size; y++ )
+			{
+				const float* row = &kernel[((y - py + size) % size) * size];
+				for( int x = 0; x < size; x++ )
+				{
+					field[y * size + x] += sign * row[(x - px + size) % size];
+				}
+			}
+		};
+		//Highest energy among set pixels or lowest among empty ones, the first on ties
+		auto find = []( const std::vector<uint8_t>& bits, const std::vector<float>& field, bool cluster )
+		{
+			int best = -1;
+			for( int i = 0; i < (int)bits.size(); i++ )
+			{
+				if( (bits[i] != 0) == cluster && (best < 0 || (cluster ? field[i] > field[best] : field[i] < field[best])) )
+					best = i;
+			}
+			return best;
+		};
+
+		uint32_t seed = 1u;
+		int ones = 0;
+		while( ones < count / 10 )
+		{
+			const int pixel = (int)(Random::PCG_Hash( seed++ ) % (uint32_t)count);
+			if( pattern[pixel] == 0 )
+			{
+				toggle( pattern, energy, pixel, true );
+				ones++;
+			}
+		}
+
+		for( ;; )
+		{
+			const int cluster = find( pattern, energy, true );
+			toggle( pattern, energy, cluster, false );
+			const int gap = find( pattern, energy, false );
+			toggle( pattern, energy, gap, true );
+			if( gap == cluster )
+				break;
+		}
+
+		std::vector<uint32_t> ranks( count );
+		{
+			std::vector<uint8_t> bits = pattern;
+			std::vector<float> field = energy;
+			for( int rank = ones - 1; rank >= 0; rank-- )
+			{
+				const int cluster = find( bits, field, true );
+				toggle( bits, field, cluster, false );
+				ranks[cluster] = (uint32_t)rank;
+			}
+		}
+		//The energy of the empty pixels is the constant kernel sum minus this one, so the
+		//tightest cluster of empty pixels is the largest void all the way up
+		for( int rank = ones; rank < count; rank++ )
+		{
+			const int gap = find( pattern, energy, false );
+			toggle( pattern, energy, gap, true );
+			ranks[gap] = (uint32_t)rank;
+		}
+
+		return ranks;
+	}
+}
+
+const char* GetSamplerName( SamplerType type )
+{
+	switch( type )
+	{
+		case SamplerType::Sobol:
+			return "Sobol";
+		case SamplerType::BlueNoise:
+			return "Blue noise";
+		default:
+			return "Random";
+	}
+}
+
+Sampler::Sampler( SamplerType type, uint32_t seed, int x, int y, uint32_t sampleIndex )
+	:
+	type( type ),
+	//Blue noise shares one sequence between all pixels, the others get one each
+	seed( type == SamplerType::BlueNoise ? seed : Hash( Hash( seed, (uint32_t)x ), (uint32_t)y ) ),
+	sampleIndex( sampleIndex ),
+	x( x ),
+	y( y )
+{
+}
+
+float Sampler::Get( uint32_t dimension ) const
+{
+	switch( type )
+	{
+		case SamplerType::Sobol:
+			return ToFloat( OwenScrambledSobol( sampleIndex, dimension, seed ) );
+		case SamplerType::BlueNoise:
+		{
+			//Every dimension reads the mask at an offset of its own, the shift wraps around
+			//in integers so it is exact on both backends
+			const uint32_t offset = Hash( seed, dimension );
+			const int mx = (x + (int)(offset & (blueNoiseSize - 1))) & (blueNoiseSize - 1);
+			const int my = (y + (int)((offset >> 8) & (blueNoiseSize - 1))) & (blueNoiseSize - 1);
+			const uint32_t shift = GetBlueNoise()[my * blueNoiseSize + mx] << 20;
+			return ToFloat( OwenScrambledSobol( sampleIndex, dimension, seed ) + shift );
+		}
+		default:
+			return ToFloat( Hash( Hash( seed, sampleIndex ), dimension ) );
+	}
+}
+
+const std::vector<uint32_t>& Sampler::GetBlueNoise()
+{
+	//4096 ranks, 12 bits that the shift puts at the top of the sample
+	static_assert( blueNoiseSize * blueNoiseSize == 1 << 12, "The blue-noise shift assumes 12 bit ranks" );
+	static const std::vector<uint32_t> ranks = BuildBlueNoise( blueNoiseSize, 1.5f );
+	return ranks;
+}
+
+uint32_t Sampler::OwenScrambledSobol( uint32_t index, uint32_t dimension, uint32_t seed )
+{
+	//Groups of four dimensions would be the same points without a shuffle of their own
+	const uint32_t groupSeed = Hash( seed, dimension / 4u );
+	const uint32_t shuffled = NestedUniformScramble( index, groupSeed );
+	return NestedUniformScramble( Sobol( shuffled, dimension % 4u ), Hash( groupSeed, dimension % 4u ) );
+}
+
+Vec3F Sampler::UniformSphere( Vec2F u )
+{
+	const float z = 1.0f - 2.0f * u.x;
+	const float r = std::sqrt( (std::max)( 1.0f - z * z, 0.0f ) );
+	const float phi = 2.0f * PI * u.y;
+	return Vec3F( r * std::cos( phi ), r * std::sin( phi ), z );
+}
+
+Vec3F Sampler::CosineHemisphere( Vec3F normal, Vec2F u )
+{
+	//Orthonormal basis around the normal without a branch on its direction (Duff et al. 2017)
+	const float zSign = normal.z >= 0.0f ? 1.0f : -1.0f;
+	const float a = -1.0f / (zSign + normal.z);
+	const float b = normal.x * normal.y * a;
+	const Vec3F tangent( 1.0f + zSign * normal.x * normal.x * a, zSign * b, -zSign * normal.x );
+	const Vec3F bitangent( b, zSign + normal.y * normal.y * a, -normal.y );
+
+	//Uniform on the disk, projected up to the hemisphere
+	const float r = std::sqrt( u.x );
+	const float phi = 2.0f * PI * u.y;
+	return tangent * (r * std::cos( phi )) + bitangent * (r * std::sin( phi )) + normal * std::sqrt( (std::max)( 1.0f - u.x, 0.0f ) );
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include "../Utils/Vec2.h"
+#include "../Utils/Vec3.h"
+#include <vector>
+#include <cstdint>
+
+using namespace Hydro;
+
+//Where the random numbers of the paths come from. Same order as the SAMPLER_ defines in RayMarcher.hlsl
+enum class SamplerType
+{
+	//Hash of pixel, sample and dimension, white noise in every respect
+	Random,
+	//Owen-scrambled Sobol (Burley 2020) with a scramble of its own for every pixel
+	Sobol,
+	//One Owen-scrambled Sobol sequence for the whole image, shifted per pixel by a blue-noise
+	//mask (Georgiev and Fajardo 2016) so the error is pushed to high frequencies on screen
+	BlueNoise,
+	Count
+};
+
+const char* GetSamplerName( SamplerType type );
+
+//Random numbers indexed by pixel, sample and dimension instead of a chained state, so any
+//sample can be drawn again on its own. Integer arithmetic only, the Sampler namespace in
+//RayMarcher.hlsl returns identical values for the same arguments
+class Sampler
+{
+public:
+	//Dimensions every bounce of a path owns, so the same decision always draws from the same
+	//dimension of the sequence. Sobol dimensions come in groups of four with their own shuffle,
+	//a bounce takes whole groups so every Get2D pair stays in one and keeps its 2D stratification
+	enum BounceDimension : uint32_t
+	{
+		JitterX,
+		JitterY,
+		ScatterU,
+		ScatterV,
+		EmitterPick,
+		EmitterFace,
+		EmitterU,
+		EmitterV,
+		Roulette,
+		DimensionsPerBounce = 12
+	};
+
+	//Side of the tiled blue-noise mask
+	static constexpr int blueNoiseSize = 64;
+public:
+	Sampler() = default;
+	//seed scrambles the whole image, a new one gives an independent image
+	Sampler( SamplerType type, uint32_t seed, int x, int y, uint32_t sampleIndex );
+	//In [0, 1) with 24 bits
+	float Get( uint32_t dimension ) const;
+	Vec2F Get2D( uint32_t dimension ) const { return Vec2F( Get( dimension ), Get( dimension + 1 ) ); }
+	//Ranks of a void-and-cluster mask (Ulichney 1993), blueNoiseSize squared of them in rows.
+	//Built on first use, the GPU gets a copy
+	static const std::vector<uint32_t>& GetBlueNoise();
+	//Sobol point index in one dimension with nested uniform scrambling, dimensions of the
+	//same group of four share a shuffle of the point order
+	static uint32_t OwenScrambledSobol( uint32_t index, uint32_t dimension, uint32_t seed );
+	static float ToFloat( uint32_t bits ) { return (float)(bits >> 8) * (1.0f / 16777216.0f); }
+	//Closed form warps of two numbers in [0, 1), no rejection loops
+	static Vec3F UniformSphere( Vec2F u );
+	//Density cosine over pi around normal
+	static Vec3F CosineHemisphere( Vec3F normal, Vec2F u );
+private:
+	SamplerType type = SamplerType::Random;
+	uint32_t seed = 0u;
+	uint32_t sampleIndex = 0u;
+	int x = 0;
+	int y = 0;
+};
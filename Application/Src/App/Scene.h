@@ -3,6 +3,7 @@
 #include "../ImGui/imgui.h"
 #include <optional>
 #include <vector>
+#include <string>
 
 using namespace Hydro;
 
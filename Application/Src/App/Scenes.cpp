@@ -0,0 +1,178 @@
+#include "Scenes.h"
+
+Scene Scene_Sphere()
+{
+    Scene scene;
+
+    scene.objectCount = 1;
+    scene.materialCount = 1;
+
+    scene.objects[0].active = 1;
+    scene.objects[0].id = 0;
+    scene.objects[0].materialIndex = 0;
+
+    scene.objects[0].data[0] = 0.0f;
+    scene.objects[0].data[1] = 0.0f;
+    scene.objects[0].data[2] = 0.0f;
+    scene.objects[0].data[3] = 0.5f;
+
+    scene.materials[0].data[0] = 0.8f;
+    scene.materials[0].data[1] = 0.8f;
+    scene.materials[0].data[2] = 0.0f;
+
+    return scene;
+}
+
+
+Scene Scene_Cube()
+{
+	Scene scene;
+
+	scene.objectCount = 1;
+	scene.materialCount = 1;
+
+	scene.objects[0].active = 1;
+	scene.objects[0].id = 1;
+	scene.objects[0].materialIndex = 0;
+
+	scene.objects[0].data[0] = 0.0f;
+	scene.objects[0].data[1] = 0.0f;
+	scene.objects[0].data[2] = 0.0f;
+	scene.objects[0].data[3] = 0.5f;
+    scene.objects[0].data[4] = 0.5f;
+    scene.objects[0].data[5] = 0.5f;
+
+	scene.materials[0].data[0] = 0.0f;
+	scene.materials[0].data[1] = 0.6f;
+	scene.materials[0].data[2] = 0.8f;
+
+	return scene;
+}
+
+
+
+Scene Scene_Torus()
+{
+	Scene scene;
+
+	scene.objectCount = 1;
+	scene.materialCount = 1;
+
+	scene.objects[0].active = 1;
+	scene.objects[0].id = 2;
+	scene.objects[0].materialIndex = 0;
+
+	scene.objects[0].data[0] = 0.0f;
+	scene.objects[0].data[1] = 0.0f;
+	scene.objects[0].data[2] = 0.0f;
+	scene.objects[0].data[3] = 0.5f;
+	scene.objects[0].data[4] = 0.2f;
+
+	scene.materials[0].data[0] = 0.8f;
+	scene.materials[0].data[1] = 0.0f;
+	scene.materials[0].data[2] = 0.8f;
+
+	return scene;
+}
+
+Scene Scene_CornellBox()
+{
+    Scene scene;
+
+    scene.objectCount = 6;
+    scene.materialCount = 4;
+
+    //Red
+    scene.materials[0].id = 0;
+    scene.materials[0].data[0] = 0.65f;
+    scene.materials[0].data[1] = 0.05f;
+    scene.materials[0].data[2] = 0.05f;
+
+    //White
+    scene.materials[1].id = 0;
+    scene.materials[1].data[0] = 0.73f;
+    scene.materials[1].data[1] = 0.73f;
+    scene.materials[1].data[2] = 0.73f;
+
+    //Green
+    scene.materials[2].id = 0;
+    scene.materials[2].data[0] = 0.12f;
+    scene.materials[2].data[1] = 0.45f;
+    scene.materials[2].data[2] = 0.15f;
+
+    //Light
+    scene.materials[3].id = 0;
+    scene.materials[3].data[0] = 1.0f;
+    scene.materials[3].data[1] = 1.0f;
+    scene.materials[3].data[2] = 1.0f;
+    scene.materials[3].emitedLight = Vec3F( 1.0f, 1.0f, 1.0f );
+    scene.materials[3].data[15] = 15.0f;
+
+    //Left Wall
+    scene.objects[0].active = 1;
+    scene.objects[0].id = 1;
+    scene.objects[0].materialIndex = 2;
+    scene.objects[0].data[0] = -3.0f;
+    scene.objects[0].data[1] = 0.0f;
+    scene.objects[0].data[2] = 0.5f;
+    scene.objects[0].data[3] = 0.1f;
+    scene.objects[0].data[4] = 2.5f;
+    scene.objects[0].data[5] = 3.0f;
+
+    //Right Wall
+    scene.objects[1].active = 1;
+    scene.objects[1].id = 1;
+    scene.objects[1].materialIndex = 0;
+    scene.objects[1].data[0] = 3.0f;
+    scene.objects[1].data[1] = 0.0f;
+    scene.objects[1].data[2] = 0.5f;
+    scene.objects[1].data[3] = 0.1f;
+    scene.objects[1].data[4] = 2.5f;
+    scene.objects[1].data[5] = 3.0f;
+
+    //Back Wall
+    scene.objects[2].active = 1;
+    scene.objects[2].id = 1;
+    scene.objects[2].materialIndex = 1;
+    scene.objects[2].data[0] = 0.0f;
+    scene.objects[2].data[1] = 0.0f;
+    scene.objects[2].data[2] = -2.6f;
+    scene.objects[2].data[3] = 2.9f;
+    scene.objects[2].data[4] = 2.5f;
+    scene.objects[2].data[5] = 0.1f;
+
+    //Floor
+    scene.objects[3].active = 1;
+    scene.objects[3].id = 1;
+    scene.objects[3].materialIndex = 1;
+    scene.objects[3].data[0] = 0.0f;
+    scene.objects[3].data[1] = -2.6f;
+    scene.objects[3].data[2] = 0.5f;
+    scene.objects[3].data[3] = 2.9f;
+    scene.objects[3].data[4] = 0.1f;
+    scene.objects[3].data[5] = 3.0f;
+
+    //Ceiling
+    scene.objects[4].active = 1;
+    scene.objects[4].id = 1;
+    scene.objects[4].materialIndex = 1;
+    scene.objects[4].data[0] = 0.0f;
+    scene.objects[4].data[1] = 2.6f;
+    scene.objects[4].data[2] = 0.5f;
+    scene.objects[4].data[3] = 2.9f;
+    scene.objects[4].data[4] = 0.1f;
+    scene.objects[4].data[5] = 3.0f;
+
+    //Ceiling Light
+    scene.objects[5].active = 1;
+    scene.objects[5].id = 1;
+    scene.objects[5].materialIndex = 3;
+    scene.objects[5].data[0] = 0.0f;
+    scene.objects[5].data[1] = 2.59f;
+    scene.objects[5].data[2] = 0.5f;
+    scene.objects[5].data[3] = 0.5f;
+    scene.objects[5].data[4] = 0.1f;
+    scene.objects[5].data[5] = 0.5f;
+
+    return scene;
+}
@@ -0,0 +1,8 @@
+#pragma once
+#include "Scene.h"
+
+//Built-in scenes, the App picks the matching skybox
+Scene Scene_Sphere();
+Scene Scene_Cube();
+Scene Scene_Torus();
+Scene Scene_CornellBox();
\ No newline at end of file
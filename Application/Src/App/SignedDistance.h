@@ -0,0 +1,197 @@
+#pragma once
+#include "../Utils/Vec2.h"
+#include "../Utils/Vec3.h"
+#include "CompiledScene.h"
+#include <cmath>
+
+using namespace Hydro;
+
+//CPU versions of the distance functions in RayMarcher.hlsl
+struct ObjectDistance
+{
+	float distance;
+	int objectIndex;
+};
+
+inline float SignedDistanceSphere( Vec3F p, Vec3F center, float radius )
+{
+	return (p - center).Magnitude() - radius;
+}
+
+inline float SignedDistanceBox( Vec3F p, Vec3F c, Vec3F b )
+{
+	Vec3F q = Vec3F::Abs( p - c ) - b;
+	return Vec3F::Max( q, Vec3F( 0.0f ) ).Magnitude() + std::fmin( std::fmax( q.x, std::fmax( q.y, q.z ) ), 0.0f );
+}
+
+inline float SignedDistanceTorus( Vec3F p, Vec3F center, Vec2F t )
+{
+	p = p - center;
+	Vec2F q = Vec2F( std::sqrt( p.x * p.x + p.z * p.z ) - t.x, p.y );
+	return q.Magnitude() - t.y;
+}
+
+//Distance to a single primitive packed like Bvh primitives
+inline float SignedDistancePrimitive( const CompiledScene& scene, uint32_t primitive, Vec3F p )
+{
+	const int index = Bvh::GetIndex( primitive );
+	switch( Bvh::GetType( primitive ) )
+	{
+		case Bvh::Box:
+		{
+			const Vec4F& center = scene.boxCenters[index];
+			const Vec4F& size = scene.boxSizes[index];
+			return SignedDistanceBox( p, Vec3F( center.x, center.y, center.z ), Vec3F( size.x, size.y, size.z ) );
+		}
+		case Bvh::Torus:
+		{
+			const Vec4F& torus = scene.tori[index];
+			return SignedDistanceTorus( p, Vec3F( torus.x, torus.y, torus.z ), Vec2F( torus.w, scene.torusMinorRadii[index] ) );
+		}
+		default:
+		{
+			const Vec4F& sphere = scene.spheres[index];
+			return SignedDistanceSphere( p, Vec3F( sphere.x, sphere.y, sphere.z ), sphere.w );
+		}
+	}
+}
+
+//Gradients of the distance functions, not normalized where the length is already 1
+inline Vec3F GradientSphere( Vec3F p, Vec3F center )
+{
+	return p - center;
+}
+
+inline Vec3F GradientBox( Vec3F p, Vec3F c, Vec3F b )
+{
+	p = p - c;
+	Vec3F w = Vec3F::Abs( p ) - b;
+	Vec3F s = Vec3F( p.x < 0.0f ? -1.0f : 1.0f, p.y < 0.0f ? -1.0f : 1.0f, p.z < 0.0f ? -1.0f : 1.0f );
+
+	//Outside the closest point is on a face, edge or corner, inside it is on the nearest face
+	if( std::fmax( w.x, std::fmax( w.y, w.z ) ) > 0.0f )
+		return Vec3F::Scale( s, Vec3F::Max( w, Vec3F( 0.0f ) ) );
+
+	if( w.x > w.y && w.x > w.z )
+		return Vec3F( s.x, 0.0f, 0.0f );
+	if( w.y > w.z )
+		return Vec3F( 0.0f, s.y, 0.0f );
+	return Vec3F( 0.0f, 0.0f, s.z );
+}
+
+inline Vec3F GradientTorus( Vec3F p, Vec3F center, Vec2F t )
+{
+	p = p - center;
+	const float ringDistance = std::sqrt( p.x * p.x + p.z * p.z );
+	const float k = (ringDistance - t.x) / ringDistance;
+	return Vec3F( p.x * k, p.y, p.z * k );
+}
+
+//Tetrahedral estimate with four evaluations of one primitive, for primitives
+//without an analytic gradient and points where it is undefined
+inline Vec3F PrimitiveNormalTetrahedral( const CompiledScene& scene, uint32_t primitive, Vec3F p )
+{
+	const float h = 0.0005f;
+	const Vec3F k0 = Vec3F( 1.0f, -1.0f, -1.0f );
+	const Vec3F k1 = Vec3F( -1.0f, -1.0f, 1.0f );
+	const Vec3F k2 = Vec3F( -1.0f, 1.0f, -1.0f );
+	const Vec3F k3 = Vec3F( 1.0f, 1.0f, 1.0f );
+	return (k0 * SignedDistancePrimitive( scene, primitive, p + k0 * h ) +
+		k1 * SignedDistancePrimitive( scene, primitive, p + k1 * h ) +
+		k2 * SignedDistancePrimitive( scene, primitive, p + k2 * h ) +
+		k3 * SignedDistancePrimitive( scene, primitive, p + k3 * h )).Normalized();
+}
+
+//Surface normal of the object that was hit, only that object is evaluated
+inline Vec3F ObjectNormal( const CompiledScene& scene, int objectIndex, Vec3F p )
+{
+	const uint32_t primitive = scene.GetObjectPrimitive( objectIndex );
+	const int index = Bvh::GetIndex( primitive );
+
+	Vec3F gradient;
+	switch( Bvh::GetType( primitive ) )
+	{
+		case Bvh::Sphere:
+		{
+			const Vec4F& sphere = scene.spheres[index];
+			gradient = GradientSphere( p, Vec3F( sphere.x, sphere.y, sphere.z ) );
+			break;
+		}
+		case Bvh::Box:
+		{
+			const Vec4F& center = scene.boxCenters[index];
+			const Vec4F& size = scene.boxSizes[index];
+			gradient = GradientBox( p, Vec3F( center.x, center.y, center.z ), Vec3F( size.x, size.y, size.z ) );
+			break;
+		}
+		case Bvh::Torus:
+		{
+			const Vec4F& torus = scene.tori[index];
+			gradient = GradientTorus( p, Vec3F( torus.x, torus.y, torus.z ), Vec2F( torus.w, scene.torusMinorRadii[index] ) );
+			break;
+		}
+		default:
+			return PrimitiveNormalTetrahedral( scene, primitive, p );
+	}
+
+	//Degenerate at the center of a sphere or on the axis of a torus
+	const float length = gradient.Magnitude();
+	if( !(length > 1e-12f) || !std::isfinite( length ) )
+		return PrimitiveNormalTetrahedral( scene, primitive, p );
+
+	return gradient / length;
+}
+
+inline ObjectDistance SignedDistanceSceneLinear( const CompiledScene& scene, Vec3F p )
+{
+	ObjectDistance result;
+	result.distance = 10000.0f;
+	result.objectIndex = -1;
+
+	auto closest = [&result]( float distance, int objectIndex )
+	{
+		const bool closer = distance < result.distance;
+		result.distance = closer ? distance : result.distance;
+		result.objectIndex = closer ? objectIndex : result.objectIndex;
+	};
+
+	for( size_t i = 0; i < scene.spheres.size(); i++ )
+	{
+		const Vec4F& sphere = scene.spheres[i];
+		closest( SignedDistanceSphere( p, Vec3F( sphere.x, sphere.y, sphere.z ), sphere.w ), scene.sphereObjects[i] );
+	}
+
+	for( size_t i = 0; i < scene.boxCenters.size(); i++ )
+	{
+		const Vec4F& center = scene.boxCenters[i];
+		const Vec4F& size = scene.boxSizes[i];
+		closest( SignedDistanceBox( p, Vec3F( center.x, center.y, center.z ), Vec3F( size.x, size.y, size.z ) ), scene.boxObjects[i] );
+	}
+
+	for( size_t i = 0; i < scene.tori.size(); i++ )
+	{
+		const Vec4F& torus = scene.tori[i];
+		closest( SignedDistanceTorus( p, Vec3F( torus.x, torus.y, torus.z ), Vec2F( torus.w, scene.torusMinorRadii[i] ) ), scene.torusObjects[i] );
+	}
+
+	return result;
+}
+
+inline ObjectDistance SignedDistanceScene( const CompiledScene& scene, Vec3F p )
+{
+	if( scene.GetBvh().IsEmpty() )
+		return SignedDistanceSceneLinear( scene, p );
+
+	return scene.GetBvh().SignedDistance( scene, p );
+}
+
+//Forward differences of the whole scene, four more scene evaluations per hit
+inline Vec3F SceneNormalForwardDifference( const CompiledScene& scene, Vec3F p )
+{
+	const float epsilon = 0.001f;
+	float centerDistance = SignedDistanceScene( scene, p ).distance;
+	float xDistance = SignedDistanceScene( scene, p + Vec3F( epsilon, 0.0f, 0.0f ) ).distance;
+	float yDistance = SignedDistanceScene( scene, p + Vec3F( 0.0f, epsilon, 0.0f ) ).distance;
+	float zDistance = SignedDistanceScene( scene, p + Vec3F( 0.0f, 0.0f, epsilon ) ).distance;
+	return ((Vec3F( xDistance, yDistance, zDistance ) - Vec3F( centerDistance )) / epsilon).Normalized();
+}
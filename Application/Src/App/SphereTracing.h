@@ -0,0 +1,164 @@
+#pragma once
+#include "Ray.h"
+#include "SignedDistance.h"
+#include <vector>
+#include <cstdint>
+#include <cmath>
+
+struct SphereTraceSettings
+{
+	int maxIterations = 1000;
+	float surfaceDistance = 0.0001f;
+	float maxDistance = 100.0f;
+	//Step multiplier, 1 is plain sphere tracing
+	float relaxation = 1.0f;
+};
+
+//MarchRay without the normal. With relaxation > 1 this is enhanced sphere tracing
+//(Keinert et al. 2014): steps are scaled up until the unbounding spheres of two
+//consecutive points stop overlapping, then the step is undone and tracing
+//continues with plain steps. Ray directions are not normalized, like in the shader.
+//startDistance skips a part of the ray already known to be empty, HitDistance is
+//still measured from ray.Origin
+template<typename DistanceFunction>
+HitPayload SphereTrace( DistanceFunction&& distance, Ray ray, const SphereTraceSettings& settings, int& steps, float startDistance = 0.0f )
+{
+	const Vec3F origin = ray.Origin;
+	const float directionLength = ray.Direction.Magnitude();
+	if( startDistance > 0.0f )
+		ray.Origin += ray.Direction * (startDistance / directionLength);
+
+	HitPayload hit;
+	hit.HitDistance = -1.0f;
+	hit.ObjectIndex = -1;
+
+	float omega = settings.relaxation;
+	float previousRadius = 0.0f;
+	float stepLength = 0.0f;
+
+	for( steps = 1; steps <= settings.maxIterations; steps++ )
+	{
+		ObjectDistance d = distance( ray.Origin );
+		const float radius = std::abs( d.distance );
+
+		const bool overshoot = omega > 1.0f && radius + previousRadius < std::abs( stepLength ) * directionLength;
+		if( overshoot )
+		{
+			stepLength -= omega * stepLength;
+			omega = 1.0f;
+		}
+		else
+		{
+			if( d.distance < settings.surfaceDistance )
+			{
+				hit.HitDistance = Vec3F::Distance( origin, ray.Origin );
+				hit.WorldPosition = ray.Origin;
+				hit.ObjectIndex = d.objectIndex;
+				return hit;
+			}
+
+			if( d.distance > settings.maxDistance )
+				return hit;
+
+			stepLength = d.distance * omega;
+		}
+
+		previousRadius = radius;
+		ray.Origin += ray.Direction * stepLength;
+	}
+
+	steps = settings.maxIterations;
+	return hit;
+}
+
+//Any-hit trace of a shadow ray towards a point length along the normalized direction,
+//true as soon as a surface other than targetObject is closer than surfaceDistance. The
+//target is a convex emitter seen from its front, the ray only touches it at the end.
+//Running out of iterations counts as occluded
+template<typename DistanceFunction>
+bool SphereTraceOccluded( DistanceFunction&& distance, Ray ray, float length, int targetObject, const SphereTraceSettings& settings, int& steps )
+{
+	float t = 0.0f;
+	for( steps = 1; steps <= settings.maxIterations; steps++ )
+	{
+		const ObjectDistance d = distance( ray.Origin );
+		if( d.distance < settings.surfaceDistance )
+			return d.objectIndex != targetObject;
+
+		//The empty sphere around the point reaches past the end of the ray
+		t += d.distance;
+		if( t >= length )
+			return false;
+
+		ray.Origin += ray.Direction * d.distance;
+	}
+
+	steps = settings.maxIterations;
+	return true;
+}
+
+//Per-ray sphere tracing iteration counts
+class StepHistogram
+{
+public:
+	void Add( int steps );
+	void Merge( const StepHistogram& other );
+	void Clear();
+	uint64_t GetRayCount() const { return rayCount; }
+	uint64_t GetStepCount() const { return stepCount; }
+	double GetAverage() const;
+	//Smallest step count that at least fraction of the rays stay at or below
+	int GetPercentile( double fraction ) const;
+private:
+	std::vector<uint64_t> counts;
+	uint64_t rayCount = 0;
+	uint64_t stepCount = 0;
+};
+
+inline void StepHistogram::Add( int steps )
+{
+	if( steps >= (int)counts.size() )
+		counts.resize( steps + 1, 0 );
+
+	counts[steps]++;
+	rayCount++;
+	stepCount += steps;
+}
+
+inline void StepHistogram::Merge( const StepHistogram& other )
+{
+	if( other.counts.size() > counts.size() )
+		counts.resize( other.counts.size(), 0 );
+
+	for( size_t i = 0; i < other.counts.size(); i++ )
+	{
+		counts[i] += other.counts[i];
+	}
+	rayCount += other.rayCount;
+	stepCount += other.stepCount;
+}
+
+inline void StepHistogram::Clear()
+{
+	counts.clear();
+	rayCount = 0;
+	stepCount = 0;
+}
+
+inline double StepHistogram::GetAverage() const
+{
+	return rayCount == 0 ? 0.0 : (double)stepCount / (double)rayCount;
+}
+
+inline int StepHistogram::GetPercentile( double fraction ) const
+{
+	const double target = fraction * (double)rayCount;
+	uint64_t below = 0;
+	for( size_t i = 0; i < counts.size(); i++ )
+	{
+		below += counts[i];
+		if( (double)below >= target )
+			return (int)i;
+	}
+	return (int)counts.size() - 1;
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+namespace Hydro
+{
+	//Polled by a long job at points where it can stop, the tiles and samples of a render.
+	//Cancelled once the source it came from was cancelled after it was handed out
+	class CancellationToken
+	{
+	public:
+		//Never cancelled
+		CancellationToken() = default;
+		bool IsCancelled() const
+		{
+			return pVersion != nullptr && pVersion->load( std::memory_order_relaxed ) != version;
+		}
+	private:
+		friend class CancellationSource;
+		CancellationToken( const std::atomic<uint64_t>* pVersion, uint64_t version )
+			:
+			pVersion( pVersion ),
+			version( version )
+		{}
+	private:
+		const std::atomic<uint64_t>* pVersion = nullptr;
+		uint64_t version = 0;
+	};
+
+	//Hands out tokens and cancels every one handed out so far at once. Has to outlive them
+	class CancellationSource
+	{
+	public:
+		CancellationToken GetToken() const { return CancellationToken( &version, version.load( std::memory_order_relaxed ) ); }
+		void Cancel() { version.fetch_add( 1, std::memory_order_relaxed ); }
+	private:
+		std::atomic<uint64_t> version = 0;
+	};
+}
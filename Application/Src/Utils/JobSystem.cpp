@@ -0,0 +1,396 @@
+#include "JobSystem.h"
+#include "HydroTimer.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cassert>
+
+#if defined( _WIN32 )
+#define NOMINMAX
+#include <Windows.h>
+#elif defined( __linux__ )
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace Hydro
+{
+	namespace
+	{
+		//Pool and queue of the worker running on this thread, null outside of every pool
+		thread_local const JobSystem* currentSystem = nullptr;
+		thread_local unsigned int currentQueue = 0;
+
+		int64_t Nanoseconds( std::chrono::steady_clock::time_point start )
+		{
+			return std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now() - start ).count();
+		}
+
+		void PinThread( std::thread& thread, unsigned int core )
+		{
+#if defined( _WIN32 )
+			SetThreadAffinityMask( (HANDLE)thread.native_handle(), (DWORD_PTR)1 << (core % (sizeof( DWORD_PTR ) * 8)) );
+#elif defined( __linux__ )
+			cpu_set_t set;
+			CPU_ZERO( &set );
+			CPU_SET( core % CPU_SETSIZE, &set );
+			pthread_setaffinity_np( thread.native_handle(), sizeof( set ), &set );
+#else
+			(void)thread;
+			(void)core;
+#endif
+		}
+	}
+
+	JobSystem::JobSystem( unsigned int threadCount, bool pinned )
+	{
+		if( threadCount == 0 )
+		{
+			const unsigned int cores = std::thread::hardware_concurrency();
+			threadCount = cores > 1 ? cores - 1 : 0;
+		}
+
+		//One queue per worker and the shared one last
+		for( unsigned int i = 0; i <= threadCount; i++ )
+		{
+			queues.push_back( std::make_unique<Queue>() );
+		}
+		for( unsigned int i = 0; i < threadCount; i++ )
+		{
+			threads.emplace_back( &JobSystem::WorkerLoop, this, i );
+			if( pinned )
+				PinThread( threads.back(), i + 1 );
+		}
+	}
+
+	JobSystem::~JobSystem()
+	{
+		{
+			std::lock_guard<std::mutex> lock( sleepMutex );
+			running = false;
+		}
+		wake.notify_all();
+		for( std::thread& thread : threads )
+		{
+			thread.join();
+		}
+	}
+
+	void JobSystem::Run( TaskGroup& group, std::function<void()> task )
+	{
+		group.pending++;
+		Push( GetQueueIndex(), Task{ std::move( task ), &group } );
+	}
+
+	void JobSystem::Then( TaskGroup& group, TaskGroup& next, std::function<void()> continuation )
+	{
+		{
+			std::lock_guard<std::mutex> lock( group.mutex );
+			if( group.pending.load() > 0 )
+			{
+				next.pending++;
+				group.continuations.emplace_back( &next, std::move( continuation ) );
+				return;
+			}
+		}
+		Run( next, std::move( continuation ) );
+	}
+
+	void JobSystem::Wait( TaskGroup& group )
+	{
+		const unsigned int queue = GetQueueIndex();
+		while( group.pending.load() > 0 )
+		{
+			if( !RunOne( queue ) )
+				std::this_thread::yield();
+		}
+		//The last task may still be inside Finish
+		std::lock_guard<std::mutex> lock( group.mutex );
+	}
+
+	JobSystem::Stats JobSystem::GetStats() const
+	{
+		Stats stats;
+		for( const auto& pQueue : queues )
+		{
+			stats.tasks += pQueue->tasksRun.load();
+			stats.steals += pQueue->steals.load();
+			stats.sleeps += pQueue->sleeps.load();
+			stats.schedulingTime += pQueue->schedulingTime.load();
+		}
+		return stats;
+	}
+
+	void JobSystem::ResetStats()
+	{
+		for( const auto& pQueue : queues )
+		{
+			pQueue->tasksRun = 0;
+			pQueue->steals = 0;
+			pQueue->sleeps = 0;
+			pQueue->schedulingTime = 0;
+		}
+	}
+
+	void JobSystem::WorkerLoop( unsigned int index )
+	{
+		currentSystem = this;
+		currentQueue = index;
+
+		while( running.load() )
+		{
+			if( RunOne( index ) )
+				continue;
+
+			//Counted as sleeping before looking at the tasks once more, so a push either sees
+			//the sleeper or the sleeper sees the task
+			std::unique_lock<std::mutex> lock( sleepMutex );
+			sleepingWorkers++;
+			if( queuedTasks.load() == 0 && running.load() )
+			{
+				queues[index]->sleeps.fetch_add( 1, std::memory_order_relaxed );
+				wake.wait( lock, [this]() { return queuedTasks.load() > 0 || !running.load(); } );
+			}
+			sleepingWorkers--;
+		}
+	}
+
+	unsigned int JobSystem::GetQueueIndex() const
+	{
+		return currentSystem == this ? currentQueue : (unsigned int)threads.size();
+	}
+
+	void JobSystem::Push( unsigned int queue, Task task )
+	{
+		const auto start = std::chrono::steady_clock::now();
+		{
+			std::lock_guard<std::mutex> lock( queues[queue]->mutex );
+			queues[queue]->tasks.push_back( std::move( task ) );
+		}
+		queuedTasks++;
+		if( sleepingWorkers.load() > 0 )
+		{
+			std::lock_guard<std::mutex> lock( sleepMutex );
+			wake.notify_one();
+		}
+		queues[queue]->schedulingTime.fetch_add( Nanoseconds( start ), std::memory_order_relaxed );
+	}
+
+	bool JobSystem::RunOne( unsigned int queue )
+	{
+		const auto start = std::chrono::steady_clock::now();
+		Task task;
+		bool found = false;
+		bool stolen = false;
+
+		//Newest own task first, it is the most likely to still be in the cache
+		{
+			Queue& own = *queues[queue];
+			std::lock_guard<std::mutex> lock( own.mutex );
+			if( !own.tasks.empty() )
+			{
+				task = std::move( own.tasks.back() );
+				own.tasks.pop_back();
+				found = true;
+			}
+		}
+		//Then the oldest task of the others, the biggest piece of work they have left
+		for( size_t i = 1; !found && i < queues.size() && queuedTasks.load() > 0; i++ )
+		{
+			Queue& victim = *queues[(queue + i) % queues.size()];
+			std::lock_guard<std::mutex> lock( victim.mutex );
+			if( !victim.tasks.empty() )
+			{
+				task = std::move( victim.tasks.front() );
+				victim.tasks.pop_front();
+				found = true;
+				stolen = true;
+			}
+		}
+
+		Queue& self = *queues[queue];
+		self.schedulingTime.fetch_add( Nanoseconds( start ), std::memory_order_relaxed );
+		if( !found )
+			return false;
+
+		queuedTasks--;
+		self.tasksRun.fetch_add( 1, std::memory_order_relaxed );
+		if( stolen )
+			self.steals.fetch_add( 1, std::memory_order_relaxed );
+		task.function();
+		Finish( *task.group );
+		return true;
+	}
+
+	void JobSystem::Finish( TaskGroup& group )
+	{
+		std::vector<std::pair<TaskGroup*, std::function<void()>>> continuations;
+		{
+			std::lock_guard<std::mutex> lock( group.mutex );
+			if( group.pending.load() == 1 )
+				std::swap( continuations, group.continuations );
+			group.pending--;
+		}
+
+		//Already counted in their groups by Then
+		const unsigned int queue = GetQueueIndex();
+		for( auto& [pNext, continuation] : continuations )
+		{
+			Push( queue, Task{ std::move( continuation ), pNext } );
+		}
+	}
+
+	std::vector<std::string> JobSystem::RunBenchmark()
+	{
+		const int spawnCount = 100000;
+		const int loopRepeats = 200;
+		const int imageSize = 512;
+		const int tileSize = 32;
+
+		std::vector<std::string> report;
+		char line[256];
+		const unsigned int cores = (std::max)( std::thread::hardware_concurrency(), 1u );
+		snprintf( line, sizeof( line ), "%u cores, %d empty tasks, %dx%d image in %dx%d tiles", cores, spawnCount, imageSize, imageSize, tileSize, tileSize );
+		report.push_back( line );
+
+		//Spawn cost: empty tasks from the thread outside the pool and split recursively by the workers
+		{
+			JobSystem jobs;
+			Hydro::Timer timer;
+			TaskGroup group;
+			for( int i = 0; i < spawnCount; i++ )
+			{
+				jobs.Run( group, []() {} );
+			}
+			jobs.Wait( group );
+			const float flatTime = timer.Mark();
+
+			std::function<void( TaskGroup&, int )> split = [&]( TaskGroup& parent, int count )
+			{
+				if( count <= 1 )
+					return;
+				jobs.Run( parent, [&jobs, &split, count]()
+				{
+					TaskGroup child;
+					split( child, count / 2 );
+					jobs.Wait( child );
+				} );
+				split( parent, count - count / 2 );
+			};
+			std::function<void( int )> tree = [&]( int count )
+			{
+				TaskGroup group;
+				split( group, count );
+				jobs.Wait( group );
+			};
+			jobs.ResetStats();
+			timer.Mark();
+			tree( spawnCount );
+			const float treeTime = timer.Mark();
+			const Stats stats = jobs.GetStats();
+
+			snprintf( line, sizeof( line ), "Spawn and run: %.0fns per task from outside, %.0fns split by the workers",
+				flatTime * 1e9f / spawnCount, treeTime * 1e9f / spawnCount );
+			report.push_back( line );
+			snprintf( line, sizeof( line ), "    Split: %lld tasks, %lld stolen, %lld sleeps, %.0fns scheduling per task",
+				(long long)stats.tasks, (long long)stats.steals, (long long)stats.sleeps, stats.tasks > 0 ? (double)stats.schedulingTime / stats.tasks : 0.0 );
+			report.push_back( line );
+		}
+
+		//Scaling of a tiled loop with an uneven cost per pixel, like a render with a bright corner
+		std::vector<float> image( (size_t)imageSize * imageSize );
+		auto shade = [&]( int x0, int y0, int x1, int y1, unsigned int )
+		{
+			for( int y = y0; y < y1; y++ )
+			{
+				for( int x = x0; x < x1; x++ )
+				{
+					const int iterations = 8 + (x * y) / (imageSize * 8);
+					float value = 0.0f;
+					for( int i = 0; i < iterations; i++ )
+					{
+						value += std::sin( (float)(x + i) * 0.01f ) * std::cos( (float)(y - i) * 0.01f );
+					}
+					image[(size_t)y * imageSize + x] = value;
+				}
+			}
+		};
+
+		std::vector<unsigned int> threadCounts;
+		for( unsigned int threadCount = 1; threadCount < cores; threadCount *= 2 )
+		{
+			threadCounts.push_back( threadCount );
+		}
+		threadCounts.push_back( cores );
+
+		float singleTime = 0.0f;
+		for( const unsigned int threadCount : threadCounts )
+		{
+			for( const bool pinned : { false, true } )
+			{
+				JobSystem jobs( threadCount - 1, pinned );
+				//Warm up
+				jobs.ParallelFor2D( imageSize, imageSize, tileSize, shade );
+				jobs.ResetStats();
+
+				Hydro::Timer timer;
+				for( int i = 0; i < loopRepeats / 10; i++ )
+				{
+					jobs.ParallelFor2D( imageSize, imageSize, tileSize, shade );
+				}
+				const float time = timer.Mark() / (loopRepeats / 10);
+				if( threadCount == 1 && !pinned )
+					singleTime = time;
+
+				//Loops too short to be worth threads, where the scheduling overhead shows
+				timer.Mark();
+				for( int i = 0; i < loopRepeats; i++ )
+				{
+					jobs.ParallelFor( 64, []( int, unsigned int ) {} );
+				}
+				const float emptyTime = timer.Mark() / loopRepeats;
+
+				snprintf( line, sizeof( line ), "%u threads%s: %.2fms per image, %.2fx, empty 64 item loop %.1fus",
+					threadCount, pinned ? " pinned" : "", time * 1000.0f, singleTime / time, emptyTime * 1e6f );
+				report.push_back( line );
+			}
+		}
+
+		//The same empty loop with threads started per call, like the ParallelFor of the renderers
+		//before. Four slots even on fewer cores, so both start the same number of threads
+		{
+			const unsigned int slots = (std::max)( cores, 4u );
+			JobSystem jobs( slots - 1 );
+			Hydro::Timer timer;
+			for( int i = 0; i < loopRepeats; i++ )
+			{
+				jobs.ParallelFor( 64, []( int, unsigned int ) {} );
+			}
+			const float poolTime = timer.Mark() / loopRepeats;
+			for( int i = 0; i < loopRepeats; i++ )
+			{
+				std::atomic<int> next = 0;
+				auto loop = [&next]()
+				{
+					while( next++ < 64 ) {}
+				};
+				std::vector<std::thread> workers;
+				for( unsigned int t = 1; t < slots; t++ )
+				{
+					workers.emplace_back( loop );
+				}
+				loop();
+				for( std::thread& worker : workers )
+				{
+					worker.join();
+				}
+			}
+			const float threadTime = timer.Mark() / loopRepeats;
+			snprintf( line, sizeof( line ), "Empty 64 item loop on %u slots: %.1fus on the workers, %.1fus starting threads per loop",
+				slots, poolTime * 1e6f, threadTime * 1e6f );
+			report.push_back( line );
+		}
+
+		return report;
+	}
+}
@@ -0,0 +1,152 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <cstdint>
+
+namespace Hydro
+{
+	//Thread pool where every worker has a deque of its own. Workers run their newest task
+	//first and once out of work steal the oldest task of another deque. A thread waiting for
+	//a group runs tasks meanwhile, so tasks can spawn and wait for more tasks
+	class JobSystem
+	{
+	public:
+		//Tasks that are waited for together. Has to outlive its tasks and continuations
+		class TaskGroup
+		{
+		public:
+			TaskGroup() = default;
+			TaskGroup( const TaskGroup& ) = delete;
+			TaskGroup& operator=( const TaskGroup& ) = delete;
+			bool IsDone() const { return pending.load() == 0; }
+		private:
+			friend class JobSystem;
+			std::atomic<int> pending = 0;
+			//Taken by the last task to finish, Wait takes it once more so the group is not
+			//destroyed while that task still holds it
+			std::mutex mutex;
+			std::vector<std::pair<TaskGroup*, std::function<void()>>> continuations;
+		};
+
+		struct Stats
+		{
+			int64_t tasks = 0;
+			//Tasks taken from the deque of another thread
+			int64_t steals = 0;
+			//Times a worker found nothing to do anywhere and went to sleep
+			int64_t sleeps = 0;
+			//Nanoseconds spent pushing tasks and looking for the next one, the overhead of the
+			//scheduler without the tasks themselves
+			int64_t schedulingTime = 0;
+		};
+	public:
+		//threadCount workers besides the threads that wait, 0 for one per core but the first.
+		//Pinned workers stay on one core each, starting at the second
+		explicit JobSystem( unsigned int threadCount = 0, bool pinned = false );
+		~JobSystem();
+		JobSystem( const JobSystem& ) = delete;
+		JobSystem& operator=( const JobSystem& ) = delete;
+		unsigned int GetThreadCount() const { return (unsigned int)threads.size(); }
+		//Slots of ParallelFor, the workers and the thread that calls it
+		unsigned int GetSlotCount() const { return GetThreadCount() + 1; }
+		void Run( TaskGroup& group, std::function<void()> task );
+		//Adds continuation to next and runs it once every task of group is done, right away
+		//if they already are
+		void Then( TaskGroup& group, TaskGroup& next, std::function<void()> continuation );
+		//Runs tasks until the group is done
+		void Wait( TaskGroup& group );
+		//function( index, slot ) for every index below count, indices are handed out one at a
+		//time. No two calls with the same slot run at once, so it can index per thread data
+		template<typename F>
+		void ParallelFor( int count, F&& function );
+		//function( x0, y0, x1, y1, slot ) for every tile of a width by height image, the tiles
+		//at the right and bottom edge can be smaller
+		template<typename F>
+		void ParallelFor2D( int width, int height, int tileSize, F&& function );
+		Stats GetStats() const;
+		void ResetStats();
+		//Spawn cost of empty tasks and the speedup of a tiled loop from one core to all of them
+		static std::vector<std::string> RunBenchmark();
+	private:
+		struct Task
+		{
+			std::function<void()> function;
+			TaskGroup* group = nullptr;
+		};
+
+		//Deque of one worker, the last one is shared by the threads outside the pool
+		struct Queue
+		{
+			std::mutex mutex;
+			std::deque<Task> tasks;
+			std::atomic<int64_t> tasksRun = 0;
+			std::atomic<int64_t> steals = 0;
+			std::atomic<int64_t> sleeps = 0;
+			std::atomic<int64_t> schedulingTime = 0;
+		};
+	private:
+		void WorkerLoop( unsigned int index );
+		//Index of the queue the calling thread owns
+		unsigned int GetQueueIndex() const;
+		void Push( unsigned int queue, Task task );
+		//Runs one task from the own queue or a stolen one, false if there was none
+		bool RunOne( unsigned int queue );
+		void Finish( TaskGroup& group );
+	private:
+		std::vector<std::unique_ptr<Queue>> queues;
+		std::vector<std::thread> threads;
+		std::atomic<bool> running = true;
+		//Tasks pushed and not yet taken, workers only sleep while it is 0
+		std::atomic<int> queuedTasks = 0;
+		std::atomic<int> sleepingWorkers = 0;
+		std::mutex sleepMutex;
+		std::condition_variable wake;
+	};
+
+	template<typename F>
+	void JobSystem::ParallelFor( int count, F&& function )
+	{
+		const unsigned int slots = (std::min)( GetSlotCount(), (unsigned int)(std::max)( count, 0 ) );
+		if( slots == 0 )
+			return;
+
+		std::atomic<int> next = 0;
+		auto loop = [&]( unsigned int slot )
+		{
+			for( int i = next++; i < count; i = next++ )
+			{
+				function( i, slot );
+			}
+		};
+
+		TaskGroup group;
+		for( unsigned int slot = 1; slot < slots; slot++ )
+		{
+			Run( group, [&loop, slot]() { loop( slot ); } );
+		}
+		loop( 0 );
+		Wait( group );
+	}
+
+	template<typename F>
+	void JobSystem::ParallelFor2D( int width, int height, int tileSize, F&& function )
+	{
+		const int tilesX = (width + tileSize - 1) / tileSize;
+		const int tilesY = (height + tileSize - 1) / tileSize;
+		ParallelFor( tilesX * tilesY, [&]( int tile, unsigned int slot )
+		{
+			const int x0 = (tile % tilesX) * tileSize;
+			const int y0 = (tile / tilesX) * tileSize;
+			function( x0, y0, (std::min)( x0 + tileSize, width ), (std::min)( y0 + tileSize, height ), slot );
+		} );
+	}
+}
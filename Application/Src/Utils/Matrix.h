@@ -194,7 +194,6 @@ namespace Hydro
 			return *this;
 		}
 
-		template<typename T>
 		static Matrix4<T> Inverse( Matrix4<T> m )
 		{
 			Matrix4<T> result;
@@ -327,7 +326,6 @@ namespace Hydro
 
 		}
 
-		template <typename T>
 		static Matrix4<T> LookAt( Vec3T<T> cameraPos, Vec3T<T> lookPos, Vec3T<T> up )
 		{
 			//Calculate forward axis direction
@@ -366,7 +364,6 @@ namespace Hydro
 			return result;
 		}
 
-		template <typename T>
 		static Matrix4<T> PerspectiveFov( T fov, T width, T height, T near_, T far_ )
 		{
 			Matrix4<T> Result;
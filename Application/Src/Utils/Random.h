@@ -1,6 +1,7 @@
 #pragma once
 #include <random>
 #include <limits>
+#include <cstdint>
 #include "Vec3.h"
 
 namespace Hydro
@@ -42,6 +43,49 @@ namespace Hydro
 		{
 			return Vec3F( Float() * (max - min) + min, Float() * (max - min) + min, Float() * (max - min) + min );
 		}
+
+		//Stateless variants, identical to the Random namespace in RayMarcher.hlsl
+		static uint32_t PCG_Hash( uint32_t input )
+		{
+			uint32_t state = input * 747796405u + 2891336453u;
+			uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+			return (word >> 22u) ^ word;
+		}
+
+		static float Float( uint32_t& seed )
+		{
+			seed = PCG_Hash( seed );
+			// [0, 1)
+			return (float)seed / (float)0xffffffffu;
+		}
+
+		static float Float( uint32_t& seed, float min, float max )
+		{
+			return Float( seed ) * (max - min) + min;
+		}
+
+		static Vec3F Vec3( uint32_t& seed, float min, float max )
+		{
+			float x = Float( seed, min, max );
+			float y = Float( seed, min, max );
+			float z = Float( seed, min, max );
+			return Vec3F( x, y, z );
+		}
+
+		static Vec3F InUnitSphere( uint32_t& seed )
+		{
+			while( true )
+			{
+				Vec3F p = Vec3( seed, -1.0f, 1.0f );
+				if( p.Magnitude() < 1.0f )
+					return p;
+			}
+		}
+
+		static Vec3F UnitVector( uint32_t& seed )
+		{
+			return InUnitSphere( seed ).Normalized();
+		}
 	private:
 		static std::mt19937 s_RandomEngine;
 		static std::uniform_int_distribution<std::mt19937::result_type> s_Distribution;
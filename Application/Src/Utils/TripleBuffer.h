@@ -0,0 +1,41 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+namespace Hydro
+{
+	//Lock-free handoff of the newest value from one writer thread to one reader thread. The
+	//writer fills the back buffer and publishes it, the reader acquires the newest published
+	//one. Neither side ever waits, values published in between are skipped
+	template<typename T>
+	class TripleBuffer
+	{
+	public:
+		//Writer side, the buffer the next Publish hands over. Holds an old value
+		T& GetBack() { return buffers[back]; }
+		void Publish()
+		{
+			back = middle.exchange( back | newBit, std::memory_order_acq_rel ) & indexMask;
+		}
+		//Reader side, true if something was published since the last Acquire
+		bool Acquire()
+		{
+			if( (middle.load( std::memory_order_relaxed ) & newBit) == 0 )
+				return false;
+			front = middle.exchange( front, std::memory_order_acq_rel ) & indexMask;
+			return true;
+		}
+		//The value last acquired, stays until the next Acquire that returns true
+		T& GetFront() { return buffers[front]; }
+		const T& GetFront() const { return buffers[front]; }
+	private:
+		static constexpr uint8_t indexMask = 3;
+		static constexpr uint8_t newBit = 4;
+		T buffers[3];
+		//Index of the buffer between the two threads and whether it holds a value the
+		//reader has not seen
+		std::atomic<uint8_t> middle = 1;
+		uint8_t back = 0;
+		uint8_t front = 2;
+	};
+}
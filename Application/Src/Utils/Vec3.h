@@ -51,6 +51,10 @@ namespace Hydro
 			z( (T)z )
 		{}
 
+		Vec3T<T> operator-() const
+		{
+			return Vec3T<T>( -x, -y, -z );
+		}
 		Vec3T<T> operator-( Vec3T<T> rhs )
 		{
 			return Vec3T<T>( x - rhs.x, y - rhs.y, z - rhs.z );
@@ -191,9 +195,9 @@ namespace Hydro
 		{
 			Vec3T<T> result;
 
-			result.x = abs( lhs.x );
-			result.y = abs( lhs.y );
-			result.z = abs( lhs.z );
+			result.x = std::abs( lhs.x );
+			result.y = std::abs( lhs.y );
+			result.z = std::abs( lhs.z );
 
 			return result;
 		}
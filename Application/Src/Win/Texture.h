@@ -1,6 +1,7 @@
 #pragma once
 #include <vector>
 #include <string>
+#include <cstdint>
 #include "Color.h"
 
 namespace Hydro
@@ -12,6 +13,7 @@ namespace Hydro
 		Texture( std::string path );
 		~Texture();
 		uint32_t* GetData() { return pixels; }
+		const uint32_t* GetData() const { return pixels; }
 		void ScaleTexture( int width, int height );
 		int GetWidth() const;
 		int GetHeight() const;
@@ -0,0 +1,29 @@
+#pragma once
+#include <cstdio>
+
+//Tests are plain executables run by ctest, a failed CHECK prints where and the exit code
+//of main says whether any failed. Works with NDEBUG, unlike assert
+inline int& CheckFailures()
+{
+	static int failures = 0;
+	return failures;
+}
+
+#define CHECK( condition ) \
+	do \
+	{ \
+		if( !(condition) ) \
+		{ \
+			std::fprintf( stderr, "%s:%d: CHECK( %s ) failed\n", __FILE__, __LINE__, #condition ); \
+			CheckFailures()++; \
+		} \
+	} while( false )
+
+//Return value of main
+inline int CheckResult()
+{
+	if( CheckFailures() == 0 )
+		return 0;
+	std::fprintf( stderr, "%d checks failed\n", CheckFailures() );
+	return 1;
+}
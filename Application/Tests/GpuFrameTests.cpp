@@ -0,0 +1,197 @@
+#include "Check.h"
+#include "../Src/App/GpuFrame.h"
+#include "../Src/App/Scenes.h"
+#include <vector>
+
+//Counts the calls of one type since the last ClearCalls
+static int CountCalls( const NullGpuDevice& device, NullGpuDevice::CallType type )
+{
+	int count = 0;
+	for( const NullGpuDevice::Call& call : device.GetCalls() )
+	{
+		if( call.type == type )
+			count++;
+	}
+	return count;
+}
+
+//Drives the frames of the GPU backend against a NullGpuDevice, the same uploads ComputeShader makes
+int main()
+{
+	using CallType = NullGpuDevice::CallType;
+	const int width = 64;
+	const int height = 48;
+	const int aovOffsets[8] = { -1, -1, -1, -1, -1, -1, -1, -1 };
+
+	Camera camera( 90.0f, 0.1f, 100.0f );
+	camera.OnResize( width, height );
+	CompiledScene scene;
+	scene.Compile( Scene_CornellBox() );
+
+	NullGpuDevice device;
+	{
+		GpuFrame frame( device );
+		frame.OnResize( width, height );
+		//Frame constants, scene and tile offset buffers and the shown texture
+		CHECK( device.GetStats().bufferAllocations == 3 );
+		CHECK( device.GetStats().textureAllocations == 1 );
+
+		//Without a budget the whole image is one tile, the first frame uploads the scene
+		GpuFrame::DispatchSettings settings;
+		device.ClearCalls();
+		GpuFrame::Start start = frame.Begin( camera, scene, settings, aovOffsets );
+		CHECK( start.started && start.restart );
+		GpuFrame::Tile tile;
+		CHECK( frame.NextTile( tile ) );
+		CHECK( tile.width == width && tile.height == height );
+		CHECK( !frame.NextTile( tile ) );
+		CHECK( frame.EndCall().finished );
+		CHECK( CountCalls( device, CallType::Upload ) == 3 );
+		CHECK( device.GetCalls()[0].resource == frame.GetFrameBuffer() );
+		CHECK( device.GetCalls()[0].size == sizeof( GpuFrame::FrameConstants ) );
+		CHECK( device.GetCalls()[1].resource == frame.GetSceneBuffer() );
+		CHECK( device.GetCalls()[2].resource == frame.GetTileBuffer() );
+
+		//The same scene again only uploads the frame constants and the tile
+		device.ClearCalls();
+		settings.frameIndex = 1;
+		start = frame.Begin( camera, scene, settings, aovOffsets );
+		CHECK( start.started && !start.restart );
+		while( frame.NextTile( tile ) )
+		{
+		}
+		CHECK( frame.EndCall().finished );
+		CHECK( CountCalls( device, CallType::Upload ) == 2 );
+
+		//A time-sliced frame covers the image once with 16x16 tiles. The first call has no time to
+		//go by and submits one tile, the GPU times read back after it fit 5 into the budget.
+		//Calls in the middle of the frame with the same camera start nothing and upload only tiles
+		settings.frameIndex = 2;
+		settings.timeBudget = 2.5f;
+		settings.tileSize = 16;
+		const float tileTime = 0.5f;
+		std::vector<int> covered( (size_t)width * height );
+		std::vector<int> callTiles;
+		bool finished = false;
+		while( !finished )
+		{
+			device.ClearCalls();
+			start = frame.Begin( camera, scene, settings, aovOffsets );
+			CHECK( start.started == callTiles.empty() );
+			const int tiles = frame.GetCallTiles( settings.timeBudget );
+			for( int i = 0; i < tiles && frame.NextTile( tile ); i++ )
+			{
+				for( int y = tile.y; y < tile.y + tile.height; y++ )
+				{
+					for( int x = tile.x; x < tile.x + tile.width; x++ )
+					{
+						covered[(size_t)y * width + x]++;
+					}
+				}
+			}
+			const GpuFrame::Call call = frame.EndCall();
+			finished = call.finished;
+			if( !callTiles.empty() )
+				CHECK( CountCalls( device, CallType::Upload ) == tiles );
+			callTiles.push_back( tiles );
+			frame.AddGpuTime( call, tileTime * (float)tiles );
+		}
+		CHECK( (callTiles == std::vector<int>{ 1, 5, 5, 1 }) );
+		CHECK( frame.GetTileStats().tileCount == 12 );
+		CHECK( frame.GetTileStats().callsPerFrame == 4 );
+		int wrongPixels = 0;
+		for( const int count : covered )
+		{
+			if( count != 1 )
+				wrongPixels++;
+		}
+		CHECK( wrongPixels == 0 );
+		//The frame time is the sum over its calls, the frames before were never timed
+		CHECK( frame.GetFramesTimed() == 1 );
+		CHECK( frame.GetFrameTime() == tileTime * 12.0f );
+
+		//A frame with a call whose time is lost gets no frame time
+		settings.frameIndex = 3;
+		frame.Begin( camera, scene, settings, aovOffsets );
+		CHECK( frame.GetCallTiles( settings.timeBudget ) == 5 );
+		CHECK( frame.GetCallTiles( 0.0f ) == 12 );
+		CHECK( frame.NextTile( tile ) );
+		frame.SkipGpuTime( frame.EndCall() );
+		while( frame.NextTile( tile ) )
+		{
+		}
+		const GpuFrame::Call last = frame.EndCall();
+		CHECK( last.finished );
+		frame.AddGpuTime( last, tileTime * 11.0f );
+		CHECK( frame.GetFramesTimed() == 1 );
+
+		//With reprojection a finished frame after a move keeps its history for the next move
+		settings.frameIndex = 4;
+		settings.reprojection = true;
+		settings.timeBudget = 0.0f;
+		camera.SetView( Vec3F( 0.05f, 0.0f, 3.0f ), Vec3F( 0.0f, 0.0f, -1.0f ) );
+		start = frame.Begin( camera, scene, settings, aovOffsets );
+		CHECK( start.started && start.restart );
+		while( frame.NextTile( tile ) )
+		{
+		}
+		CHECK( frame.EndCall().finished );
+		settings.frameIndex = 5;
+		settings.timeBudget = 2.5f;
+		camera.SetView( Vec3F( 0.1f, 0.0f, 3.0f ), Vec3F( 0.0f, 0.0f, -1.0f ) );
+		start = frame.Begin( camera, scene, settings, aovOffsets );
+		CHECK( start.started && start.reproject && !start.restart );
+
+		//Moving the camera in the middle of a frame starts the next one. The dropped frame left
+		//the history half of each camera, so it is not reprojected
+		CHECK( frame.NextTile( tile ) );
+		CHECK( !frame.EndCall().finished );
+		settings.frameIndex = 6;
+		camera.SetView( Vec3F( 0.15f, 0.0f, 3.0f ), Vec3F( 0.0f, 0.0f, -1.0f ) );
+		start = frame.Begin( camera, scene, settings, aovOffsets );
+		CHECK( start.started && !start.reproject && start.restart );
+
+		//Cancelling a frame part way does the same
+		CHECK( frame.NextTile( tile ) );
+		CHECK( !frame.EndCall().finished );
+		frame.Cancel();
+		settings.frameIndex = 7;
+		camera.SetView( Vec3F( 0.2f, 0.0f, 3.0f ), Vec3F( 0.0f, 0.0f, -1.0f ) );
+		start = frame.Begin( camera, scene, settings, aovOffsets );
+		CHECK( start.started && !start.reproject && start.restart );
+
+		//The same size keeps the texture, a new one replaces it
+		device.ClearCalls();
+		frame.OnResize( width, height );
+		CHECK( device.GetCalls().empty() );
+		frame.OnResize( width * 2, height );
+		CHECK( device.GetStats().textureAllocations == 2 );
+		CHECK( CountCalls( device, CallType::Release ) == 1 );
+		CHECK( frame.Begin( camera, scene, settings, aovOffsets ).started );
+	}
+	//Everything the frame created is released with it
+	CHECK( device.GetStats().bufferAllocations == 3 );
+	CHECK( CountCalls( device, CallType::Release ) == 1 + 4 );
+
+	//The CPU image is one texture per size, every frame only uploads its pixels
+	const GpuDevice::Id texture = device.CreateTexture( width, height );
+	const std::vector<uint32_t> pixels( (size_t)width * height );
+	const int64_t uploadedBytes = device.GetStats().uploadedBytes;
+	device.UploadTexture( texture, pixels.data() );
+	device.UploadTexture( texture, pixels.data() );
+	CHECK( device.GetStats().uploadedBytes - uploadedBytes == 2 * width * height * 4 );
+	CHECK( device.GetCalls().back().type == CallType::UploadTexture );
+	//Nothing the frames did was out of bounds or on a released resource
+	CHECK( device.GetInvalidCalls() == 0 );
+
+	//An upload bigger than its buffer, a texture upload to a buffer and a double release count
+	const GpuDevice::Id buffer = device.CreateConstantBuffer( 16 );
+	const uint32_t constants[8] = {};
+	device.Upload( buffer, constants, sizeof( constants ) );
+	device.UploadTexture( buffer, pixels.data() );
+	device.Release( texture );
+	device.Release( texture );
+	CHECK( device.GetInvalidCalls() == 3 );
+
+	return CheckResult();
+}
@@ -0,0 +1,62 @@
+#include "Check.h"
+#include "../Src/App/CpuRayMarcher.h"
+#include "../Src/App/Scenes.h"
+
+//Links the CPU backend without Windows, Direct3D or ImGui and renders the Cornell box
+int main()
+{
+	const int width = 64;
+	const int height = 48;
+
+	Camera camera( 90.0f, 0.1f, 100.0f );
+	camera.OnResize( width, height );
+	CompiledScene scene;
+	scene.Compile( Scene_CornellBox() );
+
+	CpuRayMarcher marcher;
+	marcher.OnResize( width, height );
+	CHECK( marcher.Dispatch( camera, scene, 4, nullptr, 0 ) );
+	CHECK( marcher.Dispatch( camera, scene, 4, nullptr, 1 ) );
+	CHECK( marcher.GetPixels().size() == (size_t)width * height );
+
+	//The light and the walls it lights are in view, the rest is still noisy after 8 samples
+	int litPixels = 0;
+	for( const uint32_t pixel : marcher.GetPixels() )
+	{
+		if( (pixel & 0x00ffffffu) != 0 )
+			litPixels++;
+	}
+	CHECK( litPixels > width * height / 10 );
+
+	//The wavefront marches packets of paths when the CPU has AVX2. Without bounces the same
+	//paths marched one at a time only differ where the rounding of a hit point moved an edge,
+	//bounces off those points would make the noise of the two images different
+	CpuRayMarcher packets;
+	CpuRayMarcher scalar;
+	for( CpuRayMarcher* pMarcher : { &packets, &scalar } )
+	{
+		pMarcher->GetSettings().wavefront = true;
+		pMarcher->GetSettings().maxDepth = 1;
+	}
+	scalar.GetSettings().packetMarching = false;
+	packets.OnResize( width, height );
+	scalar.OnResize( width, height );
+	CHECK( packets.Dispatch( camera, scene, 4, nullptr, 0 ) );
+	CHECK( scalar.Dispatch( camera, scene, 4, nullptr, 0 ) );
+	CHECK( scalar.GetWavefrontStats().packetWidth == 1 );
+	int differentPixels = 0;
+	for( size_t i = 0; i < packets.GetPixels().size(); i++ )
+	{
+		if( packets.GetPixels()[i] != scalar.GetPixels()[i] )
+			differentPixels++;
+	}
+	CHECK( differentPixels < width * height / 100 );
+
+	//A token cancelled before the frame starts stops it at the first tile
+	CancellationSource source;
+	const CancellationToken token = source.GetToken();
+	source.Cancel();
+	CHECK( !marcher.Dispatch( camera, scene, 1, nullptr, 2, token ) );
+
+	return CheckResult();
+}
@@ -0,0 +1,124 @@
+#include "Check.h"
+#include "../Src/Utils/JobSystem.h"
+#include <atomic>
+#include <vector>
+
+using Hydro::JobSystem;
+
+//Sums count ones with tasks that split in half and wait for their halves
+static int SplitSum( JobSystem& jobs, int count )
+{
+	if( count <= 1 )
+		return count;
+
+	std::atomic<int> sum = 0;
+	JobSystem::TaskGroup group;
+	jobs.Run( group, [&]() { sum += SplitSum( jobs, count / 2 ); } );
+	jobs.Run( group, [&]() { sum += SplitSum( jobs, count - count / 2 ); } );
+	jobs.Wait( group );
+	return sum;
+}
+
+//Only builds JobSystem.cpp. Three workers, so the tasks run concurrently even on one core
+int main()
+{
+	JobSystem jobs( 3 );
+	CHECK( jobs.GetSlotCount() == 4 );
+
+	//Run and Wait
+	{
+		std::atomic<int> counter = 0;
+		JobSystem::TaskGroup group;
+		for( int i = 0; i < 1000; i++ )
+		{
+			jobs.Run( group, [&counter]() { counter++; } );
+		}
+		jobs.Wait( group );
+		CHECK( group.IsDone() );
+		CHECK( counter == 1000 );
+	}
+
+	//Then runs after every task of the group, and right away on a group that is done
+	{
+		std::atomic<int> counter = 0;
+		int seenByContinuation = -1;
+		JobSystem::TaskGroup group;
+		JobSystem::TaskGroup next;
+		for( int i = 0; i < 100; i++ )
+		{
+			jobs.Run( group, [&counter]() { counter++; } );
+		}
+		jobs.Then( group, next, [&]() { seenByContinuation = counter; } );
+		jobs.Wait( next );
+		CHECK( seenByContinuation == 100 );
+
+		jobs.Wait( group );
+		bool ranLate = false;
+		JobSystem::TaskGroup late;
+		jobs.Then( group, late, [&ranLate]() { ranLate = true; } );
+		jobs.Wait( late );
+		CHECK( ranLate );
+	}
+
+	//Tasks that wait for the tasks they spawned
+	CHECK( SplitSum( jobs, 5000 ) == 5000 );
+
+	//ParallelFor2D covers every pixel once, the edge tiles are cut to the image
+	{
+		const int width = 100;
+		const int height = 37;
+		const int tileSize = 16;
+		std::vector<std::atomic<int>> covered( (size_t)width * height );
+		std::atomic<int> badTiles = 0;
+		jobs.ParallelFor2D( width, height, tileSize, [&]( int x0, int y0, int x1, int y1, unsigned int )
+		{
+			if( x0 % tileSize != 0 || y0 % tileSize != 0 || x1 - x0 > tileSize || y1 - y0 > tileSize || x1 > width || y1 > height )
+				badTiles++;
+			for( int y = y0; y < y1; y++ )
+			{
+				for( int x = x0; x < x1; x++ )
+				{
+					covered[(size_t)y * width + x]++;
+				}
+			}
+		} );
+		CHECK( badTiles == 0 );
+		int wrongPixels = 0;
+		for( const std::atomic<int>& count : covered )
+		{
+			if( count != 1 )
+				wrongPixels++;
+		}
+		CHECK( wrongPixels == 0 );
+	}
+
+	//No two indices with the same slot run at once
+	{
+		std::vector<std::atomic<int>> busy( jobs.GetSlotCount() );
+		std::atomic<int> overlaps = 0;
+		std::atomic<int> badSlots = 0;
+		for( int repeat = 0; repeat < 20; repeat++ )
+		{
+			jobs.ParallelFor( 500, [&]( int index, unsigned int slot )
+			{
+				if( slot >= busy.size() )
+				{
+					badSlots++;
+					return;
+				}
+				if( busy[slot].exchange( 1 ) != 0 )
+					overlaps++;
+				volatile float work = 0.0f;
+				for( int i = 0; i < 200 + index % 7 * 50; i++ )
+				{
+					work = work + (float)i;
+				}
+				busy[slot] = 0;
+			} );
+		}
+		CHECK( badSlots == 0 );
+		CHECK( overlaps == 0 );
+	}
+
+	return CheckResult();
+}